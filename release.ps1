@@ -57,7 +57,7 @@ Write-Host "arcane.dll copied to $destinationDll" -ForegroundColor Green
 # Build the amalgamation C file.
 ###############################################################################
 $amalgamationFile = Join-Path $releasePath "arcane.c"
-$filesToCombine = @("arcane.h", "functions.c", "arcane.c")
+$filesToCombine = @("arcane.h", "functions.c", "arcane.c", "vm.c", "jit.c", "aot.c", "typed.c")
 
 # Create or clear the amalgamation file.
 Set-Content -Path $amalgamationFile -Value ""
@@ -0,0 +1,1644 @@
+/*
+ * Arcane Script Interpreter
+ *
+ *         File: aot.c
+ *       Author: Blake Pell
+ * Initial Date: 2026-10-18
+ *      License: MIT License
+ *
+ * Ahead of time translation of a script into C.  The script is tokenized and
+ * compiled as usual, then each statement is written out as C in place of
+ * being run: control flow becomes C control flow and expressions become
+ * calls to the same helpers the interpreter uses (binary_operation, the
+ * builtins themselves, the symbol table), one temporary per step so operands
+ * are still evaluated left to right.  The generated file includes arcane.h and
+ * links against arcane.c, functions.c and this file.
+ */
+
+ #include "arcane.h"
+ #include <stdlib.h>
+ #include <string.h>
+ #include <stdarg.h>
+ #include <stdio.h>
+ 
+ extern int return_flag;
+ extern Value return_value;
+ 
+ /* ============================================================
+     Runtime: called from generated code
+    ============================================================ */
+ 
+ /*
+  * Resets the error state, and forgets the last script's functions, before a
+  * translated script runs.
+  */
+ void aot_begin(void)
+ {
+     return_flag = 0;
+     return_value = make_null();
+     clear_script_functions();
+ }
+ 
+ /*
+  * Finishes a translated script: frees its variables and returns what the
+  * script returned, or its error.
+  */
+ Value aot_end(void)
+ {
+     Value ret = return_value;
+     free_variables();
+     return ret;
+ }
+ 
+ /*
+  * A string literal, with any ${name} templates expanded.
+  */
+ Value aot_string(const char *text)
+ {
+     if (strstr(text, "${") == NULL)
+     {
+         return make_string(text);
+     }
+ 
+     char *processed = evaluate_template(text);
+ 
+     if (!processed)
+     {
+         return return_value;
+     }
+ 
+     Value v = make_string(processed);
+     free(processed);
+     return v;
+ }
+ 
+ /*
+  * Frees the temporary strings passed to a call.
+  */
+ void aot_free_arguments(Value *args, int arg_count)
+ {
+     for (int i = 0; i < arg_count; i++)
+     {
+         if (args[i].type == VAL_STRING && args[i].temp)
+         {
+             free_value(args[i]);
+         }
+     }
+ }
+ 
+ /*
+  * Calls a function by name and frees the temporary strings passed to it.
+  * Only for calls the translator couldn't resolve to a C function.
+  */
+ Value aot_call(const char *name, Value *args, int arg_count)
+ {
+     Value ret = call_function(name, args, arg_count);
+     aot_free_arguments(args, arg_count);
+     return ret;
+ }
+ 
+ /*
+  * Unary minus.
+  */
+ Value aot_negate(Value v)
+ {
+     if (v.type != VAL_INT)
+     {
+         raise_error("Runtime error: Unary '-' operator only supports ints.\n");
+         return return_value;
+     }
+ 
+     v.int_val = -v.int_val;
+     return v;
+ }
+ 
+ /*
+  * Logical not.
+  */
+ Value aot_not(Value v)
+ {
+     if (v.type != VAL_BOOL && v.type != VAL_INT)
+     {
+         raise_error("Runtime error: ! operator only works on bools or ints.\n");
+         return return_value;
+     }
+ 
+     return make_bool(!v.int_val);
+ }
+ 
+ /*
+  * ++ and --: adds step to the variable and returns its new value (prefix)
+  * or its old one.
+  */
+ Value aot_increment(const char *name, int step, int prefix)
+ {
+     Value v = get_variable(name);
+ 
+     if (return_flag)
+     {
+         return return_value;
+     }
+ 
+     if (v.type != VAL_INT)
+     {
+         raise_error("Runtime error: %s operator only valid for ints.\n", step > 0 ? "++" : "--");
+         return return_value;
+     }
+ 
+     int old_value = v.int_val;
+     v.int_val += step;
+     set_variable(name, v);
+     return prefix ? v : make_int(old_value);
+ }
+ 
+ /* ============================================================
+     Translator
+    ============================================================ */
+ 
+ typedef struct
+ {
+     char *text;
+     size_t length;
+     size_t capacity;
+ } AotBuffer;
+ 
+ typedef struct
+ {
+     TokenList *list;
+     int pos;
+     int temps;          /* Temporaries handed out */
+     int operators;      /* Operator tokens declared */
+     int loops;          /* Loops written, names their continue labels */
+     int switches;       /* Switches written, names their case labels */
+     int scopes;         /* Let scopes written, names their marks */
+     int loop;           /* The innermost loop, -1 outside loops */
+     int loop_scope;     /* The innermost loop body's let scope, -1 if none */
+     int continued;      /* If the innermost loop's body used continue */
+     int indent;
+     int failed;
+     AotBuffer decls;    /* File scope declarations */
+     AotBuffer functions; /* The functions the script defines */
+     AotBuffer setup;    /* Registers them, so builtins can call them by name */
+     AotBuffer body;     /* The statements of the function being written */
+ } AotWriter;
+ 
+ static int aot_assignment(AotWriter *w);
+ static void aot_statement(AotWriter *w);
+ 
+ /* Returned when the translator reads past the end of the tokens. */
+ static Token aot_end_token = { TOKEN_EOF, "EOF", -1, OP_NONE, QUICK_NONE, NULL };
+ 
+ /*
+  * Appends formatted text to a buffer.
+  */
+ static void aot_vappend(AotWriter *w, AotBuffer *b, const char *fmt, va_list args)
+ {
+     va_list copy;
+     va_copy(copy, args);
+     int length = vsnprintf(NULL, 0, fmt, copy);
+     va_end(copy);
+ 
+     if (length < 0 || w->failed)
+     {
+         return;
+     }
+ 
+     if (b->length + length + 1 > b->capacity)
+     {
+         size_t capacity = (b->length + length + 1) * 2;
+         char *text = realloc(b->text, capacity);
+ 
+         if (!text)
+         {
+             raise_error("Memory allocation error in aot_translate.\n");
+             w->failed = 1;
+             return;
+         }
+ 
+         b->text = text;
+         b->capacity = capacity;
+     }
+ 
+     vsnprintf(b->text + b->length, length + 1, fmt, args);
+     b->length += length;
+ }
+ 
+ static void aot_append(AotWriter *w, AotBuffer *b, const char *fmt, ...)
+ {
+     va_list args;
+     va_start(args, fmt);
+     aot_vappend(w, b, fmt, args);
+     va_end(args);
+ }
+ 
+ /*
+  * Writes an indented line of the script function.
+  */
+ static void aot_line(AotWriter *w, const char *fmt, ...)
+ {
+     va_list args;
+ 
+     for (int i = 0; i < w->indent; i++)
+     {
+         aot_append(w, &w->body, "    ");
+     }
+ 
+     va_start(args, fmt);
+     aot_vappend(w, &w->body, fmt, args);
+     va_end(args);
+     aot_append(w, &w->body, "\n");
+ }
+ 
+ /*
+  * Writes text as a C string literal.
+  */
+ static void aot_quote(AotWriter *w, AotBuffer *b, const char *text)
+ {
+     aot_append(w, b, "\"");
+ 
+     for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+     {
+         if (*c == '"' || *c == '\\')
+             aot_append(w, b, "\\%c", *c);
+         else if (*c == '\n')
+             aot_append(w, b, "\\n");
+         else if (*c == '\t')
+             aot_append(w, b, "\\t");
+         else if (*c < 32 || *c >= 127 || *c == '?')
+             aot_append(w, b, "\\%03o", *c);
+         else
+             aot_append(w, b, "%c", *c);
+     }
+ 
+     aot_append(w, b, "\"");
+ }
+ 
+ /*
+  * Starts a line ending in a quoted string, e.g. a call taking a name.  The
+  * caller finishes the line with aot_end_line.
+  */
+ static void aot_begin_line(AotWriter *w, const char *fmt, ...)
+ {
+     va_list args;
+ 
+     for (int i = 0; i < w->indent; i++)
+     {
+         aot_append(w, &w->body, "    ");
+     }
+ 
+     va_start(args, fmt);
+     aot_vappend(w, &w->body, fmt, args);
+     va_end(args);
+ }
+ 
+ static void aot_end_line(AotWriter *w, const char *fmt, ...)
+ {
+     va_list args;
+     va_start(args, fmt);
+     aot_vappend(w, &w->body, fmt, args);
+     va_end(args);
+     aot_append(w, &w->body, "\n");
+ }
+ 
+ /*
+  * Stops the translation with a parser error.
+  */
+ static void aot_fail(AotWriter *w, const char *message, const char *text)
+ {
+     if (!w->failed)
+     {
+         raise_error(message, text);
+         w->failed = 1;
+     }
+ }
+ 
+ static Token *aot_current(AotWriter *w)
+ {
+     return w->pos < w->list->count ? &w->list->tokens[w->pos] : &aot_end_token;
+ }
+ 
+ static Token *aot_peek(AotWriter *w)
+ {
+     return w->pos + 1 < w->list->count ? &w->list->tokens[w->pos + 1] : &aot_end_token;
+ }
+ 
+ static void aot_expect(AotWriter *w, AstTokenType type, const char *message)
+ {
+     if (aot_current(w)->type != type)
+     {
+         aot_fail(w, "Parser error: %s\n", message);
+         return;
+     }
+ 
+     w->pos++;
+ }
+ 
+ /*
+  * Hands out a new temporary.
+  */
+ static int aot_temp(AotWriter *w)
+ {
+     return w->temps++;
+ }
+ 
+ /*
+  * Leaves the script when the last step raised an error.
+  */
+ static void aot_check(AotWriter *w)
+ {
+     aot_line(w, "if (return_flag) goto done;");
+ }
+ 
+ /* OperatorCode names in enum order.  Emitted C uses them rather than the
+    codes' values, so it stays valid if the enum is reordered. */
+ static const char *aot_op_names[] = {
+     "OP_NONE", "OP_ASSIGN", "OP_ADD_ASSIGN", "OP_SUB_ASSIGN", "OP_MUL_ASSIGN", "OP_DIV_ASSIGN",
+     "OP_MOD_ASSIGN", "OP_OR", "OP_AND", "OP_EQ", "OP_NE", "OP_LT", "OP_GT", "OP_LE", "OP_GE",
+     "OP_ADD", "OP_SUB", "OP_MUL", "OP_DIV", "OP_MOD", "OP_BIT_AND", "OP_BIT_OR", "OP_BIT_XOR",
+     "OP_SHL", "OP_SHR", "OP_NOT", "OP_INC", "OP_DEC"
+ };
+ 
+ /*
+  * Declares a file scope token for an operator, which keeps the operator's
+  * type specialization between runs.  It starts out with the types compile()
+  * proved for it, if any.  Returns its number.
+  */
+ static int aot_operator(AotWriter *w, const Token *op)
+ {
+     static const char *quick[] = { "QUICK_NONE", "QUICK_INT", "QUICK_DOUBLE", "QUICK_STRING", "QUICK_GENERIC" };
+     int n = w->operators++;
+ 
+     aot_append(w, &w->decls, "static Token op_%d = { TOKEN_OPERATOR, ", n);
+     aot_quote(w, &w->decls, op->text);
+     aot_append(w, &w->decls, ", -1, %s, %s, NULL };\n", aot_op_names[op->op], quick[op->quick]);
+     return n;
+ }
+ 
+ /*
+  * Mirrors parse_primary.  Each expression function returns the temporary
+  * holding its value.
+  */
+ static int aot_primary(AotWriter *w)
+ {
+     Token *tok = aot_current(w);
+     int t;
+ 
+     if (w->failed)
+     {
+         return 0;
+     }
+ 
+     if (tok->op == OP_SUB)
+     {
+         w->pos++;
+         int operand = aot_primary(w);
+         t = aot_temp(w);
+         aot_line(w, "Value t%d = aot_negate(t%d);", t, operand);
+         aot_check(w);
+         return t;
+     }
+ 
+     switch (tok->type)
+     {
+         case TOKEN_INT:
+             t = aot_temp(w);
+             aot_line(w, "Value t%d = make_int(%d);", t, atoi(tok->text));
+             w->pos++;
+             return t;
+         case TOKEN_DOUBLE:
+             t = aot_temp(w);
+             aot_line(w, "Value t%d = make_double(%.17g);", t, atof(tok->text));
+             w->pos++;
+             return t;
+         case TOKEN_BOOL:
+             t = aot_temp(w);
+             aot_line(w, "Value t%d = make_bool(%d);", t, strcmp(tok->text, "true") == 0);
+             w->pos++;
+             return t;
+         case TOKEN_STRING:
+             t = aot_temp(w);
+             aot_begin_line(w, "Value t%d = aot_string(", t);
+             aot_quote(w, &w->body, tok->text);
+             aot_end_line(w, ");");
+             if (strstr(tok->text, "${") != NULL)
+             {
+                 aot_check(w);
+             }
+             w->pos++;
+             return t;
+         case TOKEN_IDENTIFIER:
+         {
+             Token *next = aot_peek(w);
+ 
+             if (next->type == TOKEN_LPAREN)
+             {
+                 int args[16];
+                 int arg_count = 0;
+                 w->pos += 2;
+ 
+                 if (aot_current(w)->type != TOKEN_RPAREN)
+                 {
+                     while (!w->failed)
+                     {
+                         if (arg_count == 16)
+                         {
+                             aot_fail(w, "Parser error: Too many arguments to %s\n", tok->text);
+                             return 0;
+                         }
+ 
+                         args[arg_count++] = aot_assignment(w);
+ 
+                         if (aot_current(w)->type != TOKEN_COMMA)
+                         {
+                             break;
+                         }
+ 
+                         w->pos++;
+                     }
+                 }
+ 
+                 aot_expect(w, TOKEN_RPAREN, "Expected ')' after function arguments");
+                 t = aot_temp(w);
+ 
+                 if (arg_count > 0)
+                 {
+                     aot_begin_line(w, "Value a%d[%d] = { ", t, arg_count);
+                     for (int i = 0; i < arg_count; i++)
+                     {
+                         aot_append(w, &w->body, i ? ", t%d" : "t%d", args[i]);
+                     }
+                     aot_end_line(w, " };");
+                 }
+ 
+                 // Builtins and the script's own functions are called directly,
+                 // anything else is looked up by name when it runs.
+                 const Function *fn = tok->function;
+                 int direct = 1;
+ 
+                 if (fn && !fn->func && fn->tokens == w->list)
+                 {
+                     aot_begin_line(w, "Value t%d = script_%s(", t, tok->text);
+                 }
+                 else if (fn && fn->func && fn->symbol)
+                 {
+                     aot_begin_line(w, "Value t%d = %s(", t, fn->symbol);
+                 }
+                 else
+                 {
+                     aot_begin_line(w, "Value t%d = aot_call(", t);
+                     aot_quote(w, &w->body, tok->text);
+                     aot_append(w, &w->body, ", ");
+                     direct = 0;
+                 }
+                 if (arg_count > 0)
+                 {
+                     aot_end_line(w, "a%d, %d);", t, arg_count);
+                 }
+                 else
+                 {
+                     aot_end_line(w, "NULL, 0);");
+                 }
+                 if (direct && arg_count > 0)
+                 {
+                     aot_line(w, "aot_free_arguments(a%d, %d);", t, arg_count);
+                 }
+                 aot_check(w);
+                 return t;
+             }
+ 
+             if (next->op == OP_INC || next->op == OP_DEC)
+             {
+                 t = aot_temp(w);
+                 aot_begin_line(w, "Value t%d = aot_increment(", t);
+                 aot_quote(w, &w->body, tok->text);
+                 aot_end_line(w, ", %d, 0);", next->op == OP_INC ? 1 : -1);
+                 aot_check(w);
+                 w->pos += 2;
+                 return t;
+             }
+ 
+             t = aot_temp(w);
+             aot_begin_line(w, "Value t%d = get_variable(", t);
+             aot_quote(w, &w->body, tok->text);
+             aot_end_line(w, ");");
+             aot_check(w);
+             w->pos++;
+ 
+             while (aot_current(w)->type == TOKEN_LBRACKET && !w->failed)
+             {
+                 w->pos++;
+                 int index = aot_assignment(w);
+                 aot_expect(w, TOKEN_RBRACKET, "Expected ']' after array index");
+                 aot_line(w, "t%d = array_index(t%d, t%d);", t, t, index);
+                 aot_check(w);
+             }
+ 
+             return t;
+         }
+         case TOKEN_LPAREN:
+             w->pos++;
+             t = aot_assignment(w);
+             aot_expect(w, TOKEN_RPAREN, "Expected ')' after expression");
+             return t;
+         case TOKEN_LBRACE:
+             // A map literal, mirrors parse_map_literal.
+             t = aot_temp(w);
+             aot_line(w, "Value t%d = make_map(map_new(4));", t);
+             w->pos++;
+ 
+             while (!w->failed && aot_current(w)->type != TOKEN_RBRACE)
+             {
+                 int key = aot_assignment(w);
+                 aot_expect(w, TOKEN_COLON, "Expected ':' after map key");
+                 int value = aot_assignment(w);
+                 aot_line(w, "map_entry(t%d, t%d, t%d);", t, key, value);
+                 aot_check(w);
+ 
+                 if (aot_current(w)->type != TOKEN_COMMA)
+                 {
+                     break;
+                 }
+                 w->pos++;
+             }
+ 
+             aot_expect(w, TOKEN_RBRACE, "Expected '}' after map entries");
+             return t;
+         default:
+             aot_fail(w, "Parser error: Unexpected token '%s'\n", tok->text);
+             return 0;
+     }
+ }
+ 
+ /*
+  * Mirrors parse_unary.
+  */
+ static int aot_unary(AotWriter *w)
+ {
+     Token *tok = aot_current(w);
+ 
+     if (tok->op == OP_NOT)
+     {
+         w->pos++;
+         int operand = aot_unary(w);
+         int t = aot_temp(w);
+         aot_line(w, "Value t%d = aot_not(t%d);", t, operand);
+         aot_check(w);
+         return t;
+     }
+ 
+     if (tok->op == OP_INC || tok->op == OP_DEC)
+     {
+         w->pos++;
+ 
+         if (aot_current(w)->type != TOKEN_IDENTIFIER)
+         {
+             aot_fail(w, "Parser error: Expected identifier after unary %s\n", tok->text);
+             return 0;
+         }
+ 
+         int t = aot_temp(w);
+         aot_begin_line(w, "Value t%d = aot_increment(", t);
+         aot_quote(w, &w->body, aot_current(w)->text);
+         aot_end_line(w, ", %d, 1);", tok->op == OP_INC ? 1 : -1);
+         aot_check(w);
+         w->pos++;
+         return t;
+     }
+ 
+     return aot_primary(w);
+ }
+ 
+ /*
+  * Writes left = left op right for a binary operator.
+  */
+ static void aot_binary(AotWriter *w, const Token *op, int left, int right)
+ {
+     aot_line(w, "t%d = binary_operation(&op_%d, t%d, t%d);", left, aot_operator(w, op), left, right);
+     aot_check(w);
+ }
+ 
+ /*
+  * Mirrors parse_factor, whose right operand is a primary.
+  */
+ static int aot_factor(AotWriter *w)
+ {
+     int left = aot_unary(w);
+ 
+     while ((aot_current(w)->op == OP_MUL || aot_current(w)->op == OP_DIV || aot_current(w)->op == OP_MOD) &&
+            !w->failed)
+     {
+         Token *op = aot_current(w);
+         w->pos++;
+         aot_binary(w, op, left, aot_primary(w));
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_term.
+  */
+ static int aot_term(AotWriter *w)
+ {
+     int left = aot_factor(w);
+ 
+     while ((aot_current(w)->op == OP_ADD || aot_current(w)->op == OP_SUB) && !w->failed)
+     {
+         Token *op = aot_current(w);
+         w->pos++;
+         aot_binary(w, op, left, aot_factor(w));
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_shift.
+  */
+ static int aot_shift(AotWriter *w)
+ {
+     int left = aot_term(w);
+ 
+     while ((aot_current(w)->op == OP_SHL || aot_current(w)->op == OP_SHR) && !w->failed)
+     {
+         Token *op = aot_current(w);
+         w->pos++;
+         aot_binary(w, op, left, aot_term(w));
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_relational.
+  */
+ static int aot_relational(AotWriter *w)
+ {
+     int left = aot_shift(w);
+ 
+     while ((aot_current(w)->op == OP_LT || aot_current(w)->op == OP_GT ||
+             aot_current(w)->op == OP_LE || aot_current(w)->op == OP_GE) && !w->failed)
+     {
+         Token *op = aot_current(w);
+         w->pos++;
+         aot_binary(w, op, left, aot_shift(w));
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_equality.
+  */
+ static int aot_equality(AotWriter *w)
+ {
+     int left = aot_relational(w);
+ 
+     while ((aot_current(w)->op == OP_EQ || aot_current(w)->op == OP_NE) && !w->failed)
+     {
+         Token *op = aot_current(w);
+         w->pos++;
+         aot_binary(w, op, left, aot_relational(w));
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_bit_and, parse_bit_xor and parse_bit_or, whose operators
+  * bind in that order.
+  */
+ static int aot_bit_level(AotWriter *w, OperatorCode op)
+ {
+     OperatorCode tighter = op == OP_BIT_OR ? OP_BIT_XOR : OP_BIT_AND;
+     int left = op == OP_BIT_AND ? aot_equality(w) : aot_bit_level(w, tighter);
+ 
+     while (aot_current(w)->op == op && !w->failed)
+     {
+         Token *tok = aot_current(w);
+         w->pos++;
+         aot_binary(w, tok, left, op == OP_BIT_AND ? aot_equality(w) : aot_bit_level(w, tighter));
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_logical_and and parse_logical: the right operand is only
+  * evaluated when the left one doesn't decide the result.
+  */
+ static int aot_logical_level(AotWriter *w, OperatorCode op)
+ {
+     int left = op == OP_OR ? aot_logical_level(w, OP_AND) : aot_bit_level(w, OP_BIT_OR);
+ 
+     while (aot_current(w)->op == op && !w->failed)
+     {
+         w->pos++;
+         aot_line(w, op == OP_AND ? "if (t%d.int_val != 0)" : "if (t%d.int_val == 0)", left);
+         aot_line(w, "{");
+         w->indent++;
+         int right = op == OP_OR ? aot_logical_level(w, OP_AND) : aot_bit_level(w, OP_BIT_OR);
+         aot_line(w, "t%d = make_bool(t%d.int_val != 0);", left, right);
+         w->indent--;
+         aot_line(w, "}");
+         aot_line(w, "else");
+         aot_line(w, "{");
+         aot_line(w, "    t%d = make_bool(%d);", left, op == OP_OR);
+         aot_line(w, "}");
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_element_assignment, the assignment operator is at op_pos.
+  */
+ static int aot_element_assignment(AotWriter *w, int op_pos)
+ {
+     Token *tok = aot_current(w);
+     OperatorCode op = w->list->tokens[op_pos].op;
+     int start = w->pos + 1;
+ 
+     w->pos = op_pos + 1;
+     int right = aot_assignment(w);
+     int end = w->pos;
+ 
+     int slot = aot_temp(w);
+     aot_begin_line(w, "Value t%d = get_variable(", slot);
+     aot_quote(w, &w->body, tok->text);
+     aot_end_line(w, ");");
+     aot_check(w);
+     aot_line(w, "Value *s%d = &t%d;", slot, slot);
+     w->pos = start;
+ 
+     int index = 0;
+ 
+     while (!w->failed)
+     {
+         w->pos++;
+         index = aot_assignment(w);
+         aot_expect(w, TOKEN_RBRACKET, "Expected ']' after array index");
+ 
+         if (w->pos >= op_pos)
+         {
+             break;
+         }
+ 
+         aot_line(w, "s%d = array_slot(*s%d, t%d);", slot, slot, index);
+         aot_check(w);
+     }
+ 
+     w->pos = end;
+     int t = aot_temp(w);
+     aot_line(w, "Value t%d = assign_element(*s%d, t%d, %s, t%d);", t, slot, index, aot_op_names[op], right);
+     aot_check(w);
+     return t;
+ }
+ 
+ /*
+  * Mirrors parse_assignment.
+  */
+ static int aot_assignment(AotWriter *w)
+ {
+     Token *tok = aot_current(w);
+     Token *next = aot_peek(w);
+ 
+     if (w->failed)
+     {
+         return 0;
+     }
+ 
+     if (tok->type == TOKEN_IDENTIFIER && next->type == TOKEN_LBRACKET)
+     {
+         int op_pos = w->pos + 1;
+ 
+         while (op_pos < w->list->count && w->list->tokens[op_pos].type == TOKEN_LBRACKET &&
+                w->list->tokens[op_pos].match >= 0)
+         {
+             op_pos = w->list->tokens[op_pos].match + 1;
+         }
+ 
+         if (op_pos < w->list->count && (w->list->tokens[op_pos].op == OP_ASSIGN ||
+                                         IS_COMPOUND_ASSIGN(w->list->tokens[op_pos].op)))
+         {
+             return aot_element_assignment(w, op_pos);
+         }
+     }
+ 
+     if (tok->type == TOKEN_IDENTIFIER && (next->op == OP_ASSIGN || IS_COMPOUND_ASSIGN(next->op)))
+     {
+         w->pos += 2;
+         int right = aot_assignment(w);
+ 
+         if (next->op == OP_ASSIGN)
+         {
+             aot_begin_line(w, "set_variable(");
+             aot_quote(w, &w->body, tok->text);
+             aot_end_line(w, ", t%d);", right);
+             aot_line(w, "t%d.temp = 0;", right);
+             return right;
+         }
+ 
+         int t = aot_temp(w);
+         aot_begin_line(w, "Value t%d = compound_assign(", t);
+         aot_quote(w, &w->body, tok->text);
+         aot_end_line(w, ", %s, t%d);", aot_op_names[next->op], right);
+         aot_check(w);
+         return t;
+     }
+ 
+     return aot_logical_level(w, OP_OR);
+ }
+ 
+ /*
+  * Writes an expression's steps in their own scope and calls back with the
+  * temporary holding its value still in scope.
+  */
+ static int aot_open(AotWriter *w)
+ {
+     aot_line(w, "{");
+     w->indent++;
+     return aot_assignment(w);
+ }
+ 
+ static void aot_close(AotWriter *w)
+ {
+     w->indent--;
+     aot_line(w, "}");
+ }
+ 
+ /*
+  * Marks the let variables declared so far when the block starting at the
+  * current '{' declares any of its own, so they can be released after it.
+  * Returns the mark's number, or -1 when there is nothing to release.
+  */
+ static int aot_scope_enter(AotWriter *w)
+ {
+     Token *open = aot_current(w);
+ 
+     if (open->type != TOKEN_LBRACE || open->match < 0)
+     {
+         return -1;
+     }
+ 
+     for (int i = w->pos + 1; i < open->match; i++)
+     {
+         if (w->list->tokens[i].type == TOKEN_LET)
+         {
+             int scope = w->scopes++;
+             aot_line(w, "int scope_%d = scope_enter();", scope);
+             return scope;
+         }
+     }
+ 
+     return -1;
+ }
+ 
+ static void aot_scope_exit(AotWriter *w, int scope)
+ {
+     if (scope >= 0)
+     {
+         aot_line(w, "scope_exit(scope_%d);", scope);
+     }
+ }
+ 
+ /*
+  * Writes the statements of a block.  A loop body releases its let variables
+  * itself, as continue and break leave the block early.
+  */
+ static void aot_braces(AotWriter *w, int scoped)
+ {
+     aot_line(w, "{");
+     w->indent++;
+     int scope = scoped ? aot_scope_enter(w) : -1;
+     aot_expect(w, TOKEN_LBRACE, "Expected '{' to start block");
+ 
+     while (aot_current(w)->type != TOKEN_RBRACE && aot_current(w)->type != TOKEN_EOF && !w->failed)
+     {
+         aot_statement(w);
+     }
+ 
+     aot_scope_exit(w, scope);
+     w->indent--;
+     aot_line(w, "}");
+     aot_expect(w, TOKEN_RBRACE, "Expected '}' to end block");
+ }
+ 
+ /*
+  * Mirrors parse_block.
+  */
+ static void aot_block(AotWriter *w)
+ {
+     aot_braces(w, 1);
+ }
+ 
+ /*
+  * Mirrors parse_let.
+  */
+ static void aot_let(AotWriter *w)
+ {
+     w->pos++; // let
+     Token *name = aot_current(w);
+ 
+     if (name->type != TOKEN_IDENTIFIER)
+     {
+         aot_fail(w, "Parser error: Expected a variable name after let, found '%s'.\n", name->text);
+         return;
+     }
+     w->pos++;
+ 
+     aot_line(w, "{");
+     w->indent++;
+     int v;
+ 
+     if (aot_current(w)->op == OP_ASSIGN)
+     {
+         w->pos++;
+         v = aot_assignment(w);
+     }
+     else
+     {
+         v = aot_temp(w);
+         aot_line(w, "Value t%d = make_null();", v);
+     }
+ 
+     aot_begin_line(w, "declare_variable(");
+     aot_quote(w, &w->body, name->text);
+     aot_end_line(w, ", t%d);", v);
+     aot_check(w);
+     aot_close(w);
+ }
+ 
+ /*
+  * Writes an if, else if or else chain.
+  */
+ static void aot_if(AotWriter *w, const char *kind)
+ {
+     w->pos++; // if
+     aot_expect(w, TOKEN_LPAREN, "Expected '(' after if");
+     int cond = aot_open(w);
+     aot_expect(w, TOKEN_RPAREN, "Expected ')' after if condition");
+     aot_line(w, "if (t%d.type != VAL_INT && t%d.type != VAL_BOOL)", cond, cond);
+     aot_line(w, "{");
+     aot_line(w, "    raise_error(\"Runtime error: %s condition must be int or bool.\\n\");", kind);
+     aot_line(w, "    goto done;");
+     aot_line(w, "}");
+     aot_line(w, "if (t%d.int_val != 0)", cond);
+     aot_block(w);
+ 
+     if (aot_current(w)->type == TOKEN_ELSE && !w->failed)
+     {
+         w->pos++;
+         aot_line(w, "else");
+ 
+         if (aot_current(w)->type == TOKEN_IF)
+         {
+             aot_if(w, "else if");
+         }
+         else
+         {
+             aot_block(w);
+         }
+     }
+ 
+     aot_close(w);
+ }
+ 
+ /*
+  * Writes a loop body followed by the label its continue statements jump to,
+  * if it has any.
+  */
+ static void aot_loop_body(AotWriter *w, int loop)
+ {
+     int outer = w->loop;
+     int outer_scope = w->loop_scope;
+     int outer_continued = w->continued;
+ 
+     w->loop = loop;
+     w->loop_scope = aot_scope_enter(w);
+     w->continued = 0;
+     aot_braces(w, 0);
+ 
+     if (w->continued)
+     {
+         aot_line(w, "next_%d:;", loop);
+     }
+     aot_scope_exit(w, w->loop_scope);
+ 
+     w->loop = outer;
+     w->loop_scope = outer_scope;
+     w->continued = outer_continued;
+ }
+ 
+ /*
+  * Mirrors a range loop, "for (name in start..end)" or "for (name in
+  * range(start, end, step))", as a C for loop over a long long counter.
+  */
+ static void aot_range_loop(AotWriter *w, int loop)
+ {
+     Token *name = aot_current(w);
+     int bounds[3];
+     int count = 2;
+ 
+     w->pos += 2; // the loop variable and "in"
+     aot_line(w, "{");
+     w->indent++;
+ 
+     if (aot_current(w)->type == TOKEN_IDENTIFIER && strcmp(aot_current(w)->text, "range") == 0 &&
+         aot_peek(w)->type == TOKEN_LPAREN)
+     {
+         w->pos += 2; // range(
+         count = 0;
+         while (!w->failed && count < 3)
+         {
+             bounds[count++] = aot_assignment(w);
+             if (aot_current(w)->type != TOKEN_COMMA)
+             {
+                 break;
+             }
+             w->pos++;
+         }
+         aot_expect(w, TOKEN_RPAREN, "Expected ')' after range(start, end, step)");
+ 
+         if (count < 2)
+         {
+             aot_fail(w, "Parser error: %s\n", "range() in a for loop expects a start, an end and an optional step.");
+         }
+     }
+     else
+     {
+         bounds[0] = aot_assignment(w);
+         aot_expect(w, TOKEN_RANGE, "Expected '..' or range() after 'in'");
+         bounds[1] = aot_assignment(w);
+     }
+     aot_expect(w, TOKEN_RPAREN, "Expected ')' after range loop header");
+ 
+     if (w->failed)
+     {
+         return;
+     }
+ 
+     if (count == 2)
+     {
+         bounds[2] = aot_temp(w);
+         aot_line(w, "Value t%d = make_int(1);", bounds[2]);
+     }
+ 
+     int start = bounds[0], end = bounds[1], step = bounds[2];
+ 
+     aot_line(w, "if (!check_range(t%d, t%d, t%d))", start, end, step);
+     aot_line(w, "{");
+     aot_line(w, "    goto done;");
+     aot_line(w, "}");
+     aot_line(w, "Value *counter_%d = NULL;", loop);
+     aot_line(w, "for (long long i%d = t%d.int_val; t%d.int_val > 0 ? i%d < t%d.int_val : i%d > t%d.int_val; "
+              "i%d += t%d.int_val)", loop, start, step, loop, end, loop, end, loop, step);
+     aot_line(w, "{");
+     w->indent++;
+     aot_begin_line(w, "if (!counter_%d && !(counter_%d = range_variable(", loop, loop);
+     aot_quote(w, &w->body, name->text);
+     aot_end_line(w, ", (int)i%d)))", loop);
+     aot_line(w, "{");
+     aot_line(w, "    goto done;");
+     aot_line(w, "}");
+     aot_line(w, "if (counter_%d->type == VAL_STRING)", loop);
+     aot_line(w, "{");
+     aot_line(w, "    free(counter_%d->str_val);", loop);
+     aot_line(w, "}");
+     aot_line(w, "*counter_%d = make_int((int)i%d);", loop, loop);
+     aot_loop_body(w, loop);
+     w->indent--;
+     aot_line(w, "}");
+     aot_close(w);
+ }
+ 
+ /*
+  * Mirrors the for statement.  The condition ends the loop unless it's a
+  * true int or bool, like the interpreter.
+  */
+ static void aot_for(AotWriter *w)
+ {
+     int cond_end = aot_current(w)->match;
+     int loop = w->loops++;
+ 
+     w->pos++; // for
+     int paren = w->pos;
+     aot_expect(w, TOKEN_LPAREN, "Expected '(' after for");
+ 
+     if (w->failed)
+     {
+         return;
+     }
+ 
+     if (aot_current(w)->type == TOKEN_IDENTIFIER && aot_peek(w)->type == TOKEN_IDENTIFIER &&
+         strcmp(aot_peek(w)->text, "in") == 0)
+     {
+         aot_range_loop(w, loop);
+         return;
+     }
+ 
+     if (cond_end < 0)
+     {
+         aot_fail(w, "Parser error: %s\n", "Malformed for-loop header.");
+         return;
+     }
+ 
+     int post_start = cond_end + 1;
+     int post_end = w->list->tokens[paren].match;
+ 
+     aot_line(w, "{");
+     w->indent++;
+     int scope = -1;
+ 
+     if (aot_current(w)->type == TOKEN_LET)
+     {
+         scope = w->scopes++;
+         aot_line(w, "int scope_%d = scope_enter();", scope);
+         aot_let(w);
+     }
+     else if (aot_current(w)->type != TOKEN_SEMICOLON)
+     {
+         aot_line(w, "(void)t%d;", aot_open(w));
+         aot_close(w);
+     }
+     aot_expect(w, TOKEN_SEMICOLON, "Expected ';' after for-loop initializer");
+ 
+     aot_line(w, "while (1)");
+     aot_line(w, "{");
+     w->indent++;
+ 
+     // Restrict the translator to the condition tokens, like the interpreter.
+     int count = w->list->count;
+     w->list->count = cond_end;
+     int cond = aot_open(w);
+     w->list->count = count;
+ 
+     if (w->pos != cond_end && !w->failed)
+     {
+         aot_fail(w, "Parser error: Unexpected token '%s'\n", aot_current(w)->text);
+     }
+ 
+     aot_line(w, "if ((t%d.type != VAL_INT && t%d.type != VAL_BOOL) || t%d.int_val == 0)", cond, cond, cond);
+     aot_line(w, "{");
+     aot_line(w, "    break;");
+     aot_line(w, "}");
+     aot_close(w);
+ 
+     // The body comes before the post expression.
+     w->pos = post_end;
+     aot_expect(w, TOKEN_RPAREN, "Expected ')' after for-loop post expression");
+     aot_loop_body(w, loop);
+     int body_end = w->pos;
+ 
+     if (post_start < post_end && !w->failed)
+     {
+         w->pos = post_start;
+         aot_line(w, "(void)t%d;", aot_open(w));
+         aot_close(w);
+         w->pos = body_end;
+     }
+ 
+     w->indent--;
+     aot_line(w, "}");
+     aot_scope_exit(w, scope);
+     w->indent--;
+     aot_line(w, "}");
+ }
+ 
+ /*
+  * Mirrors the while statement.
+  */
+ static void aot_while(AotWriter *w)
+ {
+     int loop = w->loops++;
+ 
+     w->pos++; // while
+     aot_expect(w, TOKEN_LPAREN, "Expected '(' after while");
+     aot_line(w, "while (1)");
+     aot_line(w, "{");
+     w->indent++;
+     int cond = aot_open(w);
+     aot_expect(w, TOKEN_RPAREN, "Expected ')' after while condition");
+     aot_line(w, "if (t%d.type != VAL_INT && t%d.type != VAL_BOOL)", cond, cond);
+     aot_line(w, "{");
+     aot_line(w, "    raise_error(\"Runtime error: while condition must be int or bool.\\n\");");
+     aot_line(w, "    goto done;");
+     aot_line(w, "}");
+     aot_line(w, "if (t%d.int_val == 0)", cond);
+     aot_line(w, "{");
+     aot_line(w, "    break;");
+     aot_line(w, "}");
+     aot_close(w);
+     aot_loop_body(w, loop);
+     w->indent--;
+     aot_line(w, "}");
+ }
+ 
+ /*
+  * Mirrors the foreach statement: the array is evaluated once and its items
+  * walked directly.
+  */
+ static void aot_foreach(AotWriter *w)
+ {
+     int loop = w->loops++;
+ 
+     w->pos++; // foreach
+     aot_expect(w, TOKEN_LPAREN, "Expected '(' after foreach");
+ 
+     Token *name = aot_current(w);
+ 
+     if (w->failed)
+     {
+         return;
+     }
+ 
+     if (name->type != TOKEN_IDENTIFIER || aot_peek(w)->type != TOKEN_IDENTIFIER ||
+         strcmp(aot_peek(w)->text, "in") != 0)
+     {
+         aot_fail(w, "Parser error: Expected 'name in array' after foreach, found '%s'.\n", name->text);
+         return;
+     }
+ 
+     w->pos += 2;
+     int list = aot_open(w);
+     aot_expect(w, TOKEN_RPAREN, "Expected ')' after foreach array");
+     aot_line(w, "t%d = foreach_list(t%d);", list, list);
+     aot_check(w);
+     aot_line(w, "for (int i%d = 0, n%d = t%d.array_val->length; i%d < n%d; i%d++)",
+              loop, loop, list, loop, loop, loop);
+     aot_line(w, "{");
+     w->indent++;
+     aot_line(w, "Value item = t%d.array_val->items[i%d];", list, loop);
+     aot_begin_line(w, "set_variable(");
+     aot_quote(w, &w->body, name->text);
+     aot_end_line(w, ", item.type == VAL_STRING ? make_string(item.str_val) : item);");
+     aot_loop_body(w, loop);
+     w->indent--;
+     aot_line(w, "}");
+     aot_line(w, "if (t%d.temp)", list);
+     aot_line(w, "{");
+     aot_line(w, "    free_value(t%d);", list);
+     aot_line(w, "}");
+     aot_close(w);
+ }
+ 
+ /*
+  * Mirrors the switch statement.  Int labels become a C switch, which the C
+  * compiler turns into a jump table, and string labels a run of strcmp.
+  * Either picks a case number that a goto then dispatches on, so the case
+  * bodies aren't inside a C switch and break still leaves the enclosing loop.
+  */
+ static void aot_switch(AotWriter *w)
+ {
+     int n = w->switches++;
+     int targets[MAX_TOKENS / 4];
+     int case_count = 0;
+     int default_case = -1;
+
+     w->pos++; // switch
+     aot_expect(w, TOKEN_LPAREN, "Expected '(' after switch");
+     int v = aot_open(w);
+     aot_expect(w, TOKEN_RPAREN, "Expected ')' after switch value");
+
+     if (aot_current(w)->type != TOKEN_LBRACE)
+     {
+         aot_fail(w, "Parser error: %s\n", "Expected '{' to start switch body.");
+     }
+
+     if (w->failed)
+     {
+         return;
+     }
+
+     int open = w->pos;
+     int close = aot_current(w)->match;
+     Token *tokens = w->list->tokens;
+
+     aot_line(w, "int c%d = -1;", n);
+     aot_line(w, "if (t%d.type == VAL_INT)", v);
+     aot_line(w, "{");
+     aot_line(w, "    switch (t%d.int_val)", v);
+     aot_line(w, "    {");
+
+     // Read the labels and write the int ones, the strings go after.
+     for (int pos = open + 1; pos < close && !w->failed; )
+     {
+         int is_default = tokens[pos].type == TOKEN_DEFAULT;
+         Token *label = &tokens[pos + 1];
+
+         if (tokens[pos].type != TOKEN_CASE && !is_default)
+         {
+             aot_fail(w, "Parser error: Expected case or default in switch, found '%s'.\n", tokens[pos].text);
+             break;
+         }
+
+         if (!is_default && label->type != TOKEN_INT &&
+             (label->type != TOKEN_STRING || strstr(label->text, "${") != NULL))
+         {
+             aot_fail(w, "Parser error: case labels must be int or string literals, found '%s'.\n", label->text);
+             break;
+         }
+
+         pos += is_default ? 1 : 2;
+
+         if (tokens[pos].type != TOKEN_COLON || tokens[pos + 1].type != TOKEN_LBRACE)
+         {
+             aot_fail(w, "Parser error: Expected ': {' after %s.\n", is_default ? "default" : "case label");
+             break;
+         }
+
+         if (is_default && default_case < 0)
+         {
+             default_case = case_count;
+         }
+         else if (!is_default && label->type == TOKEN_INT)
+         {
+             // The first of two equal labels wins.
+             int duplicate = 0;
+             for (int i = 0; i < case_count; i++)
+             {
+                 Token *other = &tokens[targets[i] - 2];
+                 duplicate |= other->type == TOKEN_INT && atoi(other->text) == atoi(label->text);
+             }
+
+             if (!duplicate)
+             {
+                 aot_line(w, "        case %d: c%d = %d; break;", atoi(label->text), n, case_count);
+             }
+         }
+
+         targets[case_count++] = pos + 1;
+         pos = tokens[pos + 1].match + 1;
+     }
+
+     aot_line(w, "    }");
+     aot_line(w, "}");
+     aot_line(w, "else if (t%d.type == VAL_STRING)", v);
+     aot_line(w, "{");
+     w->indent++;
+
+     int first = 1;
+     for (int i = 0; i < case_count; i++)
+     {
+         Token *label = &tokens[targets[i] - 2];
+
+         if (label->type == TOKEN_STRING && tokens[targets[i] - 3].type == TOKEN_CASE)
+         {
+             aot_begin_line(w, "%sif (strcmp(t%d.str_val, ", first ? "" : "else ", v);
+             aot_quote(w, &w->body, label->text);
+             aot_end_line(w, ") == 0) c%d = %d;", n, i);
+             first = 0;
+         }
+     }
+
+     aot_line(w, "if (t%d.temp)", v);
+     aot_line(w, "{");
+     aot_line(w, "    free_value(t%d);", v);
+     aot_line(w, "}");
+     w->indent--;
+     aot_line(w, "}");
+
+     aot_line(w, "switch (c%d)", n);
+     aot_line(w, "{");
+     for (int i = 0; i < case_count; i++)
+     {
+         aot_line(w, "    case %d: goto case_%d_%d;", i, n, i);
+     }
+     if (default_case >= 0)
+     {
+         aot_line(w, "    default: goto case_%d_%d;", n, default_case);
+     }
+     else
+     {
+         aot_line(w, "    default: goto end_switch_%d;", n);
+     }
+     aot_line(w, "}");
+
+     for (int i = 0; i < case_count && !w->failed; i++)
+     {
+         aot_line(w, "case_%d_%d:", n, i);
+         w->pos = targets[i];
+         aot_block(w);
+         aot_line(w, "goto end_switch_%d;", n);
+     }
+
+     aot_line(w, "end_switch_%d:;", n);
+     w->pos = close + 1;
+     aot_close(w);
+ }
+
+ /*
+  * Writes a function the script defines as a C function of its own, called
+  * like a builtin.  Its body runs in a frame, as in the interpreter.
+  */
+ static void aot_function(AotWriter *w)
+ {
+     const Function *fn = aot_current(w)->function;
+     AotBuffer body = w->body;
+     int indent = w->indent;
+     int loop = w->loop;
+     int loop_scope = w->loop_scope;
+ 
+     aot_append(w, &w->decls, "static Value script_%s(Value *args, int arg_count);\n", fn->name);
+     aot_append(w, &w->decls, "static const Function function_%s = { \"%s\", script_%s };\n", fn->name, fn->name,
+                fn->name);
+     aot_append(w, &w->setup, "    add_script_function(&function_%s);\n", fn->name);
+ 
+     memset(&w->body, 0, sizeof(w->body));
+     w->indent = 1;
+     w->loop = -1;
+     w->loop_scope = -1;
+     w->pos = fn->body;
+ 
+     if (fn->param_count > 0)
+     {
+         aot_begin_line(w, "static const char *params[] = { ");
+         for (int i = 0; i < fn->param_count; i++)
+         {
+             aot_append(w, &w->body, i ? ", " : "");
+             aot_quote(w, &w->body, fn->params[i]);
+         }
+         aot_end_line(w, " };");
+     }
+     aot_line(w, "Frame frame;");
+     aot_append(w, &w->body, "\n");
+     aot_line(w, "if (!push_frame(&frame, \"%s\", %s, %d, args, arg_count))", fn->name,
+              fn->param_count > 0 ? "params" : "NULL", fn->param_count);
+     aot_line(w, "{");
+     aot_line(w, "    return return_value;");
+     aot_line(w, "}");
+     aot_append(w, &w->body, "\n");
+     aot_block(w);
+ 
+     aot_append(w, &w->functions, "static Value script_%s(Value *args, int arg_count)\n{\n", fn->name);
+     aot_append(w, &w->functions, "%s", w->body.text ? w->body.text : "");
+     aot_append(w, &w->functions, "\ndone:\n    return pop_frame(&frame);\n}\n\n");
+     free(w->body.text);
+ 
+     w->body = body;
+     w->indent = indent;
+     w->loop = loop;
+     w->loop_scope = loop_scope;
+ }
+ 
+ /*
+  * Mirrors parse_statement.
+  */
+ static void aot_statement(AotWriter *w)
+ {
+     Token *tok = aot_current(w);
+ 
+     switch (tok->type)
+     {
+         case TOKEN_RETURN:
+         {
+             w->pos++;
+             int v = aot_open(w);
+             aot_expect(w, TOKEN_SEMICOLON, "Expected ';' after return statement");
+             aot_line(w, "if (t%d.type == VAL_STRING && !t%d.temp)", v, v);
+             aot_line(w, "{");
+             aot_line(w, "    t%d = make_string(t%d.str_val);", v, v);
+             aot_line(w, "}");
+             aot_line(w, "return_flag = 1;");
+             aot_line(w, "return_value = t%d;", v);
+             aot_line(w, "goto done;");
+             aot_close(w);
+             return;
+         }
+         case TOKEN_IF:
+             aot_if(w, "if");
+             return;
+         case TOKEN_FOR:
+             aot_for(w);
+             return;
+         case TOKEN_WHILE:
+             aot_while(w);
+             return;
+         case TOKEN_FOREACH:
+             aot_foreach(w);
+             return;
+         case TOKEN_FUNCTION:
+             aot_function(w);
+             return;
+         case TOKEN_IMPORT:
+             // The module stays interpreted, loaded from its file at run time.
+             aot_begin_line(w, "run_import(");
+             aot_quote(w, &w->body, w->list->tokens[w->pos + 1].text);
+             aot_end_line(w, ");");
+             aot_check(w);
+             w->pos += 3;
+             return;
+         case TOKEN_LET:
+             aot_let(w);
+             aot_expect(w, TOKEN_SEMICOLON, "Expected ';' after let statement");
+             return;
+         case TOKEN_SWITCH:
+             aot_switch(w);
+             return;
+         case TOKEN_CONTINUE:
+         case TOKEN_BREAK:
+             w->pos++;
+             aot_expect(w, TOKEN_SEMICOLON, tok->type == TOKEN_BREAK ? "Expected ';' after break statement"
+                                                                    : "Expected ';' after continue statement");
+             if (w->loop < 0)
+             {
+                 aot_fail(w, "Parser error: %s outside of a loop\n", tok->text);
+             }
+             else if (tok->type == TOKEN_BREAK)
+             {
+                 aot_scope_exit(w, w->loop_scope);
+                 aot_line(w, "break;");
+             }
+             else
+             {
+                 aot_line(w, "goto next_%d;", w->loop);
+                 w->continued = 1;
+             }
+             return;
+         case TOKEN_LBRACE:
+             aot_block(w);
+             return;
+         default:
+         {
+             int v = aot_open(w);
+             aot_expect(w, TOKEN_SEMICOLON, "Expected ';' after expression statement");
+             aot_line(w, "if (t%d.type == VAL_STRING && t%d.temp)", v, v);
+             aot_line(w, "{");
+             aot_line(w, "    free_value(t%d);", v);
+             aot_line(w, "}");
+             aot_close(w);
+             return;
+         }
+     }
+ }
+ 
+ /*
+  * Translates a script into C: a function taking no arguments and returning
+  * the script's value, like interpret().  Returns the C source, which the
+  * caller frees, or NULL after reporting the error through raise_error.
+  */
+ char *aot_translate(const char *src, const char *function_name)
+ {
+     TokenList *tokens = malloc(sizeof(TokenList));
+     AotBuffer out = { NULL, 0, 0 };
+     AotWriter w;
+ 
+     if (!tokens)
+     {
+         raise_error("Memory allocation error in aot_translate: tokens.");
+         return NULL;
+     }
+ 
+     memset(&w, 0, sizeof(w));
+     w.list = tokens;
+     w.loop = -1;
+     w.loop_scope = -1;
+     w.indent = 1;
+ 
+     return_flag = 0;
+     return_value = make_null();
+     tokens->count = 0;
+     tokenize(src, tokens);
+     compile(tokens);
+ 
+     if (return_flag)
+     {
+         w.failed = 1;
+     }
+ 
+     while (!w.failed && aot_current(&w)->type != TOKEN_EOF)
+     {
+         aot_statement(&w);
+     }
+ 
+     aot_append(&w, &out, "/* Generated by arcane --emit-c, do not edit. */\n\n");
+     aot_append(&w, &out, "#include \"arcane.h\"\n#include <stddef.h>\n#include <string.h>\n\n");
+     aot_append(&w, &out, "extern int return_flag;\nextern Value return_value;\n\n");
+     aot_append(&w, &out, "%s\n", w.decls.text ? w.decls.text : "");
+     aot_append(&w, &out, "%s", w.functions.text ? w.functions.text : "");
+     aot_append(&w, &out, "Value %s(void)\n{\n    aot_begin();\n%s\n", function_name, w.setup.text ? w.setup.text : "");
+     aot_append(&w, &out, "%s", w.body.text ? w.body.text : "");
+     aot_append(&w, &out, "\ndone:\n    return aot_end();\n}\n");
+ 
+     for (int i = 0; i < tokens->count; i++)
+     {
+         free(tokens->tokens[i].text);
+         if (tokens->tokens[i].type == TOKEN_FUNCTION)
+         {
+             free((Function *)tokens->tokens[i].function);
+         }
+     }
+     free(tokens);
+     free(w.decls.text);
+     free(w.functions.text);
+     free(w.setup.text);
+     free(w.body.text);
+ 
+     if (w.failed)
+     {
+         free(out.text);
+         return NULL;
+     }
+ 
+     return out.text;
+ }
@@ -18,6 +18,8 @@
  #include <stdarg.h>
  #include <stdio.h>
  #include <math.h>
+ #include <stdint.h>
+ #include <sys/stat.h>
  
  #ifdef _WIN32
     #include <time.h>
@@ -34,6 +36,11 @@
  Value return_value;
  static int continue_flag = 0;
  static int break_flag = 0;
+ static int fold_mode = 0;   /* set while the compiler evaluates constant expressions */
+ static int fold_failed = 0; /* set when a folded expression turned out not to be constant */
+ static Frame *current_frame = NULL; /* the script function call running, NULL at the top level */
+ static Variable block_locals[MAX_BLOCK_LOCALS]; /* let variables, the innermost block's last */
+ static int block_local_count = 0;
  extern Function interop_functions[];
 
  /* ============================================================
@@ -124,6 +131,442 @@ Value make_date(Date d)
     return v;
 }
 
+/**
+ * Makes a set value.  The value takes ownership of the set.
+ */
+Value make_set(StringSet *set)
+{
+    Value v;
+    v.type = VAL_SET;
+    v.set_val = set;
+    v.temp = 1;
+    return v;
+}
+
+/**
+ * Makes a map value.  The value takes ownership of the map.
+ */
+Value make_map(Map *map)
+{
+    Value v;
+    v.type = VAL_MAP;
+    v.map_val = map;
+    v.temp = 1;
+    return v;
+}
+
+/**
+ * Makes a typed array value.  The value takes ownership of the array.
+ */
+Value make_typed_array(TypedArray *arr)
+{
+    Value v;
+    v.type = VAL_TYPED_ARRAY;
+    v.typed_val = arr;
+    v.temp = 1;
+    return v;
+}
+
+ /* ============================================================
+     Number Formatting: used everywhere a number is turned into
+     a string so scripts don't pay for printf.
+    ============================================================ */
+ 
+ static const char digit_pairs[201] =
+     "00010203040506070809"
+     "10111213141516171819"
+     "20212223242526272829"
+     "30313233343536373839"
+     "40414243444546474849"
+     "50515253545556575859"
+     "60616263646566676869"
+     "70717273747576777879"
+     "80818283848586878889"
+     "90919293949596979899";
+ 
+ /**
+  * Writes the decimal digits of an unsigned 64 bit value, returning the length.
+  */
+ static int format_uint64(uint64_t value, char *buffer)
+ {
+     char temp[24];
+     char *p = temp + sizeof(temp);
+ 
+     // Two digits at a time from the right.
+     while (value >= 100)
+     {
+         int pair = (int)(value % 100) * 2;
+         value /= 100;
+         *--p = digit_pairs[pair + 1];
+         *--p = digit_pairs[pair];
+     }
+ 
+     if (value >= 10)
+     {
+         int pair = (int) value * 2;
+         *--p = digit_pairs[pair + 1];
+         *--p = digit_pairs[pair];
+     }
+     else
+     {
+         *--p = (char)('0' + value);
+     }
+ 
+     int len = (int)(temp + sizeof(temp) - p);
+     memcpy(buffer, p, len);
+     buffer[len] = '\0';
+     return len;
+ }
+ 
+ /**
+  * Formats an int into the buffer (at least 12 bytes) and returns the length.
+  */
+ int format_int(int value, char *buffer)
+ {
+     if (value < 0)
+     {
+         *buffer = '-';
+         // Negate as unsigned so INT_MIN doesn't overflow.
+         return format_uint64(0u - (unsigned int) value, buffer + 1) + 1;
+     }
+ 
+     return format_uint64((unsigned int) value, buffer);
+ }
+ 
+ /*
+  * The double formatter is an implementation of Florian Loitsch's Grisu2
+  * algorithm, which produces the shortest digits that round trip for
+  * practically every double without using big integer arithmetic.
+  */
+ 
+ typedef struct
+ {
+     uint64_t f;
+     int e;
+ } DiyFp;
+ 
+ #define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+ #define DP_HIDDEN_BIT       0x0010000000000000ULL
+ #define DP_EXPONENT_BIAS    1075
+ 
+ /* Normalized powers of ten from 10^-348 to 10^340 in steps of 8. */
+ static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+ };
+ 
+ static const short cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+ };
+ 
+ static const uint64_t pow10_table[] = {
+     1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+     100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+     10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+     100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+ };
+ 
+ static DiyFp diyfp_multiply(DiyFp x, DiyFp y)
+ {
+     const uint64_t m32 = 0xFFFFFFFFULL;
+     uint64_t a = x.f >> 32, b = x.f & m32;
+     uint64_t c = y.f >> 32, d = y.f & m32;
+     uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+     uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+     tmp += 1ULL << 31; // round
+     DiyFp r = { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
+     return r;
+ }
+ 
+ static DiyFp diyfp_normalize(DiyFp x)
+ {
+     while (!(x.f & 0x8000000000000000ULL))
+     {
+         x.f <<= 1;
+         x.e--;
+     }
+     return x;
+ }
+ 
+ /**
+  * Generates the digits of W, stopping as soon as the digits are inside the
+  * rounding interval [Mp - delta, Mp].
+  */
+ static void grisu_digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char *buffer, int *len, int *k)
+ {
+     DiyFp one = { 1ULL << -mp.e, mp.e };
+     uint64_t wp_w = mp.f - w.f;
+     uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+     uint64_t p2 = mp.f & (one.f - 1);
+     int kappa = 1;
+ 
+     while (kappa < 10 && p1 >= pow10_table[kappa])
+     {
+         kappa++;
+     }
+ 
+     *len = 0;
+ 
+     while (kappa > 0)
+     {
+         uint32_t d = (uint32_t)(p1 / pow10_table[kappa - 1]);
+         p1 = (uint32_t)(p1 % pow10_table[kappa - 1]);
+ 
+         if (d || *len)
+         {
+             buffer[(*len)++] = (char)('0' + d);
+         }
+ 
+         kappa--;
+         uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+ 
+         if (rest <= delta)
+         {
+             uint64_t ten_kappa = pow10_table[kappa] << -one.e;
+             *k += kappa;
+ 
+             // Round the last digit towards the exact value.
+             while (rest < wp_w && delta - rest >= ten_kappa &&
+                    (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+             {
+                 buffer[*len - 1]--;
+                 rest += ten_kappa;
+             }
+             return;
+         }
+     }
+ 
+     for (;;)
+     {
+         p2 *= 10;
+         delta *= 10;
+         char d = (char)(p2 >> -one.e);
+ 
+         if (d || *len)
+         {
+             buffer[(*len)++] = (char)('0' + d);
+         }
+ 
+         p2 &= one.f - 1;
+         kappa--;
+ 
+         if (p2 < delta)
+         {
+             int index = -kappa;
+             uint64_t scaled = wp_w * (index < 20 ? pow10_table[index] : 0);
+             *k += kappa;
+ 
+             while (p2 < scaled && delta - p2 >= one.f &&
+                    (p2 + one.f < scaled || scaled - p2 > p2 + one.f - scaled))
+             {
+                 buffer[*len - 1]--;
+                 p2 += one.f;
+             }
+             return;
+         }
+     }
+ }
+ 
+ /**
+  * Produces the shortest digits for a positive, finite double.  The value is
+  * digits * 10^k.
+  */
+ static void grisu2(double value, char *buffer, int *len, int *k)
+ {
+     uint64_t u;
+     memcpy(&u, &value, sizeof(double));
+ 
+     int biased_e = (int)((u >> 52) & 0x7FF);
+     DiyFp v;
+     v.f = u & DP_SIGNIFICAND_MASK;
+ 
+     if (biased_e != 0)
+     {
+         v.f += DP_HIDDEN_BIT;
+         v.e = biased_e - DP_EXPONENT_BIAS;
+     }
+     else
+     {
+         v.e = 1 - DP_EXPONENT_BIAS;
+     }
+ 
+     // The boundaries halfway to the neighbouring doubles.
+     DiyFp plus = { (v.f << 1) + 1, v.e - 1 };
+ 
+     while (!(plus.f & (DP_HIDDEN_BIT << 1)))
+     {
+         plus.f <<= 1;
+         plus.e--;
+     }
+ 
+     plus.f <<= 10;
+     plus.e -= 10;
+ 
+     DiyFp minus;
+ 
+     if (v.f == DP_HIDDEN_BIT)
+     {
+         minus.f = (v.f << 2) - 1;
+         minus.e = v.e - 2;
+     }
+     else
+     {
+         minus.f = (v.f << 1) - 1;
+         minus.e = v.e - 1;
+     }
+ 
+     minus.f <<= minus.e - plus.e;
+     minus.e = plus.e;
+ 
+     // Pick a cached power of ten that brings the exponent into [-60, -32].
+     double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+     int ik = (int) dk;
+ 
+     if (dk - ik > 0.0)
+     {
+         ik++;
+     }
+ 
+     int index = (ik >> 3) + 1;
+     DiyFp c_mk = { cached_powers_f[index], cached_powers_e[index] };
+     *k = -(-348 + index * 8);
+ 
+     DiyFp w = diyfp_multiply(diyfp_normalize(v), c_mk);
+     DiyFp wp = diyfp_multiply(plus, c_mk);
+     DiyFp wm = diyfp_multiply(minus, c_mk);
+     wm.f++;
+     wp.f--;
+ 
+     grisu_digit_gen(w, wp, wp.f - wm.f, buffer, len, k);
+ }
+ 
+ /**
+  * Formats a double into the buffer (at least 32 bytes) using the shortest
+  * representation that reads back as the same value, e.g. 3, 0.75, 1e+21.
+  * Returns the length.
+  */
+ int format_double(double value, char *buffer)
+ {
+     char *p = buffer;
+ 
+     if (isnan(value))
+     {
+         strcpy(buffer, "nan");
+         return 3;
+     }
+ 
+     if (value < 0)
+     {
+         *p++ = '-';
+         value = -value;
+     }
+ 
+     if (isinf(value))
+     {
+         strcpy(p, "inf");
+         return (int)(p - buffer) + 3;
+     }
+ 
+     if (value == 0.0)
+     {
+         strcpy(buffer, "0");
+         return 1;
+     }
+ 
+     // Whole numbers that fit in 64 bits are just integers.
+     if (value < 1e17 && value == (double)(uint64_t) value)
+     {
+         return (int)(p - buffer) + format_uint64((uint64_t) value, p);
+     }
+ 
+     char digits[20];
+     int len, k;
+     grisu2(value, digits, &len, &k);
+ 
+     // The position of the decimal point relative to the digits.
+     int point = len + k;
+ 
+     if (point > 0 && point <= 21)
+     {
+         if (k >= 0)
+         {
+             memcpy(p, digits, len);
+             memset(p + len, '0', k);
+             p += point;
+         }
+         else
+         {
+             memcpy(p, digits, point);
+             p[point] = '.';
+             memcpy(p + point + 1, digits + point, len - point);
+             p += len + 1;
+         }
+     }
+     else if (point <= 0 && point > -6)
+     {
+         *p++ = '0';
+         *p++ = '.';
+         memset(p, '0', -point);
+         p += -point;
+         memcpy(p, digits, len);
+         p += len;
+     }
+     else
+     {
+         *p++ = digits[0];
+ 
+         if (len > 1)
+         {
+             *p++ = '.';
+             memcpy(p, digits + 1, len - 1);
+             p += len - 1;
+         }
+ 
+         int exp = point - 1;
+         *p++ = 'e';
+         *p++ = exp < 0 ? '-' : '+';
+         p += format_uint64(exp < 0 ? -exp : exp, p);
+     }
+ 
+     *p = '\0';
+     return (int)(p - buffer);
+ }
+ 
  /*
   * Raises an error with the given message.
   */
@@ -132,6 +575,13 @@ Value make_date(Date d)
      va_list arg;
      char str[MAX_STRING_LENGTH];
  
+     // Errors while folding just mean the expression is left for run time.
+     if (fold_mode)
+     {
+         fold_failed = 1;
+         return;
+     }
+ 
      va_start(arg, s);
      vsnprintf(str, MAX_STRING_LENGTH, s, arg);
      va_end(arg);
@@ -143,6 +593,25 @@ Value make_date(Date d)
      return_value = make_error(str);
  }
  
+ /*
+  * Drops an array's use of the items it shares with slices, freeing them
+  * once nothing uses them.
+  */
+ static void release_storage(ArrayStorage *storage)
+ {
+     if (--storage->refs > 0)
+     {
+         return;
+     }
+ 
+     for (int i = 0; i < storage->length; i++)
+     {
+         free_value(storage->items[i]);
+     }
+     free(storage->items);
+     free(storage);
+ }
+ 
   /*
    * Frees a values allocated memory.
    */
@@ -158,6 +627,11 @@ Value make_date(Date d)
          free(v.str_val);
          v.str_val = NULL;
      }
+     else if (v.type == VAL_ARRAY && v.array_val && v.array_val->shared)
+     {
+         release_storage(v.array_val->shared);
+         free(v.array_val);
+     }
      else if (v.type == VAL_ARRAY && v.array_val)
      {
          Array *arr = v.array_val;
@@ -167,7 +641,19 @@ Value make_date(Date d)
          }
          free(arr->items);
          free(arr);
-     }     
+     }
+     else if (v.type == VAL_SET && v.set_val)
+     {
+         set_free(v.set_val);
+     }
+     else if (v.type == VAL_MAP && v.map_val)
+     {
+         map_free(v.map_val);
+     }
+     else if (v.type == VAL_TYPED_ARRAY && v.typed_val)
+     {
+         typed_array_free(v.typed_val);
+     }
  }
  
  /* ============================================================
@@ -175,110 +661,497 @@ Value make_date(Date d)
     ============================================================ */
  
  /*
-  * Finds a variable by name in the local symbol table.
+  * Finds a variable among the current function call's locals.
   */
- Variable *find_variable(const char *name)
+ static Variable *find_local(const char *name)
  {
-     Variable *cur = local_variables;
-     while (cur)
+     for (int i = 0; i < current_frame->count; i++)
      {
-         if (strcmp(cur->name, name) == 0)
+         if (strcmp(current_frame->locals[i].name, name) == 0)
          {
-             return cur;
+             return &current_frame->locals[i];
          }
-         cur = cur->next;
      }
      return NULL;
  }
  
  /*
-  *  Adds or updates a variable.  The passed-in Value’s "temp" flag is cleared (0) to
-  *  indicate that the variable table now owns it.
+  * Finds a let variable declared by the running call, innermost block first.
   */
- void set_variable(const char *name, Value v)
+ static Variable *find_block_local(const char *name)
  {
-     Variable *var = find_variable(name);
-     v.temp = 0; /* variable–stored values are not temporary */
-     if (var)
+     int base = current_frame ? current_frame->scope : 0;
+ 
+     for (int i = block_local_count - 1; i >= base; i--)
      {
-         /* free any previous string if needed */
-         if (var->value.type == VAL_STRING && var->value.str_val)
+         if (strcmp(block_locals[i].name, name) == 0)
          {
-             free(var->value.str_val);
-             var->value.str_val = NULL;
+             return &block_locals[i];
          }
-         var->value = v;
-     }
-     else
-     {
-         Variable *newVar = malloc(sizeof(Variable));
-         newVar->name = _strdup(name);
-         newVar->value = v;
-         newVar->next = local_variables;
-         local_variables = newVar;
      }
+     return NULL;
  }
  
  /*
-  * Retrieves a variable by name from the local symbol table.
+  * Starts a block: let variables declared from here on are released by the
+  * scope_exit given the returned mark.
   */
- Value get_variable(const char *name)
+ int scope_enter(void)
  {
-     Variable *var = find_variable(name);
- 
-     if (var)
-     {
-         return var->value;
-     }
- 
-     raise_error("Runtime error: variable \"%s\" not defined.\n", name);
-     return return_value;
+     return block_local_count;
  }
  
  /*
-  * Frees all local variables.
+  * Ends a block, releasing the let variables declared since scope_enter.
   */
- void free_variables()
+ void scope_exit(int scope)
  {
-     Variable *cur = local_variables;
-     while (cur)
+     while (block_local_count > scope)
      {
-         Variable *next = cur->next;
-         free(cur->name);
-         cur->name = NULL;
- 
-         if (cur->value.type == VAL_STRING && cur->value.str_val)
+         Variable *var = &block_locals[--block_local_count];
+         if (var->value.type == VAL_STRING)
          {
-             free(cur->value.str_val);
-             cur->value.str_val = NULL;
+             free(var->value.str_val);
          }
-         free(cur);
-         cur = next;
      }
-     local_variables = NULL;
  }
  
  /*
-  * Lookup interop function by name and call it with the given arguments.
+  * Declares a let variable in the innermost block, hiding any variable with
+  * the same name until the block ends.  The name isn't copied.
   */
- Value call_function(const char *name, Value *args, int arg_count)
+ void declare_variable(const char *name, Value v)
  {
-     for (int i = 0; interop_functions[i].name != NULL; i++)
+     if (block_local_count == MAX_BLOCK_LOCALS)
+     {
+         raise_error("Runtime error: Too many let variables, the limit is %d.\n", MAX_BLOCK_LOCALS);
+         return;
+     }
+ 
+     // The variable gets its own copy of another variable's string.
+     if (v.type == VAL_STRING && !v.temp)
+     {
+         v = make_string(v.str_val);
+     }
+     v.temp = 0;
+ 
+     Variable *var = &block_locals[block_local_count++];
+     var->name = (char *)name;
+     var->value = v;
+     var->next = NULL;
+ }
+ 
+ /*
+  * Finds a variable by name: the let variables of the enclosing blocks, inside
+  * a script function its locals, then the script's variables.
+  */
+ Variable *find_variable(const char *name)
+ {
+     Variable *scoped = find_block_local(name);
+     if (scoped)
+     {
+         return scoped;
+     }
+ 
+     if (current_frame)
+     {
+         Variable *local = find_local(name);
+         if (local)
+         {
+             return local;
+         }
+     }
+ 
+     Variable *cur = local_variables;
+     while (cur)
+     {
+         if (strcmp(cur->name, name) == 0)
+         {
+             return cur;
+         }
+         cur = cur->next;
+     }
+     return NULL;
+ }
+ 
+ /*
+  * Finds the variable an assignment to name updates, or NULL if it creates
+  * one.  Other than a let variable, inside a script function that's always
+  * one of its locals.
+  */
+ Variable *find_assignable(const char *name)
+ {
+     Variable *scoped = find_block_local(name);
+     if (scoped)
+     {
+         return scoped;
+     }
+ 
+     return current_frame ? find_local(name) : find_variable(name);
+ }
+ 
+ /*
+  *  Adds or updates a variable.  The passed-in Value’s "temp" flag is cleared (0) to
+  *  indicate that the variable table now owns it.
+  */
+ void set_variable(const char *name, Value v)
+ {
+     if (fold_mode)
+     {
+         fold_failed = 1;
+         return;
+     }
+ 
+     Variable *var = find_assignable(name);
+     v.temp = 0; /* variable–stored values are not temporary */
+     if (var)
+     {
+         /* free any previous string if needed */
+         if (var->value.type == VAL_STRING && var->value.str_val)
+         {
+             free(var->value.str_val);
+             var->value.str_val = NULL;
+         }
+         var->value = v;
+     }
+     else if (current_frame)
+     {
+         if (current_frame->count == MAX_LOCALS)
+         {
+             raise_error("Runtime error: Too many local variables in a function, the limit is %d.\n", MAX_LOCALS);
+             return;
+         }
+ 
+         var = &current_frame->locals[current_frame->count++];
+         var->name = _strdup(name);
+         var->value = v;
+         var->next = NULL;
+     }
+     else
+     {
+         Variable *newVar = malloc(sizeof(Variable));
+         newVar->name = _strdup(name);
+         newVar->value = v;
+         newVar->next = local_variables;
+         local_variables = newVar;
+     }
+ }
+ 
+ /*
+  * Checks the bounds of a range loop: ints, with a step other than 0.  Returns
+  * 0 after raising an error if they aren't.
+  */
+ int check_range(Value start, Value end, Value step)
+ {
+     if (start.type != VAL_INT || end.type != VAL_INT || step.type != VAL_INT)
+     {
+         Value bounds[3] = { start, end, step };
+         for (int i = 0; i < 3; i++)
+         {
+             if (bounds[i].temp)
+             {
+                 free_value(bounds[i]);
+             }
+         }
+         raise_error("Runtime error: A range loop's bounds and step must be ints.\n");
+         return 0;
+     }
+     if (step.int_val == 0)
+     {
+         raise_error("Runtime error: A range loop's step can't be 0.\n");
+         return 0;
+     }
+     return 1;
+ }
+ 
+ /*
+  * Sets a range loop's variable to its first value and returns where it's
+  * stored, so each pass can write the counter straight to it.  Returns NULL
+  * after raising an error if the variable can't be made.
+  */
+ Value *range_variable(const char *name, int first)
+ {
+     set_variable(name, make_int(first));
+ 
+     Variable *var = return_flag ? NULL : find_assignable(name);
+     return var ? &var->value : NULL;
+ }
+ 
+ /*
+  * Retrieves a variable by name from the local symbol table.
+  */
+ Value get_variable(const char *name)
+ {
+     // While folding, anything other than a constant fails the fold.  An int
+     // keeps the evaluator on safe paths until the fold is abandoned.
+     if (fold_mode)
+     {
+         fold_failed = 1;
+         return make_int(0);
+     }
+ 
+     Variable *var = find_variable(name);
+ 
+     if (var)
+     {
+         return var->value;
+     }
+ 
+     raise_error("Runtime error: variable \"%s\" not defined.\n", name);
+     return return_value;
+ }
+ 
+ /*
+  * Frees all local variables.
+  */
+ void free_variables()
+ {
+     scope_exit(0);
+ 
+     Variable *cur = local_variables;
+     while (cur)
+     {
+         Variable *next = cur->next;
+         free(cur->name);
+         cur->name = NULL;
+ 
+         if (cur->value.type == VAL_STRING && cur->value.str_val)
+         {
+             free(cur->value.str_val);
+             cur->value.str_val = NULL;
+         }
+         free(cur);
+         cur = next;
+     }
+     local_variables = NULL;
+ }
+ 
+ /* The functions the running script defines, for builtins that call one by name. */
+ static const Function *script_functions[MAX_TOKENS / 4];
+ static int script_function_count = 0;
+ 
+ /*
+  * Forgets the functions of the previous script.
+  */
+ void clear_script_functions(void)
+ {
+     script_function_count = 0;
+ }
+ 
+ /*
+  * Makes a function the script defines callable by name, e.g. by array_map.
+  * It replaces a function of the same name, such as an earlier version of a
+  * module's.
+  */
+ void add_script_function(const Function *fn)
+ {
+     for (int i = 0; i < script_function_count; i++)
+     {
+         if (strcmp(script_functions[i]->name, fn->name) == 0)
+         {
+             script_functions[i] = fn;
+             return;
+         }
+     }
+ 
+     if (script_function_count < MAX_TOKENS / 4)
+     {
+         script_functions[script_function_count++] = fn;
+     }
+ }
+ 
+ /*
+  * Finds a function by name, like find_function: the script's own first,
+  * then the builtins.  Returns NULL if there's no such function.
+  */
+ const Function *lookup_function(const char *name)
+ {
+     for (int i = 0; i < script_function_count; i++)
+     {
+         if (strcmp(script_functions[i]->name, name) == 0)
+         {
+             return script_functions[i];
+         }
+     }
+ 
+     for (int i = 0; interop_functions[i].name != NULL; i++)
      {
          if (strcmp(interop_functions[i].name, name) == 0)
          {
-             return interop_functions[i].func(args, arg_count);
+             return &interop_functions[i];
+         }
+     }
+ 
+     return NULL;
+ }
+ 
+ /*
+  * Lookup a function by name and call it with the given arguments.
+  */
+ Value call_function(const char *name, Value *args, int arg_count)
+ {
+     const Function *fn = lookup_function(name);
+ 
+     if (fn)
+     {
+         if (fold_mode && !fn->pure)
+         {
+             fold_failed = 1;
+             return make_int(0);
          }
+ 
+         return invoke_function(fn, args, arg_count);
      }
  
      raise_error("Runtime error: Unknown function \"%s\".\n", name);
      return return_value;
  }
  
+ /*
+  * Starts a script function call: binds the arguments to the parameters in a
+  * new frame, which becomes the current one.  Returns 0 after raising an error
+  * if the call can't be made.
+  */
+ int push_frame(Frame *frame, const char *name, const char **params, int param_count, Value *args, int arg_count)
+ {
+     int depth = current_frame ? current_frame->depth + 1 : 1;
+ 
+     if (arg_count != param_count)
+     {
+         raise_error("Runtime error: %s() expects %d argument%s, got %d.\n", name, param_count,
+                     param_count == 1 ? "" : "s", arg_count);
+         return 0;
+     }
+     if (depth > MAX_CALL_DEPTH)
+     {
+         raise_error("Runtime error: Too many nested calls to %s(), the limit is %d.\n", name, MAX_CALL_DEPTH);
+         return 0;
+     }
+ 
+     for (int i = 0; i < param_count; i++)
+     {
+         Value v = args[i];
+ 
+         // The frame gets its own copy of a string, the caller frees its arguments.
+         if (v.type == VAL_STRING)
+         {
+             v = make_string(v.str_val);
+         }
+         v.temp = 0;
+ 
+         frame->locals[i].name = (char *)params[i];
+         frame->locals[i].value = v;
+         frame->locals[i].next = NULL;
+     }
+ 
+     frame->count = param_count;
+     frame->params = param_count;
+     frame->depth = depth;
+     frame->scope = block_local_count;
+     frame->caller = current_frame;
+     current_frame = frame;
+     return 1;
+ }
+ 
+ /*
+  * Finishes a script function call: frees its locals, returns to the caller's
+  * frame and returns what the function returned, or null.  Errors carry on.
+  */
+ Value pop_frame(Frame *frame)
+ {
+     Value result = make_null();
+ 
+     if (return_flag && return_value.type != VAL_ERROR)
+     {
+         result = return_value;
+         return_flag = 0;
+         return_value = make_null();
+     }
+     else if (return_flag)
+     {
+         result = return_value;
+     }
+ 
+     // A break or continue outside of a loop only ends the function.
+     break_flag = 0;
+     continue_flag = 0;
+     scope_exit(frame->scope);
+ 
+     for (int i = 0; i < frame->count; i++)
+     {
+         if (i >= frame->params)
+         {
+             free(frame->locals[i].name);
+         }
+         if (frame->locals[i].value.type == VAL_STRING)
+         {
+             free(frame->locals[i].value.str_val);
+         }
+     }
+ 
+     current_frame = frame->caller;
+     return result;
+ }
+ 
+ /*
+  * Calls a function resolved by compile(), a builtin or one the script
+  * defines.  A script function's body runs in place, in a new frame.
+  */
+ Value invoke_function(const Function *fn, Value *args, int arg_count)
+ {
+     if (fn->func)
+     {
+         return fn->func(args, arg_count);
+     }
+ 
+     Frame frame;
+ 
+     if (!push_frame(&frame, fn->name, fn->params, fn->param_count, args, arg_count))
+     {
+         return return_value;
+     }
+ 
+     Parser body;
+     body.tokens = fn->tokens;
+     body.pos = fn->body;
+     parse_block(&body);
+ 
+     return pop_frame(&frame);
+ }
+ 
  /* ============================================================
      Tokenizer
     ============================================================ */
  
+ /*
+  * Maps operator text to its operator code.
+  */
+ static OperatorCode operator_code(const char *text)
+ {
+     static const struct
+     {
+         const char *text;
+         OperatorCode op;
+     } operators[] = {
+         {"=", OP_ASSIGN}, {"+=", OP_ADD_ASSIGN}, {"-=", OP_SUB_ASSIGN}, {"*=", OP_MUL_ASSIGN},
+         {"/=", OP_DIV_ASSIGN}, {"%=", OP_MOD_ASSIGN}, {"||", OP_OR}, {"&&", OP_AND},
+         {"==", OP_EQ}, {"!=", OP_NE}, {"<", OP_LT}, {">", OP_GT}, {"<=", OP_LE},
+         {">=", OP_GE}, {"+", OP_ADD}, {"-", OP_SUB}, {"*", OP_MUL}, {"/", OP_DIV},
+         {"%", OP_MOD}, {"&", OP_BIT_AND}, {"|", OP_BIT_OR}, {"^", OP_BIT_XOR}, {"<<", OP_SHL},
+         {">>", OP_SHR}, {"!", OP_NOT}, {"++", OP_INC}, {"--", OP_DEC}
+     };
+ 
+     for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+     {
+         if (strcmp(text, operators[i].text) == 0)
+         {
+             return operators[i].op;
+         }
+     }
+ 
+     return OP_NONE;
+ }
+ 
  /*
   * Adds a token to the token list for the script.
   */
@@ -292,6 +1165,12 @@ Value make_date(Date d)
  
      list->tokens[list->count].type = type;
      list->tokens[list->count].text = _strdup(text);
+     list->tokens[list->count].match = -1;
+     list->tokens[list->count].op = type == TOKEN_OPERATOR ? operator_code(text) : OP_NONE;
+     list->tokens[list->count].quick = QUICK_NONE;
+     list->tokens[list->count].code = NULL;
+     list->tokens[list->count].table = NULL;
+     list->tokens[list->count].function = NULL;
      list->count++;
  }
  
@@ -327,7 +1206,8 @@ Value make_date(Date d)
          {
              const char *start = p;
              int hasDot = 0;
-             while (isdigit(*p) || (*p == '.' && !hasDot))
+             // The '.' of "0..n" starts a range, not a fraction.
+             while (isdigit(*p) || (*p == '.' && !hasDot && p[1] != '.'))
              {
                  if (*p == '.')
                      hasDot = 1;
@@ -408,17 +1288,45 @@ Value make_date(Date d)
              {
                  add_token(list, TOKEN_WHILE, id);
              }
-             else if (strcmp(id, "return") == 0)
+             else if (strcmp(id, "foreach") == 0)
              {
-                 add_token(list, TOKEN_RETURN, id);
+                 add_token(list, TOKEN_FOREACH, id);
              }
-             else if (strcmp(id, "continue") == 0)
+             else if (strcmp(id, "function") == 0)
              {
-                 add_token(list, TOKEN_CONTINUE, id);
+                 add_token(list, TOKEN_FUNCTION, id);
              }
-             else if (strcmp(id, "break") == 0)
+             else if (strcmp(id, "let") == 0)
              {
-                 add_token(list, TOKEN_BREAK, id);
+                 add_token(list, TOKEN_LET, id);
+             }
+             else if (strcmp(id, "import") == 0)
+             {
+                 add_token(list, TOKEN_IMPORT, id);
+             }
+             else if (strcmp(id, "return") == 0)
+             {
+                 add_token(list, TOKEN_RETURN, id);
+             }
+             else if (strcmp(id, "continue") == 0)
+             {
+                 add_token(list, TOKEN_CONTINUE, id);
+             }
+             else if (strcmp(id, "break") == 0)
+             {
+                 add_token(list, TOKEN_BREAK, id);
+             }
+             else if (strcmp(id, "switch") == 0)
+             {
+                 add_token(list, TOKEN_SWITCH, id);
+             }
+             else if (strcmp(id, "case") == 0)
+             {
+                 add_token(list, TOKEN_CASE, id);
+             }
+             else if (strcmp(id, "default") == 0)
+             {
+                 add_token(list, TOKEN_DEFAULT, id);
              }
              else if (strcmp(id, "true") == 0 || strcmp(id, "false") == 0)
              {
@@ -444,6 +1352,18 @@ Value make_date(Date d)
              continue;
          }
  
+         // Check for the shift operators "<<" and ">>"
+         if ((p[0] == '<' && p[1] == '<') || (p[0] == '>' && p[1] == '>'))
+         {
+             char op[3];
+             op[0] = p[0];
+             op[1] = p[1];
+             op[2] = '\0';
+             add_token(list, TOKEN_OPERATOR, op);
+             p += 2;
+             continue;
+         }
+ 
          // Check for two-character operators: "++" and "--"
          if ((p[0] == '+' && p[1] == '+') || (p[0] == '-' && p[1] == '-'))
          {
@@ -456,9 +1376,14 @@ Value make_date(Date d)
              continue;
          }
  
-         // Check for two-character operators: "==", "+=", "!=", ">=", "<="
+         // Check for two-character operators: "==", "!=", ">=", "<=" and the
+         // compound assignments "+=", "-=", "*=", "/=", "%="
          if ((p[0] == '=' && p[1] == '=') ||
              (p[0] == '+' && p[1] == '=') ||
+             (p[0] == '-' && p[1] == '=') ||
+             (p[0] == '*' && p[1] == '=') ||
+             (p[0] == '/' && p[1] == '=') ||
+             (p[0] == '%' && p[1] == '=') ||
              (p[0] == '!' && p[1] == '=') ||
              (p[0] == '>' && p[1] == '=') ||
              (p[0] == '<' && p[1] == '='))
@@ -480,6 +1405,10 @@ Value make_date(Date d)
              case '-':
              case '*':
              case '/':
+             case '%':
+             case '&':
+             case '|':
+             case '^':
              {
                  char op[2];
                  op[0] = *p;
@@ -521,6 +1450,19 @@ Value make_date(Date d)
                  add_token(list, TOKEN_COMMA, ",");
                  p++;
                  break;
+             case ':':
+                 add_token(list, TOKEN_COLON, ":");
+                 p++;
+                 break;
+             case '.':
+                 if (p[1] != '.')
+                 {
+                     raise_error("Tokenizer error: Unexpected character '%c'\n", *p);
+                     return;
+                 }
+                 add_token(list, TOKEN_RANGE, "..");
+                 p += 2;
+                 break;
              case '>':
              case '<':
              {
@@ -629,9 +1571,10 @@ Value make_date(Date d)
              Value val = get_variable(varName);
              free(varName);
              char temp[128];
+             char *list = NULL;
              const char *valStr;
              if (val.type == VAL_INT) {
-                 sprintf(temp, "%d", val.int_val);
+                 format_int(val.int_val, temp);
                  valStr = temp;
              }
              else if (val.type == VAL_BOOL) {
@@ -641,7 +1584,7 @@ Value make_date(Date d)
                  valStr = val.str_val;
              }
              else if (val.type == VAL_DOUBLE) {
-                 sprintf(temp, "%f", val.double_val);
+                 format_double(val.double_val, temp);
                  valStr = temp;
              }
              else if (val.type == VAL_DATE) {
@@ -649,6 +1592,10 @@ Value make_date(Date d)
                 sprintf(temp, "%02d/%02d/%04d", val.date_val.month, val.date_val.day, val.date_val.year);
                 valStr = temp;
             }             
+             else if (val.type == VAL_SET) {
+                 list = set_to_list(val.set_val);
+                 valStr = list;
+             }
              else {
                  valStr = "null";
              }
@@ -663,6 +1610,7 @@ Value make_date(Date d)
                  }
              }
              strcat(result, valStr);
+             free(list);
          }
          else {
           // Append regular character.
@@ -683,6 +1631,421 @@ Value make_date(Date d)
      return result;
  }
  
+ static Value *copy_items(const Value *items, int length);
+ 
+ /*
+  * Copies an item of an array, along with any container it is, so the copy
+  * can be freed separately.  Raises an error, leaving the item null, if
+  * memory runs out.
+  */
+ static Value copy_item(Value v)
+ {
+     Value copy = v;
+ 
+     if (v.type == VAL_STRING)
+     {
+         copy = make_string(v.str_val);
+     }
+     else if (v.type == VAL_ARRAY)
+     {
+         Array *arr = malloc(sizeof(Array));
+         Value *items = arr ? copy_items(v.array_val->items, v.array_val->length) : NULL;
+ 
+         if (items)
+         {
+             arr->items = items;
+             arr->length = v.array_val->length;
+             arr->shared = NULL;
+             copy.array_val = arr;
+         }
+         else
+         {
+             free(arr);
+             copy = make_null();
+         }
+     }
+     else if (v.type == VAL_SET)
+     {
+         copy.set_val = set_new(v.set_val->count);
+ 
+         for (int i = 0; copy.set_val && i < v.set_val->used; i++)
+         {
+             if (v.set_val->items[i])
+             {
+                 set_add(copy.set_val, v.set_val->items[i]);
+             }
+         }
+     }
+     else if (v.type == VAL_MAP)
+     {
+         copy.map_val = map_new(v.map_val->count);
+ 
+         for (int i = 0; copy.map_val && i < v.map_val->used; i++)
+         {
+             MapEntry *entry = &v.map_val->entries[i];
+             Value *slot = entry->key.type != VAL_NULL ? map_slot(copy.map_val, entry->key) : NULL;
+ 
+             if (slot)
+             {
+                 *slot = copy_item(entry->value);
+             }
+         }
+     }
+     else if (v.type == VAL_TYPED_ARRAY)
+     {
+         TypedArray *arr = v.typed_val;
+         copy.typed_val = typed_array_new(arr->kind, arr->length);
+ 
+         if (copy.typed_val)
+         {
+             memcpy(copy.typed_val->data, arr->data, arr->length * (arr->kind == TYPED_INT ? sizeof(int) : sizeof(double)));
+         }
+     }
+ 
+     if ((copy.type == VAL_SET && !copy.set_val) || (copy.type == VAL_MAP && !copy.map_val) ||
+         (copy.type == VAL_TYPED_ARRAY && !copy.typed_val) || (v.type == VAL_ARRAY && copy.type == VAL_NULL))
+     {
+         if (!return_flag)
+         {
+             raise_error("Runtime error: Memory allocation failed copying an array.\n");
+         }
+         copy = make_null();
+     }
+ 
+     copy.temp = 0;
+     return copy;
+ }
+ 
+ /*
+  * Copies the items of an array, or returns NULL if memory runs out.
+  */
+ static Value *copy_items(const Value *items, int length)
+ {
+     Value *copy = malloc(sizeof(Value) * (length > 0 ? length : 1));
+ 
+     for (int i = 0; copy && i < length; i++)
+     {
+         copy[i] = copy_item(items[i]);
+     }
+     return copy;
+ }
+ 
+ /*
+  * Makes sure an array owns its items before one is written.  An array that
+  * shares them with slices gets a copy of its own, down to the strings and
+  * containers in it, unless nothing else uses them any more.  Returns 0 after raising an error
+  * if the copy can't be allocated.
+  */
+ int array_own(Array *arr)
+ {
+     ArrayStorage *storage = arr->shared;
+ 
+     if (!storage)
+     {
+         return 1;
+     }
+     if (storage->refs == 1 && arr->items == storage->items && arr->length == storage->length)
+     {
+         free(storage);
+         arr->shared = NULL;
+         return 1;
+     }
+ 
+     // The storage frees its items with the last array using them, so
+     // nothing in the copy can point into it.
+     Value *items = copy_items(arr->items, arr->length);
+     if (!items || return_flag)
+     {
+         for (int i = 0; items && i < arr->length; i++)
+         {
+             free_value(items[i]);
+         }
+         free(items);
+         if (!return_flag)
+         {
+             raise_error("Runtime error: Memory allocation failed copying an array.\n");
+         }
+         return 0;
+     }
+ 
+     arr->items = items;
+     arr->shared = NULL;
+     release_storage(storage);
+     return 1;
+ }
+ 
+ /*
+  * Makes a slice of length items of an array from start, which the caller has
+  * checked are in range.  The slice points into the array's items rather
+  * than copying them, and they're only copied when one side is written.
+  */
+ Value array_slice(Value v, int start, int length)
+ {
+     Array *parent = v.array_val;
+     Array *slice = malloc(sizeof(Array));
+ 
+     if (slice && !parent->shared)
+     {
+         parent->shared = malloc(sizeof(ArrayStorage));
+ 
+         if (parent->shared)
+         {
+             parent->shared->items = parent->items;
+             parent->shared->length = parent->length;
+             parent->shared->refs = 1;
+         }
+     }
+     if (!slice || !parent->shared)
+     {
+         free(slice);
+         raise_error("Runtime error: Memory allocation failed creating an array.\n");
+         return return_value;
+     }
+ 
+     parent->shared->refs++;
+     slice->items = parent->items + start;
+     slice->length = length;
+     slice->shared = parent->shared;
+ 
+     Value ret;
+     ret.type = VAL_ARRAY;
+     ret.array_val = slice;
+     ret.temp = 1;
+     return ret;
+ }
+ 
+ /*
+  * Returns where the element of an array value at the given index is stored,
+  * or NULL after raising an error.  Reading an element goes through here too,
+  * so it's left to array_slot to take the array's items over from its slices.
+  */
+ static Value *array_item(Value v, Value index)
+ {
+     if (v.type != VAL_ARRAY)
+     {
+         raise_error("Runtime error: Attempting to index a value that isn't an array or a map.");
+         return NULL;
+     }
+     if (index.type != VAL_INT)
+     {
+         raise_error("Runtime error: Array index must be an integer.");
+         return NULL;
+     }
+     int idx = index.int_val;
+     Array *arr = v.array_val;
+     if (idx < 0 || idx >= arr->length)
+     {
+         raise_error("Runtime error: Array index out of bounds.");
+         return NULL;
+     }
+     return &arr->items[idx];
+ }
+ 
+ /*
+  * Returns where the element of an array value at the given index is stored,
+  * or NULL after raising an error.  It's for assigning the element, so a map
+  * gets the key added if it's missing, and an array shared with slices is
+  * copied first.
+  */
+ Value *array_slot(Value v, Value index)
+ {
+     if (v.type == VAL_MAP)
+     {
+         return map_slot(v.map_val, index);
+     }
+ 
+     Value *slot = array_item(v, index);
+ 
+     if (slot && v.array_val->shared)
+     {
+         int idx = (int)(slot - v.array_val->items);
+         slot = array_own(v.array_val) ? &v.array_val->items[idx] : NULL;
+     }
+     return slot;
+ }
+ 
+ /*
+  * Returns the element of an array value at the given index.  The array keeps
+  * owning it, so it's never handed out as a temporary.
+  */
+ Value array_index(Value v, Value index)
+ {
+     Value *slot;
+ 
+     if (v.type == VAL_TYPED_ARRAY)
+     {
+         return typed_array_index(v.typed_val, index);
+     }
+ 
+     if (v.type == VAL_MAP)
+     {
+         slot = map_get(v.map_val, index);
+ 
+         if (!slot)
+         {
+             char number[16];
+             if (index.type == VAL_INT)
+             {
+                 format_int(index.int_val, number);
+             }
+             raise_error("Runtime error: The map has no key \"%s\".\n", index.type == VAL_STRING ? index.str_val :
+                         index.type == VAL_INT ? number : "?");
+             return return_value;
+         }
+     }
+     else
+     {
+         slot = array_item(v, index);
+ 
+         if (!slot)
+         {
+             return return_value;
+         }
+     }
+ 
+     Value item = *slot;
+     item.temp = 0;
+     return item;
+ }
+ 
+ /*
+  * Applies container[index] op= right, the last step of an element
+  * assignment, and returns the stored value.  A typed array stores the number
+  * itself rather than a Value, so it has no slot to update.
+  */
+ Value assign_element(Value container, Value index, OperatorCode op, Value right)
+ {
+     if (container.type == VAL_TYPED_ARRAY)
+     {
+         return typed_array_update(container.typed_val, index, op, right);
+     }
+ 
+     Value *slot = array_slot(container, index);
+ 
+     if (!slot)
+     {
+         if (right.type == VAL_STRING && right.temp)
+         {
+             free_value(right);
+         }
+         return return_value;
+     }
+     return update_slot(slot, op, right);
+ }
+ 
+ /*
+  * Adds an entry of a map literal.  The map takes the key and value the way
+  * m[key] = value would, freeing a temporary key.
+  */
+ void map_entry(Value map, Value key, Value value)
+ {
+     Value *slot = map_slot(map.map_val, key);
+ 
+     if (slot)
+     {
+         update_slot(slot, OP_ASSIGN, value);
+     }
+     else if (value.temp)
+     {
+         free_value(value);
+     }
+ 
+     if (key.temp)
+     {
+         free_value(key);
+     }
+ }
+ 
+ /*
+  * The array a foreach loop walks: the array itself, or the keys of a map,
+  * taken before the body can change it.  A temporary map is freed.  Raises
+  * an error if the value is neither.
+  */
+ Value foreach_list(Value list)
+ {
+     if (list.type == VAL_MAP)
+     {
+         Value keys = map_keys(list.map_val);
+ 
+         if (list.temp)
+         {
+             free_value(list);
+         }
+         return keys;
+     }
+ 
+     if (list.type == VAL_TYPED_ARRAY)
+     {
+         Value items = typed_array_values(list.typed_val);
+ 
+         if (list.temp)
+         {
+             free_value(list);
+         }
+         return items;
+     }
+ 
+     if (list.type != VAL_ARRAY)
+     {
+         raise_error("Runtime error: foreach expects an array or a map.\n");
+     }
+     return list;
+ }
+ 
+ /*
+  * Parses a map literal: { key: value, ... }.
+  */
+ static Value parse_map_literal(Parser *p)
+ {
+     Value map = fold_mode ? make_null() : make_map(map_new(4));
+     advance(p); // consume '{'
+ 
+     while (!return_flag && current(p)->type != TOKEN_RBRACE)
+     {
+         Value key = parse_assignment(p);
+         expect(p, TOKEN_COLON, "Expected ':' after map key");
+         Value value = return_flag ? make_null() : parse_assignment(p);
+ 
+         if (return_flag || fold_mode)
+         {
+             // Whatever was parsed is dropped.
+             if (key.temp)
+             {
+                 free_value(key);
+             }
+             if (value.temp)
+             {
+                 free_value(value);
+             }
+         }
+         else
+         {
+             map_entry(map, key, value);
+         }
+ 
+         if (current(p)->type != TOKEN_COMMA)
+         {
+             break;
+         }
+         advance(p); // consume ','
+     }
+ 
+     expect(p, TOKEN_RBRACE, "Expected '}' after map entries");
+ 
+     // A map is never a constant, and while folding it isn't built.
+     if (fold_mode)
+     {
+         fold_failed = 1;
+         return make_int(0);
+     }
+     if (return_flag)
+     {
+         free_value(map);
+         return return_value;
+     }
+     return map;
+ }
+ 
  /*
   * Parse a primary expression.
   */
@@ -691,7 +2054,7 @@ Value make_date(Date d)
      Token *tok = current(p);
  
      // Handle unary minus for negative numbers.
-     if (tok->type == TOKEN_OPERATOR && strcmp(tok->text, "-") == 0)
+     if (tok->op == OP_SUB)
      {
          advance(p); // consume '-'
          Value v = parse_primary(p);
@@ -729,6 +2092,12 @@ Value make_date(Date d)
          if (strstr(tok->text, "${") != NULL)
          {
              processed = evaluate_template(tok->text);
+ 
+             if (!processed)
+             {
+                 advance(p);
+                 return return_value;
+             }
          }
          else
          {
@@ -740,6 +2109,12 @@ Value make_date(Date d)
          return v;
      }
  
+     // Handle map literals.
+     if (tok->type == TOKEN_LBRACE)
+     {
+         return parse_map_literal(p);
+     }
+ 
      // Handle boolean literals.
      if (tok->type == TOKEN_BOOL)
      {
@@ -758,12 +2133,17 @@ Value make_date(Date d)
          {
              // Function call.
              advance(p); // consume '('
-             Value args[16];
+             Value args[MAX_ARGUMENTS];
              int arg_count = 0;
              if (current(p)->type != TOKEN_RPAREN)
              {
                  while (1)
                  {
+                     if (arg_count == MAX_ARGUMENTS)
+                     {
+                         raise_error("Parser error: Too many arguments to %s\n", id);
+                         break;
+                     }
                      args[arg_count] = parse_assignment(p);
                      arg_count++;
                      if (current(p)->type == TOKEN_COMMA)
@@ -777,7 +2157,8 @@ Value make_date(Date d)
                  }
              }
              expect(p, TOKEN_RPAREN, "Expected ')' after function arguments");
-             Value ret = call_function(id, args, arg_count);
+             Value ret = tok->function ? invoke_function(tok->function, args, arg_count)
+                                       : call_function(id, args, arg_count);
              for (int i = 0; i < arg_count; i++)
              {
                  if (args[i].type == VAL_STRING && args[i].temp)
@@ -790,22 +2171,19 @@ Value make_date(Date d)
          }
  
          // Handle postfix increment/decrement operators.
-         if (current(p)->type == TOKEN_OPERATOR &&
-             (strcmp(current(p)->text, "++") == 0 ||
-              strcmp(current(p)->text, "--") == 0))
+         if (current(p)->op == OP_INC || current(p)->op == OP_DEC)
          {
-             char op[3];
-             strcpy(op, current(p)->text);
+             Token *op = current(p);
              advance(p);
              Value orig = get_variable(id);
              if (orig.type != VAL_INT)
              {
-                 raise_error("Runtime error: %s operator only valid for ints.\n", op);
+                 raise_error("Runtime error: %s operator only valid for ints.\n", op->text);
                  free(id);
                  return return_value;
              }
              int oldVal = orig.int_val;
-             if (strcmp(op, "++") == 0)
+             if (op->op == OP_INC)
              {
                  orig.int_val++;
              }
@@ -834,24 +2212,11 @@ Value make_date(Date d)
                  return return_value;
              }
              advance(p);  // consume ']'
-             if (v.type != VAL_ARRAY)
-             {
-                 raise_error("Runtime error: Attempting to index a non-array value.");
-                 return return_value;
-             }
-             if (index.type != VAL_INT)
-             {
-                 raise_error("Runtime error: Array index must be an integer.");
-                 return return_value;
-             }
-             int idx = index.int_val;
-             Array *arr = v.array_val;
-             if (idx < 0 || idx >= arr->length)
+             v = array_index(v, index);
+             if (return_flag)
              {
-                 raise_error("Runtime error: Array index out of bounds.");
                  return return_value;
              }
-             v = arr->items[idx];
          }
          // --- End Array Indexing Support ---
  
@@ -877,7 +2242,7 @@ Value make_date(Date d)
  Value parse_unary(Parser *p)
  {
      // Handle the '!' operator for logical negation
-     if (current(p)->type == TOKEN_OPERATOR && strcmp(current(p)->text, "!") == 0)
+     if (current(p)->op == OP_NOT)
      {
          advance(p); // consume '!'
          Value operand = parse_unary(p);
@@ -890,17 +2255,15 @@ Value make_date(Date d)
          return make_bool(result);
      }
  
-     if (current(p)->type == TOKEN_OPERATOR &&
-         (strcmp(current(p)->text, "++") == 0 || strcmp(current(p)->text, "--") == 0))
+     if (current(p)->op == OP_INC || current(p)->op == OP_DEC)
      {
-         char op[3];
-         strcpy(op, current(p)->text);
+         Token *op = current(p);
          advance(p);
          
          // The next token must be an identifier
          if (current(p)->type != TOKEN_IDENTIFIER)
          {
-             raise_error("Parser error: Expected identifier after unary %s\n", op);
+             raise_error("Parser error: Expected identifier after unary %s\n", op->text);
              return return_value;
          }
 
@@ -910,13 +2273,13 @@ Value make_date(Date d)
 
          if (v.type != VAL_INT)
          {
-             raise_error("Runtime error: %s operator only valid for ints.\n", op);
+             raise_error("Runtime error: %s operator only valid for ints.\n", op->text);
              free(id);
              return return_value;
          }
 
          // For prefix, update before returning.
-         if (strcmp(op, "++") == 0)
+         if (op->op == OP_INC)
          {
              v.int_val++;
          }
@@ -937,12 +2300,22 @@ Value make_date(Date d)
   */
  Value parse_logical_and(Parser *p)
  {
-     Value left = parse_equality(p);
+     Value left = parse_bit_or(p);
  
-     while (current(p)->type == TOKEN_OPERATOR && strcmp(current(p)->text, "&&") == 0)
+     while (current(p)->op == OP_AND)
      {
+         int skip = current(p)->match;
          advance(p); // consume "&&"
-         Value right = parse_equality(p);
+ 
+         // A false left side decides the result, jump over the right operand.
+         if (left.int_val == 0 && skip >= 0)
+         {
+             p->pos = skip;
+             left = make_bool(0);
+             continue;
+         }
+ 
+         Value right = parse_bit_or(p);
          int result = ((left.int_val != 0) && (right.int_val != 0));
          left = make_bool(result);
      }
@@ -956,9 +2329,19 @@ Value make_date(Date d)
  Value parse_logical(Parser *p)
  {
      Value left = parse_logical_and(p);
-     while (current(p)->type == TOKEN_OPERATOR && strcmp(current(p)->text, "||") == 0)
+     while (current(p)->op == OP_OR)
      {
+         int skip = current(p)->match;
          advance(p); // consume "||"
+ 
+         // A true left side decides the result, jump over the right operand.
+         if (left.int_val != 0 && skip >= 0)
+         {
+             p->pos = skip;
+             left = make_bool(1);
+             continue;
+         }
+ 
          Value right = parse_logical_and(p);
          int result = ((left.int_val != 0) || (right.int_val != 0));
          left = make_bool(result);
@@ -984,211 +2367,242 @@ Value make_date(Date d)
 }
 
  /*
-  * Parse relational: Calls into parse_term and handles relational operators.
+  * Records the operand types a binary operator has seen.  The first execution
+  * specializes the operator for that pair of types; any other pair seen later
+  * deoptimizes it back to the generic path for good.
   */
- Value parse_relational(Parser *p)
+ static void quicken(Token *op, ValueType left, ValueType right)
  {
-     Value left = parse_term(p);
-     while (current(p)->type == TOKEN_OPERATOR &&
-            (strcmp(current(p)->text, ">") == 0 ||
-             strcmp(current(p)->text, "<") == 0 ||
-             strcmp(current(p)->text, ">=") == 0 ||
-             strcmp(current(p)->text, "<=") == 0))
-     {
-         char op[3];
-         strcpy(op, current(p)->text);
-         advance(p);
-         Value right = parse_term(p);
+     QuickType seen = QUICK_GENERIC;
  
-         int result = 0;
-         if (left.type == VAL_INT && right.type == VAL_INT)
-         {
-             if (strcmp(op, ">") == 0)
-                 result = (left.int_val > right.int_val);
-             else if (strcmp(op, "<") == 0)
-                 result = (left.int_val < right.int_val);
-             else if (strcmp(op, ">=") == 0)
-                 result = (left.int_val >= right.int_val);
-             else if (strcmp(op, "<=") == 0)
-                 result = (left.int_val <= right.int_val);
-         }
-         else if (left.type == VAL_DOUBLE && right.type == VAL_DOUBLE)         
-         {
-            if (strcmp(op, ">") == 0)
-                result = (left.double_val > right.double_val);
-            else if (strcmp(op, "<") == 0)
-                result = (left.double_val < right.double_val);
-            else if (strcmp(op, ">=") == 0)
-                result = (left.double_val >= right.double_val);
-            else if (strcmp(op, "<=") == 0)
-                result = (left.double_val <= right.double_val);
-         }
-         else if (left.type == VAL_DATE && right.type == VAL_DATE)
-         {
-             int cmp = compare_dates(left, right);
-             if (strcmp(op, ">") == 0)
-                 result = (cmp > 0);
-             else if (strcmp(op, "<") == 0)
-                 result = (cmp < 0);
-             else if (strcmp(op, ">=") == 0)
-                 result = (cmp >= 0);
-             else if (strcmp(op, "<=") == 0)
-                 result = (cmp <= 0);
-         }
-         else
-         {
-             raise_error("Runtime error: Relational operators only support ints or dates.\n");
-             return return_value;
-         }
+     // Constant folding runs on placeholder values, don't learn from it.
+     if (fold_mode)
+     {
+         return;
+     }
  
-         left = make_int(result);
-         if (right.type == VAL_STRING && right.temp)
-         {
-             free_value(right);
-         }
+     if (left == right)
+     {
+         if (left == VAL_INT)
+             seen = QUICK_INT;
+         else if (left == VAL_DOUBLE)
+             seen = QUICK_DOUBLE;
+         else if (left == VAL_STRING)
+             seen = QUICK_STRING;
      }
-     return left;
+ 
+     op->quick = (op->quick == QUICK_NONE || op->quick == seen) ? seen : QUICK_GENERIC;
  }
  
  /*
-  * Parse a factor (a term that can be multiplied or divided).
+  * Relational operators (>, <, >=, <=) on ints, doubles or dates.
   */
- Value parse_factor(Parser *p)
+ static Value relational_operation(OperatorCode op, Value left, Value right)
  {
-     Value left = parse_unary(p);
-     while (current(p)->type == TOKEN_OPERATOR &&
-         (strcmp(current(p)->text, "*") == 0 || strcmp(current(p)->text, "/") == 0))
+     int result = 0;
+     if (left.type == VAL_INT && right.type == VAL_INT)
      {
-         char op[3];
-         strcpy(op, current(p)->text);
-         advance(p);
-         Value right = parse_primary(p);
-         if (strcmp(op, "*") == 0)
+         if (op == OP_GT)
+             result = (left.int_val > right.int_val);
+         else if (op == OP_LT)
+             result = (left.int_val < right.int_val);
+         else if (op == OP_GE)
+             result = (left.int_val >= right.int_val);
+         else if (op == OP_LE)
+             result = (left.int_val <= right.int_val);
+     }
+     else if (left.type == VAL_DOUBLE && right.type == VAL_DOUBLE)
+     {
+        if (op == OP_GT)
+            result = (left.double_val > right.double_val);
+        else if (op == OP_LT)
+            result = (left.double_val < right.double_val);
+        else if (op == OP_GE)
+            result = (left.double_val >= right.double_val);
+        else if (op == OP_LE)
+            result = (left.double_val <= right.double_val);
+     }
+     else if (left.type == VAL_DATE && right.type == VAL_DATE)
+     {
+         int cmp = compare_dates(left, right);
+         if (op == OP_GT)
+             result = (cmp > 0);
+         else if (op == OP_LT)
+             result = (cmp < 0);
+         else if (op == OP_GE)
+             result = (cmp >= 0);
+         else if (op == OP_LE)
+             result = (cmp <= 0);
+     }
+     else
+     {
+         raise_error("Runtime error: Relational operators only support ints or dates.\n");
+         return return_value;
+     }
+ 
+     if (right.type == VAL_STRING && right.temp)
+     {
+         free_value(right);
+     }
+     return make_int(result);
+ }
+ 
+ /*
+  * Multiplication, division and remainder.
+  */
+ static Value factor_operation(OperatorCode op, Value left, Value right)
+ {
+     if (op == OP_MOD)
+     {
+         double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
+         if (r == 0.0)
          {
-             if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
-             {
-                 double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
-                 double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
-                 left = make_double(l * r);
-             }
-             else
-             {
-                 left = make_int(left.int_val * right.int_val);
-             }
+             raise_error("Runtime error: Division by zero.\n");
+             return return_value;
          }
-         else if (strcmp(op, "/") == 0)
+         if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
+         {
+             double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
+             return make_double(fmod(l, r));
+         }
+ 
+         return make_int(left.int_val % right.int_val);
+     }
+ 
+     if (op == OP_MUL)
+     {
+         if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
          {
+             double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
              double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
-             if (r == 0.0)
-             {
-                 raise_error("Runtime error: Division by zero.\n");
-                 return return_value;
-             }
-             if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
-             {
-                 double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
-                 left = make_double(l / r);
-             }
-             else
-             {
-                 left = make_int(left.int_val / (int)r);
-             }
+             return make_double(l * r);
          }
-         /* (Integers do not need freeing.) */
+ 
+         return make_int(left.int_val * right.int_val);
      }
-     return left;
+ 
+     double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
+     if (r == 0.0)
+     {
+         raise_error("Runtime error: Division by zero.\n");
+         return return_value;
+     }
+     if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
+     {
+         double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
+         return make_double(l / r);
+     }
+ 
+     /* (Integers do not need freeing.) */
+     return make_int(left.int_val / (int)r);
  }
  
  /*
-  * Terms (handle +, -; note: '+' is also used for string concatenation)
+  * Bitwise and shift operators, on ints only.  Shift counts use their low five
+  * bits, as the hardware does.
   */
- Value parse_term(Parser *p)
+ static Value bitwise_operation(OperatorCode op, Value left, Value right)
  {
-     Value left = parse_factor(p);
-     while (current(p)->type == TOKEN_OPERATOR &&
-         (strcmp(current(p)->text, "+") == 0 || strcmp(current(p)->text, "-") == 0))
+     if (left.type != VAL_INT || right.type != VAL_INT)
      {
-         char op[3];
-         strcpy(op, current(p)->text);
-         advance(p);
-         Value right = parse_factor(p);
-         if (strcmp(op, "+") == 0)
+         raise_error("Runtime error: Bitwise operators only support ints.\n");
+         return return_value;
+     }
+ 
+     int l = left.int_val;
+     int r = right.int_val;
+ 
+     switch (op)
+     {
+         case OP_BIT_AND: return make_int(l & r);
+         case OP_BIT_OR:  return make_int(l | r);
+         case OP_BIT_XOR: return make_int(l ^ r);
+         case OP_SHL:     return make_int((int)((unsigned int)l << (r & 31)));
+         default:         return make_int(l >> (r & 31));
+     }
+ }
+ 
+ /*
+  * Addition and subtraction; '+' is also used for string concatenation.
+  */
+ static Value term_operation(OperatorCode op, Value left, Value right)
+ {
+     if (op == OP_ADD)
+     {
+         if (left.type == VAL_STRING || right.type == VAL_STRING)
          {
-             if (left.type == VAL_STRING || right.type == VAL_STRING)
+             char *s1, *s2;
+             char buffer1[64], buffer2[64];
+ 
+             if (left.type == VAL_STRING)
              {
-                 char *s1, *s2;
-                 char buffer1[64], buffer2[64];
-
-                 if (left.type == VAL_STRING)
-                 {
-                     s1 = left.str_val;
-                 }
-                 else if (left.type == VAL_INT)
-                 {
-                     sprintf(buffer1, "%d", left.int_val);
-                     s1 = buffer1;
-                 }
-                 else if (left.type == VAL_DOUBLE)
-                 {
-                     sprintf(buffer1, "%f", left.double_val);
-                     s1 = buffer1;
-                 }
-                 // Process right value
-                 if (right.type == VAL_STRING)
-                 {
-                     s2 = right.str_val;
-                 }
-                 else if (right.type == VAL_INT)
-                 {
-                     sprintf(buffer2, "%d", right.int_val);
-                     s2 = buffer2;
-                 }
-                 else if (right.type == VAL_DOUBLE)
-                 {
-                     sprintf(buffer2, "%f", right.double_val);
-                     s2 = buffer2;
-                 }
-                 
-                 char *concat = malloc(strlen(s1) + strlen(s2) + 1);
-                 strcpy(concat, s1);
-                 strcat(concat, s2);
-                 Value temp = make_string(concat);
-                 free(concat);
-                 if (left.type == VAL_STRING && left.temp)
-                 {
-                     free_value(left);
-                 }
-                 left = temp;
+                 s1 = left.str_val;
              }
-             else if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
+             else if (left.type == VAL_INT)
              {
-                 double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
-                 double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
-                 left = make_double(l + r);
+                 format_int(left.int_val, buffer1);
+                 s1 = buffer1;
              }
-             else
+             else if (left.type == VAL_DOUBLE)
              {
-                 left = make_int(left.int_val + right.int_val);
+                 format_double(left.double_val, buffer1);
+                 s1 = buffer1;
              }
-         }
-         else if (strcmp(op, "-") == 0)
-         {
-             if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
+             // Process right value
+             if (right.type == VAL_STRING)
              {
-                 double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
-                 double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
-                 left = make_double(l - r);
+                 s2 = right.str_val;
              }
-             else
+             else if (right.type == VAL_INT)
              {
-                 left = make_int(left.int_val - right.int_val);
+                 format_int(right.int_val, buffer2);
+                 s2 = buffer2;
+             }
+             else if (right.type == VAL_DOUBLE)
+             {
+                 format_double(right.double_val, buffer2);
+                 s2 = buffer2;
              }
-         }
  
-         if (right.type == VAL_STRING && right.temp)
+             char *concat = malloc(strlen(s1) + strlen(s2) + 1);
+             strcpy(concat, s1);
+             strcat(concat, s2);
+             Value temp = make_string(concat);
+             free(concat);
+             if (left.type == VAL_STRING && left.temp)
+             {
+                 free_value(left);
+             }
+             left = temp;
+         }
+         else if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
          {
-             free_value(right);
+             double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
+             double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
+             left = make_double(l + r);
+         }
+         else
+         {
+             left = make_int(left.int_val + right.int_val);
+         }
+     }
+     else
+     {
+         if (left.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
+         {
+             double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
+             double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
+             left = make_double(l - r);
          }
+         else
+         {
+             left = make_int(left.int_val - right.int_val);
+         }
+     }
+ 
+     if (right.type == VAL_STRING && right.temp)
+     {
+         free_value(right);
      }
      return left;
  }
@@ -1202,17 +2616,17 @@ Value make_date(Date d)
      {
          return 0;
      }
-
+ 
      if (a.type == VAL_INT)
      {
          return a.int_val == b.int_val;
      }
-
+ 
      if (a.type == VAL_STRING)
      {
          return strcmp(a.str_val, b.str_val) == 0;
      }
-
+ 
      if (a.type == VAL_DOUBLE && b.type == VAL_DOUBLE)
      {
          return fabs(a.double_val - b.double_val) < 1e-9;
@@ -1222,559 +2636,3489 @@ Value make_date(Date d)
      {
          return a.int_val == b.int_val;
      }
-  
+ 
      if (a.type == VAL_DATE)
      {
          return a.date_val.day == b.date_val.day &&
                 a.date_val.month == b.date_val.month &&
                 a.date_val.year == b.date_val.year;
      }
-
+ 
      return 0;
  }
  
  /*
-  * Parse equality (handles == and !=)
+  * Applies a binary arithmetic, relational or equality operator.  The
+  * expression parser and the loop VM both go through here, so they follow the
+  * same rules and train the same per-operator type specialization.
   */
- Value parse_equality(Parser *p)
+ Value binary_operation(Token *op, Value left, Value right)
  {
-     Value left = parse_relational(p);
- 
-     while (current(p)->type == TOKEN_OPERATOR &&
-         (strcmp(current(p)->text, "==") == 0 || strcmp(current(p)->text, "!=") == 0))
+     // Specialized paths, guarded by the operand types.
+     if (op->quick == QUICK_INT && left.type == VAL_INT && right.type == VAL_INT)
      {
-         int isNotEqual = 0;
-         if (strcmp(current(p)->text, "!=") == 0)
+         int l = left.int_val;
+         int r = right.int_val;
+ 
+         switch (op->op)
          {
-             isNotEqual = 1;
+             case OP_ADD: return make_int(l + r);
+             case OP_SUB: return make_int(l - r);
+             case OP_MUL: return make_int(l * r);
+             case OP_DIV: if (r != 0) return make_int(l / r); break;
+             case OP_MOD: if (r != 0) return make_int(l % r); break;
+             case OP_BIT_AND: return make_int(l & r);
+             case OP_BIT_OR:  return make_int(l | r);
+             case OP_BIT_XOR: return make_int(l ^ r);
+             case OP_SHL: return make_int((int)((unsigned int)l << (r & 31)));
+             case OP_SHR: return make_int(l >> (r & 31));
+             case OP_LT:  return make_int(l < r);
+             case OP_GT:  return make_int(l > r);
+             case OP_LE:  return make_int(l <= r);
+             case OP_GE:  return make_int(l >= r);
+             case OP_EQ:  return make_int(l == r);
+             case OP_NE:  return make_int(l != r);
+             default:     break;
          }
+     }
+     else if (op->quick == QUICK_DOUBLE && left.type == VAL_DOUBLE && right.type == VAL_DOUBLE)
+     {
+         double l = left.double_val;
+         double r = right.double_val;
  
-         advance(p); // skip '==' or '!='
-         Value right = parse_relational(p);
-         int eq = values_equal(left, right);
- 
-         if (isNotEqual)
+         switch (op->op)
          {
-             eq = !eq;
+             case OP_ADD: return make_double(l + r);
+             case OP_SUB: return make_double(l - r);
+             case OP_MUL: return make_double(l * r);
+             case OP_DIV: if (r != 0.0) return make_double(l / r); break;
+             case OP_MOD: if (r != 0.0) return make_double(fmod(l, r)); break;
+             case OP_LT:  return make_int(l < r);
+             case OP_GT:  return make_int(l > r);
+             case OP_LE:  return make_int(l <= r);
+             case OP_GE:  return make_int(l >= r);
+             default:     break;
          }
- 
-         left = make_int(eq);
- 
-         if (right.type == VAL_STRING && right.temp)
+     }
+     else if (op->quick == QUICK_STRING && left.type == VAL_STRING && right.type == VAL_STRING &&
+              (op->op == OP_EQ || op->op == OP_NE))
+     {
+         int eq = strcmp(left.str_val, right.str_val) == 0;
+         if (right.temp)
          {
              free_value(right);
          }
+         return make_int(op->op == OP_EQ ? eq : !eq);
      }
  
-     return left;
+     quicken(op, left.type, right.type);
+ 
+     switch (op->op)
+     {
+         case OP_ADD:
+         case OP_SUB:
+             return term_operation(op->op, left, right);
+         case OP_MUL:
+         case OP_DIV:
+         case OP_MOD:
+             return factor_operation(op->op, left, right);
+         case OP_BIT_AND:
+         case OP_BIT_OR:
+         case OP_BIT_XOR:
+         case OP_SHL:
+         case OP_SHR:
+             return bitwise_operation(op->op, left, right);
+         case OP_LT:
+         case OP_GT:
+         case OP_LE:
+         case OP_GE:
+             return relational_operation(op->op, left, right);
+         default:
+         {
+             int eq = values_equal(left, right);
+             if (right.type == VAL_STRING && right.temp)
+             {
+                 free_value(right);
+             }
+             return make_int(op->op == OP_NE ? !eq : eq);
+         }
+     }
  }
  
  /*
-  * Parse an assignment expression.  (handles x = expr; and x += expr;)
+  * Parse relational: Calls into parse_term and handles relational operators.
   */
- Value parse_assignment(Parser *p)
+ Value parse_relational(Parser *p)
  {
-     if (current(p)->type == TOKEN_IDENTIFIER && peek(p) &&
-         peek(p)->type == TOKEN_OPERATOR &&
-         (strcmp(peek(p)->text, "=") == 0 || strcmp(peek(p)->text, "+=") == 0))
+     Value left = parse_shift(p);
+     while (current(p)->op == OP_GT || current(p)->op == OP_LT ||
+            current(p)->op == OP_GE || current(p)->op == OP_LE)
      {
-         char *varName = _strdup(current(p)->text);
-         advance(p); // consume identifier
-         char *assign_op = _strdup(current(p)->text);
-         advance(p); // consume '=' or '+='
-         Value right = parse_assignment(p);
- 
-         if (strcmp(assign_op, "=") == 0)
-         {
-             set_variable(varName, right);
-             right.temp = 0; /* <--- FIX: mark returned value as non-temporary */
-         }
-         else if (strcmp(assign_op, "+=") == 0)
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_shift(p);
+         left = binary_operation(op, left, right);
+         if (left.type == VAL_ERROR)
          {
-             Value currentVal = get_variable(varName);
-             Value newVal;
- 
-             if (currentVal.type == VAL_STRING || right.type == VAL_STRING)
-             {
-                 char buffer1[64], buffer2[64];
-                 char *s1, *s2;
- 
-                 if (currentVal.type == VAL_STRING)
-                 {
-                     s1 = currentVal.str_val;
-                 }
-                 else
-                 {
-                     sprintf(buffer1, "%d", currentVal.int_val);
-                     s1 = buffer1;
-                 }
- 
-                 if (right.type == VAL_STRING)
-                 {
-                     s2 = right.str_val;
-                 }
-                 else
-                 {
-                     sprintf(buffer2, "%d", right.int_val);
-                     s2 = buffer2;
-                 }
- 
-                 char *concat = malloc(strlen(s1) + strlen(s2) + 1);
-                 strcpy(concat, s1);
-                 strcat(concat, s2);
-                 newVal = make_string(concat);
-                 free(concat);
-                 // Free the temporary right value if needed.
-                 if (right.type == VAL_STRING && right.temp)
-                 {
-                     free_value(right);
-                 }
-             }
-             else if (currentVal.type == VAL_DOUBLE || right.type == VAL_DOUBLE)
-             {
-                 double l = (currentVal.type == VAL_DOUBLE) ? currentVal.double_val : currentVal.int_val;
-                 double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
-                 newVal = make_double(l + r);
-             }
-             else
-             {
-                 newVal = make_int(currentVal.int_val + right.int_val);
-             }
- 
-             set_variable(varName, newVal);
-             right = newVal;
-             right.temp = 0; /* mark returned value as non-temporary */
+             return left;
          }
- 
-         free(varName);
-         free(assign_op);
-         return right;
      }
-     return parse_logical(p);
+     return left;
  }
  
- /* ============================================================
-      Statements
-    ============================================================ */
- 
-  /*
-   * Parses a block of statements.
-   */
- void parse_block(Parser *p)
+ /*
+  * Parse shifts (<< and >>), between relational operators and terms as in C.
+  */
+ Value parse_shift(Parser *p)
  {
-     expect(p, TOKEN_LBRACE, "Expected '{' to start block");
- 
-     while (current(p)->type != TOKEN_RBRACE && current(p)->type != TOKEN_EOF && !return_flag)
+     Value left = parse_term(p);
+     while (current(p)->op == OP_SHL || current(p)->op == OP_SHR)
      {
-         parse_statement(p);
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_term(p);
+         left = binary_operation(op, left, right);
      }
- 
-     expect(p, TOKEN_RBRACE, "Expected '}' to end block");
+     return left;
  }
  
  /*
-  * Parses a statement.
+  * Parse a factor (a term that can be multiplied or divided).
   */
- void parse_statement(Parser *p)
+ Value parse_factor(Parser *p)
  {
-     Token *tok = current(p);
- 
-     if (tok->type == TOKEN_RETURN)
+     Value left = parse_unary(p);
+     while (current(p)->op == OP_MUL || current(p)->op == OP_DIV || current(p)->op == OP_MOD)
      {
-         advance(p); // consume 'return'
-         Value v = parse_assignment(p);
-         expect(p, TOKEN_SEMICOLON, "Expected ';' after return statement");
-         return_flag = 1;
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_primary(p);
+         left = binary_operation(op, left, right);
+         if (left.type == VAL_ERROR)
+         {
+             return left;
+         }
+     }
+     return left;
+ }
+ 
+ /*
+  * Terms (handle +, -; note: '+' is also used for string concatenation)
+  */
+ Value parse_term(Parser *p)
+ {
+     Value left = parse_factor(p);
+     while (current(p)->op == OP_ADD || current(p)->op == OP_SUB)
+     {
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_factor(p);
+         left = binary_operation(op, left, right);
+     }
+     return left;
+ }
+ 
+ /*
+  * Parse equality (handles == and !=)
+  */
+ Value parse_equality(Parser *p)
+ {
+     Value left = parse_relational(p);
+ 
+     while (current(p)->op == OP_EQ || current(p)->op == OP_NE)
+     {
+         Token *op = current(p);
+         advance(p); // skip '==' or '!='
+         Value right = parse_relational(p);
+         left = binary_operation(op, left, right);
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Parse bitwise and (&), which binds looser than equality as in C.
+  */
+ Value parse_bit_and(Parser *p)
+ {
+     Value left = parse_equality(p);
+     while (current(p)->op == OP_BIT_AND)
+     {
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_equality(p);
+         left = binary_operation(op, left, right);
+     }
+     return left;
+ }
+ 
+ /*
+  * Parse bitwise exclusive or (^).
+  */
+ Value parse_bit_xor(Parser *p)
+ {
+     Value left = parse_bit_and(p);
+     while (current(p)->op == OP_BIT_XOR)
+     {
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_bit_and(p);
+         left = binary_operation(op, left, right);
+     }
+     return left;
+ }
+ 
+ /*
+  * Parse bitwise or (|).
+  */
+ Value parse_bit_or(Parser *p)
+ {
+     Value left = parse_bit_xor(p);
+     while (current(p)->op == OP_BIT_OR)
+     {
+         Token *op = current(p);
+         advance(p);
+         Value right = parse_bit_xor(p);
+         left = binary_operation(op, left, right);
+     }
+     return left;
+ }
+ 
+ /*
+  * Applies an assignment (=, +=, -=, *=, /=, %=) to the value stored in slot,
+  * in place.  = moves a temporary string in and copies a borrowed one, += on
+  * a string grows the stored buffer rather than building a new one.  Returns
+  * the new value, which the slot still owns.
+  */
+ Value update_slot(Value *slot, OperatorCode op, Value right)
+ {
+     Value left = *slot;
+ 
+     if (op == OP_ASSIGN)
+     {
+         if (right.type == VAL_STRING && !right.temp)
+         {
+             right = make_string(right.str_val);
+         }
+ 
+         // Storing a container back where it already is mustn't free it.
+         if ((left.type != VAL_ARRAY && left.type != VAL_MAP && left.type != VAL_TYPED_ARRAY) || left.type != right.type ||
+             left.array_val != right.array_val)
+         {
+             free_value(left);
+         }
+ 
+         *slot = right;
+         slot->temp = 0;
+         return *slot;
+     }
+ 
+     if (op == OP_ADD_ASSIGN && (left.type == VAL_STRING || right.type == VAL_STRING))
+     {
+         char buffer[64];
+         const char *s2 = buffer;
+ 
+         if (right.type == VAL_STRING)
+             s2 = right.str_val;
+         else if (right.type == VAL_DOUBLE)
+             format_double(right.double_val, buffer);
+         else
+             format_int(right.int_val, buffer);
+ 
+         if (left.type == VAL_STRING)
+         {
+             size_t length = strlen(left.str_val);
+             size_t extra = strlen(s2);
+             int self = s2 == left.str_val; // x += x
+             char *grown = realloc(left.str_val, length + extra + 1);
+ 
+             if (!grown)
+             {
+                 raise_error("Memory allocation error in update_slot.\n");
+                 return return_value;
+             }
+ 
+             memcpy(grown + length, self ? grown : s2, extra);
+             grown[length + extra] = '\0';
+             slot->str_val = grown;
+         }
+         else
+         {
+             char number[64];
+ 
+             if (left.type == VAL_DOUBLE)
+                 format_double(left.double_val, number);
+             else
+                 format_int(left.int_val, number);
+ 
+             char *concat = malloc(strlen(number) + strlen(s2) + 1);
+             strcpy(concat, number);
+             strcat(concat, s2);
+             *slot = make_string(concat);
+             free(concat);
+         }
+ 
+         if (right.type == VAL_STRING && right.temp)
+         {
+             free_value(right);
+         }
+         slot->temp = 0;
+         return *slot;
+     }
+ 
+     if ((left.type != VAL_INT && left.type != VAL_DOUBLE) || (right.type != VAL_INT && right.type != VAL_DOUBLE))
+     {
+         raise_error("Runtime error: Compound assignment only supports numbers, or strings with '+='.\n");
+         return return_value;
+     }
+ 
+     if (left.type == VAL_INT && right.type == VAL_INT)
+     {
+         int r = right.int_val;
+ 
+         if ((op == OP_DIV_ASSIGN || op == OP_MOD_ASSIGN) && r == 0)
+         {
+             raise_error("Runtime error: Division by zero.\n");
+             return return_value;
+         }
+ 
+         switch (op)
+         {
+             case OP_ADD_ASSIGN: slot->int_val += r; break;
+             case OP_SUB_ASSIGN: slot->int_val -= r; break;
+             case OP_MUL_ASSIGN: slot->int_val *= r; break;
+             case OP_DIV_ASSIGN: slot->int_val /= r; break;
+             default:            slot->int_val %= r; break;
+         }
+         return *slot;
+     }
+ 
+     double l = (left.type == VAL_DOUBLE) ? left.double_val : left.int_val;
+     double r = (right.type == VAL_DOUBLE) ? right.double_val : right.int_val;
+ 
+     if ((op == OP_DIV_ASSIGN || op == OP_MOD_ASSIGN) && r == 0.0)
+     {
+         raise_error("Runtime error: Division by zero.\n");
+         return return_value;
+     }
+ 
+     switch (op)
+     {
+         case OP_ADD_ASSIGN: *slot = make_double(l + r); break;
+         case OP_SUB_ASSIGN: *slot = make_double(l - r); break;
+         case OP_MUL_ASSIGN: *slot = make_double(l * r); break;
+         case OP_DIV_ASSIGN: *slot = make_double(l / r); break;
+         default:            *slot = make_double(fmod(l, r)); break;
+     }
+     return *slot;
+ }
+ 
+ /*
+  * Applies x op= value to a variable, updating it where it is stored.  Inside
+  * a function a variable only the script has is read, and the result
+  * assigned to a new local, as with x = x op value.
+  */
+ Value compound_assign(const char *name, OperatorCode op, Value right)
+ {
+     if (fold_mode)
+     {
+         fold_failed = 1;
+         return make_int(0);
+     }
+ 
+     Variable *var = find_assignable(name);
+ 
+     if (var)
+     {
+         return update_slot(&var->value, op, right);
+     }
+ 
+     Value copy = get_variable(name);
+ 
+     if (return_flag)
+     {
+         return return_value;
+     }
+ 
+     if (copy.type == VAL_STRING)
+     {
+         copy = make_string(copy.str_val);
+     }
+ 
+     Value v = update_slot(&copy, op, right);
+ 
+     if (return_flag)
+     {
+         free_value(copy);
+         return return_value;
+     }
+ 
+     set_variable(name, v);
+     return v;
+ }
+ 
+ /*
+  * Returns the token just past the indexes of "name[...]...", or -1 when the
+  * brackets haven't been matched, e.g. while constant folding.
+  */
+ static int element_end(const Parser *p)
+ {
+     int i = p->pos + 1;
+ 
+     while (i < p->tokens->count && p->tokens->tokens[i].type == TOKEN_LBRACKET)
+     {
+         if (p->tokens->tokens[i].match < 0)
+         {
+             return -1;
+         }
+         i = p->tokens->tokens[i].match + 1;
+     }
+ 
+     return i < p->tokens->count ? i : -1;
+ }
+ 
+ /*
+  * Parses "name[index]... = value" or a compound assignment, updating the
+  * element where the array stores it.  The value is evaluated first, so a call in it that changes the
+  * array can't leave the element's address stale.
+  */
+ static Value parse_element_assignment(Parser *p, int op_pos)
+ {
+     Token *name = current(p);
+     OperatorCode op = p->tokens->tokens[op_pos].op;
+     int start = p->pos + 1;
+ 
+     p->pos = op_pos + 1;
+     Value right = parse_assignment(p);
+     int end = p->pos;
+ 
+     if (return_flag)
+     {
+         return return_value;
+     }
+ 
+     Value container = get_variable(name->text);
+     Value index = make_null();
+     p->pos = start;
+ 
+     while (!return_flag)
+     {
+         advance(p); // consume '['
+         index = parse_assignment(p);
+         expect(p, TOKEN_RBRACKET, "Expected ']' after array index");
+ 
+         if (return_flag || p->pos >= op_pos)
+         {
+             break;
+         }
+ 
+         Value *slot = array_slot(container, index);
+         if (slot)
+         {
+             container = *slot;
+         }
+     }
+ 
+     p->pos = end;
+ 
+     if (return_flag)
+     {
+         if (right.type == VAL_STRING && right.temp)
+         {
+             free_value(right);
+         }
+         return return_value;
+     }
+ 
+     return assign_element(container, index, op, right);
+ }
+ 
+ /*
+  * Parse an assignment expression: x = expr, x op= expr, arr[i] = expr and
+  * arr[i] op= expr.
+  */
+ Value parse_assignment(Parser *p)
+ {
+     if (current(p)->type == TOKEN_IDENTIFIER && peek(p) && peek(p)->type == TOKEN_LBRACKET)
+     {
+         int op_pos = element_end(p);
+ 
+         if (op_pos >= 0 && (p->tokens->tokens[op_pos].op == OP_ASSIGN ||
+                             IS_COMPOUND_ASSIGN(p->tokens->tokens[op_pos].op)))
+         {
+             return parse_element_assignment(p, op_pos);
+         }
+     }
+ 
+     if (current(p)->type == TOKEN_IDENTIFIER && peek(p) &&
+         peek(p)->type == TOKEN_OPERATOR &&
+         (peek(p)->op == OP_ASSIGN || IS_COMPOUND_ASSIGN(peek(p)->op)))
+     {
+         char *varName = _strdup(current(p)->text);
+         advance(p); // consume identifier
+         OperatorCode assign_op = current(p)->op;
+         advance(p); // consume '=' or the compound operator
+         Value right = parse_assignment(p);
+ 
+         if (assign_op == OP_ASSIGN)
+         {
+             set_variable(varName, right);
+             right.temp = 0; /* <--- FIX: mark returned value as non-temporary */
+         }
+         else if (!return_flag)
+         {
+             right = compound_assign(varName, assign_op, right);
+         }
+ 
+         free(varName);
+         return right;
+     }
+     return parse_logical(p);
+ }
+ 
+ /* ============================================================
+      Statements
+    ============================================================ */
+ 
+  /*
+   * Parses a block of statements.
+   */
+ void parse_block(Parser *p)
+ {
+     int close = current(p)->type == TOKEN_LBRACE ? current(p)->match : -1;
+     int scope = scope_enter();
+     expect(p, TOKEN_LBRACE, "Expected '{' to start block");
+ 
+     while (current(p)->type != TOKEN_RBRACE && current(p)->type != TOKEN_EOF &&
+            !return_flag && !break_flag && !continue_flag)
+     {
+         parse_statement(p);
+     }
+ 
+     // A return, break or continue skips the rest of the block.
+     if ((return_flag || break_flag || continue_flag) && close >= 0)
+     {
+         p->pos = close;
+     }
+ 
+     expect(p, TOKEN_RBRACE, "Expected '}' to end block");
+     scope_exit(scope);
+ }
+
+ /*
+  * Parses "let name" or "let name = value", declaring the variable in the
+  * innermost block.
+  */
+ static void parse_let(Parser *p)
+ {
+     advance(p); // consume "let"
+     Token *name = current(p);
+ 
+     if (name->type != TOKEN_IDENTIFIER)
+     {
+         raise_error("Parser error: Expected a variable name after let, found '%s'.\n", name->text);
+         return;
+     }
+     advance(p);
+ 
+     Value v = make_null();
+     if (current(p)->op == OP_ASSIGN)
+     {
+         advance(p); // consume '='
+         v = parse_assignment(p);
+     }
+ 
+     if (!return_flag)
+     {
+         declare_variable(name->text, v);
+     }
+ }
+ 
+ /*
+  * Jumps over a block without executing it, using the matching '}' the
+  * compiler recorded on the '{'.
+  */
+ static void skip_block(Parser *p)
+ {
+     if (current(p)->type == TOKEN_LBRACE)
+     {
+         p->pos = current(p)->match + 1;
+     }
+ }
+ 
+ /* ============================================================
+     Switch Tables
+    ============================================================ */
+ 
+ typedef struct
+ {
+     unsigned int hash;
+     int is_string;
+     int int_key;
+     const char *str_key;    /* Borrowed from the case token */
+     int target;             /* Token index of the case's '{', -1 for an empty slot */
+ } SwitchEntry;
+ 
+ /* A switch's cases, built the first time the switch runs.  Int cases close
+    enough together go in a jump table indexed by value, the rest in an open
+    addressing hash. */
+ typedef struct SwitchTable
+ {
+     int min;                /* The smallest int case */
+     int span;               /* Entries in jump, 0 when the int cases are hashed */
+     int *jump;              /* Case body for each int from min, -1 for none */
+     int size;               /* Slots in entries, a power of two, 0 if none */
+     SwitchEntry *entries;
+     int default_target;     /* Body of default, -1 for none */
+ } SwitchTable;
+ 
+ /*
+  * FNV-1a hash of a case label, case-sensitive like ==.
+  */
+ static unsigned int switch_hash(const SwitchEntry *entry)
+ {
+     if (!entry->is_string)
+     {
+         return (unsigned int)entry->int_key * 2654435761u;
+     }
+ 
+     unsigned int hash = 2166136261u;
+     for (const char *c = entry->str_key; *c; c++)
+     {
+         hash ^= (unsigned char)*c;
+         hash *= 16777619u;
+     }
+     return hash;
+ }
+ 
+ /*
+  * Finds the hash slot holding a case label, or the empty slot it would go in.
+  */
+ static SwitchEntry *switch_slot(const SwitchTable *table, const SwitchEntry *key)
+ {
+     unsigned int mask = table->size - 1;
+     unsigned int i = key->hash & mask;
+ 
+     while (table->entries[i].target >= 0)
+     {
+         const SwitchEntry *entry = &table->entries[i];
+ 
+         if (entry->hash == key->hash && entry->is_string == key->is_string &&
+             (key->is_string ? strcmp(entry->str_key, key->str_key) == 0 : entry->int_key == key->int_key))
+         {
+             break;
+         }
+ 
+         i = (i + 1) & mask;
+     }
+ 
+     return &table->entries[i];
+ }
+ 
+ /*
+  * Frees a switch table.
+  */
+ static void switch_free(SwitchTable *table)
+ {
+     if (!table)
+     {
+         return;
+     }
+ 
+     free(table->jump);
+     free(table->entries);
+     free(table);
+ }
+ 
+ /*
+  * Reads the cases in the switch body starting at the '{' at open.  Each is
+  * "case <int or string>: { ... }" or "default: { ... }".  When a label
+  * appears twice the first case wins, as it would in an if/else if chain.
+  */
+ static SwitchTable *switch_table(TokenList *list, int open)
+ {
+     int close = list->tokens[open].match;
+     int case_count = 0, int_count = 0;
+     int min = 0, max = 0;
+     SwitchEntry *cases = malloc(sizeof(SwitchEntry) * (close - open + 1));
+     SwitchTable *table = calloc(1, sizeof(SwitchTable));
+ 
+     if (!cases || !table)
+     {
+         free(cases);
+         free(table);
+         raise_error("Memory allocation error in switch_table.\n");
+         return NULL;
+     }
+ 
+     table->default_target = -1;
+ 
+     // Collect the labels and where their blocks start.
+     for (int pos = open + 1; pos < close; )
+     {
+         Token *tok = &list->tokens[pos];
+         SwitchEntry entry = { 0, 0, 0, NULL, -1 };
+         int is_default = tok->type == TOKEN_DEFAULT;
+ 
+         if (tok->type != TOKEN_CASE && !is_default)
+         {
+             raise_error("Parser error: Expected case or default in switch, found '%s'.\n", tok->text);
+             break;
+         }
+         pos++;
+ 
+         if (!is_default)
+         {
+             // Folding has already turned constant labels like -1 or 2 * 8 into literals.
+             Token *label = &list->tokens[pos];
+ 
+             if (label->type == TOKEN_INT)
+             {
+                 entry.int_key = atoi(label->text);
+             }
+             else if (label->type == TOKEN_STRING && strstr(label->text, "${") == NULL)
+             {
+                 entry.is_string = 1;
+                 entry.str_key = label->text;
+             }
+             else
+             {
+                 raise_error("Parser error: case labels must be int or string literals, found '%s'.\n", label->text);
+                 break;
+             }
+             pos++;
+         }
+ 
+         if (list->tokens[pos].type != TOKEN_COLON || list->tokens[pos + 1].type != TOKEN_LBRACE)
+         {
+             raise_error("Parser error: Expected ': {' after %s.\n", is_default ? "default" : "case label");
+             break;
+         }
+ 
+         entry.target = pos + 1;
+         pos = list->tokens[pos + 1].match + 1;
+ 
+         if (is_default)
+         {
+             if (table->default_target < 0)
+             {
+                 table->default_target = entry.target;
+             }
+             continue;
+         }
+ 
+         entry.hash = switch_hash(&entry);
+         cases[case_count++] = entry;
+ 
+         if (!entry.is_string)
+         {
+             min = int_count == 0 || entry.int_key < min ? entry.int_key : min;
+             max = int_count == 0 || entry.int_key > max ? entry.int_key : max;
+             int_count++;
+         }
+     }
+ 
+     if (return_flag)
+     {
+         free(cases);
+         switch_free(table);
+         return NULL;
+     }
+ 
+     // Ints go in a jump table unless they're spread too thin for one.
+     long long span = (long long)max - min + 1;
+     int dense = int_count > 0 && span <= 2LL * int_count + 16;
+ 
+     if (dense)
+     {
+         table->min = min;
+         table->span = (int)span;
+         table->jump = malloc(sizeof(int) * table->span);
+ 
+         for (int i = 0; table->jump && i < table->span; i++)
+         {
+             table->jump[i] = -1;
+         }
+     }
+ 
+     int hashed = case_count - (dense ? int_count : 0);
+     if (hashed > 0)
+     {
+         table->size = 8;
+         while (table->size < hashed * 2)
+         {
+             table->size *= 2;
+         }
+         table->entries = malloc(sizeof(SwitchEntry) * table->size);
+ 
+         for (int i = 0; table->entries && i < table->size; i++)
+         {
+             table->entries[i].target = -1;
+         }
+     }
+ 
+     if ((dense && !table->jump) || (hashed > 0 && !table->entries))
+     {
+         free(cases);
+         switch_free(table);
+         raise_error("Memory allocation error in switch_table.\n");
+         return NULL;
+     }
+ 
+     for (int i = 0; i < case_count; i++)
+     {
+         if (dense && !cases[i].is_string)
+         {
+             int *target = &table->jump[cases[i].int_key - min];
+             *target = *target < 0 ? cases[i].target : *target;
+             continue;
+         }
+ 
+         SwitchEntry *slot = switch_slot(table, &cases[i]);
+         if (slot->target < 0)
+         {
+             *slot = cases[i];
+         }
+     }
+ 
+     free(cases);
+     return table;
+ }
+ 
+ /*
+  * The token index of the block to run for a switch value, -1 for none.
+  */
+ static int switch_lookup(const SwitchTable *table, Value v)
+ {
+     SwitchEntry key = { 0, 0, 0, NULL, -1 };
+ 
+     if (v.type == VAL_INT)
+     {
+         if (table->span > 0)
+         {
+             long long i = (long long)v.int_val - table->min;
+             int target = i >= 0 && i < table->span ? table->jump[i] : -1;
+             return target >= 0 ? target : table->default_target;
+         }
+         key.int_key = v.int_val;
+     }
+     else if (v.type == VAL_STRING)
+     {
+         key.is_string = 1;
+         key.str_key = v.str_val;
+     }
+     else
+     {
+         return table->default_target;
+     }
+ 
+     if (table->size > 0)
+     {
+         key.hash = switch_hash(&key);
+         SwitchEntry *slot = switch_slot(table, &key);
+ 
+         if (slot->target >= 0)
+         {
+             return slot->target;
+         }
+     }
+ 
+     return table->default_target;
+ }
+ 
+ /*
+  * Runs a range loop, "for (name in start..end)" or "for (name in range(start,
+  * end, step))", with p at the loop variable.  The bounds are evaluated once
+  * and the end is exclusive.  The loop counts in a long long, so a step past
+  * the largest or smallest int ends the loop rather than wrapping, and writes
+  * the count to the variable before each pass, so the body can't change the
+  * iteration.  Every value written is short of the end, so it fits an int.
+  */
+ static void parse_range_loop(Parser *p)
+ {
+     const char *name = current(p)->text;
+     Value bounds[3] = { make_int(0), make_int(0), make_int(1) };
+ 
+     advance(p); // consume the loop variable
+     advance(p); // consume "in"
+ 
+     if (current(p)->type == TOKEN_IDENTIFIER && strcmp(current(p)->text, "range") == 0 &&
+         peek(p) && peek(p)->type == TOKEN_LPAREN)
+     {
+         int count = 0;
+ 
+         advance(p); // consume "range"
+         advance(p); // consume '('
+         while (!return_flag && count < 3)
+         {
+             bounds[count++] = parse_assignment(p);
+             if (current(p)->type != TOKEN_COMMA)
+             {
+                 break;
+             }
+             advance(p);
+         }
+         expect(p, TOKEN_RPAREN, "Expected ')' after range(start, end, step)");
+ 
+         if (!return_flag && count < 2)
+         {
+             raise_error("Parser error: range() in a for loop expects a start, an end and an optional step.\n");
+         }
+     }
+     else
+     {
+         bounds[0] = parse_assignment(p);
+         expect(p, TOKEN_RANGE, "Expected '..' or range() after 'in'");
+         if (!return_flag)
+         {
+             bounds[1] = parse_assignment(p);
+         }
+     }
+     expect(p, TOKEN_RPAREN, "Expected ')' after range loop header");
+ 
+     int block_start = p->pos + 1;
+     int block_end = current(p)->match + 1;
+     expect(p, TOKEN_LBRACE, "Expected '{' to start for-loop body");
+ 
+     if (return_flag || !check_range(bounds[0], bounds[1], bounds[2]))
+     {
+         return;
+     }
+ 
+     int end = bounds[1].int_val;
+     int step = bounds[2].int_val;
+     long long i = bounds[0].int_val;
+     Value *counter = NULL;
+ 
+     if (step > 0 ? i < end : i > end)
+     {
+         counter = range_variable(name, (int)i);
+     }
+ 
+     for (; counter && (step > 0 ? i < end : i > end); i += step)
+     {
+         // The body may have stored a string in the variable.
+         if (counter->type == VAL_STRING)
+         {
+             free(counter->str_val);
+         }
+         *counter = make_int((int)i);
+ 
+         Parser bodyParser;
+         bodyParser.tokens = p->tokens;
+         bodyParser.pos = block_start;
+         int scope = scope_enter();
+         while (bodyParser.pos < block_end &&
+             current(&bodyParser)->type != TOKEN_RBRACE &&
+             !return_flag && !continue_flag && !break_flag)
+         {
+             parse_statement(&bodyParser);
+         }
+         scope_exit(scope);
+ 
+         if (break_flag)
+         {
+             break_flag = 0;
+             break;
+         }
+         if (continue_flag)
+         {
+             continue_flag = 0;
+         }
+         if (return_flag)
+         {
+             break;
+         }
+     }
+ 
+     p->pos = block_end;
+ }
+ 
+ /*
+  * Parses a statement.
+  */
+ void parse_statement(Parser *p)
+ {
+     Token *tok = current(p);
+ 
+     if (tok->type == TOKEN_RETURN)
+     {
+         advance(p); // consume 'return'
+         Value v = parse_assignment(p);
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after return statement");
+ 
+         // An error raised in the expression, maybe by a nested call, carries on.
+         if (return_flag && return_value.type == VAL_ERROR)
+         {
+             return;
+         }
+ 
+         // A variable's string goes away with its block or frame, return a copy.
+         if (v.type == VAL_STRING && !v.temp)
+         {
+             v = make_string(v.str_val);
+         }
+         return_flag = 1;
          return_value = v;
      }
-     else if (tok->type == TOKEN_IF)
+     else if (tok->type == TOKEN_IF)
+     {
+         // The compiler recorded where the whole if/else if/else chain ends.
+         int chain_end = tok->match;
+ 
+         advance(p); // consume "if"
+         expect(p, TOKEN_LPAREN, "Expected '(' after if");
+         Value cond = parse_assignment(p);
+         expect(p, TOKEN_RPAREN, "Expected ')' after if condition");
+ 
+         int condition_true = 0;
+         if (cond.type == VAL_INT || cond.type == VAL_BOOL)
+         {
+             condition_true = (cond.int_val != 0);
+         }
+         else
+         {
+             raise_error("Runtime error: if condition must be int or bool.\n");
+             return;
+         }
+ 
+         if (condition_true)
+         {
+             parse_block(p);
+             // Jump past any trailing else/else if blocks.
+             p->pos = chain_end;
+         }
+         else
+         {
+             // If false, jump over the if's block.
+             skip_block(p);
+ 
+             // Process subsequent else if/else clauses normally.
+             while (current(p)->type == TOKEN_ELSE)
+             {
+                 advance(p); // consume 'else'
+                 if (current(p)->type == TOKEN_IF)
+                 {
+                     advance(p); // consume 'if'
+                     expect(p, TOKEN_LPAREN, "Expected '(' after else if");
+                     Value cond2 = parse_assignment(p);
+                     expect(p, TOKEN_RPAREN, "Expected ')' after else if condition");
+ 
+                     int condition_true2 = 0;
+                     if (cond2.type == VAL_INT || cond2.type == VAL_BOOL)
+                     {
+                         condition_true2 = (cond2.int_val != 0);
+                     }
+                     else
+                     {
+                         raise_error("Runtime error: else if condition must be int or bool.\n");
+                         return;
+                     }
+ 
+                     if (condition_true2)
+                     {
+                         parse_block(p);
+                         p->pos = chain_end;
+                         break;
+                     }
+                     else
+                     {
+                         // Skip the else if block and continue checking further else clauses.
+                         skip_block(p);
+                     }
+                 }
+                 else
+                 {
+                     // Else branch.
+                     if (current(p)->type == TOKEN_LBRACE)
+                     {
+                         parse_block(p);
+                     }
+                     break;
+                 }
+             }
+         }
+     }
+     else if (tok->type == TOKEN_FOR)
+     {
+         // The compiler recorded the ';' that ends the condition.
+         int cond_end = tok->match;
+ 
+         advance(p); // consume "for"
+         int paren = p->pos;
+         expect(p, TOKEN_LPAREN, "Expected '(' after for");
+ 
+         if (return_flag)
+         {
+             return;
+         }
+ 
+         // "in" is only special here, as in foreach.
+         if (current(p)->type == TOKEN_IDENTIFIER && peek(p) && peek(p)->type == TOKEN_IDENTIFIER &&
+             strcmp(peek(p)->text, "in") == 0)
+         {
+             parse_range_loop(p);
+             return;
+         }
+ 
+         if (cond_end < 0)
+         {
+             raise_error("Parser error: Malformed for-loop header.\n");
+             return;
+         }
+ 
+         /* --- Parse the initializer expression (if any), a let lasts the whole loop --- */
+         int loop_scope = scope_enter();
+         if (current(p)->type == TOKEN_LET)
+         {
+             parse_let(p);
+         }
+         else if (current(p)->type != TOKEN_SEMICOLON)
+         {
+             parse_assignment(p);
+         }
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after for-loop initializer");
+ 
+         /* --- The condition and post expression ranges --- */
+         int cond_start = p->pos;
+         int post_start = cond_end + 1;
+         int post_end = p->tokens->tokens[paren].match;
+         p->pos = post_end;
+         expect(p, TOKEN_RPAREN, "Expected ')' after for-loop post expression");
+ 
+         /* --- The loop body --- */
+         int block_start = p->pos + 1; // body starts after '{'
+         int block_end = current(p)->match + 1; // token position just after the matching '}'
+         expect(p, TOKEN_LBRACE, "Expected '{' to start for-loop body");
+ 
+         if (return_flag)
+         {
+             scope_exit(loop_scope);
+             return;
+         }
+ 
+         /* --- Compiled forms of the condition and post expression, if any --- */
+         VmProgram *cond_code = vm_program(p->tokens, cond_start, cond_end);
+         VmProgram *post_code = vm_program(p->tokens, post_start, post_end);
+ 
+         /* --- Both fused into one step program, cached on the "for" --- */
+         VmProgram *step_code = NULL;
+         if (cond_code && post_code)
+         {
+             if (!tok->code)
+             {
+                 tok->code = vm_fuse(post_code, cond_code);
+             }
+             step_code = tok->code;
+         }
+ 
+         Value cond_val;
+         int stepped = 0; // set when the step program already evaluated the condition
+ #ifdef ARCANE_JIT
+         int native = 1;  // cleared when the loop's variables don't suit its machine code
+ #endif
+ 
+         /* --- Execute the for loop --- */
+         while (1)
+         {
+ #ifdef ARCANE_JIT
+             /* --- A loop compiled on an earlier run starts out as machine code --- */
+             if (!stepped && step_code && step_code->jit && native)
+             {
+                 if (jit_run(step_code->jit, 0))
+                 {
+                     break;
+                 }
+                 native = 0;
+             }
+ #endif
+ 
+             /* --- Evaluate the condition --- */
+             {
+                 if (stepped)
+                 {
+                     stepped = 0;
+                 }
+                 else if (cond_code)
+                 {
+                     cond_val = vm_run(cond_code);
+                 }
+                 else
+                 {
+                     Parser condParser;
+                     condParser.tokens = p->tokens;
+                     condParser.pos = cond_start;
+                     // Temporarily restrict the parser to the condition tokens.
+                     int original_count = condParser.tokens->count;
+                     condParser.tokens->count = cond_end;
+                     cond_val = parse_assignment(&condParser);
+                     condParser.tokens->count = original_count;
+                 }
+                 if ((cond_val.type != VAL_INT && cond_val.type != VAL_BOOL) || cond_val.int_val == 0)
+                 {
+                     if (cond_val.type == VAL_STRING && cond_val.temp)
+                     {
+                         free_value(cond_val);
+                     }
+                     break; // condition false: exit loop
+                 }
+                 if (cond_val.type == VAL_STRING && cond_val.temp)
+                 {
+                     free_value(cond_val);
+                 }
+             }
+ 
+             /* --- Execute the loop body --- */
+             {
+                 Parser bodyParser;
+                 bodyParser.tokens = p->tokens;
+                 bodyParser.pos = block_start;
+                 int scope = scope_enter(); // let variables last one pass of the body
+                 while (bodyParser.pos < block_end &&
+                     current(&bodyParser)->type != TOKEN_RBRACE &&
+                     !return_flag && !continue_flag && !break_flag)
+                 {
+                     parse_statement(&bodyParser);
+                 }
+                 scope_exit(scope);
+             }
+ 
+             if (break_flag)
+             {
+                 break_flag = 0;
+                 break;
+             }
+             if (continue_flag)
+             {
+                 continue_flag = 0;
+             }
+             if (return_flag)
+             {
+                 break;
+             }
+ 
+ #ifdef ARCANE_JIT
+             /* --- Hot loops carry on as machine code --- */
+             if (step_code && native)
+             {
+                 if (jit_hot(step_code))
+                 {
+                     step_code->jit = jit_compile(p->tokens, cond_start, cond_end, post_start, post_end,
+                                                  block_start, block_end - 1);
+                 }
+                 if (step_code->jit)
+                 {
+                     if (jit_run(step_code->jit, 1))
+                     {
+                         break;
+                     }
+                     native = 0;
+                 }
+             }
+ #endif
+ 
+             /* --- Execute the post expression and the next condition together --- */
+             if (step_code)
+             {
+                 cond_val = vm_run(step_code);
+                 stepped = 1;
+                 continue;
+             }
+ 
+             /* --- Execute the post expression --- */
+             {
+                 Value post_val;
+                 if (post_code)
+                 {
+                     post_val = vm_run(post_code);
+                 }
+                 else
+                 {
+                     Parser postParser;
+                     postParser.tokens = p->tokens;
+                     postParser.pos = post_start;
+                     int original_post_count = postParser.tokens->count;
+                     postParser.tokens->count = post_end;
+                     post_val = parse_assignment(&postParser);
+                     postParser.tokens->count = original_post_count;
+                 }
+                 post_val.temp = 0; // mark as non-temporary
+                 if (post_val.type == VAL_STRING && post_val.temp)
+                 {
+                     free_value(post_val);
+                 }
+             }
+         }
+ 
+         scope_exit(loop_scope);
+ 
+         // Skip the entire for-loop block.
+         p->pos = block_end;
+     }
+     else if (tok->type == TOKEN_IMPORT)
+     {
+         // compile() checked the statement and compiled the module.
+         advance(p); // consume "import"
+         Token *path = current(p);
+         advance(p);
+         run_import(path->text);
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after import statement");
+     }
+     else if (tok->type == TOKEN_LET)
+     {
+         parse_let(p);
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after let statement");
+     }
+     else if (tok->type == TOKEN_FUNCTION)
+     {
+         // Definitions were read by compile(), calls run the body in place.
+         p->pos = p->tokens->tokens[tok->function->body].match + 1;
+     }
+     else if (tok->type == TOKEN_FOREACH)
+     {
+         advance(p); // consume "foreach"
+         expect(p, TOKEN_LPAREN, "Expected '(' after foreach");
+ 
+         if (return_flag)
+         {
+             return;
+         }
+ 
+         // "in" is only special here, it's still a valid variable name elsewhere.
+         if (current(p)->type != TOKEN_IDENTIFIER || !peek(p) ||
+             peek(p)->type != TOKEN_IDENTIFIER || strcmp(peek(p)->text, "in") != 0)
+         {
+             raise_error("Parser error: Expected 'name in array' after foreach, found '%s'.\n", current(p)->text);
+             return;
+         }
+ 
+         const char *name = current(p)->text;
+         advance(p); // consume the loop variable
+         advance(p); // consume "in"
+ 
+         // The array is evaluated once, its items are then walked directly.
+         Value list = parse_assignment(p);
+         expect(p, TOKEN_RPAREN, "Expected ')' after foreach array");
+ 
+         int block_start = p->pos + 1;
+         int block_end = current(p)->match + 1;
+         expect(p, TOKEN_LBRACE, "Expected '{' to start foreach body");
+ 
+         if (!return_flag)
+         {
+             list = foreach_list(list);
+         }
+ 
+         if (return_flag)
+         {
+             if (list.temp)
+             {
+                 free_value(list);
+             }
+             return;
+         }
+ 
+         Array *arr = list.array_val;
+         int length = arr->length;
+ 
+         for (int i = 0; i < length; i++)
+         {
+             // The variable gets its own copy of a string, so reassigning it
+             // in the body can't free the array's.
+             Value item = arr->items[i];
+             if (item.type == VAL_STRING)
+             {
+                 item = make_string(item.str_val);
+             }
+             set_variable(name, item);
+ 
+             Parser bodyParser;
+             bodyParser.tokens = p->tokens;
+             bodyParser.pos = block_start;
+             int scope = scope_enter();
+             while (bodyParser.pos < block_end &&
+                 current(&bodyParser)->type != TOKEN_RBRACE &&
+                 !return_flag && !continue_flag && !break_flag)
+             {
+                 parse_statement(&bodyParser);
+             }
+             scope_exit(scope);
+ 
+             if (break_flag)
+             {
+                 break_flag = 0;
+                 break;
+             }
+             if (continue_flag)
+             {
+                 continue_flag = 0;
+             }
+             if (return_flag)
+             {
+                 break;
+             }
+         }
+ 
+         // An array made just for the loop, like split()'s, is done with.
+         if (list.temp)
+         {
+             free_value(list);
+         }
+ 
+         p->pos = block_end;
+     }
+     else if (tok->type == TOKEN_WHILE)
+     {
+         // Consume the "while" keyword.
+         advance(p);
+         int paren = p->pos;
+         expect(p, TOKEN_LPAREN, "Expected '(' after while");
+ 
+         if (return_flag)
+         {
+             return;
+         }
+ 
+         // Save the condition's range and jump to its ')'.
+         int cond_start = p->pos;
+         int cond_end = p->tokens->tokens[paren].match;
+         p->pos = cond_end;
+         expect(p, TOKEN_RPAREN, "Expected ')' after while condition");
+ 
+         // The body starts after the '{' and ends just after its matching '}'.
+         int block_start = p->pos + 1;
+         int block_end = current(p)->match + 1;
+         expect(p, TOKEN_LBRACE, "Expected '{' to start while-loop body");
+ 
+         if (return_flag)
+         {
+             return;
+         }
+ 
+         // The compiled form of the condition, if it has one.
+         VmProgram *cond_code = vm_program(p->tokens, cond_start, cond_end);
+ #ifdef ARCANE_JIT
+         int native = 1; // cleared when the loop's variables don't suit its machine code
+ #endif
+ 
+         // --- Execute the while loop ---
+         while (1)
+         {
+ #ifdef ARCANE_JIT
+             // Hot loops carry on as machine code.
+             if (cond_code && native)
+             {
+                 if (jit_hot(cond_code))
+                 {
+                     cond_code->jit = jit_compile(p->tokens, cond_start, cond_end, cond_end, cond_end,
+                                                  block_start, block_end - 1);
+                 }
+                 if (cond_code->jit)
+                 {
+                     if (jit_run(cond_code->jit, 0))
+                     {
+                         break;
+                     }
+                     native = 0;
+                 }
+             }
+ #endif
+ 
+             Value cond_val;
+             if (cond_code)
+             {
+                 cond_val = vm_run(cond_code);
+             }
+             else
+             {
+                 // Create a temporary parser for the condition, starting at cond_start.
+                 Parser condParser;
+                 condParser.tokens = p->tokens;
+                 condParser.pos = cond_start;
+                 cond_val = parse_assignment(&condParser);
+             }
+             // Determine truth: accept both int and bool.
+             int loop_true = 0;
+             if (cond_val.type == VAL_INT || cond_val.type == VAL_BOOL)
+             {
+                 loop_true = (cond_val.int_val != 0);
+             }
+             else
+             {
+                 raise_error("Runtime error: while condition must be int or bool.\n");
+                 return;
+             }
+             if (cond_val.type == VAL_STRING && cond_val.temp)
+             {
+                 free_value(cond_val);
+             }
+             if (!loop_true)
+             {
+                 break; // exit loop if condition is false
+             }
+ 
+             // Execute the loop body using a temporary parser.
+             {
+                 Parser bodyParser;
+                 bodyParser.tokens = p->tokens;
+                 bodyParser.pos = block_start;
+                 int scope = scope_enter();
+                 // Execute until we reach the token just before the closing '}'.
+                 while (bodyParser.pos < block_end &&
+                     current(&bodyParser)->type != TOKEN_RBRACE &&
+                     current(&bodyParser)->type != TOKEN_EOF &&
+                     !return_flag &&
+                     !continue_flag &&
+                     !break_flag)
+                 {
+                     parse_statement(&bodyParser);
+                 }
+                 scope_exit(scope);
+             }
+ 
+             // If a break was executed, reset the flag and exit the loop.
+             if (break_flag)
+             {
+                 break_flag = 0;
+                 break;
+             }
+ 
+             // If a continue was executed in the loop body, reset the flag.
+             if (continue_flag)
+             {
+                 continue_flag = 0;
+             }
+         }
+ 
+         // Advance the main parser position to after the loop block.
+         p->pos = block_end;
+     }
+     else if (tok->type == TOKEN_SWITCH)
+     {
+         advance(p); // consume "switch"
+         expect(p, TOKEN_LPAREN, "Expected '(' after switch");
+         Value v = parse_assignment(p);
+         expect(p, TOKEN_RPAREN, "Expected ')' after switch value");
+ 
+         if (return_flag)
+         {
+             return;
+         }
+ 
+         if (current(p)->type != TOKEN_LBRACE)
+         {
+             raise_error("Parser error: Expected '{' to start switch body.\n");
+             return;
+         }
+ 
+         // The body ends just after its matching '}'.
+         int block_end = current(p)->match + 1;
+ 
+         // Look the case up instead of comparing against each one in turn.
+         if (!tok->table)
+         {
+             tok->table = switch_table(p->tokens, p->pos);
+ 
+             if (!tok->table)
+             {
+                 return;
+             }
+         }
+ 
+         int target = switch_lookup(tok->table, v);
+         if (v.type == VAL_STRING && v.temp)
+         {
+             free_value(v);
+         }
+ 
+         if (target >= 0)
+         {
+             p->pos = target;
+             parse_block(p);
+         }
+ 
+         p->pos = block_end;
+     }
+     else if (tok->type == TOKEN_CONTINUE)
+     {
+         advance(p);
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after continue statement");
+         continue_flag = 1;
+         return;
+     }
+     else if (tok->type == TOKEN_BREAK)
+     {
+         advance(p); // consume 'break'
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after break statement");
+         break_flag = 1;
+         return;
+     }
+     else if (tok->type == TOKEN_LBRACE)
+     {
+         // A bare block, e.g. the surviving branch of an if the compiler removed.
+         parse_block(p);
+     }
+     else
+     {
+         /* Expression statement */
+         Value v = parse_assignment(p);
+         expect(p, TOKEN_SEMICOLON, "Expected ';' after expression statement");
+         if (v.type == VAL_STRING && v.temp)
+         {
+             free_value(v);
+         }
+     }
+ }
+ 
+ /* ============================================================
+     Compiler: passes run over the token list once after it is
+     tokenized and before the script executes.
+    ============================================================ */
+ 
+ /*
+  * Expression precedence levels, from the loosest binding (assignment) to the
+  * tightest (unary).  These mirror the parse_* call chain.
+  */
+ typedef enum
+ {
+     LEVEL_ASSIGNMENT,
+     LEVEL_LOGICAL,
+     LEVEL_LOGICAL_AND,
+     LEVEL_BIT_OR,
+     LEVEL_BIT_XOR,
+     LEVEL_BIT_AND,
+     LEVEL_EQUALITY,
+     LEVEL_RELATIONAL,
+     LEVEL_SHIFT,
+     LEVEL_TERM,
+     LEVEL_FACTOR,
+     LEVEL_UNARY,
+     LEVEL_PRIMARY
+ } ExprLevel;
+ 
+ /*
+  * Parses an expression at the given precedence level.
+  */
+ static Value parse_at_level(Parser *p, ExprLevel level)
+ {
+     switch (level)
+     {
+         case LEVEL_ASSIGNMENT:  return parse_assignment(p);
+         case LEVEL_LOGICAL:     return parse_logical(p);
+         case LEVEL_LOGICAL_AND: return parse_logical_and(p);
+         case LEVEL_BIT_OR:      return parse_bit_or(p);
+         case LEVEL_BIT_XOR:     return parse_bit_xor(p);
+         case LEVEL_BIT_AND:     return parse_bit_and(p);
+         case LEVEL_EQUALITY:    return parse_equality(p);
+         case LEVEL_RELATIONAL:  return parse_relational(p);
+         case LEVEL_SHIFT:       return parse_shift(p);
+         case LEVEL_TERM:        return parse_term(p);
+         case LEVEL_FACTOR:      return parse_factor(p);
+         case LEVEL_UNARY:       return parse_unary(p);
+         default:                return parse_primary(p);
+     }
+ }
+ 
+ /*
+  * If the token ends an operand, e.g. a literal, variable or closing bracket.
+  */
+ static int ends_operand(const Token *tok)
+ {
+     switch (tok->type)
+     {
+         case TOKEN_INT:
+         case TOKEN_DOUBLE:
+         case TOKEN_STRING:
+         case TOKEN_BOOL:
+         case TOKEN_IDENTIFIER:
+         case TOKEN_RPAREN:
+         case TOKEN_RBRACKET:
+             return 1;
+         case TOKEN_OPERATOR:
+             // Postfix ++ and --
+             return strcmp(tok->text, "++") == 0 || strcmp(tok->text, "--") == 0;
+         default:
+             return 0;
+     }
+ }
+ 
+ /*
+  * If the operator token at index i is a binary operator (as opposed to a
+  * unary minus, which binds to the primary that follows it).
+  */
+ static int is_binary_operator(const TokenList *list, int i)
+ {
+     const Token *tok = &list->tokens[i];
+ 
+     if (tok->type != TOKEN_OPERATOR || strcmp(tok->text, "!") == 0 ||
+         strcmp(tok->text, "++") == 0 || strcmp(tok->text, "--") == 0)
+     {
+         return 0;
+     }
+ 
+     if (strcmp(tok->text, "-") == 0)
+     {
+         return i > 0 && ends_operand(&list->tokens[i - 1]);
+     }
+ 
+     return 1;
+ }
+ 
+ /*
+  * The level a binary operator belongs to, i.e. the parse_* loop that consumes it.
+  */
+ static ExprLevel binary_operator_level(OperatorCode op)
+ {
+     switch (op)
+     {
+         case OP_OR:
+             return LEVEL_LOGICAL;
+         case OP_AND:
+             return LEVEL_LOGICAL_AND;
+         case OP_BIT_OR:
+             return LEVEL_BIT_OR;
+         case OP_BIT_XOR:
+             return LEVEL_BIT_XOR;
+         case OP_BIT_AND:
+             return LEVEL_BIT_AND;
+         case OP_EQ:
+         case OP_NE:
+             return LEVEL_EQUALITY;
+         case OP_LT:
+         case OP_GT:
+         case OP_LE:
+         case OP_GE:
+             return LEVEL_RELATIONAL;
+         case OP_SHL:
+         case OP_SHR:
+             return LEVEL_SHIFT;
+         case OP_ADD:
+         case OP_SUB:
+             return LEVEL_TERM;
+         case OP_MUL:
+         case OP_DIV:
+         case OP_MOD:
+             return LEVEL_FACTOR;
+         default:
+             return LEVEL_ASSIGNMENT;
+     }
+ }
+ 
+ /*
+  * The loosest level an operand starting at index i can be parsed at, or -1 if
+  * no operand starts there.
+  */
+ static int operand_level(const TokenList *list, int i)
+ {
+     const Token *tok = &list->tokens[i];
+ 
+     switch (tok->type)
+     {
+         case TOKEN_INT:
+         case TOKEN_DOUBLE:
+         case TOKEN_STRING:
+         case TOKEN_BOOL:
+         case TOKEN_IDENTIFIER:
+         case TOKEN_LPAREN:
+             break;
+         case TOKEN_OPERATOR:
+             if (strcmp(tok->text, "-") == 0 || strcmp(tok->text, "!") == 0)
+             {
+                 break;
+             }
+             return -1;
+         default:
+             return -1;
+     }
+ 
+     if (i == 0)
+     {
+         return LEVEL_ASSIGNMENT;
+     }
+ 
+     const Token *prev = &list->tokens[i - 1];
+ 
+     switch (prev->type)
+     {
+         case TOKEN_LPAREN:
+         case TOKEN_LBRACKET:
+         case TOKEN_COMMA:
+         case TOKEN_SEMICOLON:
+         case TOKEN_LBRACE:
+         case TOKEN_RBRACE:
+         case TOKEN_RETURN:
+         case TOKEN_CASE:
+         case TOKEN_COLON:
+             return LEVEL_ASSIGNMENT;
+         case TOKEN_OPERATOR:
+             if (prev->op == OP_ASSIGN || IS_COMPOUND_ASSIGN(prev->op))
+             {
+                 return LEVEL_ASSIGNMENT;
+             }
+             if (strcmp(prev->text, "!") == 0)
+             {
+                 return LEVEL_UNARY;
+             }
+             if (!is_binary_operator(list, i - 1))
+             {
+                 // Operand of a unary minus (or a prefix ++/--).
+                 return LEVEL_PRIMARY;
+             }
+             // The right hand side of a binary operator is parsed one level tighter,
+             // except for *, / and % which take a primary.
+             if (binary_operator_level(prev->op) == LEVEL_FACTOR)
+             {
+                 return LEVEL_PRIMARY;
+             }
+             return binary_operator_level(prev->op) + 1;
+         default:
+             return -1;
+     }
+ }
+ 
+ /*
+  * Removes count tokens starting at index start.
+  */
+ static void remove_tokens(TokenList *list, int start, int count)
+ {
+     for (int i = start; i < start + count; i++)
+     {
+         free(list->tokens[i].text);
+     }
+ 
+     memmove(&list->tokens[start], &list->tokens[start + count],
+             sizeof(Token) * (list->count - start - count));
+     list->count -= count;
+ }
+ 
+ /*
+  * Replaces the tokens from start up to (but not including) end with a single
+  * literal token holding the given value.  Returns 0 if the value can't be
+  * written as a literal.
+  */
+ static int replace_with_literal(TokenList *list, int start, int end, Value v)
+ {
+     char buffer[64];
+     AstTokenType type;
+     const char *text;
+ 
+     switch (v.type)
+     {
+         case VAL_INT:
+             format_int(v.int_val, buffer);
+             type = TOKEN_INT;
+             text = buffer;
+             break;
+         case VAL_DOUBLE:
+             if (isnan(v.double_val) || isinf(v.double_val))
+             {
+                 return 0;
+             }
+             format_double(v.double_val, buffer);
+             type = TOKEN_DOUBLE;
+             text = buffer;
+             break;
+         case VAL_BOOL:
+             type = TOKEN_BOOL;
+             text = v.int_val ? "true" : "false";
+             break;
+         case VAL_STRING:
+             // A folded string that looks like a template would be expanded at run time.
+             if (strstr(v.str_val, "${") != NULL)
+             {
+                 return 0;
+             }
+             type = TOKEN_STRING;
+             text = v.str_val;
+             break;
+         default:
+             return 0;
+     }
+ 
+     char *copy = _strdup(text);
+     remove_tokens(list, start + 1, end - start - 1);
+     free(list->tokens[start].text);
+     list->tokens[start].type = type;
+     list->tokens[start].text = copy;
+     list->tokens[start].op = OP_NONE;
+     list->tokens[start].quick = QUICK_NONE;
+     return 1;
+ }
+ 
+ /*
+  * Evaluates the tokens from start at the given level without side effects.
+  * When stop is not -1 the expression must end exactly at stop.  If the tokens
+  * form a constant expression they are replaced by its value.
+  */
+ static int fold_range(TokenList *list, int start, int stop, ExprLevel level)
+ {
+     AstTokenType stop_type = TOKEN_EOF;
+ 
+     // Temporarily end the token list at stop.
+     if (stop >= 0)
+     {
+         stop_type = list->tokens[stop].type;
+         list->tokens[stop].type = TOKEN_EOF;
+     }
+ 
+     int saved_return_flag = return_flag;
+     Value saved_return_value = return_value;
+     Parser parser;
+     parser.tokens = list;
+     parser.pos = start;
+ 
+     return_value = make_int(0);
+     fold_mode = 1;
+     fold_failed = 0;
+     Value v = parse_at_level(&parser, level);
+     fold_mode = 0;
+     return_flag = saved_return_flag;
+     return_value = saved_return_value;
+ 
+     if (stop >= 0)
+     {
+         list->tokens[stop].type = stop_type;
+     }
+ 
+     int folded = 0;
+ 
+     if (!fold_failed && parser.pos - start > 1 && (stop < 0 || parser.pos == stop))
+     {
+         folded = replace_with_literal(list, start, parser.pos, v);
+     }
+ 
+     if (v.type == VAL_STRING && v.temp)
+     {
+         free_value(v);
+     }
+ 
+     return folded;
+ }
+ 
+ /*
+  * Tries to fold the operand starting at index start.  Each level is tried from
+  * the loosest to the tightest, first as a whole and then as each left hand
+  * prefix that ends before one of the level's own operators, e.g. the
+  * "a" + "b" in "a" + "b" + name.
+  */
+ static int fold_operand(TokenList *list, int start, ExprLevel level)
+ {
+     for (int lvl = level; lvl <= LEVEL_UNARY; lvl++)
+     {
+         if (fold_range(list, start, -1, lvl))
+         {
+             return 1;
+         }
+ 
+         if (lvl == LEVEL_ASSIGNMENT)
+         {
+             continue;
+         }
+ 
+         // Find this level's operators at the top nesting depth.
+         int stops[64];
+         int stop_count = 0;
+         int depth = 0;
+ 
+         for (int i = start + 1; i < list->count && stop_count < 64; i++)
+         {
+             AstTokenType type = list->tokens[i].type;
+ 
+             if (type == TOKEN_LPAREN || type == TOKEN_LBRACKET)
+             {
+                 depth++;
+             }
+             else if (type == TOKEN_RPAREN || type == TOKEN_RBRACKET)
+             {
+                 if (--depth < 0)
+                 {
+                     break;
+                 }
+             }
+             else if (type != TOKEN_OPERATOR && type != TOKEN_INT && type != TOKEN_DOUBLE &&
+                      type != TOKEN_STRING && type != TOKEN_BOOL && type != TOKEN_IDENTIFIER &&
+                      (depth == 0 || type != TOKEN_COMMA))
+             {
+                 break;
+             }
+             else if (depth == 0 && is_binary_operator(list, i))
+             {
+                 int op_level = binary_operator_level(list->tokens[i].op);
+ 
+                 if (op_level < lvl)
+                 {
+                     break;
+                 }
+ 
+                 if (op_level == lvl)
+                 {
+                     stops[stop_count++] = i;
+                 }
+             }
+         }
+ 
+         // Longest prefix first.
+         for (int i = stop_count - 1; i >= 0; i--)
+         {
+             if (fold_range(list, start, stops[i], lvl))
+             {
+                 return 1;
+             }
+         }
+     }
+ 
+     return 0;
+ }
+ 
+ /*
+  * Finds the index of the '}' that matches the '{' at index open, or -1.
+  */
+ static int find_matching_brace(const TokenList *list, int open)
+ {
+     int depth = 0;
+ 
+     for (int i = open; i < list->count; i++)
+     {
+         if (list->tokens[i].type == TOKEN_LBRACE)
+         {
+             depth++;
+         }
+         else if (list->tokens[i].type == TOKEN_RBRACE && --depth == 0)
+         {
+             return i;
+         }
+     }
+ 
+     return -1;
+ }
+ 
+ /*
+  * If tokens[i] starts "if (<literal>) {" or "while (<literal>) {" with an int
+  * or bool literal, stores the literal's truth in *truth.
+  */
+ static int is_constant_condition(const TokenList *list, int i, int *truth)
+ {
+     if (i + 4 >= list->count ||
+         list->tokens[i + 1].type != TOKEN_LPAREN ||
+         list->tokens[i + 3].type != TOKEN_RPAREN ||
+         list->tokens[i + 4].type != TOKEN_LBRACE)
+     {
+         return 0;
+     }
+ 
+     const Token *lit = &list->tokens[i + 2];
+ 
+     if (lit->type == TOKEN_INT)
+     {
+         *truth = atoi(lit->text) != 0;
+         return 1;
+     }
+ 
+     if (lit->type == TOKEN_BOOL)
+     {
+         *truth = strcmp(lit->text, "true") == 0;
+         return 1;
+     }
+ 
+     return 0;
+ }
+ 
+ /*
+  * Removes if/else if branches whose condition is a constant and while loops
+  * that can never run.  Returns 1 if anything was removed.
+  */
+ static int eliminate_dead_branches(TokenList *list)
+ {
+     int changed = 0;
+ 
+     for (int i = 0; i < list->count; i++)
+     {
+         AstTokenType type = list->tokens[i].type;
+         int truth;
+ 
+         if ((type != TOKEN_IF && type != TOKEN_WHILE) || !is_constant_condition(list, i, &truth))
+         {
+             continue;
+         }
+ 
+         int close = find_matching_brace(list, i + 4);
+ 
+         if (close < 0)
+         {
+             continue;
+         }
+ 
+         if (type == TOKEN_WHILE)
+         {
+             if (!truth)
+             {
+                 remove_tokens(list, i, close - i + 1);
+                 i--;
+                 changed = 1;
+             }
+             continue;
+         }
+ 
+         int after_else = i > 0 && list->tokens[i - 1].type == TOKEN_ELSE;
+ 
+         if (truth)
+         {
+             // Drop every clause after the block, then the "if (true)" itself,
+             // leaving the block.
+             int end = close + 1;
+ 
+             while (end < list->count && list->tokens[end].type == TOKEN_ELSE)
+             {
+                 int j = end + 1;
+ 
+                 if (j < list->count && list->tokens[j].type == TOKEN_IF)
+                 {
+                     // Skip the else if condition up to its block.
+                     while (j < list->count && list->tokens[j].type != TOKEN_LBRACE)
+                     {
+                         j++;
+                     }
+                 }
+ 
+                 if (j >= list->count || list->tokens[j].type != TOKEN_LBRACE)
+                 {
+                     break;
+                 }
+ 
+                 int clause_close = find_matching_brace(list, j);
+ 
+                 if (clause_close < 0)
+                 {
+                     break;
+                 }
+ 
+                 end = clause_close + 1;
+             }
+ 
+             remove_tokens(list, close + 1, end - close - 1);
+             remove_tokens(list, i, 4);
+         }
+         else
+         {
+             int end = close + 1;
+ 
+             if (end < list->count && list->tokens[end].type == TOKEN_ELSE)
+             {
+                 // The else (or else if) takes this branch's place.
+                 remove_tokens(list, i, end - i + 1);
+             }
+             else
+             {
+                 remove_tokens(list, i, end - i);
+ 
+                 // A dangling "else" before a removed "else if" goes too.
+                 if (after_else)
+                 {
+                     remove_tokens(list, i - 1, 1);
+                     i--;
+                 }
+             }
+         }
+ 
+         i--;
+         changed = 1;
+     }
+ 
+     return changed;
+ }
+ 
+ /*
+  * Returns the index just past an if/else if/else chain starting at the
+  * "if" token at i, or -1 if the chain is malformed.  Brackets must already
+  * be linked.
+  */
+ static int if_chain_end(TokenList *list, int i)
+ {
+     while (1)
+     {
+         // if ( ... ) { ... }
+         if (list->tokens[i + 1].type != TOKEN_LPAREN || list->tokens[i + 1].match < 0)
+         {
+             return -1;
+         }
+ 
+         i = list->tokens[i + 1].match + 1;
+ 
+         if (list->tokens[i].type != TOKEN_LBRACE || list->tokens[i].match < 0)
+         {
+             return -1;
+         }
+ 
+         i = list->tokens[i].match + 1;
+ 
+         if (list->tokens[i].type != TOKEN_ELSE)
+         {
+             return i;
+         }
+ 
+         i++;
+ 
+         if (list->tokens[i].type == TOKEN_LBRACE)
+         {
+             return list->tokens[i].match < 0 ? -1 : list->tokens[i].match + 1;
+         }
+         else if (list->tokens[i].type != TOKEN_IF)
+         {
+             return -1;
+         }
+     }
+ }
+ 
+ /*
+  * Returns the index just past the right operand of the binary operator at i,
+  * i.e. the first token at the same bracket depth that the operator's own
+  * parse loop would stop at.  Brackets must already be linked.
+  */
+ static int operand_end(const TokenList *list, int i)
+ {
+     ExprLevel level = binary_operator_level(list->tokens[i].op);
+     int j = i + 1;
+ 
+     while (j < list->count)
+     {
+         const Token *tok = &list->tokens[j];
+ 
+         switch (tok->type)
+         {
+             case TOKEN_LPAREN:
+             case TOKEN_LBRACKET:
+             case TOKEN_LBRACE:
+                 if (tok->match <= j)
+                 {
+                     return -1;
+                 }
+                 j = tok->match + 1;
+                 continue;
+             case TOKEN_OPERATOR:
+                 if (is_binary_operator(list, j) && binary_operator_level(tok->op) <= level)
+                 {
+                     return j;
+                 }
+                 break;
+             case TOKEN_INT:
+             case TOKEN_DOUBLE:
+             case TOKEN_STRING:
+             case TOKEN_BOOL:
+             case TOKEN_IDENTIFIER:
+                 break;
+             default:
+                 return j;
+         }
+ 
+         j++;
+     }
+ 
+     return -1;
+ }
+ 
+ /*
+  * Fills in the jump targets the statement parser uses instead of scanning
+  * for braces at run time: brackets point at their partner, "if" points just
+  * past its whole else chain, "for" points at the ';' ending its condition and
+  * "&&" and "||" point past their right operand so it can be skipped.
+  * Anything left unmatched jumps to the end of the script so the parser's
+  * own error checks report it.
+  */
+ static void link_jumps(TokenList *list)
+ {
+     int stack[MAX_TOKENS];
+     int depth = 0;
+     int eof = list->count - 1;
+ 
+     for (int i = 0; i < list->count; i++)
+     {
+         Token *tok = &list->tokens[i];
+         tok->match = -1;
+ 
+         if (tok->type == TOKEN_LPAREN || tok->type == TOKEN_LBRACKET || tok->type == TOKEN_LBRACE)
+         {
+             stack[depth++] = i;
+         }
+         else if (tok->type == TOKEN_RPAREN || tok->type == TOKEN_RBRACKET || tok->type == TOKEN_RBRACE)
+         {
+             AstTokenType open = tok->type == TOKEN_RPAREN ? TOKEN_LPAREN :
+                                 tok->type == TOKEN_RBRACKET ? TOKEN_LBRACKET : TOKEN_LBRACE;
+ 
+             if (depth > 0 && list->tokens[stack[depth - 1]].type == open)
+             {
+                 depth--;
+                 tok->match = stack[depth];
+                 list->tokens[stack[depth]].match = i;
+             }
+         }
+     }
+ 
+     // Openers that were never closed.
+     while (depth > 0)
+     {
+         list->tokens[stack[--depth]].match = eof;
+     }
+ 
+     for (int i = 0; i < eof; i++)
+     {
+         Token *tok = &list->tokens[i];
+ 
+         if (tok->type == TOKEN_IF)
+         {
+             int end = if_chain_end(list, i);
+             tok->match = end < 0 ? eof : end;
+         }
+         else if (tok->op == OP_AND || tok->op == OP_OR)
+         {
+             tok->match = operand_end(list, i);
+         }
+         else if (tok->type == TOKEN_FOR && list->tokens[i + 1].type == TOKEN_LPAREN)
+         {
+             // The second ';' at the top level of the header ends the condition.
+             int semicolons = 0;
+             int close = list->tokens[i + 1].match;
+ 
+             for (int j = i + 2; j < close; j++)
+             {
+                 AstTokenType type = list->tokens[j].type;
+ 
+                 if ((type == TOKEN_LPAREN || type == TOKEN_LBRACKET || type == TOKEN_LBRACE) &&
+                     list->tokens[j].match > j)
+                 {
+                     j = list->tokens[j].match;
+                 }
+                 else if (type == TOKEN_SEMICOLON && ++semicolons == 2)
+                 {
+                     tok->match = j;
+                     break;
+                 }
+             }
+         }
+     }
+ }
+ 
+ /* ============================================================
+     Modules
+    ============================================================ */
+ 
+ /* A script file brought in with import.  It's compiled once and the tokens
+    are shared by every script importing it until the file changes. */
+ typedef struct Module
+ {
+     char *path;
+     TokenList *tokens;
+     time_t modified;        /* The file's mtime and size when last checked */
+     long size;
+     unsigned int hash;      /* FNV-1a hash of the source */
+     int loading;            /* Being compiled, so importing it again is a cycle */
+     const Function **functions; /* Its own functions, then those it imports */
+     int function_count;
+     struct Module *next;
+ } Module;
+ 
+ static Module *modules = NULL;
+ /* Versions replaced after their file changed.  Scripts compiled against them
+    still call their functions, so they live until free_modules. */
+ static Module *replaced_modules = NULL;
+ static int module_depth = 0;    /* Modules being compiled */
+ 
+ /*
+  * FNV-1a hash of a module's source.
+  */
+ static unsigned int source_hash(const char *src, long size)
+ {
+     unsigned int hash = 2166136261u;
+ 
+     for (long i = 0; i < size; i++)
+     {
+         hash ^= (unsigned char)src[i];
+         hash *= 16777619u;
+     }
+     return hash;
+ }
+ 
+ /*
+  * Reads a module's source into a string the caller frees, setting size to
+  * its length.  Returns NULL if the file can't be read.
+  */
+ static char *read_module(const char *path, long *size)
+ {
+     FILE *file = fopen(path, "rb");
+ 
+     if (!file)
+     {
+         return NULL;
+     }
+ 
+     fseek(file, 0, SEEK_END);
+     long length = ftell(file);
+     rewind(file);
+ 
+     char *src = length >= 0 ? malloc(length + 1) : NULL;
+ 
+     if (src)
+     {
+         *size = (long)fread(src, 1, length, file);
+         src[*size] = '\0';
+     }
+     fclose(file);
+     return src;
+ }
+ 
+ /*
+  * The cached module for a path, or NULL if it hasn't been imported.
+  */
+ static Module *find_module(const char *path)
+ {
+     for (Module *module = modules; module; module = module->next)
+     {
+         if (strcmp(module->path, path) == 0)
+         {
+             return module;
+         }
+     }
+     return NULL;
+ }
+ 
+ /*
+  * Frees a module's tokens along with what compile() attached to them.
+  */
+ static void free_module(Module *module)
+ {
+     for (int i = 0; i < module->tokens->count; i++)
+     {
+         free(module->tokens->tokens[i].text);
+         vm_free(module->tokens->tokens[i].code);
+         switch_free(module->tokens->tokens[i].table);
+         if (module->tokens->tokens[i].type == TOKEN_FUNCTION)
+         {
+             free((Function *)module->tokens->tokens[i].function);
+         }
+     }
+     free(module->tokens);
+     free(module->functions);
+     free(module->path);
+     free(module);
+ }
+ 
+ /*
+  * Removes a module from the cache list it's in.
+  */
+ static void unlink_module(Module **list, Module *module)
+ {
+     while (*list != module)
+     {
+         list = &(*list)->next;
+     }
+     *list = module->next;
+ }
+ 
+ /*
+  * Frees every cached module.  Scripts compiled before this can't run after
+  * it, their calls may point into the modules.
+  */
+ void free_modules(void)
+ {
+     Module *lists[] = { modules, replaced_modules };
+ 
+     for (int i = 0; i < 2; i++)
+     {
+         while (lists[i])
+         {
+             Module *next = lists[i]->next;
+             free_module(lists[i]);
+             lists[i] = next;
+         }
+     }
+     modules = NULL;
+     replaced_modules = NULL;
+ }
+ 
+ /*
+  * Adds a function to those a module exports, once.
+  */
+ static void export_function(Module *module, const Function *fn)
+ {
+     for (int i = 0; i < module->function_count; i++)
+     {
+         if (module->functions[i] == fn)
+         {
+             return;
+         }
+     }
+ 
+     const Function **grown = realloc(module->functions, (module->function_count + 1) * sizeof(Function *));
+ 
+     if (grown)
+     {
+         module->functions = grown;
+         module->functions[module->function_count++] = fn;
+     }
+ }
+ 
+ /*
+  * Lists the functions a freshly compiled module exports: its own, then
+  * everything the modules it imports export.
+  */
+ static void export_functions(Module *module)
+ {
+     TokenList *list = module->tokens;
+ 
+     for (int i = 0; i < list->count - 1; i++)
+     {
+         if (list->tokens[i].type == TOKEN_FUNCTION)
+         {
+             export_function(module, list->tokens[i].function);
+         }
+     }
+ 
+     for (int i = 0; i < list->count - 1; i++)
+     {
+         const Module *imported = list->tokens[i].type == TOKEN_IMPORT ? find_module(list->tokens[i + 1].text) : NULL;
+ 
+         for (int j = 0; imported && j < imported->function_count; j++)
+         {
+             export_function(module, imported->functions[j]);
+         }
+     }
+ }
+ 
+ /*
+  * Returns the compiled module for a path.  The cached copy is used while the
+  * file's mtime and size are unchanged; when they change the file is read
+  * again, and only compiled again if its content hash differs.  Returns NULL
+  * after raising an error.
+  */
+ static Module *load_module(const char *path)
+ {
+     Module *cached = find_module(path);
+     struct stat info;
+ 
+     if (cached && cached->loading)
+     {
+         raise_error("Parser error: \"%s\" imports itself.\n", path);
+         return NULL;
+     }
+     if (stat(path, &info) != 0)
+     {
+         raise_error("Runtime error: Can't import \"%s\", the file wasn't found.\n", path);
+         return NULL;
+     }
+     if (cached && cached->modified == info.st_mtime && cached->size == (long)info.st_size)
+     {
+         return cached;
+     }
+ 
+     long size = 0;
+     char *src = read_module(path, &size);
+ 
+     if (!src)
+     {
+         raise_error("Runtime error: Can't import \"%s\", the file couldn't be read.\n", path);
+         return NULL;
+     }
+ 
+     unsigned int hash = source_hash(src, size);
+ 
+     // Saved again without changes, the compiled tokens are still good.
+     if (cached && cached->hash == hash && cached->size == size)
+     {
+         cached->modified = info.st_mtime;
+         free(src);
+         return cached;
+     }
+ 
+     Module *module = calloc(1, sizeof(Module));
+     TokenList *tokens = malloc(sizeof(TokenList));
+ 
+     if (!module || !tokens)
+     {
+         free(module);
+         free(tokens);
+         free(src);
+         raise_error("Memory allocation error in load_module.");
+         return NULL;
+     }
+ 
+     tokens->count = 0;
+     module->path = _strdup(path);
+     module->tokens = tokens;
+     module->modified = info.st_mtime;
+     module->size = size;
+     module->hash = hash;
+     module->loading = 1;
+     module->next = modules;
+     modules = module;
+ 
+     module_depth++;
+     tokenize(src, tokens);
+     if (!return_flag)
+     {
+         compile(tokens);
+     }
+     module_depth--;
+     free(src);
+     module->loading = 0;
+ 
+     if (return_flag)
+     {
+         unlink_module(&modules, module);
+         free_module(module);
+         return NULL;
+     }
+ 
+     export_functions(module);
+ 
+     if (cached)
+     {
+         unlink_module(&modules, cached);
+         cached->next = replaced_modules;
+         replaced_modules = cached;
+     }
+     return module;
+ }
+ 
+ /*
+  * Loads the modules a script imports, which it does at its top level:
+  *
+  *     import "path";
+  *
+  * Returns 0 after raising an error.
+  */
+ static int import_modules(TokenList *list)
+ {
+     int depth = 0;
+ 
+     for (int i = 0; i < list->count - 1 && !return_flag; i++)
      {
-         advance(p); // consume "if"
-         expect(p, TOKEN_LPAREN, "Expected '(' after if");
-         Value cond = parse_assignment(p);
-         expect(p, TOKEN_RPAREN, "Expected ')' after if condition");
+         Token *tok = &list->tokens[i];
  
-         int condition_true = 0;
-         if (cond.type == VAL_INT || cond.type == VAL_BOOL)
+         if (tok->type == TOKEN_LBRACE)
          {
-             condition_true = (cond.int_val != 0);
+             depth++;
          }
-         else
+         else if (tok->type == TOKEN_RBRACE)
          {
-             raise_error("Runtime error: if condition must be int or bool.\n");
-             return;
+             depth--;
+         }
+         else if (tok->type == TOKEN_IMPORT)
+         {
+             if (depth != 0)
+             {
+                 raise_error("Parser error: Modules can only be imported at the top level of a script.\n");
+             }
+             else if (list->tokens[i + 1].type != TOKEN_STRING || list->tokens[i + 2].type != TOKEN_SEMICOLON)
+             {
+                 raise_error("Parser error: Expected a file name in quotes and ';' after import, found '%s'.\n",
+                             list->tokens[i + 1].text);
+             }
+             else
+             {
+                 load_module(list->tokens[i + 1].text);
+             }
          }
+     }
  
-         if (condition_true)
+     return !return_flag;
+ }
+ 
+ /*
+  * Runs an import statement: makes the module's functions callable by name
+  * and runs its top level statements, which set the importing script's
+  * variables.  The module is reloaded if its file has changed.
+  */
+ void run_import(const char *path)
+ {
+     Module *module = load_module(path);
+ 
+     if (!module)
+     {
+         return;
+     }
+ 
+     for (int i = 0; i < module->function_count; i++)
+     {
+         add_script_function(module->functions[i]);
+     }
+ 
+     Parser parser;
+     parser.tokens = module->tokens;
+     parser.pos = 0;
+ 
+     while (current(&parser)->type != TOKEN_EOF && !return_flag)
+     {
+         parse_statement(&parser);
+     }
+ }
+ 
+ /*
+  * Finds a function by name, the script's own first and then the interop
+  * functions.  Returns NULL if there's no such function.
+  */
+ static const Function *find_function(const Function **defined, int defined_count, const char *name)
+ {
+     for (int i = 0; i < defined_count; i++)
+     {
+         if (strcmp(defined[i]->name, name) == 0)
          {
-             parse_block(p);
-             // Skip any trailing else/else if blocks.
-             while (current(p)->type == TOKEN_ELSE)
+             return defined[i];
+         }
+     }
+ 
+     for (int i = 0; interop_functions[i].name != NULL; i++)
+     {
+         if (strcmp(interop_functions[i].name, name) == 0)
+         {
+             return &interop_functions[i];
+         }
+     }
+ 
+     return NULL;
+ }
+ 
+ /*
+  * Reads the function definition at index i:
+  *
+  *     function name(param, ...) { body }
+  *
+  * Returns the function, or NULL after raising an error.  The parameter
+  * names point into the token list.
+  */
+ static Function *define_function(TokenList *list, int i)
+ {
+     int name = i + 1;
+     int open = i + 2;
+ 
+     if (list->tokens[name].type != TOKEN_IDENTIFIER || list->tokens[open].type != TOKEN_LPAREN)
+     {
+         raise_error("Parser error: Expected a name and '(' after function, found '%s'.\n", list->tokens[name].text);
+         return NULL;
+     }
+ 
+     int close = list->tokens[open].match;
+     int param_count = (close - open) / 2;
+ 
+     if (list->tokens[close].type != TOKEN_RPAREN || list->tokens[close + 1].type != TOKEN_LBRACE)
+     {
+         raise_error("Parser error: Expected '{' after the parameters of %s.\n", list->tokens[name].text);
+         return NULL;
+     }
+     if (param_count > MAX_ARGUMENTS)
+     {
+         raise_error("Parser error: %s has more than %d parameters.\n", list->tokens[name].text, MAX_ARGUMENTS);
+         return NULL;
+     }
+ 
+     // Parameters are names separated by commas.
+     for (int j = open + 1; j < close; j++)
+     {
+         AstTokenType expected = (j - open) % 2 ? TOKEN_IDENTIFIER : TOKEN_COMMA;
+ 
+         if (list->tokens[j].type != expected || (expected == TOKEN_COMMA && j + 1 == close))
+         {
+             raise_error("Parser error: Expected a parameter name in %s, found '%s'.\n",
+                         list->tokens[name].text, list->tokens[j].text);
+             return NULL;
+         }
+     }
+ 
+     // The parameter names follow the function.
+     Function *fn = calloc(1, sizeof(Function) + param_count * sizeof(char *));
+     fn->name = list->tokens[name].text;
+     fn->tokens = list;
+     fn->body = close + 1;
+     fn->param_count = param_count;
+     fn->params = (const char **)(fn + 1);
+ 
+     for (int j = 0; j < param_count; j++)
+     {
+         fn->params[j] = list->tokens[open + 1 + j * 2].text;
+     }
+ 
+     return fn;
+ }
+ 
+ /*
+  * Resolves every call to the function it calls, so a call doesn't have to
+  * look its function up by name.  The script's own functions are read first,
+  * so they can be called before their definition.
+  */
+ static void resolve_functions(TokenList *list)
+ {
+     const Function *defined[MAX_TOKENS / 4];
+     int defined_count = 0;
+     int depth = 0;
+ 
+     // Imported functions are called as if the script defined them.
+     for (int i = 0; i < list->count - 1 && !return_flag; i++)
+     {
+         const Module *module = list->tokens[i].type == TOKEN_IMPORT ? find_module(list->tokens[i + 1].text) : NULL;
+ 
+         for (int j = 0; module && j < module->function_count; j++)
+         {
+             const Function *fn = module->functions[j];
+             const Function *known = find_function(defined, defined_count, fn->name);
+ 
+             if (known == fn)
              {
-                 advance(p); // consume 'else'
-                 if (current(p)->type == TOKEN_IF)
-                 {
-                     // Consume "else if" condition tokens without evaluating.
-                     advance(p); // consume 'if'
-                     expect(p, TOKEN_LPAREN, "Expected '(' after else if");
-                     while (current(p)->type != TOKEN_RPAREN && current(p)->type != TOKEN_EOF)
-                     {
-                         advance(p);
-                     }
-                     expect(p, TOKEN_RPAREN, "Expected ')' after else if condition");
-                 }
-                 if (current(p)->type == TOKEN_LBRACE)
-                 {
-                     // Skip the block.
-                     int brace_count = 1;
-                     advance(p); // consume '{'
-                     while (brace_count > 0 && current(p)->type != TOKEN_EOF)
-                     {
-                         if (current(p)->type == TOKEN_LBRACE)
-                         {
-                             brace_count++;
-                         }
-                         else if (current(p)->type == TOKEN_RBRACE)
-                         {
-                             brace_count--;
-                         }
-                         advance(p);
-                     }
-                 }
+                 continue;
+             }
+             if (known)
+             {
+                 raise_error("Parser error: Function \"%s\" from \"%s\" is already defined.\n", fn->name, module->path);
+                 return;
              }
+             if (defined_count == MAX_TOKENS / 4)
+             {
+                 raise_error("Parser error: Too many functions defined and imported.\n");
+                 return;
+             }
+ 
+             defined[defined_count++] = fn;
+             add_script_function(fn);
          }
-         else
+     }
+ 
+     for (int i = 0; i < list->count - 1 && !return_flag; i++)
+     {
+         Token *tok = &list->tokens[i];
+ 
+         if (tok->type == TOKEN_LBRACE)
+         {
+             depth++;
+         }
+         else if (tok->type == TOKEN_RBRACE)
+         {
+             depth--;
+         }
+         else if (tok->type == TOKEN_FUNCTION)
          {
-             // If false, process the if's block as before.
-             if (current(p)->type == TOKEN_LBRACE)
+             if (depth != 0)
              {
-                 int brace_count = 1;
-                 advance(p);
-                 while (brace_count > 0 && current(p)->type != TOKEN_EOF)
-                 {
-                     if (current(p)->type == TOKEN_LBRACE)
-                         brace_count++;
-                     else if (current(p)->type == TOKEN_RBRACE)
-                         brace_count--;
-                     advance(p);
-                 }
+                 raise_error("Parser error: Functions can only be defined at the top level of a script.\n");
+                 return;
              }
-             // Process subsequent else if/else clauses normally.
-             while (current(p)->type == TOKEN_ELSE)
+ 
+             Function *fn = define_function(list, i);
+ 
+             if (fn && find_function(defined, defined_count, fn->name))
              {
-                 advance(p); // consume 'else'
-                 if (current(p)->type == TOKEN_IF)
-                 {
-                     advance(p); // consume 'if'
-                     expect(p, TOKEN_LPAREN, "Expected '(' after else if");
-                     Value cond2 = parse_assignment(p);
-                     expect(p, TOKEN_RPAREN, "Expected ')' after else if condition");
+                 raise_error("Parser error: Function \"%s\" is already defined.\n", fn->name);
+                 free(fn);
+                 fn = NULL;
+             }
+             if (fn && defined_count == MAX_TOKENS / 4)
+             {
+                 raise_error("Parser error: Too many functions defined and imported.\n");
+                 free(fn);
+                 fn = NULL;
+             }
+             if (!fn)
+             {
+                 return;
+             }
  
-                     int condition_true2 = 0;
-                     if (cond2.type == VAL_INT || cond2.type == VAL_BOOL)
-                     {
-                         condition_true2 = (cond2.int_val != 0);
-                     }
-                     else
-                     {
-                         raise_error("Runtime error: else if condition must be int or bool.\n");
-                         return;
-                     }
+             tok->function = fn;
+             defined[defined_count++] = fn;
+             add_script_function(fn);
+         }
+     }
  
-                     if (condition_true2)
-                     {
-                         parse_block(p);
-                         break;
-                     }
-                     else
-                     {
-                         // Skip the else if block.
-                         if (current(p)->type == TOKEN_LBRACE)
-                         {
-                             int brace_count = 1;
-                             advance(p);
-                             while (brace_count > 0 && current(p)->type != TOKEN_EOF)
-                             {
-                                 if (current(p)->type == TOKEN_LBRACE)
-                                     brace_count++;
-                                 else if (current(p)->type == TOKEN_RBRACE)
-                                     brace_count--;
-                                 advance(p);
-                             }
-                         }
-                         // Continue checking further else clauses.
-                     }
-                 }
-                 else
-                 {
-                     // Else branch.
-                     if (current(p)->type == TOKEN_LBRACE)
-                     {
-                         parse_block(p);
-                     }
-                     break;
+     for (int i = 0; i < list->count - 1 && !return_flag; i++)
+     {
+         Token *tok = &list->tokens[i];
+ 
+         if (tok->type == TOKEN_IDENTIFIER && list->tokens[i + 1].type == TOKEN_LPAREN &&
+             (i == 0 || list->tokens[i - 1].type != TOKEN_FUNCTION))
+         {
+             tok->function = find_function(defined, defined_count, tok->text);
+         }
+     }
+ }
+ 
+ /* Inferred types are a ValueType, or one of these. */
+ #define TYPE_UNSET -1   /* Never assigned, so reading it is an error */
+ #define TYPE_MIXED -2   /* Assigned values of more than one type */
+ 
+ /* State of the type inference pass. */
+ typedef struct
+ {
+     TokenList *list;
+     int pos;
+     int mark;               /* Record proven operators, once the types are settled */
+     int changed;            /* A variable's type grew on this pass */
+     int count;
+     const char *names[MAX_TOKENS / 2];
+     int types[MAX_TOKENS / 2];
+     unsigned char operators[MAX_TOKENS]; /* Binary operators typed, for dump_types */
+     signed char left[MAX_TOKENS];        /* and their operand types */
+     signed char right[MAX_TOKENS];
+ } TypeInference;
+ 
+ static int infer_assignment(TypeInference *t);
+ 
+ /*
+  * The least type that covers both, e.g. int and int is int, int and string
+  * is mixed.
+  */
+ static int join_types(int a, int b)
+ {
+     if (a == TYPE_UNSET || a == b)
+     {
+         return b;
+     }
+     return b == TYPE_UNSET ? a : TYPE_MIXED;
+ }
+ 
+ /*
+  * The slot holding a variable's inferred type, added as unset on first use.
+  */
+ static int *variable_type(TypeInference *t, const char *name)
+ {
+     for (int i = 0; i < t->count; i++)
+     {
+         if (strcmp(t->names[i], name) == 0)
+         {
+             return &t->types[i];
+         }
+     }
+ 
+     if (t->count == MAX_TOKENS / 2)
+     {
+         static int mixed;
+         mixed = TYPE_MIXED;
+         return &mixed;
+     }
+ 
+     t->names[t->count] = name;
+     t->types[t->count] = TYPE_UNSET;
+     return &t->types[t->count++];
+ }
+ 
+ /*
+  * Adds a type a variable is assigned to the types it holds.
+  */
+ static void assign_type(TypeInference *t, const char *name, int type)
+ {
+     int *slot = variable_type(t, name);
+     int joined = join_types(*slot, type);
+ 
+     if (joined != *slot)
+     {
+         *slot = joined;
+         t->changed = 1;
+     }
+ }
+ 
+ /*
+  * The type of "left op right", following binary_operation (or update_slot
+  * for a compound assignment).  An operand that can't be read means the
+  * operation never completes, so neither does the result.
+  */
+ static int operation_type(OperatorCode op, int left, int right)
+ {
+     if (op == OP_AND || op == OP_OR)
+     {
+         return VAL_BOOL;
+     }
+     if (left == TYPE_UNSET || right == TYPE_UNSET)
+     {
+         return TYPE_UNSET;
+     }
+ 
+     switch (op)
+     {
+         case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+         case OP_BIT_AND: case OP_BIT_OR: case OP_BIT_XOR: case OP_SHL: case OP_SHR:
+             // Comparisons give ints; the rest work on ints only.
+             return VAL_INT;
+         case OP_ADD:
+         case OP_ADD_ASSIGN:
+             if (left == VAL_STRING || right == VAL_STRING)
+             {
+                 return VAL_STRING;
+             }
+             if ((left == VAL_INT || left == VAL_DOUBLE) && (right == VAL_INT || right == VAL_DOUBLE))
+             {
+                 return left == VAL_INT && right == VAL_INT ? VAL_INT : VAL_DOUBLE;
+             }
+             return TYPE_MIXED;
+         default:
+             // -, *, / and %: double if either side is, ints otherwise.
+             if (left == VAL_INT && right == VAL_INT)
+             {
+                 return VAL_INT;
+             }
+             return left == VAL_DOUBLE || right == VAL_DOUBLE ? VAL_DOUBLE : TYPE_MIXED;
+     }
+ }
+ 
+ /*
+  * Mirrors parse_primary.
+  */
+ static int infer_primary(TypeInference *t)
+ {
+     TokenList *list = t->list;
+     Token *tok = &list->tokens[t->pos];
+ 
+     if (tok->op == OP_SUB)
+     {
+         // Unary minus works on ints only.
+         t->pos++;
+         return infer_primary(t) == TYPE_UNSET ? TYPE_UNSET : VAL_INT;
+     }
+ 
+     switch (tok->type)
+     {
+         case TOKEN_INT:
+             t->pos++;
+             return VAL_INT;
+         case TOKEN_DOUBLE:
+             t->pos++;
+             return VAL_DOUBLE;
+         case TOKEN_STRING:
+             t->pos++;
+             return VAL_STRING;
+         case TOKEN_BOOL:
+             t->pos++;
+             return VAL_BOOL;
+         case TOKEN_LBRACE:
+             // A map literal, its entries are typed where they start.
+             t->pos = tok->match > 0 ? tok->match + 1 : t->pos + 1;
+             return VAL_MAP;
+         case TOKEN_LPAREN:
+         {
+             int close = tok->match;
+             t->pos++;
+             int type = infer_assignment(t);
+             t->pos = close > 0 ? close + 1 : t->pos;
+             return type;
+         }
+         case TOKEN_IDENTIFIER:
+         {
+             Token *next = &list->tokens[t->pos + 1];
+ 
+             if (next->op == OP_INC || next->op == OP_DEC)
+             {
+                 t->pos += 2;
+                 return VAL_INT;
+             }
+             if (next->type == TOKEN_LPAREN || next->type == TOKEN_LBRACKET)
+             {
+                 // Calls and array elements could be anything.
+                 t->pos++;
+                 while (t->pos < list->count && list->tokens[t->pos].match > t->pos &&
+                        (list->tokens[t->pos].type == TOKEN_LPAREN || list->tokens[t->pos].type == TOKEN_LBRACKET))
+                 {
+                     t->pos = list->tokens[t->pos].match + 1;
                  }
+                 return TYPE_MIXED;
              }
+ 
+             t->pos++;
+             return *variable_type(t, tok->text);
          }
+         default:
+             return TYPE_MIXED;
      }
-     else if (tok->type == TOKEN_FOR)
+ }
+ 
+ /*
+  * Mirrors parse_unary.
+  */
+ static int infer_unary(TypeInference *t)
+ {
+     Token *tok = &t->list->tokens[t->pos];
+ 
+     if (tok->op == OP_NOT)
      {
-         advance(p); // consume "for"
-         expect(p, TOKEN_LPAREN, "Expected '(' after for");
+         t->pos++;
+         infer_unary(t);
+         return VAL_BOOL;
+     }
+     if ((tok->op == OP_INC || tok->op == OP_DEC) && t->list->tokens[t->pos + 1].type == TOKEN_IDENTIFIER)
+     {
+         t->pos += 2;
+         return VAL_INT;
+     }
+     return infer_primary(t);
+ }
+ 
+ /*
+  * Mirrors the parse_* loop for one level of binary operators, from
+  * parse_logical down to parse_factor, whose right operand is a primary.
+  * Once the types are settled the operators whose operands are proven to be
+  * two ints, two doubles or two strings are marked as such.
+  */
+ static int infer_binary(TypeInference *t, ExprLevel level)
+ {
+     int left = level == LEVEL_FACTOR ? infer_unary(t) : infer_binary(t, level + 1);
+ 
+     while (t->pos < t->list->count - 1)
+     {
+         int at = t->pos;
+         Token *op = &t->list->tokens[at];
  
-         /* --- Parse the initializer expression (if any) --- */
-         if (current(p)->type != TOKEN_SEMICOLON)
+         if (op->type != TOKEN_OPERATOR || binary_operator_level(op->op) != level)
          {
-             parse_assignment(p);
+             break;
          }
-         expect(p, TOKEN_SEMICOLON, "Expected ';' after for-loop initializer");
  
-         /* --- Capture the condition expression range --- */
-         int cond_start = p->pos;
-         int cond_end = cond_start;
-         while (p->pos < p->tokens->count && current(p)->type != TOKEN_SEMICOLON)
+         t->pos++;
+         int right = level == LEVEL_FACTOR ? infer_primary(t) : infer_binary(t, level + 1);
+ 
+         if (t->mark)
          {
-             cond_end++;
-             advance(p);
+             t->operators[at] = 1;
+             t->left[at] = (signed char)left;
+             t->right[at] = (signed char)right;
+ 
+             if (left == right && (left == VAL_INT || left == VAL_DOUBLE ||
+                                   (left == VAL_STRING && (op->op == OP_EQ || op->op == OP_NE))))
+             {
+                 op->quick = left == VAL_INT ? QUICK_INT : left == VAL_DOUBLE ? QUICK_DOUBLE : QUICK_STRING;
+             }
          }
-         expect(p, TOKEN_SEMICOLON, "Expected ';' after for-loop condition");
  
-         /* --- Capture the post expression range --- */
-         int post_start = p->pos;
-         int post_end = post_start;
-         while (p->pos < p->tokens->count && current(p)->type != TOKEN_RPAREN)
+         left = operation_type(op->op, left, right);
+     }
+ 
+     return left;
+ }
+ 
+ /*
+  * Mirrors parse_assignment, adding the type each assignment stores to the
+  * variable's types.
+  */
+ static int infer_assignment(TypeInference *t)
+ {
+     TokenList *list = t->list;
+     Token *tok = &list->tokens[t->pos];
+ 
+     if (tok->type == TOKEN_IDENTIFIER)
+     {
+         // Skip the indexes of an element assignment.
+         int at = t->pos + 1;
+         while (at < list->count && list->tokens[at].type == TOKEN_LBRACKET && list->tokens[at].match > at)
          {
-             post_end++;
-             advance(p);
+             at = list->tokens[at].match + 1;
          }
-         expect(p, TOKEN_RPAREN, "Expected ')' after for-loop post expression");
  
-         /* --- Parse the loop body --- */
-         expect(p, TOKEN_LBRACE, "Expected '{' to start for-loop body");
-         int block_start = p->pos; // body starts after '{'
+         OperatorCode op = at < list->count ? list->tokens[at].op : OP_NONE;
  
-         // Scan to find the matching '}'
-         int brace_count = 1;
-         int i = p->pos;
-         while (i < p->tokens->count && brace_count > 0)
+         if (op == OP_ASSIGN || IS_COMPOUND_ASSIGN(op))
          {
-             if (p->tokens->tokens[i].type == TOKEN_LBRACE)
-             {
-                 brace_count++;
-             }
-             else if (p->tokens->tokens[i].type == TOKEN_RBRACE)
+             int element = at != t->pos + 1;
+             t->pos = at + 1;
+             int right = infer_assignment(t);
+ 
+             if (element)
              {
-                 brace_count--;
+                 // Stored in the array, the variable still holds the array.
+                 return op == OP_ASSIGN ? right : operation_type(op, TYPE_MIXED, right);
              }
-             i++;
+ 
+             int type = op == OP_ASSIGN ? right : operation_type(op, *variable_type(t, tok->text), right);
+             assign_type(t, tok->text, type);
+             return type;
          }
-         int block_end = i; // token position just after the matching '}'
+     }
  
-         /* --- Execute the for loop --- */
-         while (1)
+     return infer_binary(t, LEVEL_LOGICAL);
+ }
+ 
+ /*
+  * Modules aren't typed, they're shared by scripts that use their variables
+  * differently.  So anything a module's top level statements might set,
+  * including through the modules it imports, is mixed.
+  */
+ static void infer_module(TypeInference *t, const Module *module)
+ {
+     TokenList *list = module ? module->tokens : NULL;
+ 
+     for (int i = 0; list && i < list->count - 1; i++)
+     {
+         Token *tok = &list->tokens[i];
+ 
+         if (tok->type == TOKEN_FUNCTION && tok->function)
          {
-             /* --- Evaluate the condition --- */
+             // A function's assignments are to its own locals.
+             i = list->tokens[tok->function->body].match;
+         }
+         else if (tok->type == TOKEN_IMPORT)
+         {
+             infer_module(t, find_module(list->tokens[i + 1].text));
+         }
+         else if (tok->type == TOKEN_IDENTIFIER && list->tokens[i + 1].type != TOKEN_LPAREN)
+         {
+             assign_type(t, tok->text, TYPE_MIXED);
+         }
+     }
+ }
+ 
+ /*
+  * Adds the types of the variables the statement at index i binds without an
+  * assignment: let without a value, loop variables and parameters.
+  */
+ static void infer_binding(TypeInference *t, int i)
+ {
+     Token *tokens = t->list->tokens;
+ 
+     if (i + 3 >= t->list->count)
+     {
+         return;
+     }
+ 
+     switch (tokens[i].type)
+     {
+         case TOKEN_LET:
+             if (tokens[i + 1].type == TOKEN_IDENTIFIER && tokens[i + 2].op != OP_ASSIGN)
              {
-                 Parser condParser;
-                 condParser.tokens = p->tokens;
-                 condParser.pos = cond_start;
-                 // Temporarily restrict the parser to the condition tokens.
-                 int original_count = condParser.tokens->count;
-                 condParser.tokens->count = cond_end;
-                 Value cond_val = parse_assignment(&condParser);
-                 condParser.tokens->count = original_count;
-                 if (cond_val.type != VAL_INT || cond_val.int_val == 0)
-                 {
-                     if (cond_val.type == VAL_STRING && cond_val.temp)
-                     {
-                         free_value(cond_val);
-                     }
-                     break; // condition false: exit loop
-                 }
-                 if (cond_val.type == VAL_STRING && cond_val.temp)
+                 assign_type(t, tokens[i + 1].text, VAL_NULL);
+             }
+             break;
+         case TOKEN_FOR:
+         case TOKEN_FOREACH:
+             if (tokens[i + 1].type == TOKEN_LPAREN && tokens[i + 2].type == TOKEN_IDENTIFIER &&
+                 tokens[i + 3].type == TOKEN_IDENTIFIER && strcmp(tokens[i + 3].text, "in") == 0)
+             {
+                 // A range loop counts in ints, foreach takes the array's items.
+                 assign_type(t, tokens[i + 2].text, tokens[i].type == TOKEN_FOR ? VAL_INT : TYPE_MIXED);
+             }
+             break;
+         case TOKEN_FUNCTION:
+             if (tokens[i].function)
+             {
+                 for (int p = 0; p < tokens[i].function->param_count; p++)
                  {
-                     free_value(cond_val);
+                     assign_type(t, tokens[i].function->params[p], TYPE_MIXED);
                  }
              }
+             break;
+         case TOKEN_IMPORT:
+             infer_module(t, find_module(tokens[i + 1].text));
+             break;
+         default:
+             break;
+     }
+ }
  
-             /* --- Execute the loop body --- */
+ /*
+  * Whether the identifier at index i is the "in" of a for or foreach loop,
+  * rather than a variable.
+  */
+ static int loop_in(const TokenList *list, int i)
+ {
+     return i >= 3 && strcmp(list->tokens[i].text, "in") == 0 && list->tokens[i - 2].type == TOKEN_LPAREN &&
+            (list->tokens[i - 3].type == TOKEN_FOR || list->tokens[i - 3].type == TOKEN_FOREACH);
+ }
+ 
+ /*
+  * Infers the type of every variable from all the assignments to it anywhere
+  * in the script, repeating until nothing changes since an assignment can
+  * depend on variables assigned later on.  This is flow-insensitive: a
+  * variable gets one type for the whole script, not one per statement.
+  * Variables are matched by name, so a global, a function's local and a let
+  * variable of the same name share a type, and one the host sets is mixed.
+  * Then marks each variable read with its type when it has a single one, and
+  * each binary operator whose operands are proven to be two ints, two
+  * doubles or two strings, so the first run of the operator already takes
+  * its fast path and the loop VM can compile it without type checks.
+  */
+ static void infer_types(TokenList *list, TypeInference *t)
+ {
+     int widened;
+ 
+     memset(t, 0, sizeof(*t));
+     t->list = list;
+ 
+     do
+     {
+         do
+         {
+             t->changed = 0;
+ 
+             for (int i = 0; i < list->count - 1; i++)
              {
-                 Parser bodyParser;
-                 bodyParser.tokens = p->tokens;
-                 bodyParser.pos = block_start;
-                 while (bodyParser.pos < block_end &&
-                     current(&bodyParser)->type != TOKEN_RBRACE &&
-                     !return_flag && !continue_flag && !break_flag)
+                 infer_binding(t, i);
+ 
+                 if (list->tokens[i].type == TOKEN_IDENTIFIER && !loop_in(list, i))
                  {
-                     parse_statement(&bodyParser);
+                     t->pos = i;
+                     infer_assignment(t);
                  }
              }
+         } while (t->changed);
  
-             if (break_flag)
-             {
-                 break_flag = 0;
-                 break;
-             }
-             if (continue_flag)
-             {
-                 continue_flag = 0;
-             }
-             if (return_flag)
+         // A variable the script reads without ever assigning it must have been
+         // set by the host, as may one that already exists, so either can hold
+         // anything.  What was inferred from them is worked out again.
+         widened = 0;
+         for (int i = 0; i < t->count; i++)
+         {
+             if (t->types[i] != TYPE_MIXED && (t->types[i] == TYPE_UNSET || find_variable(t->names[i])))
              {
-                 break;
+                 t->types[i] = TYPE_MIXED;
+                 widened = 1;
              }
+         }
+     } while (widened);
  
-             /* --- Execute the post expression --- */
+     t->mark = 1;
+ 
+     for (int i = 0; i < list->count - 1; i++)
+     {
+         Token *tok = &list->tokens[i];
+ 
+         if (tok->type == TOKEN_IDENTIFIER && list->tokens[i + 1].type != TOKEN_LPAREN)
+         {
+             switch (*variable_type(t, tok->text))
              {
-                 Parser postParser;
-                 postParser.tokens = p->tokens;
-                 postParser.pos = post_start;
-                 int original_post_count = postParser.tokens->count;
-                 postParser.tokens->count = post_end;
-                 Value post_val = parse_assignment(&postParser);
-                 postParser.tokens->count = original_post_count;
-                 post_val.temp = 0; // mark as non-temporary
-                 if (post_val.type == VAL_STRING && post_val.temp)
-                 {
-                     free_value(post_val);
-                 }
+                 case VAL_INT:    tok->quick = QUICK_INT; break;
+                 case VAL_DOUBLE: tok->quick = QUICK_DOUBLE; break;
+                 case VAL_STRING: tok->quick = QUICK_STRING; break;
+                 default:         break;
              }
          }
- 
-         // Skip the entire for-loop block.
-         p->pos = block_end;
+         if (operand_level(list, i) == LEVEL_ASSIGNMENT)
+         {
+             t->pos = i;
+             infer_assignment(t);
+         }
      }
-     else if (tok->type == TOKEN_WHILE)
+ }
+ 
+ /*
+  * Compiles a tokenized script: loads the modules it imports, folds constant
+  * expressions (including calls to pure interop functions) into literals,
+  * removes branches that can never run and links the jump targets used by the
+  * statement parser.  Then infers the variables' types, see infer_types;
+  * modules are left untyped.
+  */
+ void compile(TokenList *list)
+ {
+     // The previous script's functions may have been freed with its tokens.
+     // A module compiled while a script runs keeps the script's.
+     if (module_depth == 0)
      {
-         // Consume the "while" keyword.
-         advance(p);
-         expect(p, TOKEN_LPAREN, "Expected '(' after while");
+         clear_script_functions();
+     }
  
-         // Save the starting position of the condition.
-         int cond_start = p->pos;
+     if (list->count == 0 || list->tokens[list->count - 1].type != TOKEN_EOF || !import_modules(list))
+     {
+         return;
+     }
  
-         // Parse the condition once (for syntax checking).
+     do
+     {
+         for (int i = 0; i < list->count - 1; i++)
          {
-             Value dummy_cond = parse_assignment(p);
+             int level = operand_level(list, i);
  
-             if (dummy_cond.type == VAL_STRING && dummy_cond.temp)
+             if (level >= 0)
              {
-                 free_value(dummy_cond);
+                 fold_operand(list, i, level);
              }
          }
-         expect(p, TOKEN_RPAREN, "Expected ')' after while condition");
+     } while (eliminate_dead_branches(list));
  
-         // Expect a block for the loop body.
-         expect(p, TOKEN_LBRACE, "Expected '{' to start while-loop body");
+     link_jumps(list);
+     resolve_functions(list);
+ 
+     if (!return_flag && module_depth == 0)
+     {
+         static TypeInference inference;
+         infer_types(list, &inference);
+     }
+ }
+ 
+ /*
+  * The name dump_types shows for an inferred type.
+  */
+ static const char *type_name(int type)
+ {
+     static const char *names[] = { "int", "string", "bool", "double", "date", "array", "set", "map", "typed array", "null", "error" };
+ 
+     if (type == TYPE_UNSET)
+     {
+         return "unset";
+     }
+     return type == TYPE_MIXED ? "mixed" : names[type];
+ }
+ 
+ /*
+  * Prints what type inference proved about a script, for arcane --types: the
+  * type of each variable, and each binary operator with its operand types.
+  * Operators marked generic take the checked path at run time.  Returns 0
+  * after reporting the error if the script doesn't compile.
+  */
+ int dump_types(const char *src)
+ {
+     TokenList *tokens = malloc(sizeof(TokenList));
+     TypeInference *t = malloc(sizeof(TypeInference));
+ 
+     if (!tokens || !t)
+     {
+         free(tokens);
+         free(t);
+         raise_error("Memory allocation error in dump_types.");
+         return 0;
+     }
  
-         // Consume the '{' and record the start of the body.
-         int block_start = p->pos;
+     return_flag = 0;
+     return_value = make_null();
+     tokens->count = 0;
+     tokenize(src, tokens);
+     compile(tokens);
+     int compiled = !return_flag;
  
-         // Find the matching '}' to determine the end of the block.
-         int brace_count = 1;
-         int i = p->pos;
+     if (compiled)
+     {
+         infer_types(tokens, t);
  
-         while (i < p->tokens->count && brace_count > 0)
+         printf("Variables (one type for the whole script, not per statement):\n");
+         for (int i = 0; i < t->count; i++)
          {
-             if (p->tokens->tokens[i].type == TOKEN_LBRACE)
-             {
-                 brace_count++;
-             }
-             else if (p->tokens->tokens[i].type == TOKEN_RBRACE)
+             if (t->types[i] != TYPE_UNSET)
              {
-                 brace_count--;
+                 printf("    %-24s %s\n", t->names[i], type_name(t->types[i]));
              }
- 
-             i++;
          }
-         int block_end = i; // token index just after the matching '}'
  
-         // --- Execute the while loop ---
-         while (1)
+         printf("\nOperators:\n");
+         for (int i = 1; i < tokens->count - 1; i++)
          {
-             // Create a temporary parser for the condition, starting at cond_start.
-             Parser condParser;
-             condParser.tokens = p->tokens;
-             condParser.pos = cond_start;
-             Value cond_val = parse_assignment(&condParser);
-             // Determine truth: accept both int and bool.
-             int loop_true = 0;
-             if (cond_val.type == VAL_INT || cond_val.type == VAL_BOOL)
-             {
-                 loop_true = (cond_val.int_val != 0);
-             }
-             else
-             {
-                 raise_error("Runtime error: while condition must be int or bool.\n");
-                 return;
-             }
-             if (cond_val.type == VAL_STRING && cond_val.temp)
-             {
-                 free_value(cond_val);
-             }
-             if (!loop_true)
+             if (!t->operators[i])
              {
-                 break; // exit loop if condition is false
+                 continue;
              }
  
-             // Execute the loop body using a temporary parser.
-             {
-                 Parser bodyParser;
-                 bodyParser.tokens = p->tokens;
-                 bodyParser.pos = block_start;
-                 // Execute until we reach the token just before the closing '}'.
-                 while (bodyParser.pos < block_end &&
-                     current(&bodyParser)->type != TOKEN_RBRACE &&
-                     current(&bodyParser)->type != TOKEN_EOF &&
-                     !return_flag &&
-                     !continue_flag &&
-                     !break_flag)
-                 {
-                     parse_statement(&bodyParser);
-                 }
-             }
+             char expression[64];
+             snprintf(expression, sizeof(expression), "%s %s %s", tokens->tokens[i - 1].text,
+                      tokens->tokens[i].text, tokens->tokens[i + 1].text);
  
-             // If a break was executed, reset the flag and exit the loop.
-             if (break_flag)
+             if (tokens->tokens[i].quick == QUICK_NONE)
              {
-                 break_flag = 0;
-                 break;
+                 printf("    %-24s generic: %s, %s\n", expression, type_name(t->left[i]), type_name(t->right[i]));
              }
- 
-             // If a continue was executed in the loop body, reset the flag.
-             if (continue_flag)
+             else
              {
-                 continue_flag = 0;
+                 printf("    %-24s %s\n", expression, type_name(t->left[i]));
              }
          }
- 
-         // Advance the main parser position to after the loop block.
-         p->pos = block_end;
-     }
-     else if (tok->type == TOKEN_CONTINUE)
-     {
-         advance(p);
-         expect(p, TOKEN_SEMICOLON, "Expected ';' after continue statement");
-         continue_flag = 1;
-         return;
-     }
-     else if (tok->type == TOKEN_BREAK)
-     {
-         advance(p); // consume 'break'
-         expect(p, TOKEN_SEMICOLON, "Expected ';' after break statement");
-         break_flag = 1;
-         return;
      }
-     else
+ 
+     for (int i = 0; i < tokens->count; i++)
      {
-         /* Expression statement */
-         Value v = parse_assignment(p);
-         expect(p, TOKEN_SEMICOLON, "Expected ';' after expression statement");
-         if (v.type == VAL_STRING && v.temp)
+         free(tokens->tokens[i].text);
+         if (tokens->tokens[i].type == TOKEN_FUNCTION)
          {
-             free_value(v);
+             free((Function *)tokens->tokens[i].function);
          }
      }
+     free(tokens);
+     free(t);
+     return compiled;
  }
  
  /**
@@ -1796,6 +6140,7 @@ Value interpret(const char *src)  // Add a timeout parameter (ms)
     parser.pos = 0;
     return_flag = 0;
     return_value = make_null();
+    compile(tokens);
     int timeout_ms = 0;  // Timeout in milliseconds, 0 means no timeout    
     clock_t start_time = clock();
     clock_t current_time;
@@ -1822,6 +6167,12 @@ Value interpret(const char *src)  // Add a timeout parameter (ms)
     for (int i = 0; i < tokens->count; i++)
     {
          free(tokens->tokens[i].text);
+         vm_free(tokens->tokens[i].code);
+         switch_free(tokens->tokens[i].table);
+         if (tokens->tokens[i].type == TOKEN_FUNCTION)
+         {
+             free((Function *)tokens->tokens[i].function);
+         }
     }
     free(tokens);
 
@@ -1833,6 +6184,9 @@ Value interpret(const char *src)  // Add a timeout parameter (ms)
         printf("\n%s", HEADER);
         printf("| Script execution time: %.0fms\n", elapsed_ms);
         printf("| %d/%d tokens used.\n", tokens->count, MAX_TOKENS);
+#ifdef ARCANE_VM_STATS
+        printf("| %lld loop VM instructions dispatched.\n", vm_dispatches);
+#endif
         printf("%s\n", HEADER);    
     }
 
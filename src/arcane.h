@@ -51,6 +51,10 @@ typedef struct {
  #define MAX_STRING_LENGTH 4608
  #define MSL MAX_STRING_LENGTH
  #define MAX_TOKENS 2048
+ #define MAX_ARGUMENTS 16   /* Most arguments a call can pass */
+ #define MAX_LOCALS 32      /* Most variables a script function call can have */
+ #define MAX_CALL_DEPTH 100 /* Most script function calls in progress at once */
+ #define MAX_BLOCK_LOCALS 256 /* Most let variables alive at once */
  #define HEADER "+------------------------------------------------------------------------------+\n\r"
  #define DEBUG TRUE
 
@@ -68,6 +72,9 @@ typedef struct {
      VAL_DOUBLE,
      VAL_DATE,
      VAL_ARRAY,
+     VAL_SET,
+     VAL_MAP,
+     VAL_TYPED_ARRAY,
      VAL_NULL,
      VAL_ERROR
  } ValueType;
@@ -75,11 +82,71 @@ typedef struct {
  // Forward reference for dependency.
  typedef struct Value Value;
 
+ /* Items shared by an array and the slices taken from it.  Any of them that's
+    written to while they're shared copies its items out first (see array_own). */
+ typedef struct ArrayStorage {
+    Value *items;
+    int length;
+    int refs;               /* arrays using the items */
+} ArrayStorage;
+
  typedef struct Array {
     Value *items;
     int length;
+    ArrayStorage *shared;   /* NULL when the array owns its items */
 } Array;
 
+ /* A case-insensitive set of words.  Items are kept in insertion order so a set
+    can be turned back into a space separated list, while the open addressing
+    index gives O(1) membership tests. */
+ typedef struct StringSet {
+    char **items;           /* insertion ordered, NULL where an item was removed */
+    unsigned int *hashes;   /* cached hash for each entry in items */
+    int used;               /* number of slots used in items (including removed) */
+    int count;              /* number of live items */
+    int capacity;           /* allocated size of items and hashes */
+    int *index;             /* -1 = empty, -2 = deleted, otherwise a position in items */
+    int index_size;         /* always a power of two */
+} StringSet;
+
+ /* A slot of a map's open addressing index.  It keeps a copy of the entry's
+    hash, so a probe only leaves the index once the hashes match. */
+ typedef struct MapSlot {
+    unsigned int hash;
+    int entry;              /* -1 = empty, -2 = deleted, otherwise a position in entries */
+} MapSlot;
+
+ /* A map from string or int keys to values.  Entries are kept in insertion
+    order, which is the order foreach visits them in. */
+ typedef struct Map {
+    struct MapEntry *entries; /* insertion ordered, the key is null where an entry was removed */
+    int used;               /* number of entries used (including removed) */
+    int count;              /* number of live entries */
+    int capacity;           /* allocated size of entries */
+    MapSlot *index;
+    int index_size;         /* always a power of two */
+} Map;
+
+ typedef enum
+ {
+     TYPED_INT,
+     TYPED_DOUBLE
+ } TypedKind;
+
+ /* A packed array of ints or doubles (see typed.c).  A host can read and write
+    the elements in place, or wrap its own buffer, in which case owned is 0. */
+ typedef struct TypedArray {
+    TypedKind kind;
+    int length;
+    int owned;              /* 1 = data is freed with the array */
+    union
+    {
+        int *ints;
+        double *doubles;
+        void *data;
+    };
+} TypedArray;
+
  typedef struct Value
  {
      ValueType type;
@@ -91,8 +158,18 @@ typedef struct {
          char *str_val;
          Date date_val;
          Array *array_val;
+         StringSet *set_val;
+         Map *map_val;
+         TypedArray *typed_val;
      };
  } Value;
+
+ typedef struct MapEntry
+ {
+     Value key;              /* a string or an int */
+     Value value;
+     unsigned int hash;      /* of the key, computed once */
+ } MapEntry;
  
 
  typedef struct Variable
@@ -124,19 +201,80 @@ typedef struct {
      TOKEN_ELSE,
      TOKEN_FOR,
      TOKEN_WHILE,
+     TOKEN_FOREACH,
+     TOKEN_FUNCTION,
+     TOKEN_LET,
      TOKEN_RETURN,
      TOKEN_PRINT,
      TOKEN_CONTINUE,
      TOKEN_BREAK,
      TOKEN_LBRACKET,
      TOKEN_RBRACKET, 
+     TOKEN_SWITCH,
+     TOKEN_CASE,
+     TOKEN_DEFAULT,
+     TOKEN_COLON,
+     TOKEN_RANGE,
+     TOKEN_IMPORT,
      TOKEN_EOF
  } AstTokenType;
  
+ /* Operator codes, resolved once when an operator is tokenized. */
+ typedef enum
+ {
+     OP_NONE,
+     OP_ASSIGN,
+     OP_ADD_ASSIGN,
+     OP_SUB_ASSIGN,
+     OP_MUL_ASSIGN,
+     OP_DIV_ASSIGN,
+     OP_MOD_ASSIGN,
+     OP_OR,
+     OP_AND,
+     OP_EQ,
+     OP_NE,
+     OP_LT,
+     OP_GT,
+     OP_LE,
+     OP_GE,
+     OP_ADD,
+     OP_SUB,
+     OP_MUL,
+     OP_DIV,
+     OP_MOD,
+     OP_BIT_AND,
+     OP_BIT_OR,
+     OP_BIT_XOR,
+     OP_SHL,
+     OP_SHR,
+     OP_NOT,
+     OP_INC,
+     OP_DEC
+ } OperatorCode;
+ 
+ /* +=, -=, *=, /= and %= */
+ #define IS_COMPOUND_ASSIGN(op) ((op) >= OP_ADD_ASSIGN && (op) <= OP_MOD_ASSIGN)
+ 
+ /* The operand types a binary operator has been specialized for. */
+ typedef enum
+ {
+     QUICK_NONE,    /* Not executed yet */
+     QUICK_INT,     /* Only ever seen two ints */
+     QUICK_DOUBLE,  /* Only ever seen two doubles */
+     QUICK_STRING,  /* Only ever seen two strings */
+     QUICK_GENERIC  /* Mixed types seen, always take the generic path */
+ } QuickType;
+ 
  typedef struct
  {
      AstTokenType type;
-     char *text; /* For identifiers, literals, or operator text */
+     char *text;         /* For identifiers, literals, or operator text */
+     int match;          /* Jump target filled in by compile(), -1 if none */
+     OperatorCode op;    /* For operators, OP_NONE otherwise */
+     QuickType quick;    /* For binary operators, the types seen so far */
+     struct VmProgram *code; /* Loop VM program for the expression starting here */
+     struct SwitchTable *table; /* For switch, its case lookup table */
+     const struct Function *function; /* For calls and definitions, the function resolved by compile() */
  } Token;
  
  typedef struct
@@ -152,12 +290,32 @@ typedef struct {
  /* --- C Interop functions --- */
  typedef Value(*InteropFunction)(Value *args, int arg_count);
  
- typedef struct
+ typedef struct Function
  {
      char *name;
      InteropFunction func;
+     bool pure; /* 1 = no side effects, calls with constant arguments can be folded */
+     const char *symbol; /* The C function's name, translated scripts call it directly */
+ 
+     /* Functions defined by the script have no func, a call runs their body */
+     TokenList *tokens;
+     int body;               /* Index of the body's '{' */
+     int param_count;
+     const char **params;
  } Function;
  
+ /* The local variables of a script function call.  A frame lives on the C
+    stack of the call it belongs to, see push_frame. */
+ typedef struct Frame
+ {
+     Variable locals[MAX_LOCALS];
+     int count;              /* Locals in use */
+     int params;             /* The first params locals, whose names aren't owned */
+     int depth;              /* Calls in progress, including this one */
+     int scope;              /* The first let variable declared by this call */
+     struct Frame *caller;
+ } Frame;
+ 
  /* ============================================================
      Parser and Interpreter
     ============================================================ */
@@ -168,18 +326,77 @@ typedef struct {
      int pos;
  } Parser;
  
+ /* ============================================================
+     Loop VM
+    ============================================================ */
+ 
+ /* Stack machine instructions for the expressions a loop re-evaluates on
+    every iteration, see vm.c. */
+ typedef enum
+ {
+     VM_CONST,       /* Push the constant */
+     VM_LOAD,        /* Push the variable named by the token */
+     VM_STORE,       /* Assign the top of the stack to the variable, keep it */
+     VM_INDEX,       /* Pop index and array, push the element */
+     VM_CALL,        /* Pop arg arguments, call the function named by the token */
+     VM_BINARY,      /* Pop right and left, push left <token> right */
+     VM_NEGATE,      /* Unary minus */
+     VM_NOT,         /* Logical not */
+     VM_PRE_INC,     /* ++x / --x on the variable named by the token */
+     VM_POST_INC,    /* x++ / x-- on the variable named by the token */
+     VM_COMPOUND,    /* Apply the compound assignment arg to the variable named by the token */
+     VM_AND,         /* If the top is false replace it with false and jump to arg */
+     VM_OR,          /* If the top is true replace it with true and jump to arg */
+     VM_TRUTH,       /* Replace the top with its truth as a bool */
+     VM_POP,         /* Discard the top of the stack */
+     VM_RETURN,      /* Stop, the top of the stack is the result */
+ 
+     /* Superinstructions produced by the peephole pass */
+     VM_BINARY_LOCAL, /* Push operand <token> operand2 (or the constant if operand2 is NULL) */
+     VM_LOAD_INDEX,   /* Push operand[operand2] */
+     VM_INC,          /* Add arg to operand without pushing anything */
+     VM_INC_COMPARE   /* VM_INC followed by VM_BINARY_LOCAL on the same variable */
+ } VmOpcode;
+ 
+ typedef struct
+ {
+     VmOpcode opcode;
+     int arg;        /* Jump target, argument count or increment */
+     Token *token;   /* The operator or identifier the instruction came from */
+     Token *operand; /* Variables read by superinstructions */
+     Token *operand2;
+     Value constant; /* For VM_CONST and VM_BINARY_LOCAL */
+     QuickType quick; /* For binary instructions, QUICK_INT when both operands are proven ints */
+ } VmInstruction;
+ 
+ typedef struct VmProgram
+ {
+     VmInstruction *code;
+     int count;
+     int capacity;
+     int hits;               /* Trips around the loop this program runs for */
+     struct JitLoop *jit;    /* The loop as machine code, see jit.c */
+ } VmProgram;
+ 
  /* ============================================================
      Declarations
     ============================================================ */
  Value interpret(const char *src);
+ void compile(TokenList *list);
+ void tokenize(const char *src, TokenList *list);
  void free_value(Value v);
  void parse_statement(Parser *p);
+ void parse_block(Parser *p);
  void raise_error(const char *s, ...);
  Value parse_primary(Parser *p);
  Value parse_factor(Parser *p);
  Value parse_term(Parser *p); // Add this forward declaration
+ Value parse_shift(Parser *p);
  Value parse_relational(Parser *p);
  Value parse_equality(Parser *p);
+ Value parse_bit_and(Parser *p);
+ Value parse_bit_xor(Parser *p);
+ Value parse_bit_or(Parser *p);
  Value parse_assignment(Parser *p);
  Value parse_unary(Parser *p);
  Value parse_logical_and(Parser *p);
@@ -191,9 +408,91 @@ typedef struct {
  Value make_double(double d);
  Value make_date(Date d);
  Value make_error(const char *s);
+ Value make_set(StringSet *set);
+ Value make_map(Map *map);
+ Value make_typed_array(TypedArray *arr);
+ Variable *find_variable(const char *name);
+ Variable *find_assignable(const char *name);
+ Value get_variable(const char *name);
+ void free_variables();
+ char *evaluate_template(const char *tpl);
+ void set_variable(const char *name, Value v);
+ int check_range(Value start, Value end, Value step);
+ Value *range_variable(const char *name, int first);
+ void declare_variable(const char *name, Value v);
+ int scope_enter(void);
+ void scope_exit(int scope);
+ void clear_script_functions(void);
+ void add_script_function(const Function *fn);
+ const Function *lookup_function(const char *name);
+ void run_import(const char *path);
+ void free_modules(void);
+ Value call_function(const char *name, Value *args, int arg_count);
+ Value invoke_function(const Function *fn, Value *args, int arg_count);
+ int push_frame(Frame *frame, const char *name, const char **params, int param_count, Value *args, int arg_count);
+ Value pop_frame(Frame *frame);
+ Value binary_operation(Token *op, Value left, Value right);
+ int values_equal(const Value a, const Value b);
+ Value compound_assign(const char *name, OperatorCode op, Value right);
+ Value update_slot(Value *slot, OperatorCode op, Value right);
+ Value assign_element(Value container, Value index, OperatorCode op, Value right);
+ int array_own(Array *arr);
+ Value array_slice(Value v, int start, int length);
+ Value *array_slot(Value v, Value index);
+ Value array_index(Value v, Value index);
+ void map_entry(Value map, Value key, Value value);
+ Value foreach_list(Value list);
+ VmProgram *vm_compile(TokenList *list, int start, int end);
+ VmProgram *vm_program(TokenList *list, int start, int end);
+ VmProgram *vm_fuse(const VmProgram *first, const VmProgram *second);
+ Value vm_run(const VmProgram *program);
+ void vm_free(VmProgram *program);
+ #ifdef ARCANE_VM_STATS
+ extern long long vm_dispatches;
+ #endif
+ int dump_types(const char *src);
+ char *aot_translate(const char *src, const char *function_name);
+ void aot_begin(void);
+ Value aot_end(void);
+ Value aot_string(const char *text);
+ Value aot_call(const char *name, Value *args, int arg_count);
+ void aot_free_arguments(Value *args, int arg_count);
+ Value aot_negate(Value v);
+ Value aot_not(Value v);
+ Value aot_increment(const char *name, int step, int prefix);
+ #ifdef ARCANE_JIT
+ int jit_hot(VmProgram *program);
+ struct JitLoop *jit_compile(TokenList *list, int cond_start, int cond_end, int post_start, int post_end,
+                             int body_start, int body_end);
+ int jit_run(struct JitLoop *loop, int at_post);
+ void jit_free(struct JitLoop *loop);
+ #endif
+ int format_int(int value, char *buffer);
+ int format_double(double value, char *buffer);
  int get_time(struct timeval *tp, void *tzp);
  const char *_list_getarg(const char *argument, char *arg, int length);
  int _list_contains(const char *list, const char *value);
+ StringSet *set_new(int capacity);
+ void set_free(StringSet *set);
+ int set_contains(const StringSet *set, const char *value);
+ int set_add(StringSet *set, const char *value);
+ int set_remove(StringSet *set, const char *value);
+ StringSet *set_from_list(const char *list);
+ char *set_to_list(const StringSet *set);
+ Map *map_new(int capacity);
+ void map_free(Map *map);
+ Value *map_get(const Map *map, Value key);
+ Value *map_slot(Map *map, Value key);
+ int map_remove(Map *map, Value key);
+ Value map_keys(const Map *map);
+ TypedArray *typed_array_new(TypedKind kind, int length);
+ TypedArray *typed_array_wrap(TypedKind kind, void *data, int length);
+ void typed_array_free(TypedArray *arr);
+ Value typed_array_index(const TypedArray *arr, Value index);
+ Value typed_array_update(TypedArray *arr, Value index, OperatorCode op, Value right);
+ Value typed_array_values(const TypedArray *arr);
+ Value typed_array_sum(const TypedArray *arr);
+ Value typed_array_extreme(const TypedArray *arr, int sign);
  Value fn_typeof(Value *args, int arg_count);
  Value fn_left(Value *args, int arg_count);
  Value fn_right(Value *args, int arg_count);
@@ -253,6 +552,28 @@ typedef struct {
  Value fn_split(Value *args, int arg_count);
  Value fn_new_array(Value *args, int arg_count);
  Value fn_array_set(Value *args, int arg_count);
+ Value fn_array_sum(Value *args, int arg_count);
+ Value fn_array_min(Value *args, int arg_count);
+ Value fn_array_max(Value *args, int arg_count);
+ Value fn_array_join(Value *args, int arg_count);
+ Value fn_array_index_of(Value *args, int arg_count);
+ Value fn_array_slice(Value *args, int arg_count);
+ Value fn_array_sort(Value *args, int arg_count);
+ Value fn_array_sort_stable(Value *args, int arg_count);
+ Value fn_array_binary_search(Value *args, int arg_count);
+ Value fn_array_map(Value *args, int arg_count);
+ Value fn_array_filter(Value *args, int arg_count);
+ Value fn_new_set(Value *args, int arg_count);
+ Value fn_map_has(Value *args, int arg_count);
+ Value fn_map_remove(Value *args, int arg_count);
+ Value fn_map_keys(Value *args, int arg_count);
+ Value fn_map_count(Value *args, int arg_count);
+ Value fn_int_array(Value *args, int arg_count);
+ Value fn_double_array(Value *args, int arg_count);
+ Value fn_array_dot(Value *args, int arg_count);
+ Value fn_array_scale(Value *args, int arg_count);
+ Value fn_array_fill(Value *args, int arg_count);
+ Value fn_array_add(Value *args, int arg_count);
 
  #ifdef __cplusplus
  }
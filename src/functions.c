@@ -22,6 +22,7 @@
     #include <time.h>
     #include <windows.h>
     #define strcasecmp _stricmp
+    #define strncasecmp _strnicmp
  #else
     #include <time.h>
     #include <errno.h>
@@ -29,71 +30,99 @@
     #include <unistd.h>
  #endif
  
+ extern int return_flag;
  extern Value return_value;
  
  /* ============================================================
      Interop Functions
     ============================================================ */
  
+    /* Functions marked true have no side effects, so the compiler can fold calls
+       to them when every argument is a constant.  The C name goes along so a
+       script translated to C can call the function directly. */
+    #define INTEROP(name, fn, pure) { name, fn, pure, #fn }
+
     Function interop_functions[] = {
-        {"print", fn_print},
-        {"println", fn_println},
-        {"typeof", fn_typeof},
-        {"substring", fn_substring},
-        {"left", fn_left},
-        {"right", fn_right},
-        {"sleep", fn_sleep},
-        {"input",  fn_input},
-        {"is_number", fn_is_number},
-        {"len", fn_strlen},
-        {"cint", fn_cint},
-        {"cdbl", fn_cdbl},
-        {"cstr", fn_cstr},     
-        {"cbool", fn_cbool},
-        {"cepoch", fn_cepoch},
-        {"is_interval", fn_is_interval},
-        {"list_contains", fn_list_contains},
-        {"list_add", fn_list_add},
-        {"list_remove", fn_list_remove},
-        {"rnd", fn_number_range},
-        {"chance", fn_chance},
-        {"replace", fn_replace},
-        {"trim", fn_trim },
-        {"trim_start", fn_trim_start },
-        {"trim_end", fn_trim_end },
-        {"lcase", fn_lcase },
-        {"ucase", fn_ucase }, 
-        {"umin", fn_umin }, 
-        {"umax", fn_umax },
-        {"timestr", fn_timestr },
-        {"abs", fn_abs },
-        {"pos", fn_set_cursor_position},
-        {"cls", fn_clear_screen},
-        {"round", fn_round},
-        {"round_up", fn_round_up},
-        {"round_down", fn_round_down},
-        {"sqrt", fn_sqrt},
-        {"contains", fn_contains},
-        {"starts_with", fn_starts_with},
-        {"ends_with", fn_ends_with},
-        {"index_of", fn_index_of},
-        {"last_index_of", fn_last_index_of},
-        {"month", fn_month},
-        {"day", fn_day},
-        {"year", fn_year},
-        {"cdate", fn_cdate},
-        {"today", fn_today},
-        {"add_days", fn_add_days},
-        {"add_months", fn_add_months},
-        {"add_years", fn_add_years},
-        {"terminal_width", fn_terminal_width},
-        {"terminal_height", fn_terminal_height},
-        {"chr", fn_chr},
-        {"asc", fn_asc},
-        {"ubound", fn_upperbound},
-        {"split", fn_split},
-        {"new_array", fn_new_array},
-        {"array_set", fn_array_set},
+        INTEROP("print", fn_print, false),
+        INTEROP("println", fn_println, false),
+        INTEROP("typeof", fn_typeof, true),
+        INTEROP("substring", fn_substring, true),
+        INTEROP("left", fn_left, true),
+        INTEROP("right", fn_right, true),
+        INTEROP("sleep", fn_sleep, false),
+        INTEROP("input", fn_input, false),
+        INTEROP("is_number", fn_is_number, true),
+        INTEROP("len", fn_strlen, true),
+        INTEROP("cint", fn_cint, true),
+        INTEROP("cdbl", fn_cdbl, true),
+        INTEROP("cstr", fn_cstr, true),
+        INTEROP("cbool", fn_cbool, true),
+        INTEROP("cepoch", fn_cepoch, false),
+        INTEROP("is_interval", fn_is_interval, true),
+        INTEROP("list_contains", fn_list_contains, true),
+        INTEROP("list_add", fn_list_add, true),
+        INTEROP("list_remove", fn_list_remove, true),
+        INTEROP("rnd", fn_number_range, false),
+        INTEROP("chance", fn_chance, false),
+        INTEROP("replace", fn_replace, true),
+        INTEROP("trim", fn_trim, true),
+        INTEROP("trim_start", fn_trim_start, true),
+        INTEROP("trim_end", fn_trim_end, true),
+        INTEROP("lcase", fn_lcase, true),
+        INTEROP("ucase", fn_ucase, true),
+        INTEROP("umin", fn_umin, true),
+        INTEROP("umax", fn_umax, true),
+        INTEROP("timestr", fn_timestr, false),
+        INTEROP("abs", fn_abs, true),
+        INTEROP("pos", fn_set_cursor_position, false),
+        INTEROP("cls", fn_clear_screen, false),
+        INTEROP("round", fn_round, true),
+        INTEROP("round_up", fn_round_up, true),
+        INTEROP("round_down", fn_round_down, true),
+        INTEROP("sqrt", fn_sqrt, true),
+        INTEROP("contains", fn_contains, true),
+        INTEROP("starts_with", fn_starts_with, true),
+        INTEROP("ends_with", fn_ends_with, true),
+        INTEROP("index_of", fn_index_of, true),
+        INTEROP("last_index_of", fn_last_index_of, true),
+        INTEROP("month", fn_month, false),
+        INTEROP("day", fn_day, false),
+        INTEROP("year", fn_year, false),
+        INTEROP("cdate", fn_cdate, false),
+        INTEROP("today", fn_today, false),
+        INTEROP("add_days", fn_add_days, false),
+        INTEROP("add_months", fn_add_months, false),
+        INTEROP("add_years", fn_add_years, false),
+        INTEROP("terminal_width", fn_terminal_width, false),
+        INTEROP("terminal_height", fn_terminal_height, false),
+        INTEROP("chr", fn_chr, true),
+        INTEROP("asc", fn_asc, true),
+        INTEROP("ubound", fn_upperbound, false),
+        INTEROP("split", fn_split, false),
+        INTEROP("new_array", fn_new_array, false),
+        INTEROP("array_set", fn_array_set, false),
+        INTEROP("array_sum", fn_array_sum, false),
+        INTEROP("array_min", fn_array_min, false),
+        INTEROP("array_max", fn_array_max, false),
+        INTEROP("array_join", fn_array_join, false),
+        INTEROP("array_index_of", fn_array_index_of, false),
+        INTEROP("array_slice", fn_array_slice, false),
+        INTEROP("array_sort", fn_array_sort, false),
+        INTEROP("array_sort_stable", fn_array_sort_stable, false),
+        INTEROP("array_binary_search", fn_array_binary_search, false),
+        INTEROP("array_map", fn_array_map, false),
+        INTEROP("array_filter", fn_array_filter, false),
+        INTEROP("new_set", fn_new_set, false),
+        INTEROP("map_has", fn_map_has, false),
+        INTEROP("map_remove", fn_map_remove, false),
+        INTEROP("map_keys", fn_map_keys, false),
+        INTEROP("map_count", fn_map_count, false),
+        INTEROP("int_array", fn_int_array, false),
+        INTEROP("double_array", fn_double_array, false),
+        INTEROP("array_dot", fn_array_dot, false),
+        INTEROP("array_scale", fn_array_scale, false),
+        INTEROP("array_fill", fn_array_fill, false),
+        INTEROP("array_add", fn_array_add, false),
         {NULL, NULL} 
      };
 
@@ -148,7 +177,8 @@
  }
  
  /**
-  * If a list contains a specified value.
+  * If a list contains a specified value.  The words are compared in place so
+  * there is no limit on the length of a single word.
   */
  int _list_contains(const char *list, const char *value)
  {
@@ -159,2082 +189,3971 @@
          return 0;
      }
  
-     char arg[MSL];
-     const char *p = _list_getarg(list, arg, MSL);
+     size_t value_len = strlen(value);
+     const char *p = list;
  
-     while (arg[0])
+     while (*p)
      {
-         if (!strcasecmp(value, arg))
+         while (*p && isspace((unsigned char) *p))
          {
-             return 1;
+             p++;
+         }
+ 
+         const char *start = p;
+ 
+         while (*p && !isspace((unsigned char) *p))
+         {
+             p++;
          }
  
-         p = _list_getarg(p, arg, MSL);
+         if ((size_t)(p - start) == value_len && value_len > 0 && !strncasecmp(start, value, value_len))
+         {
+             return 1;
+         }
      }
  
      return 0;
  }
  
+ /* ============================================================
+     String Sets: case-insensitive word sets used by the list
+     functions.
+    ============================================================ */
+ 
+ #define SET_EMPTY -1
+ #define SET_DELETED -2
+ #define LIST_CACHE_SIZE 8
+ 
+ /*
+  * Space separated lists that have been converted to a set, so repeated
+  * list_contains() calls against the same string don't rescan it.
+  */
+ static struct
+ {
+     char *source;
+     unsigned int hash;
+     StringSet *set;
+ } list_cache[LIST_CACHE_SIZE];
+ 
  /**
-  * Populates a timeval structure with the current time.
+  * Case-insensitive FNV-1a hash of the first len characters of a string.
   */
- int get_datetime_string(struct timeval *tp, void *tzp)
+ static unsigned int _set_hash(const char *s, size_t len)
  {
-     tp->tv_sec = time(NULL);
-     tp->tv_usec = 0;
+     unsigned int hash = 2166136261u;
+ 
+     for (size_t i = 0; i < len; i++)
+     {
+         hash ^= (unsigned char) tolower((unsigned char) s[i]);
+         hash *= 16777619u;
+     }
+ 
+     return hash;
  }
-
- /* ============================================================
-     Language Interop Functions
-    ============================================================ */
-
-/*
- * Returns a random number between the two given integers.
- */
-Value fn_number_range(Value *args, int arg_count)
-{
-    if (arg_count != 2)
-    {
-        raise_error("Runtime error: number_range() expects two arguments.\n");
-        return return_value;
-    }
-
-    if (args[0].type != VAL_INT || args[1].type != VAL_INT)
-    {
-        raise_error("Runtime error: number_range() expects two integer arguments.\n");
-        return return_value;
-    }
-
-    int from = args[0].int_val;
-    int to = args[1].int_val;         
-    static int seeded = 0;
-
-    if (!seeded) {
-        srand(time(NULL));
-        seeded = 1;
-    }
-
-    long mm = rand() >> 6;
-
-    register int power;
-    register int number;
-
-    if (from == 0 && to == 0)
-    {
-        return make_int(0);
-    }
-
-    if ((to = to - from + 1) <= 1)
-    {
-        return make_int(from);
-    }
-
-    for (power = 2; power < to; power <<= 1)
-    {
-        ;
-    }
-
-    while ((number = rand() >> 6 & (power - 1)) >= to)
-    {
-        ;
-    }
-
-    return make_int(from + number); 
-}   
-
-/*
- * Returns a random number between the two given integers.
- */
-Value fn_chance(Value *args, int arg_count)
-{
-    if (arg_count != 1)
-    {
-        raise_error("Runtime error: chance() expects one argument between 1 and 100.\n");
-        return return_value;
-    }
-
-    if (args[0].type != VAL_INT)
-    {
-        raise_error("Runtime error: chance() expects one argument between 1 and 100.\n");
-        return return_value;
-    }
-
-    int from = 1;
-    int to = 100;
-    static int seeded = 0;
-
-    if (!seeded) {
-        srand(time(NULL));
-        seeded = 1;
-    }
-
-    long mm = rand() >> 6;
-
-    register int power;
-    register int number;
-
-    if (from == 0 && to == 0)
-    {
-        return make_int(0);
-    }
-
-    if ((to = to - from + 1) <= 1)
-    {
-        return make_int(from);
-    }
-
-    for (power = 2; power < to; power <<= 1)
-    {
-        ;
-    }
-
-    while ((number = rand() >> 6 & (power - 1)) >= to)
-    {
-        ;
-    }
-
-    return make_bool(from + number < args[0].int_val);
-}   
-
+ 
  /**
-  * If a string list contains an element.
+  * Returns the index slot that holds the given word, or -1 if the word is not
+  * in the set.
   */
- Value fn_list_contains(Value *args, int arg_count)
+ static int _set_find(const StringSet *set, const char *value, size_t len, unsigned int hash)
  {
-     if (arg_count != 2)
+     int mask = set->index_size - 1;
+     int slot = hash & mask;
+ 
+     while (set->index[slot] != SET_EMPTY)
      {
-         raise_error("Runtime error: list_contains() expects two arguments.\n");
-         return return_value;
-     }
+         int pos = set->index[slot];
  
-     Value list = args[0];
-     Value arg = args[1];
+         if (pos >= 0 && set->hashes[pos] == hash &&
+             strlen(set->items[pos]) == len && !strncasecmp(set->items[pos], value, len))
+         {
+             return slot;
+         }
+ 
+         slot = (slot + 1) & mask;
+     }
  
-     return make_bool(_list_contains(list.str_val, arg.str_val));
+     return -1;
  }
  
  /**
-  * Adds an item to a list if it does not already exist in it.
+  * Rebuilds the index (and compacts removed items) so the index is at most
+  * half full.
   */
- Value fn_list_add(Value *args, int arg_count)
+ static void _set_rebuild(StringSet *set, int min_items)
  {
-     if (arg_count != 2)
+     int size = 8;
+ 
+     while (size < min_items * 2)
      {
-         raise_error("Runtime error: list_add() expects two arguments.\n");
-         return return_value;
+         size <<= 1;
      }
  
-     Value list = args[0];
-     Value arg = args[1];
+     // Compact the insertion ordered items, dropping removed ones.
+     int used = 0;
  
-     if (_list_contains(list.str_val, arg.str_val))
+     for (int i = 0; i < set->used; i++)
      {
-         return make_string(list.str_val);
+         if (set->items[i])
+         {
+             set->items[used] = set->items[i];
+             set->hashes[used] = set->hashes[i];
+             used++;
+         }
      }
  
-     char *new_list = malloc(strlen(list.str_val) + strlen(arg.str_val) + 2);
+     set->used = used;
  
-     if (!new_list)
+     free(set->index);
+     set->index = malloc(sizeof(int) * size);
+     set->index_size = size;
+ 
+     for (int i = 0; i < size; i++)
      {
-         raise_error("Runtime error: Memory allocation failed in list_add().\n");
-         return return_value;
+         set->index[i] = SET_EMPTY;
      }
  
-     strcpy(new_list, list.str_val);
-     strcat(new_list, " ");
-     strcat(new_list, arg.str_val);
+     for (int i = 0; i < used; i++)
+     {
+         int slot = set->hashes[i] & (size - 1);
  
-     Value str = make_string(new_list);
-     free(new_list);
+         while (set->index[slot] != SET_EMPTY)
+         {
+             slot = (slot + 1) & (size - 1);
+         }
  
-     return str;
+         set->index[slot] = i;
+     }
  }
  
  /**
-  * Removes an item from a list.
+  * Creates a new empty set with room for at least capacity items.
   */
- Value fn_list_remove(Value *args, int arg_count)
+ StringSet *set_new(int capacity)
  {
-     if (arg_count != 2)
+     StringSet *set = malloc(sizeof(StringSet));
+ 
+     if (capacity < 4)
      {
-         raise_error("Runtime error: list_remove() expects two arguments.\n");
-         return return_value;
+         capacity = 4;
      }
  
-     Value list = args[0];
-     Value arg = args[1];
+     set->items = malloc(sizeof(char *) * capacity);
+     set->hashes = malloc(sizeof(unsigned int) * capacity);
+     set->capacity = capacity;
+     set->used = 0;
+     set->count = 0;
+     set->index = NULL;
+     set->index_size = 0;
+     _set_rebuild(set, capacity);
  
-     const char *p;
-     char arg_buf[MSL];
-     char new_list[MSL] = {0};
+     return set;
+ }
  
-     p = list.str_val;
+ /**
+  * Frees a set and all of the words it holds.
+  */
+ void set_free(StringSet *set)
+ {
+     if (!set)
+     {
+         return;
+     }
  
-     while (*p)
+     for (int i = 0; i < set->used; i++)
      {
-         p = _list_getarg(p, arg_buf, MSL);
+         free(set->items[i]);
+     }
  
-         if (strcasecmp(arg_buf, arg.str_val))
-         {
-             if (new_list[0])
-             {
-                 strcat(new_list, " ");
-             }
+     free(set->items);
+     free(set->hashes);
+     free(set->index);
+     free(set);
+ }
  
-             strcat(new_list, arg_buf);
-         }
+ /**
+  * If the set contains the given word (case-insensitive).
+  */
+ int set_contains(const StringSet *set, const char *value)
+ {
+     if (set == NULL || value == NULL)
+     {
+         return 0;
      }
  
-     return make_string(new_list);
+     size_t len = strlen(value);
+     return _set_find(set, value, len, _set_hash(value, len)) >= 0;
  }
  
- /*
-  * Prints a value to the screen.
+ /**
+  * Adds a word of the given length to the set.  Returns 1 if it was added or 0
+  * if it already existed.
   */
- Value fn_print(Value *args, int arg_count)
+ static int _set_add_len(StringSet *set, const char *value, size_t len)
  {
-     if (arg_count != 1)
+     unsigned int hash = _set_hash(value, len);
+ 
+     if (_set_find(set, value, len, hash) >= 0)
      {
-         raise_error("Runtime error: print() expects exactly one argument.\n");
-         return return_value;
+         return 0;
      }
  
-     Value arg = args[0];
-
-     switch (arg.type)
+     // Removed items still occupy index slots, so count them towards the load.
+     if ((set->used + 1) * 2 > set->index_size)
      {
-         case VAL_INT:
-             printf("%d\n", arg.int_val);
-             break;
-         case VAL_STRING:
-             printf("%s\n", arg.str_val);
-             break;
-         case VAL_BOOL:
-             printf(arg.int_val ? "true\n" : "false\n");
-             break;
-         case VAL_DOUBLE:
-             printf("%f\n", arg.double_val);
-             break;             
-         case VAL_DATE:
-             printf("%02d/%02d/%04d\n", arg.date_val.month, arg.date_val.day, arg.date_val.year);
-             break;            
-         case VAL_NULL:
-             printf("(null)\n");
-             break;
-         default:
-             break;
+         _set_rebuild(set, set->count + 1);
      }
  
-     return make_null();
+     if (set->used >= set->capacity)
+     {
+         set->capacity *= 2;
+         set->items = realloc(set->items, sizeof(char *) * set->capacity);
+         set->hashes = realloc(set->hashes, sizeof(unsigned int) * set->capacity);
+     }
+ 
+     char *copy = malloc(len + 1);
+     memcpy(copy, value, len);
+     copy[len] = '\0';
+ 
+     int slot = hash & (set->index_size - 1);
+ 
+     while (set->index[slot] >= 0)
+     {
+         slot = (slot + 1) & (set->index_size - 1);
+     }
+ 
+     set->items[set->used] = copy;
+     set->hashes[set->used] = hash;
+     set->index[slot] = set->used;
+     set->used++;
+     set->count++;
+ 
+     return 1;
  }
  
- /*
-  * Prints a value to the screen with a trailing line ending.  Null values do not
-  * print to the sreeen.
+ /**
+  * Adds a word to the set.  Returns 1 if it was added or 0 if it already existed.
   */
- Value fn_println(Value *args, int arg_count)
+ int set_add(StringSet *set, const char *value)
  {
-     if (arg_count != 1)
+     if (set == NULL || IS_NULLSTR(value))
      {
-         raise_error("Runtime error: println() expects exactly one argument.\n");
-         return return_value;
+         return 0;
      }
  
-    Value arg = args[0];
-
-    switch (arg.type)
-    {
-        case VAL_INT:
-            printf("%d\n", arg.int_val);
-            break;
-        case VAL_STRING:
-            printf("%s\n", arg.str_val);
-            break;
-        case VAL_BOOL:
-            printf(arg.int_val ? "true\n" : "false\n");
-            break;
-        case VAL_DOUBLE:
-            printf("%f\n", arg.double_val);
-            break;             
-        case VAL_DATE:
-            printf("%02d/%02d/%04d\n", arg.date_val.month, arg.date_val.day, arg.date_val.year);
-            break;            
-        case VAL_NULL:
-            printf("(null)\n");
-            break;
-        default:
-            break;
-    }
-
-     return make_null();
+     return _set_add_len(set, value, strlen(value));
  }
  
  /**
-  * Returns the type of the given value as a string.
+  * Removes a word from the set.  Returns 1 if it was removed.
   */
- Value fn_typeof(Value *args, int arg_count)
+ int set_remove(StringSet *set, const char *value)
  {
-     if (arg_count != 1)
+     if (set == NULL || value == NULL)
      {
-         raise_error("Runtime error: typeof() expects exactly one argument.\n");
-         return return_value;
+         return 0;
      }
  
-     Value arg = args[0];
-     const char *type_str = "unknown";
-     switch (arg.type)
+     size_t len = strlen(value);
+     int slot = _set_find(set, value, len, _set_hash(value, len));
+ 
+     if (slot < 0)
      {
-         case VAL_INT:
-             type_str = "int";
-             break;
-         case VAL_STRING:
-             type_str = "string";
-             break;
-         case VAL_BOOL:
-             type_str = "bool";
-             break;
-         case VAL_DOUBLE:
-            type_str = "double";
-            break;             
-         case VAL_DATE:
-            type_str = "date";
-            break;            
-         case VAL_NULL:
-             type_str = "null";
-             break;
-         default:
-             type_str = "unknown";
-             break;
+         return 0;
      }
  
-     return make_string(type_str);
+     int pos = set->index[slot];
+     free(set->items[pos]);
+     set->items[pos] = NULL;
+     set->index[slot] = SET_DELETED;
+     set->count--;
+ 
+     return 1;
  }
  
  /**
-  * Returns the substring of the given string starting at the given index and
-  * continuing for the given length.
+  * Builds a set from a space separated list.
   */
- Value fn_substring(Value *args, int arg_count)
+ StringSet *set_from_list(const char *list)
  {
-     if (arg_count != 3)
+     StringSet *set = set_new(8);
+ 
+     if (list == NULL)
      {
-         raise_error("Runtime error: substring() expects 3 arguments: a string, a start index, and a length.\n");
-         return return_value;
+         return set;
      }
  
-     if (args[0].type != VAL_STRING)
+     const char *p = list;
+ 
+     while (*p)
      {
-         raise_error("Runtime error: substring() expects the first argument to be a string.\n");
-         return return_value;
+         while (*p && isspace((unsigned char) *p))
+         {
+             p++;
+         }
+ 
+         const char *start = p;
+ 
+         while (*p && !isspace((unsigned char) *p))
+         {
+             p++;
+         }
+ 
+         if (p > start)
+         {
+             _set_add_len(set, start, p - start);
+         }
      }
  
-     if (args[1].type != VAL_INT)
+     return set;
+ }
+ 
+ /**
+  * Converts a set back into a space separated list.  The caller owns the
+  * returned string.
+  */
+ char *set_to_list(const StringSet *set)
+ {
+     size_t len = 0;
+ 
+     for (int i = 0; i < set->used; i++)
      {
-         raise_error("Runtime error: substring() expects the second argument to be an int.\n");
-         return return_value;
+         if (set->items[i])
+         {
+             len += strlen(set->items[i]) + 1;
+         }
      }
  
-     if (args[2].type != VAL_INT)
+     char *list = malloc(len + 1);
+     char *q = list;
+ 
+     for (int i = 0; i < set->used; i++)
      {
-         raise_error("Runtime error: substring() expects the third argument to be an int.\n");
-         return return_value;
+         if (set->items[i])
+         {
+             if (q != list)
+             {
+                 *q++ = ' ';
+             }
+ 
+             size_t item_len = strlen(set->items[i]);
+             memcpy(q, set->items[i], item_len);
+             q += item_len;
+         }
      }
  
-     char *s = args[0].str_val;
-     int start = args[1].int_val;
-     int len = args[2].int_val;
+     *q = '\0';
+     return list;
+ }
  
-     if (start < 0)
+ /**
+  * Returns a cached set for a space separated list, converting the list the
+  * first time it's seen.  The cache owns the returned set.
+  */
+ static const StringSet *_list_cached_set(const char *list)
+ {
+     size_t len = strlen(list);
+     unsigned int hash = _set_hash(list, len) ^ (unsigned int) len;
+     int slot = hash & (LIST_CACHE_SIZE - 1);
+ 
+     // The hash is case-insensitive, so the source still has to match exactly.
+     if (list_cache[slot].source && list_cache[slot].hash == hash &&
+         strcmp(list_cache[slot].source, list) == 0)
      {
-         start = 0;
+         return list_cache[slot].set;
      }
  
-     if (len < 0)
+     free(list_cache[slot].source);
+     set_free(list_cache[slot].set);
+ 
+     list_cache[slot].source = _strdup(list);
+     list_cache[slot].hash = hash;
+     list_cache[slot].set = set_from_list(list);
+ 
+     return list_cache[slot].set;
+ }
+ 
+ /**
+  * Populates a timeval structure with the current time.
+  */
+ int get_datetime_string(struct timeval *tp, void *tzp)
+ {
+     tp->tv_sec = time(NULL);
+     tp->tv_usec = 0;
+ }
+
+ /* ============================================================
+     Maps: string or int keys to values, for VAL_MAP.
+    ============================================================ */
+ 
+ #define MAP_EMPTY -1
+ #define MAP_DELETED -2
+ 
+ /**
+  * Hashes a map key: FNV-1a for a string, case-sensitive like ==, and a
+  * multiplicative hash for an int.  Returns 0 if the key isn't a string or an
+  * int.
+  */
+ static int _map_hash(Value key, unsigned int *hash)
+ {
+     if (key.type == VAL_INT)
      {
-         len = 0;
+         *hash = (unsigned int) key.int_val * 2654435761u;
+         return 1;
      }
  
-     int s_len = strlen(s);
-     if (start >= s_len)
+     if (key.type != VAL_STRING)
      {
-         return make_string("");
+         return 0;
      }
  
-     int end = start + len;
-     if (end > s_len)
+     unsigned int h = 2166136261u;
+ 
+     for (const char *c = key.str_val; *c; c++)
      {
-         end = s_len;
+         h ^= (unsigned char) *c;
+         h *= 16777619u;
      }
  
-     int result_len = end - start;
-     char *result = malloc(result_len + 1);
+     *hash = h;
+     return 1;
+ }
  
-     if (!result)
+ /**
+  * Returns the index slot of the entry with the given key, or -1 if the map
+  * doesn't have it.
+  */
+ static int _map_find(const Map *map, Value key, unsigned int hash)
+ {
+     int mask = map->index_size - 1;
+     int slot = hash & mask;
+ 
+     while (map->index[slot].entry != MAP_EMPTY)
      {
-         raise_error("Runtime error: Memory allocation failed in substring().\n");
-         return return_value;
-     }
+         if (map->index[slot].hash == hash && map->index[slot].entry >= 0)
+         {
+             const Value *k = &map->entries[map->index[slot].entry].key;
  
-     strncpy(result, s + start, result_len);
-     result[result_len] = '\0';
+             if (k->type == key.type &&
+                 (key.type == VAL_INT ? k->int_val == key.int_val : strcmp(k->str_val, key.str_val) == 0))
+             {
+                 return slot;
+             }
+         }
  
-     Value ret = make_string(result);
-     free(result);
-     return ret;
+         slot = (slot + 1) & mask;
+     }
+ 
+     return -1;
  }
  
  /**
-  * Returns the first n characters of the given string.
-  *
-  * @param args Expects a string and an int.
-  * @param arg_count Expects 2 arguments: a string and an int.
-  * @return A string containing the first n characters of the input string.  If n exceeds the string length then the entire string is returned.
+  * Rebuilds the index (and compacts removed entries) so the index is at most
+  * half full.
   */
- Value fn_left(Value *args, int arg_count)
+ static void _map_rebuild(Map *map, int min_entries)
  {
-     if (arg_count != 2)
+     int size = 8;
+ 
+     while (size < min_entries * 2)
      {
-         raise_error("Runtime error: left() expects 2 arguments: a string and an int.\n");
-         return return_value;
+         size <<= 1;
      }
  
-     if (args[0].type != VAL_STRING)
+     int used = 0;
+ 
+     for (int i = 0; i < map->used; i++)
      {
-         raise_error("Runtime error: left() expects the first argument to be a string.\n");
-         return return_value;
+         if (map->entries[i].key.type != VAL_NULL)
+         {
+             map->entries[used++] = map->entries[i];
+         }
      }
  
-     if (args[1].type != VAL_INT)
+     map->used = used;
+ 
+     free(map->index);
+     map->index = malloc(sizeof(MapSlot) * size);
+     map->index_size = size;
+ 
+     for (int i = 0; i < size; i++)
      {
-         raise_error("Runtime error: left() expects the second argument to be an int.\n");
-         return return_value;
+         map->index[i].entry = MAP_EMPTY;
      }
  
-     char *s = args[0].str_val;
-     int n = args[1].int_val;
+     for (int i = 0; i < used; i++)
+     {
+         int slot = map->entries[i].hash & (size - 1);
  
-     if (n < 0)
+         while (map->index[slot].entry != MAP_EMPTY)
+         {
+             slot = (slot + 1) & (size - 1);
+         }
+ 
+         map->index[slot].hash = map->entries[i].hash;
+         map->index[slot].entry = i;
+     }
+ }
+ 
+ /**
+  * Creates a new empty map with room for at least capacity entries.
+  */
+ Map *map_new(int capacity)
+ {
+     Map *map = malloc(sizeof(Map));
+ 
+     if (capacity < 4)
      {
-         n = 0;
+         capacity = 4;
      }
  
-     int len = strlen(s);
-     int result_len = (n < len) ? n : len;
-     char *result = malloc(result_len + 1);
+     map->entries = malloc(sizeof(MapEntry) * capacity);
+     map->capacity = capacity;
+     map->used = 0;
+     map->count = 0;
+     map->index = NULL;
+     map->index_size = 0;
+     _map_rebuild(map, capacity);
  
-     if (!result)
+     return map;
+ }
+ 
+ /**
+  * Frees a map along with its keys and values.
+  */
+ void map_free(Map *map)
+ {
+     if (!map)
      {
-         raise_error("Runtime error: Memory allocation failed in left().\n");
-         return return_value;
+         return;
      }
  
-     strncpy(result, s, result_len);
-     result[result_len] = '\0';
+     for (int i = 0; i < map->used; i++)
+     {
+         free_value(map->entries[i].key);
+         free_value(map->entries[i].value);
+     }
  
-     // Create a Value containing the new string.
-     Value ret = make_string(result);
-     free(result);
-     return ret;
+     free(map->entries);
+     free(map->index);
+     free(map);
  }
  
  /**
-  * Returns the right n characters of a string.
-  * @param args Expects 2 arguments, a string and an int.
-  * @param arg_count 2
-  * @return Returns the right n characters of a string.  If n is greater than the string length the entire string is returned.
+  * Returns where the value for a key is stored, or NULL if the map doesn't
+  * have the key.
   */
- Value fn_right(Value *args, int arg_count)
+ Value *map_get(const Map *map, Value key)
  {
-     if (arg_count != 2)
+     unsigned int hash;
+ 
+     if (!_map_hash(key, &hash))
      {
-         raise_error("Runtime error: right() expects 2 arguments: a string and an int.\n");
-         return return_value;
+         return NULL;
      }
  
-     if (args[0].type != VAL_STRING)
+     int slot = _map_find(map, key, hash);
+     return slot < 0 ? NULL : &map->entries[map->index[slot].entry].value;
+ }
+ 
+ /**
+  * Returns where the value for a key is stored, adding the key with a null
+  * value if it's new.  The pointer is good until the next key is added.
+  * Returns NULL after raising an error if the key isn't a string or an int.
+  */
+ Value *map_slot(Map *map, Value key)
+ {
+     unsigned int hash;
+ 
+     if (!_map_hash(key, &hash))
      {
-         raise_error("Runtime error: right() expects the first argument to be a string.\n");
-         return return_value;
+         raise_error("Runtime error: Map keys must be strings or ints.\n");
+         return NULL;
      }
  
-     if (args[1].type != VAL_INT)
+     int slot = _map_find(map, key, hash);
+ 
+     if (slot >= 0)
      {
-         raise_error("Runtime error: right() expects the second argument to be an int.\n");
-         return return_value;
+         return &map->entries[map->index[slot].entry].value;
      }
  
-     char *s = args[0].str_val;
-     int n = args[1].int_val;
+     // Removed entries still occupy index slots, so count them towards the load.
+     if ((map->used + 1) * 2 > map->index_size)
+     {
+         _map_rebuild(map, map->count + 1);
+     }
  
-     if (n < 0)
+     if (map->used >= map->capacity)
      {
-         n = 0;
+         map->capacity *= 2;
+         map->entries = realloc(map->entries, sizeof(MapEntry) * map->capacity);
      }
  
-     int len = strlen(s);
-     int result_len = (n < len) ? n : len;
-     char *result = malloc(result_len + 1);
+     slot = hash & (map->index_size - 1);
  
-     if (!result)
+     while (map->index[slot].entry >= 0)
      {
-         raise_error("Runtime error: Memory allocation failed in right().\n");
-         return return_value;
+         slot = (slot + 1) & (map->index_size - 1);
      }
  
-     /* Copy the last result_len characters from s. */
-     strncpy(result, s + (len - result_len), result_len);
-     result[result_len] = '\0';
+     MapEntry *entry = &map->entries[map->used];
+     entry->key = key.type == VAL_STRING ? make_string(key.str_val) : key;
+     entry->key.temp = 0;
+     entry->value = make_null();
+     entry->value.temp = 0;
+     entry->hash = hash;
  
-     Value ret = make_string(result);
-     free(result);
-     return ret;
+     map->index[slot].hash = hash;
+     map->index[slot].entry = map->used;
+     map->used++;
+     map->count++;
+ 
+     return &entry->value;
  }
  
-/**
- * Replaces all occurrences of a substring in a string with another substring.
- */
-Value fn_replace(Value *args, int arg_count)
+ /**
+  * Removes a key and its value from the map.  Returns 1 if it was removed.
+  */
+ int map_remove(Map *map, Value key)
+ {
+     unsigned int hash;
+ 
+     if (!_map_hash(key, &hash))
+     {
+         return 0;
+     }
+ 
+     int slot = _map_find(map, key, hash);
+ 
+     if (slot < 0)
+     {
+         return 0;
+     }
+ 
+     MapEntry *entry = &map->entries[map->index[slot].entry];
+     free_value(entry->key);
+     free_value(entry->value);
+     entry->key = make_null();
+     map->index[slot].entry = MAP_DELETED;
+     map->count--;
+ 
+     return 1;
+ }
+ 
+ /**
+  * Returns a new array of a map's keys, in insertion order.
+  */
+ Value map_keys(const Map *map)
+ {
+     Array *arr = malloc(sizeof(Array));
+     Value *items = malloc(sizeof(Value) * (map->count > 0 ? map->count : 1));
+ 
+     if (!arr || !items)
+     {
+         free(arr);
+         free(items);
+         raise_error("Runtime error: Memory allocation failed creating an array.\n");
+         return return_value;
+     }
+ 
+     int length = 0;
+ 
+     for (int i = 0; i < map->used; i++)
+     {
+         Value key = map->entries[i].key;
+ 
+         if (key.type != VAL_NULL)
+         {
+             items[length] = key.type == VAL_STRING ? make_string(key.str_val) : key;
+             items[length++].temp = 0;
+         }
+     }
+ 
+     arr->items = items;
+     arr->length = length;
+     arr->shared = NULL;
+ 
+     Value ret;
+     ret.type = VAL_ARRAY;
+     ret.array_val = arr;
+     ret.temp = 1;
+     return ret;
+ }
+ 
+ /* ============================================================
+     Language Interop Functions
+    ============================================================ */
+
+/*
+ * Returns a random number between the two given integers.
+ */
+Value fn_number_range(Value *args, int arg_count)
 {
-    if (arg_count != 3)
+    if (arg_count != 2)
     {
-        raise_error("Runtime error: replace() expects 3 arguments: a string, a substring to replace, and a substring to replace it with.\n");
+        raise_error("Runtime error: number_range() expects two arguments.\n");
         return return_value;
     }
 
-    if (args[0].type != VAL_STRING)
+    if (args[0].type != VAL_INT || args[1].type != VAL_INT)
     {
-        raise_error("Runtime error: replace() expects the first argument to be a string.\n");
+        raise_error("Runtime error: number_range() expects two integer arguments.\n");
         return return_value;
     }
 
-    if (args[1].type != VAL_STRING)
+    int from = args[0].int_val;
+    int to = args[1].int_val;         
+    static int seeded = 0;
+
+    if (!seeded) {
+        srand(time(NULL));
+        seeded = 1;
+    }
+
+    long mm = rand() >> 6;
+
+    register int power;
+    register int number;
+
+    if (from == 0 && to == 0)
     {
-        raise_error("Runtime error: replace() expects the second argument to be a string.\n");
+        return make_int(0);
+    }
+
+    if ((to = to - from + 1) <= 1)
+    {
+        return make_int(from);
+    }
+
+    for (power = 2; power < to; power <<= 1)
+    {
+        ;
+    }
+
+    while ((number = rand() >> 6 & (power - 1)) >= to)
+    {
+        ;
+    }
+
+    return make_int(from + number); 
+}   
+
+/*
+ * Returns a random number between the two given integers.
+ */
+Value fn_chance(Value *args, int arg_count)
+{
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: chance() expects one argument between 1 and 100.\n");
         return return_value;
     }
 
-    if (args[2].type != VAL_STRING)
+    if (args[0].type != VAL_INT)
     {
-        raise_error("Runtime error: replace() expects the third argument to be a string.\n");
+        raise_error("Runtime error: chance() expects one argument between 1 and 100.\n");
         return return_value;
     }
 
-    char *s = args[0].str_val;
-    char *find = args[1].str_val;
-    char *replace = args[2].str_val;
+    int from = 1;
+    int to = 100;
+    static int seeded = 0;
 
-    // Allocate a new string that is large enough to hold the result.
-    // We'll allocate the maximum size it could be, which is the length of the
-    // original string times the length of the replacement string.  This is
-    // the worst case scenario where every character in the original string
-    // is the substring we are replacing.
-    int find_len = strlen(find);
-    int replace_len = strlen(replace);
-    int s_len = strlen(s);
-    int result_len = s_len;
-    char *result = malloc(result_len + 1);
+    if (!seeded) {
+        srand(time(NULL));
+        seeded = 1;
+    }
 
-    if (!result)
+    long mm = rand() >> 6;
+
+    register int power;
+    register int number;
+
+    if (from == 0 && to == 0)
     {
-        raise_error("Runtime error: Memory allocation failed in replace().\n");
-        return return_value;
+        return make_int(0);
     }
 
-    // Loop through the string looking for the substring to replace.
-    char *p = s;
-    char *q = result;
-    while (*p)
+    if ((to = to - from + 1) <= 1)
     {
-        // If the substring is found, copy the replacement string.
-        if (strstr(p, find) == p)
-        {
-            strcpy(q, replace);
-            q += replace_len;
-            p += find_len;
-        }
-        else
-        {
-            // Copy the current character and move to the next.
-            *q++ = *p++;
-        }
+        return make_int(from);
     }
 
-    // Null terminate the result string.
-    *q = '\0';
+    for (power = 2; power < to; power <<= 1)
+    {
+        ;
+    }
 
-    // Create a Value containing the new string.
-    Value ret = make_string(result);
-    free(result);
-    return ret;
-}
+    while ((number = rand() >> 6 & (power - 1)) >= to)
+    {
+        ;
+    }
+
+    return make_bool(from + number < args[0].int_val);
+}   
 
  /**
-  * Sleeps for the given number of milliseconds.
-  * @param args Expects 1 argument, an int.
-  * @param arg_count 1
-  * @return Null
+  * If a string list contains an element.  The list can be a space separated
+  * string or a set.
   */
- Value fn_sleep(Value *args, int arg_count)
+ Value fn_list_contains(Value *args, int arg_count)
  {
-     if (arg_count != 1 || args[0].type != VAL_INT) {
-         raise_error("Runtime error: sleep() expects 1 integer argument (milliseconds).\n");
+     if (arg_count != 2)
+     {
+         raise_error("Runtime error: list_contains() expects two arguments.\n");
          return return_value;
      }
  
-     int ms = args[0].int_val;
+     Value list = args[0];
+     Value arg = args[1];
  
-     if (ms < 0)
+     if (arg.type != VAL_STRING)
      {
-         ms = 0;
+         return make_bool(false);
      }
  
- #ifdef _WIN32
-     // Sleep() takes milliseconds.
-     Sleep(ms);
- #else
-     // For POSIX, use nanosleep. Construct a timespec.
-     struct timespec req, rem;
-     req.tv_sec = ms / 1000;
-     req.tv_nsec = (ms % 1000) * 1000000; // convert ms to ns
-     // Loop in case nanosleep is interrupted by a signal.
-     while (nanosleep(&req, &rem) == -1 && errno == EINTR) {
-         req = rem;
+     if (list.type == VAL_SET)
+     {
+         return make_bool(set_contains(list.set_val, arg.str_val));
      }
- #endif
  
-     // Return null as sleep does not produce a meaningful value.
-     return make_null();
+     if (list.type != VAL_STRING)
+     {
+         raise_error("Runtime error: list_contains() expects a string or set as the list.\n");
+         return return_value;
+     }
+ 
+     return make_bool(set_contains(_list_cached_set(list.str_val), arg.str_val));
  }
  
  /**
-  * Gets input from the user.
-  * @return A string value of the input the user entered.
+  * Adds an item to a list if it does not already exist in it.  Sets are updated
+  * in place and returned.
   */
- Value fn_input(Value *args, int arg_count)
+ Value fn_list_add(Value *args, int arg_count)
  {
-     // Allow zero or one argument (a prompt message)
-     if (arg_count > 1)
+     if (arg_count != 2)
      {
-         raise_error("Runtime error: input() expects 0 or 1 argument.\n");
+         raise_error("Runtime error: list_add() expects two arguments.\n");
          return return_value;
      }
  
-     char prompt[256] = {0};
-     if (arg_count == 1)
+     Value list = args[0];
+     Value arg = args[1];
+ 
+     if (arg.type != VAL_STRING)
      {
-         if (args[0].type != VAL_STRING)
-         {
-             raise_error("Runtime error: input() expects a string as prompt.\n");
-             return return_value;
-         }
-         // Copy the prompt into our buffer (limit its size)
-         strncpy(prompt, args[0].str_val, sizeof(prompt) - 1);
+         raise_error("Runtime error: list_add() expects a string item.\n");
+         return return_value;
      }
  
-     // If a prompt was provided, print it (and flush so the user sees it immediately)
-     if (prompt[0] != '\0')
+     if (list.type == VAL_SET)
      {
-         printf("%s", prompt);
-         fflush(stdout);
+         set_add(list.set_val, arg.str_val);
+         return list;
      }
  
-     // Read a line from stdin
-     char buffer[1024];
-     if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+     if (list.type != VAL_STRING)
      {
-         // On error or EOF, you might return null
-         return make_null();
+         raise_error("Runtime error: list_add() expects a string or set as the list.\n");
+         return return_value;
      }
  
-     // Remove the newline character, if present
-     buffer[strcspn(buffer, "\n")] = '\0';
+     if (set_contains(_list_cached_set(list.str_val), arg.str_val))
+     {
+         return make_string(list.str_val);
+     }
  
-     // Return the input as a string value
-     return make_string(buffer);
- }
+     char *new_list = malloc(strlen(list.str_val) + strlen(arg.str_val) + 2);
  
- /**
-  * is_number: returns true if the string is an integer number, false otherwise.
-  * @return A bool value of whether the string is a number.
-  */
- Value fn_is_number(Value *args, int arg_count)
- {
-     if (arg_count != 1)
+     if (!new_list)
      {
-         raise_error("Runtime error: is_number() expects exactly one argument.\n");
+         raise_error("Runtime error: Memory allocation failed in list_add().\n");
          return return_value;
      }
-     if (args[0].type != VAL_STRING)
-     {
-         raise_error("Runtime error: is_number() expects a string argument.\n");
+ 
+     strcpy(new_list, list.str_val);
+     strcat(new_list, " ");
+     strcat(new_list, arg.str_val);
+ 
+     Value str = make_string(new_list);
+     free(new_list);
+ 
+     return str;
+ }
+ 
+ /**
+  * Removes an item from a list.  Sets are updated in place and returned.
+  */
+ Value fn_list_remove(Value *args, int arg_count)
+ {
+     if (arg_count != 2)
+     {
+         raise_error("Runtime error: list_remove() expects two arguments.\n");
          return return_value;
      }
  
-     const char *s = args[0].str_val;
+     Value list = args[0];
+     Value arg = args[1];
  
-     // Skip any leading whitespace.
-     while (*s && isspace((unsigned char) *s))
+     if (arg.type != VAL_STRING)
      {
-         s++;
+         raise_error("Runtime error: list_remove() expects a string item.\n");
+         return return_value;
      }
  
-     // Handle an optional '+' or '-' sign.
-     if (*s == '+' || *s == '-')
+     if (list.type == VAL_SET)
      {
-         s++;
+         set_remove(list.set_val, arg.str_val);
+         return list;
      }
  
-     // There must be at least one digit.
-     if (!isdigit((unsigned char) *s))
+     if (list.type != VAL_STRING)
      {
-         return make_bool(false);
+         raise_error("Runtime error: list_remove() expects a string or set as the list.\n");
+         return return_value;
      }
  
-     // Check the remainder of the string.
-     while (*s)
+     // The result is never longer than the original list.
+     char *new_list = malloc(strlen(list.str_val) + 1);
+ 
+     if (!new_list)
      {
-         if (!isdigit((unsigned char) *s))
+         raise_error("Runtime error: Memory allocation failed in list_remove().\n");
+         return return_value;
+     }
+ 
+     size_t value_len = strlen(arg.str_val);
+     const char *p = list.str_val;
+     char *q = new_list;
+ 
+     while (*p)
+     {
+         while (*p && isspace((unsigned char) *p))
          {
-             return make_bool(false);
+             p++;
          }
-         s++;
+ 
+         const char *start = p;
+ 
+         while (*p && !isspace((unsigned char) *p))
+         {
+             p++;
+         }
+ 
+         size_t len = p - start;
+ 
+         if (len == 0 || (len == value_len && !strncasecmp(start, arg.str_val, len)))
+         {
+             continue;
+         }
+ 
+         if (q != new_list)
+         {
+             *q++ = ' ';
+         }
+ 
+         memcpy(q, start, len);
+         q += len;
      }
  
-     return make_bool(true);
+     *q = '\0';
+ 
+     Value str = make_string(new_list);
+     free(new_list);
+ 
+     return str;
  }
  
  /**
-  * Returns the length of the string if the Value is of type string, or 0 otherwise.
-  *
-  * @param args Expects a single argument.
-  * @param arg_count Expects 1 argument.
-  * @return An int Value representing the string length or -1 if not a string.
+  * Creates a new case-insensitive set, optionally populated from a space
+  * separated list.
   */
- Value fn_strlen(Value *args, int arg_count)
+ Value fn_new_set(Value *args, int arg_count)
  {
-     if (arg_count != 1)
+     if (arg_count > 1)
      {
-         raise_error("Runtime error: strlen() expects exactly one argument.\n");
+         raise_error("Runtime error: new_set() expects 0 or 1 argument.\n");
          return return_value;
      }
  
+     if (arg_count == 0)
+     {
+         return make_set(set_new(8));
+     }
+ 
+     if (args[0].type == VAL_SET)
+     {
+         char *list = set_to_list(args[0].set_val);
+         Value ret = make_set(set_from_list(list));
+         free(list);
+         return ret;
+     }
+ 
      if (args[0].type != VAL_STRING)
      {
-         return make_int(-1);
+         raise_error("Runtime error: new_set() expects a string list.\n");
+         return return_value;
      }
  
-     int len = strlen(args[0].str_val);
-     return make_int(len);
+     return make_set(set_from_list(args[0].str_val));
  }
  
  /*
-  * Converts a string to an int.
+  * Prints a value to the screen.
   */
- Value fn_cint(Value *args, int arg_count)
+ Value fn_print(Value *args, int arg_count)
  {
      if (arg_count != 1)
      {
-         raise_error("Runtime error: cint() expects 1 argument.\n");
+         raise_error("Runtime error: print() expects exactly one argument.\n");
          return return_value;
      }
  
-     Value input = args[0];
- 
-     if (input.type == VAL_STRING)
-     {
-         int num = atoi(input.str_val);
-         return make_int(num);
-     }
-     else if (input.type == VAL_BOOL)
+     Value arg = args[0];
+     char buffer[64];
+
+     switch (arg.type)
      {
-         return make_int(input.int_val != 0);
+         case VAL_INT:
+             format_int(arg.int_val, buffer);
+             printf("%s\n", buffer);
+             break;
+         case VAL_STRING:
+             printf("%s\n", arg.str_val);
+             break;
+         case VAL_BOOL:
+             printf(arg.int_val ? "true\n" : "false\n");
+             break;
+         case VAL_DOUBLE:
+             format_double(arg.double_val, buffer);
+             printf("%s\n", buffer);
+             break;             
+         case VAL_DATE:
+             printf("%02d/%02d/%04d\n", arg.date_val.month, arg.date_val.day, arg.date_val.year);
+             break;            
+         case VAL_SET:
+         {
+             char *list = set_to_list(arg.set_val);
+             printf("%s\n", list);
+             free(list);
+             break;
+         }
+         case VAL_NULL:
+             printf("(null)\n");
+             break;
+         default:
+             break;
      }
-     else
+ 
+     return make_null();
+ }
+ 
+ /*
+  * Prints a value to the screen with a trailing line ending.  Null values do not
+  * print to the sreeen.
+  */
+ Value fn_println(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
      {
-         raise_error("Runtime error: cint() expects a string or bool argument.\n");
+         raise_error("Runtime error: println() expects exactly one argument.\n");
          return return_value;
      }
+ 
+    Value arg = args[0];
+    char buffer[64];
+
+    switch (arg.type)
+    {
+        case VAL_INT:
+            format_int(arg.int_val, buffer);
+            printf("%s\n", buffer);
+            break;
+        case VAL_STRING:
+            printf("%s\n", arg.str_val);
+            break;
+        case VAL_BOOL:
+            printf(arg.int_val ? "true\n" : "false\n");
+            break;
+        case VAL_DOUBLE:
+            format_double(arg.double_val, buffer);
+            printf("%s\n", buffer);
+            break;             
+        case VAL_DATE:
+            printf("%02d/%02d/%04d\n", arg.date_val.month, arg.date_val.day, arg.date_val.year);
+            break;            
+        case VAL_SET:
+        {
+            char *list = set_to_list(arg.set_val);
+            printf("%s\n", list);
+            free(list);
+            break;
+        }
+        case VAL_NULL:
+            printf("(null)\n");
+            break;
+        default:
+            break;
+    }
+
+     return make_null();
  }
  
  /**
-  * Converts a string, int, or bool to a double.
+  * Returns the type of the given value as a string.
   */
- Value fn_cdbl(Value *args, int arg_count)
+ Value fn_typeof(Value *args, int arg_count)
  {
      if (arg_count != 1)
      {
-         raise_error("Runtime error: cdbl() expects 1 argument.\n");
+         raise_error("Runtime error: typeof() expects exactly one argument.\n");
          return return_value;
      }
  
-     Value input = args[0];
- 
-     if (input.type == VAL_DOUBLE)
-     {
-         return input;
-     }
-     else if (input.type == VAL_INT)
+     Value arg = args[0];
+     const char *type_str = "unknown";
+     switch (arg.type)
      {
-         return make_double((double) input.int_val);
+         case VAL_INT:
+             type_str = "int";
+             break;
+         case VAL_STRING:
+             type_str = "string";
+             break;
+         case VAL_BOOL:
+             type_str = "bool";
+             break;
+         case VAL_DOUBLE:
+            type_str = "double";
+            break;             
+         case VAL_DATE:
+            type_str = "date";
+            break;            
+         case VAL_SET:
+            type_str = "set";
+            break;
+         case VAL_MAP:
+            type_str = "map";
+            break;
+         case VAL_TYPED_ARRAY:
+            type_str = args[0].typed_val->kind == TYPED_INT ? "int_array" : "double_array";
+            break;
+         case VAL_NULL:
+             type_str = "null";
+             break;
+         default:
+             type_str = "unknown";
+             break;
      }
-     else if (input.type == VAL_BOOL)
+ 
+     return make_string(type_str);
+ }
+ 
+ /**
+  * Returns the substring of the given string starting at the given index and
+  * continuing for the given length.
+  */
+ Value fn_substring(Value *args, int arg_count)
+ {
+     if (arg_count != 3)
      {
-         return make_double(input.int_val ? 1.0 : 0.0);
+         raise_error("Runtime error: substring() expects 3 arguments: a string, a start index, and a length.\n");
+         return return_value;
      }
-     else if (input.type == VAL_STRING)
+ 
+     if (args[0].type != VAL_STRING)
      {
-         double num = atof(input.str_val);
-         return make_double(num);
+         raise_error("Runtime error: substring() expects the first argument to be a string.\n");
+         return return_value;
      }
-     else
+ 
+     if (args[1].type != VAL_INT)
      {
-         raise_error("Runtime error: cdbl() expects a string, int, bool, or double argument.\n");
+         raise_error("Runtime error: substring() expects the second argument to be an int.\n");
          return return_value;
      }
- }
-
- /*
-  * Converts an int or bool to a string.
-  */
- Value fn_cstr(Value *args, int arg_count)
- {
-     if (arg_count != 1)
+ 
+     if (args[2].type != VAL_INT)
      {
-         raise_error("Runtime error: cstr() expects 1 argument.\n");
+         raise_error("Runtime error: substring() expects the third argument to be an int.\n");
          return return_value;
      }
  
-     Value input = args[0];
-     char buffer[64];
+     char *s = args[0].str_val;
+     int start = args[1].int_val;
+     int len = args[2].int_val;
  
-     if (input.type == VAL_INT)
+     if (start < 0)
      {
-         snprintf(buffer, sizeof(buffer), "%d", input.int_val);
-         return make_string(buffer);
+         start = 0;
      }
-     else if (input.type == VAL_DOUBLE)
-     {
-         snprintf(buffer, sizeof(buffer), "%f", input.double_val);
-         return make_string(buffer);
+ 
+     if (len < 0)
+     {
+         len = 0;
      }
-     else if (input.type == VAL_BOOL)
+ 
+     int s_len = strlen(s);
+     if (start >= s_len)
      {
-         return make_string(input.int_val ? "true" : "false");
+         return make_string("");
      }
-     else if (input.type == VAL_DATE)
+ 
+     int end = start + len;
+     if (end > s_len)
      {
-        snprintf(buffer, sizeof(buffer), "%02d/%02d/%04d", input.date_val.month, input.date_val.day, input.date_val.year);
-        return make_string(buffer);
+         end = s_len;
      }
-     else
+ 
+     int result_len = end - start;
+     char *result = malloc(result_len + 1);
+ 
+     if (!result)
      {
-         raise_error("Runtime error: cstr() expects an int, double, bool or date argument.\n");
+         raise_error("Runtime error: Memory allocation failed in substring().\n");
          return return_value;
      }
+ 
+     memcpy(result, s + start, result_len);
+     result[result_len] = '\0';
+ 
+     // The value takes the buffer over instead of make_string copying it.
+     Value ret;
+     ret.type = VAL_STRING;
+     ret.str_val = result;
+     ret.temp = 1;
+     return ret;
  }
  
- /*
-  * Converts an int to a bool (nonzero true) or a string ("true"/"false" case-insensitive) to a bool.
+ /**
+  * Returns the first n characters of the given string.
+  *
+  * @param args Expects a string and an int.
+  * @param arg_count Expects 2 arguments: a string and an int.
+  * @return A string containing the first n characters of the input string.  If n exceeds the string length then the entire string is returned.
   */
- Value fn_cbool(Value *args, int arg_count)
+ Value fn_left(Value *args, int arg_count)
  {
-     if (arg_count != 1)
+     if (arg_count != 2)
      {
-         raise_error("Runtime error: cbool() expects 1 argument.\n");
+         raise_error("Runtime error: left() expects 2 arguments: a string and an int.\n");
          return return_value;
      }
  
-     Value input = args[0];
- 
-     if (input.type == VAL_INT)
+     if (args[0].type != VAL_STRING)
      {
-         return make_bool(input.int_val != 0);
+         raise_error("Runtime error: left() expects the first argument to be a string.\n");
+         return return_value;
      }
-     else if (input.type == VAL_STRING)
-     {
-         char *lower = _strdup(input.str_val);
  
-         if (!lower)
-         {
-             raise_error("fn_cbool error: memory allocation failed.\n");
-             return return_value;
-         }
+     if (args[1].type != VAL_INT)
+     {
+         raise_error("Runtime error: left() expects the second argument to be an int.\n");
+         return return_value;
+     }
  
-         for (char *p = lower; *p; ++p)
-         {
-             *p = tolower(*p);
-         }
+     char *s = args[0].str_val;
+     int n = args[1].int_val;
  
-         if (strcmp(lower, "true") == 0)
-         {
-             free(lower);
-             return make_bool(true);
-         }
-         else if (strcmp(lower, "false") == 0)
-         {
-             free(lower);
-             return make_bool(false);
-         }
-         else
-         {
-             free(lower);
-             raise_error("fn_cbool error: unsupported string value '%s'.\n", input.str_val);
-             return return_value;
-         }
+     if (n < 0)
+     {
+         n = 0;
      }
-     else
+ 
+     int len = strlen(s);
+     int result_len = (n < len) ? n : len;
+     char *result = malloc(result_len + 1);
+ 
+     if (!result)
      {
-         raise_error("fn_cbool error: unsupported type.\n");
+         raise_error("Runtime error: Memory allocation failed in left().\n");
          return return_value;
      }
+ 
+     strncpy(result, s, result_len);
+     result[result_len] = '\0';
+ 
+     // Create a Value containing the new string.
+     Value ret = make_string(result);
+     free(result);
+     return ret;
  }
  
  /**
-  *  Returns true if the given value is an interval (mod), false otherwise.
+  * Returns the right n characters of a string.
+  * @param args Expects 2 arguments, a string and an int.
+  * @param arg_count 2
+  * @return Returns the right n characters of a string.  If n is greater than the string length the entire string is returned.
   */
- Value fn_is_interval(Value *args, int arg_count)
+ Value fn_right(Value *args, int arg_count)
  {
      if (arg_count != 2)
      {
-         raise_error("Runtime error: is_interval() expects two arguments.\n");
+         raise_error("Runtime error: right() expects 2 arguments: a string and an int.\n");
          return return_value;
      }
  
-     if (args[0].type != VAL_INT || args[1].type != VAL_INT)
+     if (args[0].type != VAL_STRING)
      {
-         return make_bool(false);
+         raise_error("Runtime error: right() expects the first argument to be a string.\n");
+         return return_value;
      }
  
-     if (args[1].int_val == 0) {
-         return make_bool(false);
+     if (args[1].type != VAL_INT)
+     {
+         raise_error("Runtime error: right() expects the second argument to be an int.\n");
+         return return_value;
      }
  
-     return make_bool((args[0].int_val % args[1].int_val) == 0);
+     char *s = args[0].str_val;
+     int n = args[1].int_val;
+ 
+     if (n < 0)
+     {
+         n = 0;
+     }
+ 
+     int len = strlen(s);
+     int result_len = (n < len) ? n : len;
+     char *result = malloc(result_len + 1);
+ 
+     if (!result)
+     {
+         raise_error("Runtime error: Memory allocation failed in right().\n");
+         return return_value;
+     }
+ 
+     /* Copy the last result_len characters from s. */
+     strncpy(result, s + (len - result_len), result_len);
+     result[result_len] = '\0';
+ 
+     Value ret = make_string(result);
+     free(result);
+     return ret;
  }
-
- /**
-  * Trims whitespace from the beginning and end of a string.
-  */
- Value fn_trim(Value *args, int arg_count)
- {
-    if (arg_count != 1)
+ 
+/**
+ * Replaces all occurrences of a substring in a string with another substring.
+ */
+Value fn_replace(Value *args, int arg_count)
+{
+    if (arg_count != 3)
     {
-        raise_error("Runtime error: trim() expects exactly one argument.\n");
+        raise_error("Runtime error: replace() expects 3 arguments: a string, a substring to replace, and a substring to replace it with.\n");
         return return_value;
     }
 
     if (args[0].type != VAL_STRING)
     {
-        raise_error("Runtime error: trim() expects a string argument.\n");
+        raise_error("Runtime error: replace() expects the first argument to be a string.\n");
         return return_value;
     }
 
-    char *s = args[0].str_val;
-    char *start = s;
-    char *end = s + strlen(s) - 1;
-
-    while (isspace(*start))
+    if (args[1].type != VAL_STRING)
     {
-        start++;
+        raise_error("Runtime error: replace() expects the second argument to be a string.\n");
+        return return_value;
     }
 
-    while (end > start && isspace(*end))
+    if (args[2].type != VAL_STRING)
     {
-        end--;
+        raise_error("Runtime error: replace() expects the third argument to be a string.\n");
+        return return_value;
     }
 
-    int len = end - start + 1;
-    char *result = malloc(len + 1);
+    char *s = args[0].str_val;
+    char *find = args[1].str_val;
+    char *replace = args[2].str_val;
+
+    // Allocate a new string that is large enough to hold the result.
+    // We'll allocate the maximum size it could be, which is the length of the
+    // original string times the length of the replacement string.  This is
+    // the worst case scenario where every character in the original string
+    // is the substring we are replacing.
+    int find_len = strlen(find);
+    int replace_len = strlen(replace);
+    int s_len = strlen(s);
+    int result_len = s_len;
+    char *result = malloc(result_len + 1);
 
     if (!result)
     {
-        raise_error("Runtime error: Memory allocation failed in trim().\n");
+        raise_error("Runtime error: Memory allocation failed in replace().\n");
         return return_value;
     }
 
-    strncpy(result, start, len);
-    result[len] = '\0';
+    // Loop through the string looking for the substring to replace.
+    char *p = s;
+    char *q = result;
+    while (*p)
+    {
+        // If the substring is found, copy the replacement string.
+        if (strstr(p, find) == p)
+        {
+            strcpy(q, replace);
+            q += replace_len;
+            p += find_len;
+        }
+        else
+        {
+            // Copy the current character and move to the next.
+            *q++ = *p++;
+        }
+    }
+
+    // Null terminate the result string.
+    *q = '\0';
 
+    // Create a Value containing the new string.
     Value ret = make_string(result);
     free(result);
-    return ret;    
- }
+    return ret;
+}
 
  /**
-  * Trims whitespace from the beginning of a string.
+  * Sleeps for the given number of milliseconds.
+  * @param args Expects 1 argument, an int.
+  * @param arg_count 1
+  * @return Null
   */
- Value fn_trim_start(Value *args, int arg_count)
+ Value fn_sleep(Value *args, int arg_count)
  {
-    if (arg_count != 1)
-    {
-        raise_error("Runtime error: trim_start() expects exactly one argument.\n");
-        return return_value;
-    }
-
-    if (args[0].type != VAL_STRING)
-    {
-        raise_error("Runtime error: trim_start() expects a string argument.\n");
-        return return_value;
-    }
-
-    char *s = args[0].str_val;
-    char *start = s;
-    char *end = s + strlen(s) - 1;
-
-    while (isspace(*start))
-    {
-        start++;
-    }
+     if (arg_count != 1 || args[0].type != VAL_INT) {
+         raise_error("Runtime error: sleep() expects 1 integer argument (milliseconds).\n");
+         return return_value;
+     }
+ 
+     int ms = args[0].int_val;
+ 
+     if (ms < 0)
+     {
+         ms = 0;
+     }
+ 
+ #ifdef _WIN32
+     // Sleep() takes milliseconds.
+     Sleep(ms);
+ #else
+     // For POSIX, use nanosleep. Construct a timespec.
+     struct timespec req, rem;
+     req.tv_sec = ms / 1000;
+     req.tv_nsec = (ms % 1000) * 1000000; // convert ms to ns
+     // Loop in case nanosleep is interrupted by a signal.
+     while (nanosleep(&req, &rem) == -1 && errno == EINTR) {
+         req = rem;
+     }
+ #endif
+ 
+     // Return null as sleep does not produce a meaningful value.
+     return make_null();
+ }
+ 
+ /**
+  * Gets input from the user.
+  * @return A string value of the input the user entered.
+  */
+ Value fn_input(Value *args, int arg_count)
+ {
+     // Allow zero or one argument (a prompt message)
+     if (arg_count > 1)
+     {
+         raise_error("Runtime error: input() expects 0 or 1 argument.\n");
+         return return_value;
+     }
+ 
+     char prompt[256] = {0};
+     if (arg_count == 1)
+     {
+         if (args[0].type != VAL_STRING)
+         {
+             raise_error("Runtime error: input() expects a string as prompt.\n");
+             return return_value;
+         }
+         // Copy the prompt into our buffer (limit its size)
+         strncpy(prompt, args[0].str_val, sizeof(prompt) - 1);
+     }
+ 
+     // If a prompt was provided, print it (and flush so the user sees it immediately)
+     if (prompt[0] != '\0')
+     {
+         printf("%s", prompt);
+         fflush(stdout);
+     }
+ 
+     // Read a line from stdin
+     char buffer[1024];
+     if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+     {
+         // On error or EOF, you might return null
+         return make_null();
+     }
+ 
+     // Remove the newline character, if present
+     buffer[strcspn(buffer, "\n")] = '\0';
+ 
+     // Return the input as a string value
+     return make_string(buffer);
+ }
+ 
+ /**
+  * is_number: returns true if the string is an integer number, false otherwise.
+  * @return A bool value of whether the string is a number.
+  */
+ Value fn_is_number(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
+     {
+         raise_error("Runtime error: is_number() expects exactly one argument.\n");
+         return return_value;
+     }
+     if (args[0].type != VAL_STRING)
+     {
+         raise_error("Runtime error: is_number() expects a string argument.\n");
+         return return_value;
+     }
+ 
+     const char *s = args[0].str_val;
+ 
+     // Skip any leading whitespace.
+     while (*s && isspace((unsigned char) *s))
+     {
+         s++;
+     }
+ 
+     // Handle an optional '+' or '-' sign.
+     if (*s == '+' || *s == '-')
+     {
+         s++;
+     }
+ 
+     // There must be at least one digit.
+     if (!isdigit((unsigned char) *s))
+     {
+         return make_bool(false);
+     }
+ 
+     // Check the remainder of the string.
+     while (*s)
+     {
+         if (!isdigit((unsigned char) *s))
+         {
+             return make_bool(false);
+         }
+         s++;
+     }
+ 
+     return make_bool(true);
+ }
+ 
+ /**
+  * Returns the length of the string if the Value is of type string, or 0 otherwise.
+  *
+  * @param args Expects a single argument.
+  * @param arg_count Expects 1 argument.
+  * @return An int Value representing the string length or -1 if not a string.
+  */
+ Value fn_strlen(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
+     {
+         raise_error("Runtime error: strlen() expects exactly one argument.\n");
+         return return_value;
+     }
+ 
+     if (args[0].type != VAL_STRING)
+     {
+         return make_int(-1);
+     }
+ 
+     int len = strlen(args[0].str_val);
+     return make_int(len);
+ }
+ 
+ /*
+  * Converts a string to an int.
+  */
+ Value fn_cint(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
+     {
+         raise_error("Runtime error: cint() expects 1 argument.\n");
+         return return_value;
+     }
+ 
+     Value input = args[0];
+ 
+     if (input.type == VAL_STRING)
+     {
+         int num = atoi(input.str_val);
+         return make_int(num);
+     }
+     else if (input.type == VAL_BOOL)
+     {
+         return make_int(input.int_val != 0);
+     }
+     else
+     {
+         raise_error("Runtime error: cint() expects a string or bool argument.\n");
+         return return_value;
+     }
+ }
+ 
+ /**
+  * Converts a string, int, or bool to a double.
+  */
+ Value fn_cdbl(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
+     {
+         raise_error("Runtime error: cdbl() expects 1 argument.\n");
+         return return_value;
+     }
+ 
+     Value input = args[0];
+ 
+     if (input.type == VAL_DOUBLE)
+     {
+         return input;
+     }
+     else if (input.type == VAL_INT)
+     {
+         return make_double((double) input.int_val);
+     }
+     else if (input.type == VAL_BOOL)
+     {
+         return make_double(input.int_val ? 1.0 : 0.0);
+     }
+     else if (input.type == VAL_STRING)
+     {
+         double num = atof(input.str_val);
+         return make_double(num);
+     }
+     else
+     {
+         raise_error("Runtime error: cdbl() expects a string, int, bool, or double argument.\n");
+         return return_value;
+     }
+ }
+
+ /*
+  * Converts an int, double, bool, date or set to a string.
+  */
+ Value fn_cstr(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
+     {
+         raise_error("Runtime error: cstr() expects 1 argument.\n");
+         return return_value;
+     }
+ 
+     Value input = args[0];
+     char buffer[64];
+ 
+     if (input.type == VAL_INT)
+     {
+         format_int(input.int_val, buffer);
+         return make_string(buffer);
+     }
+     else if (input.type == VAL_DOUBLE)
+     {
+         format_double(input.double_val, buffer);
+         return make_string(buffer);
+     }
+     else if (input.type == VAL_BOOL)
+     {
+         return make_string(input.int_val ? "true" : "false");
+     }
+     else if (input.type == VAL_DATE)
+     {
+        snprintf(buffer, sizeof(buffer), "%02d/%02d/%04d", input.date_val.month, input.date_val.day, input.date_val.year);
+        return make_string(buffer);
+     }
+     else if (input.type == VAL_SET)
+     {
+         Value ret;
+         ret.type = VAL_STRING;
+         ret.str_val = set_to_list(input.set_val);
+         ret.temp = 1;
+         return ret;
+     }
+     else
+     {
+         raise_error("Runtime error: cstr() expects an int, double, bool, date or set argument.\n");
+         return return_value;
+     }
+ }
+ 
+ /*
+  * Converts an int to a bool (nonzero true) or a string ("true"/"false" case-insensitive) to a bool.
+  */
+ Value fn_cbool(Value *args, int arg_count)
+ {
+     if (arg_count != 1)
+     {
+         raise_error("Runtime error: cbool() expects 1 argument.\n");
+         return return_value;
+     }
+ 
+     Value input = args[0];
+ 
+     if (input.type == VAL_INT)
+     {
+         return make_bool(input.int_val != 0);
+     }
+     else if (input.type == VAL_STRING)
+     {
+         char *lower = _strdup(input.str_val);
+ 
+         if (!lower)
+         {
+             raise_error("fn_cbool error: memory allocation failed.\n");
+             return return_value;
+         }
+ 
+         for (char *p = lower; *p; ++p)
+         {
+             *p = tolower(*p);
+         }
+ 
+         if (strcmp(lower, "true") == 0)
+         {
+             free(lower);
+             return make_bool(true);
+         }
+         else if (strcmp(lower, "false") == 0)
+         {
+             free(lower);
+             return make_bool(false);
+         }
+         else
+         {
+             free(lower);
+             raise_error("fn_cbool error: unsupported string value '%s'.\n", input.str_val);
+             return return_value;
+         }
+     }
+     else
+     {
+         raise_error("fn_cbool error: unsupported type.\n");
+         return return_value;
+     }
+ }
+ 
+ /**
+  *  Returns true if the given value is an interval (mod), false otherwise.
+  */
+ Value fn_is_interval(Value *args, int arg_count)
+ {
+     if (arg_count != 2)
+     {
+         raise_error("Runtime error: is_interval() expects two arguments.\n");
+         return return_value;
+     }
+ 
+     if (args[0].type != VAL_INT || args[1].type != VAL_INT)
+     {
+         return make_bool(false);
+     }
+ 
+     if (args[1].int_val == 0) {
+         return make_bool(false);
+     }
+ 
+     return make_bool((args[0].int_val % args[1].int_val) == 0);
+ }
+
+ /**
+  * Trims whitespace from the beginning and end of a string.
+  */
+ Value fn_trim(Value *args, int arg_count)
+ {
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: trim() expects exactly one argument.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: trim() expects a string argument.\n");
+        return return_value;
+    }
+
+    char *s = args[0].str_val;
+    char *start = s;
+    char *end = s + strlen(s) - 1;
+
+    while (isspace(*start))
+    {
+        start++;
+    }
+
+    while (end > start && isspace(*end))
+    {
+        end--;
+    }
+
+    int len = end - start + 1;
+    char *result = malloc(len + 1);
+
+    if (!result)
+    {
+        raise_error("Runtime error: Memory allocation failed in trim().\n");
+        return return_value;
+    }
+
+    strncpy(result, start, len);
+    result[len] = '\0';
+
+    Value ret = make_string(result);
+    free(result);
+    return ret;    
+ }
+
+ /**
+  * Trims whitespace from the beginning of a string.
+  */
+ Value fn_trim_start(Value *args, int arg_count)
+ {
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: trim_start() expects exactly one argument.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: trim_start() expects a string argument.\n");
+        return return_value;
+    }
+
+    char *s = args[0].str_val;
+    char *start = s;
+    char *end = s + strlen(s) - 1;
+
+    while (isspace(*start))
+    {
+        start++;
+    }
+
+    int len = end - start + 1;
+    char *result = malloc(len + 1);
+
+    if (!result)
+    {
+        raise_error("Runtime error: Memory allocation failed in trim_start().\n");
+        return return_value;
+    }
+
+    strncpy(result, start, len);
+    result[len] = '\0';
+
+    Value ret = make_string(result);
+    free(result);
+    return ret;    
+ }
+
+ /**
+  * Trims whitespace from the end of a string.
+  */
+ Value fn_trim_end(Value *args, int arg_count)
+ {
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: trim_end() expects exactly one argument.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: trim_end() expects a string argument.\n");
+        return return_value;
+    }
+
+    char *s = args[0].str_val;
+    char *start = s;
+    char *end = s + strlen(s) - 1;
+
+    while (end > start && isspace(*end))
+    {
+        end--;
+    }
+
+    int len = end - start + 1;
+    char *result = malloc(len + 1);
+
+    if (!result)
+    {
+        raise_error("Runtime error: Memory allocation failed in trim_end().\n");
+        return return_value;
+    }
+
+    strncpy(result, start, len);
+    result[len] = '\0';
+
+    Value ret = make_string(result);
+    free(result);
+    return ret;    
+ }
+
+ /**
+  * Converts a string to lowercase.
+  */
+ Value fn_lcase(Value *args, int arg_count)
+ {
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: lcase() expects exactly one argument.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: lcase() expects a string argument.\n");
+        return return_value;
+    }
+
+    char *s = args[0].str_val;
+    char *p = s;
+    while (*p)
+    {
+        *p = tolower(*p);
+        p++;
+    }
+
+    return make_string(s);    
+ }
+
+ /**
+  * Converts a string to uppercase.
+  */
+ Value fn_ucase(Value *args, int arg_count)
+ {
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: ucase() expects exactly one argument.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: ucase() expects a string argument.\n");
+        return return_value;
+    }
+
+    char *s = args[0].str_val;
+    char *p = s + strlen(s) - 1;
+    while (p >= s)
+    {
+        *p = toupper(*p);
+        p--;
+    }
+
+    return make_string(s);    
+ }
+
+ /**
+  * Returns the lower of two int values.
+  */
+Value fn_umin(Value *args, int arg_count) 
+{
+    if (arg_count != 2)
+    {
+        raise_error("Runtime error: umin() expects exactly two arguments.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_INT || args[1].type != VAL_INT)
+    {
+        raise_error("Runtime error: umin() expects two integer arguments.\n");
+        return return_value;
+    }
+
+    return make_int(args[0].int_val < args[1].int_val ? args[0].int_val : args[1].int_val);
+}
+
+/**
+ * Returns the higher of two int values.
+ */
+Value fn_umax(Value *args, int arg_count) 
+{
+    if (arg_count != 2)
+    {
+        raise_error("Runtime error: umax() expects exactly two arguments.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_INT || args[1].type != VAL_INT)
+    {
+        raise_error("Runtime error: umax() expects two integer arguments.\n");
+        return return_value;
+    }
+
+    return make_int(args[0].int_val > args[1].int_val ? args[0].int_val : args[1].int_val);
+}
+
+/**
+ * Returns the current date/time as a string.
+ */
+Value fn_timestr(Value *args, int arg_count) 
+{
+    char buf[256];
+    struct timeval now_time;
+
+    get_datetime_string(&now_time, NULL);
+    time_t current_time = (time_t) now_time.tv_sec;
+    strcpy(buf, ctime( &current_time ));
+
+    return make_string(buf);
+}
+
+/**
+ * Returns the absolute value of a number.
+ */
+Value fn_abs(Value *args, int arg_count) 
+{
+    if (arg_count != 1)
+    {
+        raise_error("Runtime error: abs() expects exactly one argument.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_INT)
+    {
+        raise_error("Runtime error: abs() expects an integer argument.\n");
+        return return_value;
+    }
+
+    int num = args[0].int_val;
+    int abs_val = num < 0 ? -num : num;
+    return make_int(abs_val);
+}
+
+/**
+ * Sets the cursor position in the terminal.
+ */
+Value fn_set_cursor_position(Value *args, int arg_count)
+{
+    if (arg_count != 2 || args[0].type != VAL_INT || args[1].type != VAL_INT)
+    {
+        raise_error("Runtime error: set_cursor_position expects two integer arguments.\n");
+        return make_null();
+    }
+    int x = args[0].int_val;
+    int y = args[1].int_val;
+    printf("\033[%d;%dH", x, y);
+
+    return make_null();
+}
+
+/**
+ * Clears the terminal screen using ANSI escape codes.
+ */
+Value fn_clear_screen(Value *args, int arg_count)
+{
+    if (arg_count != 0)
+    {
+        raise_error("Runtime error: clear() expects no arguments.\n");
+        return return_value;
+    }
+
+    // ANSI escape codes to clear the screen and reset the cursor position.
+    printf("\033[2J\033[H");
+    fflush(stdout);
+
+    return make_null();
+}
+
+Value fn_round(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    {
+        raise_error("Runtime error: round() expects one double argument.\n");
+        return return_value;
+    }
+
+    double d = args[0].double_val;
+    // round() rounds to the nearest integer.
+    return make_int((int) round(d));
+}
+
+Value fn_round_up(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    {
+        raise_error("Runtime error: roundup() expects one double argument.\n");
+        return return_value;
+    }
+
+    double d = args[0].double_val;
+    // ceil() returns the smallest integer value not less than d.
+    return make_int((int) ceil(d));
+}
+
+Value fn_round_down(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    {
+        raise_error("Runtime error: roundown() expects one double argument.\n");
+        return return_value;
+    }
+
+    double d = args[0].double_val;
+    // floor() returns the largest integer value not greater than d.
+    return make_int((int) floor(d));
+}
+
+/**
+ *  Finds the square root of a number.
+ */
+Value fn_sqrt(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    {
+        raise_error("Runtime error: sqrt() expects one double argument.\n");
+        return return_value;
+    }
+
+    double d = args[0].double_val;
+    if (d < 0)
+    {
+        raise_error("Runtime error: sqrt() domain error, negative value.\n");
+        return return_value;
+    }
+
+    return make_double(sqrt(d));
+}
+
+/**
+ * If one string is contained within another.
+ */
+Value fn_contains(Value *args, int arg_count)
+{
+    if (arg_count != 2)
+    {
+        raise_error("Runtime error: contains() expects exactly 2 arguments.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: contains() expects the first argument to be a string.\n");
+        return return_value;
+    }
+
+    if (args[1].type != VAL_STRING)
+    {
+        raise_error("Runtime error: contains() expects the second argument to be a string.\n");
+        return return_value;
+    }
+
+    // Use strstr to check if the second string is found within the first.
+    if (strstr(args[0].str_val, args[1].str_val))
+    {
+        return make_bool(true);
+    }
+
+    return make_bool(false);
+}
+
+/**
+ * Returns true if the first string starts with the second string.
+ */
+Value fn_starts_with(Value *args, int arg_count)
+{
+    if (arg_count != 2)
+    {
+        raise_error("Runtime error: starts_with() expects exactly 2 arguments.\n");
+        return return_value;
+    }
+    
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: starts_with() expects the first argument to be a string.\n");
+        return return_value;
+    }
+    
+    if (args[1].type != VAL_STRING)
+    {
+        raise_error("Runtime error: starts_with() expects the second argument to be a string.\n");
+        return return_value;
+    }
+    
+    const char *str = args[0].str_val;
+    const char *prefix = args[1].str_val;
+    size_t prefix_len = strlen(prefix);
+    
+    if (strncmp(str, prefix, prefix_len) == 0)
+    {
+        return make_bool(true);
+    }
+    
+    return make_bool(false);
+}
+
+/**
+ * Returns true if the first string ends with the second string.
+ */
+Value fn_ends_with(Value *args, int arg_count)
+{
+    if (arg_count != 2)
+    {
+        raise_error("Runtime error: ends_with() expects exactly 2 arguments.\n");
+        return return_value;
+    }
+    
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: ends_with() expects the first argument to be a string.\n");
+        return return_value;
+    }
+    
+    if (args[1].type != VAL_STRING)
+    {
+        raise_error("Runtime error: ends_with() expects the second argument to be a string.\n");
+        return return_value;
+    }
+    
+    const char *str = args[0].str_val;
+    const char *suffix = args[1].str_val;
+    size_t str_len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    
+    if (suffix_len > str_len)
+    {
+        return make_bool(false);
+    }
+    
+    if (strcmp(str + (str_len - suffix_len), suffix) == 0)
+    {
+        return make_bool(true);
+    }
+    
+    return make_bool(false);
+}
+
+/*
+ * Searchs for the first occurrence of a substring in a string.  Returns -1
+ * if no matches are found.
+ */
+Value fn_index_of(Value *args, int arg_count)
+{
+    if (arg_count != 3)
+    {
+        raise_error("Runtime error: index_of() expects 3 arguments: a string, a substring, and a starting index.\n");
+        return return_value;
+    }
+
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: index_of() expects the first argument to be a string.\n");
+        return return_value;
+    }
+
+    if (args[1].type != VAL_STRING)
+    {
+        raise_error("Runtime error: index_of() expects the second argument to be a string.\n");
+        return return_value;
+    }
+
+    if (args[2].type != VAL_INT)
+    {
+        raise_error("Runtime error: index_of() expects the third argument to be an int.\n");
+        return return_value;
+    }
+
+    const char *str = args[0].str_val;
+    const char *substr = args[1].str_val;
+    int start = args[2].int_val;
+    size_t str_len = strlen(str);
+
+    if (start < 0 || (size_t)start >= str_len)
+    {
+        return make_int(-1);
+    }
+
+    const char *found = strstr(str + start, substr);
+    if (found)
+    {
+        int index = found - str;
+        return make_int(index);
+    }
+
+    return make_int(-1);
+}
+
+/**
+ * Searchs for the last occurrence of a substring in a string.  Returns -1
+ * if no matches are found.
+ */
+Value fn_last_index_of(Value *args, int arg_count)
+{
+    if (arg_count < 2 || arg_count > 3)
+    {
+        raise_error("Runtime error: last_index_of() expects 2 or 3 arguments: a string, a substring, and an optional starting index.\n");
+        return return_value;
+    }
+    
+    if (args[0].type != VAL_STRING)
+    {
+        raise_error("Runtime error: last_index_of() expects the first argument to be a string.\n");
+        return return_value;
+    }
+    
+    if (args[1].type != VAL_STRING)
+    {
+        raise_error("Runtime error: last_index_of() expects the second argument to be a string.\n");
+        return return_value;
+    }
+    
+    const char *str = args[0].str_val;
+    const char *substr = args[1].str_val;
+    size_t str_len = strlen(str);
+    size_t substr_len = strlen(substr);
+    int start;
+    
+    if (arg_count == 3)
+    {
+        if (args[2].type != VAL_INT)
+        {
+            raise_error("Runtime error: last_index_of() expects the third argument to be an int.\n");
+            return return_value;
+        }
+        start = args[2].int_val;
+    }
+    else
+    {
+        // Default starting index: from the end of the string.
+        start = (int)str_len - 1;
+    }
+    
+    // If start is negative, return -1.
+    if (start < 0)
+    {
+        return make_int(-1);
+    }
+    
+    // Clamp start to the last valid index.
+    if ((size_t)start >= str_len)
+    {
+        start = (int)str_len - 1;
+    }
+    
+    // Search backwards from the start position.
+    for (int i = start; i >= 0; i--)
+    {
+        // Ensure there is enough room for substr to match.
+        if ((size_t)(i + substr_len) > str_len)
+        {
+            continue;
+        }
+        
+        if (strncmp(str + i, substr, substr_len) == 0)
+        {
+            return make_int(i);
+        }
+    }
+    
+    return make_int(-1);
+}
 
-    int len = end - start + 1;
-    char *result = malloc(len + 1);
+/**
+ * Returns the month of a date.
+ */
+Value fn_month(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DATE)
+    {
+        raise_error("month() requires one date argument.\n");
+        return make_null();
+    }
+    return make_int(args[0].date_val.month);
+}
 
-    if (!result)
+/**
+ * Returns the day of a date.
+ */
+Value fn_day(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DATE)
     {
-        raise_error("Runtime error: Memory allocation failed in trim_start().\n");
-        return return_value;
+        raise_error("day() requires one date argument.\n");
+        return make_null();
+    }
+    return make_int(args[0].date_val.day);
+}
+
+/**
+ * Returns the year of a date.
+ */
+Value fn_year(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DATE)
+    {
+        raise_error("year() requires one date argument.\n");
+        return make_null();
+    }
+    return make_int(args[0].date_val.year);
+}
+
+/**
+ * Converts a string or an int (as an epoch) to a Date value.
+ */
+Value fn_cdate(Value *args, int arg_count)
+{
+    if (arg_count != 1)
+    {
+        raise_error("cdate() requires one argument.\n");
+        return make_null();
+    }
+
+    if (args[0].type == VAL_STRING)
+    {
+        // Supported formats: MM/DD/YYYY or YYYY/MM/DD
+        int m, d, y;
+        if (sscanf(args[0].str_val, "%d/%d/%d", &m, &d, &y) == 3)
+        {
+            // If the first number is greater than 12, assume format is YYYY/MM/DD.
+            if (m > 12)
+            {
+                int temp = m;
+                m = d;
+                d = y;
+                y = temp;
+            }
+            Date date = { m, d, y };
+            return make_date(date);
+        }
+        else
+        {
+            raise_error("cdate() could not parse date from string: %s\n", args[0].str_val);
+            return make_null();
+        }
+    }
+    else if (args[0].type == VAL_INT)
+    {
+        time_t epoch = args[0].int_val;
+        struct tm *tm_date = localtime(&epoch);
+        if (!tm_date)
+        {
+            raise_error("cdate() failed to convert epoch %d to date.\n", args[0].int_val);
+            return make_null();
+        }
+        Date date = { tm_date->tm_mon + 1, tm_date->tm_mday, tm_date->tm_year + 1900 };
+        return make_date(date);
+    }
+    else
+    {
+        raise_error("cdate() expects a string or integer argument.\n");
+        return make_null();
+    }
+}
+
+/**
+ * Returns today's date as a Date value.
+ */
+Value fn_today(Value *args, int arg_count)
+{
+    if (arg_count != 0)
+    {
+        raise_error("today() expects no arguments.\n");
+        return make_null();
+    }
+
+    time_t now = time(NULL);
+    struct tm *local = localtime(&now);
+    if (!local)
+    {
+        raise_error("today() failed to retrieve local time.\n");
+        return make_null();
+    }
+
+    // struct tm: tm_mon is 0-indexed and tm_year is years since 1900.
+    Date date = { local->tm_mon + 1, local->tm_mday, local->tm_year + 1900 };
+    return make_date(date);
+}
+
+/**
+ * Adds a given number of days to a date.
+ */
+Value fn_add_days(Value *args, int arg_count)
+{
+    if (arg_count != 2 || args[0].type != VAL_DATE || args[1].type != VAL_INT)
+    {
+        raise_error("add_days() expects a date and an integer.\n");
+        return make_null();
+    }
+
+    Date old = args[0].date_val;
+    int days = args[1].int_val;
+
+    struct tm tm_date = {0};
+    tm_date.tm_year = old.year - 1900;
+    tm_date.tm_mon  = old.month - 1;
+    tm_date.tm_mday = old.day;
+    tm_date.tm_isdst = -1;
+
+    time_t t = mktime(&tm_date);
+    if (t == -1)
+    {
+        raise_error("add_days() failed to convert date.\n");
+        return make_null();
+    }
+
+    t += days * 86400; // 86400 seconds in a day
+    struct tm *new_tm = localtime(&t);
+    if (!new_tm)
+    {
+        raise_error("add_days() failed to compute new date.\n");
+        return make_null();
+    }
+
+    Date result = { new_tm->tm_mon + 1, new_tm->tm_mday, new_tm->tm_year + 1900 };
+    return make_date(result);
+}
+
+/**
+ * Adds a given number of months to a date.
+ */
+Value fn_add_months(Value *args, int arg_count)
+{
+    if (arg_count != 2 || args[0].type != VAL_DATE || args[1].type != VAL_INT)
+    {
+        raise_error("add_months() expects a date and an integer.\n");
+        return make_null();
+    }
+
+    Date old = args[0].date_val;
+    int months_to_add = args[1].int_val;
+    int new_month = old.month + months_to_add;
+    int new_year = old.year;
+
+    // Normalize month and adjust year accordingly.
+    while (new_month > 12)
+    {
+        new_month -= 12;
+        new_year++;
+    }
+    while (new_month < 1)
+    {
+        new_month += 12;
+        new_year--;
+    }
+
+    int new_day = old.day;
+    int days_in_month;
+    switch(new_month)
+    {
+        case 1: case 3: case 5: case 7: case 8: case 10: case 12:
+            days_in_month = 31; break;
+        case 4: case 6: case 9: case 11:
+            days_in_month = 30; break;
+        case 2:
+            // Leap year check.
+            if ((new_year % 4 == 0 && new_year % 100 != 0) || (new_year % 400 == 0))
+                days_in_month = 29;
+            else
+                days_in_month = 28;
+            break;
+        default:
+            days_in_month = 31; break;
+    }
+    if (new_day > days_in_month)
+    {
+        new_day = days_in_month;
+    }
+
+    Date result = { new_month, new_day, new_year };
+    return make_date(result);
+}
+
+/**
+ * Adds a given number of years to a date.
+ */
+Value fn_add_years(Value *args, int arg_count)
+{
+    if (arg_count != 2 || args[0].type != VAL_DATE || args[1].type != VAL_INT)
+    {
+        raise_error("add_years() expects a date and an integer.\n");
+        return make_null();
     }
 
-    strncpy(result, start, len);
-    result[len] = '\0';
-
-    Value ret = make_string(result);
-    free(result);
-    return ret;    
- }
+    Date old = args[0].date_val;
+    int years_to_add = args[1].int_val;
+    int new_year = old.year + years_to_add;
+    int new_month = old.month;
+    int new_day = old.day;
 
- /**
-  * Trims whitespace from the end of a string.
-  */
- Value fn_trim_end(Value *args, int arg_count)
- {
-    if (arg_count != 1)
+    // Adjust February 29th if new year is not a leap year.
+    if (new_month == 2 && new_day == 29)
     {
-        raise_error("Runtime error: trim_end() expects exactly one argument.\n");
-        return return_value;
+        if (!((new_year % 4 == 0 && new_year % 100 != 0) || (new_year % 400 == 0)))
+        {
+            new_day = 28;
+        }
     }
 
-    if (args[0].type != VAL_STRING)
+    Date result = { new_month, new_day, new_year };
+    return make_date(result);
+}
+
+/**
+ * Converts a date to its Unix epoch equivalent.
+ */
+Value fn_cepoch(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_DATE)
     {
-        raise_error("Runtime error: trim_end() expects a string argument.\n");
-        return return_value;
+        raise_error("cepoch() expects a single date argument.\n");
+        return make_null();
     }
+    
+    Date date = args[0].date_val;
+    struct tm tm_date = {0};
+    tm_date.tm_year = date.year - 1900;
+    tm_date.tm_mon  = date.month - 1;
+    tm_date.tm_mday = date.day;
+    tm_date.tm_hour = 0;
+    tm_date.tm_min  = 0;
+    tm_date.tm_sec  = 0;
+    tm_date.tm_isdst = -1;
 
-    char *s = args[0].str_val;
-    char *start = s;
-    char *end = s + strlen(s) - 1;
-
-    while (end > start && isspace(*end))
+    time_t epoch = mktime(&tm_date);
+    if (epoch == -1)
     {
-        end--;
+        raise_error("cepoch() failed to convert date to epoch.\n");
+        return make_null();
     }
+    
+    return make_int((int)epoch);
+}
 
-    int len = end - start + 1;
-    char *result = malloc(len + 1);
+/**
+ * Returns the width of the terminal window.
+ */
+Value fn_terminal_width(Value *args, int arg_count)
+{
+    int width;
 
-    if (!result)
-    {
-        raise_error("Runtime error: Memory allocation failed in trim_end().\n");
-        return return_value;
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (GetConsoleScreenBufferInfo(hStdout, &csbi)) {
+        width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+    } else {
+        // Handle error: default to a safe size or exit.
+        width = 80;
+    }
+#else
+    struct winsize w;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != -1) {
+        width = w.ws_col;
+        height = w.ws_row;
+    } else {
+        // Handle error: default to a safe size or exit.
+        width = 80;
     }
+#endif
 
-    strncpy(result, start, len);
-    result[len] = '\0';
+    return make_int(width);
+}
 
-    Value ret = make_string(result);
-    free(result);
-    return ret;    
- }
+/**
+ * Returns the height of the terminal window.
+ */
+Value fn_terminal_height(Value *args, int arg_count)
+{
+    int height;
 
- /**
-  * Converts a string to lowercase.
-  */
- Value fn_lcase(Value *args, int arg_count)
- {
-    if (arg_count != 1)
-    {
-        raise_error("Runtime error: lcase() expects exactly one argument.\n");
-        return return_value;
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (GetConsoleScreenBufferInfo(hStdout, &csbi)) {
+        height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+    } else {
+        // Handle error: default to a safe size or exit.
+        height = 25;
+    }
+#else
+    struct winsize w;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != -1) {
+        height = w.ws_row;
+    } else {
+        // Handle error: default to a safe size or exit.
+        height = 25;
     }
+#endif
 
-    if (args[0].type != VAL_STRING)
+    return make_int(height);
+}
+
+/**
+ * Returns the ASCII character for a given code.
+ */
+Value fn_chr(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_INT)
     {
-        raise_error("Runtime error: lcase() expects a string argument.\n");
-        return return_value;
+        raise_error("asc() expects a single integer argument.\n");
+        return make_null();
     }
 
-    char *s = args[0].str_val;
-    char *p = s;
-    while (*p)
+    int code = args[0].int_val;
+    char result[2];
+    result[0] = (char) code;
+    result[1] = '\0';
+
+    return make_string(result);
+}
+
+/**
+ * Returns the ASCII code for a given character.
+ */
+Value fn_asc(Value *args, int arg_count)
+{
+    if (arg_count != 1 || args[0].type != VAL_STRING)
     {
-        *p = tolower(*p);
-        p++;
+        raise_error("asc() expects a single character argument.\n");
+        return make_null();
     }
 
-    return make_string(s);    
- }
+    char *str = args[0].str_val;
+    return make_int((int) str[0]);
+}
 
- /**
-  * Converts a string to uppercase.
-  */
- Value fn_ucase(Value *args, int arg_count)
- {
+Value fn_upperbound(Value *args, int arg_count)
+{
     if (arg_count != 1)
     {
-        raise_error("Runtime error: ucase() expects exactly one argument.\n");
+        raise_error("Runtime error: upperbound() expects one argument (an array).\n");
         return return_value;
     }
-
-    if (args[0].type != VAL_STRING)
+    if (args[0].type == VAL_TYPED_ARRAY)
     {
-        raise_error("Runtime error: ucase() expects a string argument.\n");
-        return return_value;
+        return make_int(args[0].typed_val->length - 1);
     }
-
-    char *s = args[0].str_val;
-    char *p = s + strlen(s) - 1;
-    while (p >= s)
+    if (args[0].type != VAL_ARRAY)
     {
-        *p = toupper(*p);
-        p--;
+        raise_error("Runtime error: upperbound() expects an array.\n");
+        return return_value;
     }
+    Array *arr = args[0].array_val;
+    return make_int(arr->length - 1);
+}
 
-    return make_string(s);    
- }
-
- /**
-  * Returns the lower of two int values.
-  */
-Value fn_umin(Value *args, int arg_count) 
+Value fn_split(Value *args, int arg_count)
 {
     if (arg_count != 2)
     {
-        raise_error("Runtime error: umin() expects exactly two arguments.\n");
+        raise_error("Runtime error: split() expects two arguments: a string and a delimiter.\n");
         return return_value;
     }
-
-    if (args[0].type != VAL_INT || args[1].type != VAL_INT)
+    if (args[0].type != VAL_STRING || args[1].type != VAL_STRING)
     {
-        raise_error("Runtime error: umin() expects two integer arguments.\n");
+        raise_error("Runtime error: split() expects both arguments to be strings.\n");
         return return_value;
     }
-
-    return make_int(args[0].int_val < args[1].int_val ? args[0].int_val : args[1].int_val);
-}
-
-/**
- * Returns the higher of two int values.
- */
-Value fn_umax(Value *args, int arg_count) 
-{
-    if (arg_count != 2)
+    char *str = args[0].str_val;
+    char *delim = args[1].str_val;
+    
+    // First, count the number of tokens
+    int count = 0;
+    char *copy = strdup(str);
+    char *token = strtok(copy, delim);
+    while (token != NULL)
     {
-        raise_error("Runtime error: umax() expects exactly two arguments.\n");
+        count++;
+        token = strtok(NULL, delim);
+    }
+    free(copy);
+    
+    // Allocate an array of Value items
+    Value *items = malloc(sizeof(Value) * count);
+    if (!items)
+    {
+        raise_error("Runtime error: Memory allocation failed in split().\n");
         return return_value;
     }
-
-    if (args[0].type != VAL_INT || args[1].type != VAL_INT)
+    int index = 0;
+    copy = strdup(str);
+    token = strtok(copy, delim);
+    while (token != NULL)
+    {
+        items[index++] = make_string(token);
+        token = strtok(NULL, delim);
+    }
+    free(copy);
+    
+    // Create and populate the Array structure
+    Array *arr = malloc(sizeof(Array));
+    if (!arr)
     {
-        raise_error("Runtime error: umax() expects two integer arguments.\n");
+        free(items);
+        raise_error("Runtime error: Memory allocation failed in split().\n");
         return return_value;
     }
-
-    return make_int(args[0].int_val > args[1].int_val ? args[0].int_val : args[1].int_val);
-}
-
-/**
- * Returns the current date/time as a string.
- */
-Value fn_timestr(Value *args, int arg_count) 
-{
-    char buf[256];
-    struct timeval now_time;
-
-    get_datetime_string(&now_time, NULL);
-    time_t current_time = (time_t) now_time.tv_sec;
-    strcpy(buf, ctime( &current_time ));
-
-    return make_string(buf);
+    arr->items = items;
+    arr->length = count;
+    arr->shared = NULL;
+    
+    Value ret;
+    ret.type = VAL_ARRAY;
+    ret.array_val = arr;
+    ret.temp = 1;
+    return ret;
 }
 
-/**
- * Returns the absolute value of a number.
- */
-Value fn_abs(Value *args, int arg_count) 
+Value fn_new_array(Value *args, int arg_count)
 {
     if (arg_count != 1)
     {
-        raise_error("Runtime error: abs() expects exactly one argument.\n");
+        raise_error("Runtime error: new_array() expects one argument (the size).\n");
         return return_value;
     }
-
     if (args[0].type != VAL_INT)
     {
-        raise_error("Runtime error: abs() expects an integer argument.\n");
+        raise_error("Runtime error: new_array() expects an integer.\n");
         return return_value;
     }
-
-    int num = args[0].int_val;
-    int abs_val = num < 0 ? -num : num;
-    return make_int(abs_val);
-}
-
-/**
- * Sets the cursor position in the terminal.
- */
-Value fn_set_cursor_position(Value *args, int arg_count)
-{
-    if (arg_count != 2 || args[0].type != VAL_INT || args[1].type != VAL_INT)
+    int size = args[0].int_val;
+    if (size < 0)
     {
-        raise_error("Runtime error: set_cursor_position expects two integer arguments.\n");
-        return make_null();
+        raise_error("Runtime error: new_array() expects a non-negative integer.\n");
+        return return_value;
     }
-    int x = args[0].int_val;
-    int y = args[1].int_val;
-    printf("\033[%d;%dH", x, y);
-
-    return make_null();
-}
-
-/**
- * Clears the terminal screen using ANSI escape codes.
- */
-Value fn_clear_screen(Value *args, int arg_count)
-{
-    if (arg_count != 0)
+    Value *items = malloc(sizeof(Value) * size);
+    if (!items)
     {
-        raise_error("Runtime error: clear() expects no arguments.\n");
+        raise_error("Runtime error: Memory allocation failed in new_array().\n");
         return return_value;
     }
-
-    // ANSI escape codes to clear the screen and reset the cursor position.
-    printf("\033[2J\033[H");
-    fflush(stdout);
-
-    return make_null();
-}
-
-Value fn_round(Value *args, int arg_count)
-{
-    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    for (int i = 0; i < size; i++)
     {
-        raise_error("Runtime error: round() expects one double argument.\n");
-        return return_value;
+        items[i] = make_null(); // Initialize each element to null
     }
-
-    double d = args[0].double_val;
-    // round() rounds to the nearest integer.
-    return make_int((int) round(d));
-}
-
-Value fn_round_up(Value *args, int arg_count)
-{
-    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    Array *arr = malloc(sizeof(Array));
+    if (!arr)
     {
-        raise_error("Runtime error: roundup() expects one double argument.\n");
+        free(items);
+        raise_error("Runtime error: Memory allocation failed in new_array().\n");
         return return_value;
     }
-
-    double d = args[0].double_val;
-    // ceil() returns the smallest integer value not less than d.
-    return make_int((int) ceil(d));
+    arr->items = items;
+    arr->length = size;
+    arr->shared = NULL;
+    
+    Value ret;
+    ret.type = VAL_ARRAY;
+    ret.array_val = arr;
+    ret.temp = 1;
+    return ret;
 }
 
-Value fn_round_down(Value *args, int arg_count)
+Value fn_array_set(Value *args, int arg_count)
 {
-    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    if (arg_count != 3)
     {
-        raise_error("Runtime error: roundown() expects one double argument.\n");
+        raise_error("Runtime error: array_set() expects three arguments: an array, an index, and a value.\n");
         return return_value;
     }
-
-    double d = args[0].double_val;
-    // floor() returns the largest integer value not greater than d.
-    return make_int((int) floor(d));
-}
-
-/**
- *  Finds the square root of a number.
- */
-Value fn_sqrt(Value *args, int arg_count)
-{
-    if (arg_count != 1 || args[0].type != VAL_DOUBLE)
+    if (args[0].type != VAL_ARRAY)
     {
-        raise_error("Runtime error: sqrt() expects one double argument.\n");
+        raise_error("Runtime error: First argument to array_set() must be an array.\n");
         return return_value;
     }
-
-    double d = args[0].double_val;
-    if (d < 0)
+    if (args[1].type != VAL_INT)
     {
-        raise_error("Runtime error: sqrt() domain error, negative value.\n");
+        raise_error("Runtime error: Second argument to array_set() must be an integer index.\n");
         return return_value;
     }
-
-    return make_double(sqrt(d));
-}
-
-/**
- * If one string is contained within another.
- */
-Value fn_contains(Value *args, int arg_count)
-{
-    if (arg_count != 2)
+    Array *arr = args[0].array_val;
+    int idx = args[1].int_val;
+    if (idx < 0 || idx >= arr->length)
     {
-        raise_error("Runtime error: contains() expects exactly 2 arguments.\n");
+        raise_error("Runtime error: Array index out of bounds.\n");
         return return_value;
     }
-
-    if (args[0].type != VAL_STRING)
+    if (!array_own(arr))
     {
-        raise_error("Runtime error: contains() expects the first argument to be a string.\n");
         return return_value;
     }
+    /* Free the previous value at that index if necessary */
+    free_value(arr->items[idx]);
 
-    if (args[1].type != VAL_STRING)
+    Value newVal;
+    if (args[2].type == VAL_STRING)
     {
-        raise_error("Runtime error: contains() expects the second argument to be a string.\n");
-        return return_value;
+        /* Create a new string so that the array element owns its memory */
+        newVal = make_string(args[2].str_val);
+        newVal.temp = 0;  // Mark it as owned by the array.
     }
-
-    // Use strstr to check if the second string is found within the first.
-    if (strstr(args[0].str_val, args[1].str_val))
+    else
     {
-        return make_bool(true);
+        /* For other types, a shallow copy is sufficient */
+        newVal = args[2];
+        newVal.temp = 0;
     }
-
-    return make_bool(false);
+    
+    arr->items[idx] = newVal;
+    return make_null();
 }
 
-/**
- * Returns true if the first string starts with the second string.
+
+/*
+ * Wraps items in a new array value, which owns them.
  */
-Value fn_starts_with(Value *args, int arg_count)
+static Value array_result(Value *items, int length)
 {
-    if (arg_count != 2)
-    {
-        raise_error("Runtime error: starts_with() expects exactly 2 arguments.\n");
-        return return_value;
-    }
-    
-    if (args[0].type != VAL_STRING)
-    {
-        raise_error("Runtime error: starts_with() expects the first argument to be a string.\n");
-        return return_value;
-    }
-    
-    if (args[1].type != VAL_STRING)
+    Array *arr = malloc(sizeof(Array));
+    if (!arr)
     {
-        raise_error("Runtime error: starts_with() expects the second argument to be a string.\n");
+        for (int i = 0; i < length; i++)
+        {
+            free_value(items[i]);
+        }
+        free(items);
+        raise_error("Runtime error: Memory allocation failed creating an array.\n");
         return return_value;
     }
-    
-    const char *str = args[0].str_val;
-    const char *prefix = args[1].str_val;
-    size_t prefix_len = strlen(prefix);
-    
-    if (strncmp(str, prefix, prefix_len) == 0)
+    arr->items = items;
+    arr->length = length;
+    arr->shared = NULL;
+
+    Value ret;
+    ret.type = VAL_ARRAY;
+    ret.array_val = arr;
+    ret.temp = 1;
+    return ret;
+}
+
+/*
+ * Checks the array argument of an array builtin, raising an error if it's
+ * missing or isn't an array.
+ */
+static Array *array_arg(Value *args, int arg_count, int expected, const char *usage)
+{
+    if (arg_count != expected || args[0].type != VAL_ARRAY)
     {
-        return make_bool(true);
+        raise_error("Runtime error: %s\n", usage);
+        return NULL;
     }
-    
-    return make_bool(false);
+    return args[0].array_val;
 }
 
-/**
- * Returns true if the first string ends with the second string.
+/*
+ * Adds up an array of numbers.  An array of ints is summed as ints.
  */
-Value fn_ends_with(Value *args, int arg_count)
+Value fn_array_sum(Value *args, int arg_count)
 {
-    if (arg_count != 2)
+    if (arg_count == 1 && args[0].type == VAL_TYPED_ARRAY)
     {
-        raise_error("Runtime error: ends_with() expects exactly 2 arguments.\n");
-        return return_value;
+        return typed_array_sum(args[0].typed_val);
     }
-    
-    if (args[0].type != VAL_STRING)
+
+    Array *arr = array_arg(args, arg_count, 1, "array_sum() expects an array of numbers.");
+    if (!arr)
     {
-        raise_error("Runtime error: ends_with() expects the first argument to be a string.\n");
         return return_value;
     }
-    
-    if (args[1].type != VAL_STRING)
+
+    Value *items = arr->items;
+    int length = arr->length;
+    int i = 0;
+    int int_sum = 0;
+
+    while (i < length && items[i].type == VAL_INT)
     {
-        raise_error("Runtime error: ends_with() expects the second argument to be a string.\n");
-        return return_value;
+        int_sum += items[i++].int_val;
     }
-    
-    const char *str = args[0].str_val;
-    const char *suffix = args[1].str_val;
-    size_t str_len = strlen(str);
-    size_t suffix_len = strlen(suffix);
-    
-    if (suffix_len > str_len)
+    if (i == length)
     {
-        return make_bool(false);
+        return make_int(int_sum);
     }
-    
-    if (strcmp(str + (str_len - suffix_len), suffix) == 0)
+
+    // A double (or anything else) turned up, carry on in doubles.
+    double sum = int_sum;
+    for (; i < length; i++)
     {
-        return make_bool(true);
+        if (items[i].type == VAL_INT)
+        {
+            sum += items[i].int_val;
+        }
+        else if (items[i].type == VAL_DOUBLE)
+        {
+            sum += items[i].double_val;
+        }
+        else
+        {
+            raise_error("Runtime error: array_sum() expects an array of numbers.\n");
+            return return_value;
+        }
     }
-    
-    return make_bool(false);
+    return make_double(sum);
 }
 
 /*
- * Searchs for the first occurrence of a substring in a string.  Returns -1
- * if no matches are found.
+ * Finds the smallest (sign = 1) or largest (sign = -1) item of an array of
+ * numbers or of strings.  An empty array gives null.
  */
-Value fn_index_of(Value *args, int arg_count)
+static Value array_extreme(Value *args, int arg_count, int sign, const char *name)
 {
-    if (arg_count != 3)
+    char usage[96];
+    snprintf(usage, sizeof(usage), "%s() expects an array of numbers or of strings.", name);
+
+    if (arg_count == 1 && args[0].type == VAL_TYPED_ARRAY)
     {
-        raise_error("Runtime error: index_of() expects 3 arguments: a string, a substring, and a starting index.\n");
-        return return_value;
+        return typed_array_extreme(args[0].typed_val, sign);
     }
 
-    if (args[0].type != VAL_STRING)
+    Array *arr = array_arg(args, arg_count, 1, usage);
+    if (!arr)
     {
-        raise_error("Runtime error: index_of() expects the first argument to be a string.\n");
         return return_value;
     }
-
-    if (args[1].type != VAL_STRING)
+    if (arr->length == 0)
     {
-        raise_error("Runtime error: index_of() expects the second argument to be a string.\n");
-        return return_value;
+        return make_null();
     }
 
-    if (args[2].type != VAL_INT)
+    Value *items = arr->items;
+    int length = arr->length;
+    int best = 0;
+
+    if (items[0].type == VAL_STRING)
     {
-        raise_error("Runtime error: index_of() expects the third argument to be an int.\n");
-        return return_value;
+        for (int i = 1; i < length; i++)
+        {
+            if (items[i].type != VAL_STRING)
+            {
+                raise_error("Runtime error: %s\n", usage);
+                return return_value;
+            }
+            if (sign * strcmp(items[i].str_val, items[best].str_val) < 0)
+            {
+                best = i;
+            }
+        }
+        return make_string(items[best].str_val);
     }
 
-    const char *str = args[0].str_val;
-    const char *substr = args[1].str_val;
-    int start = args[2].int_val;
-    size_t str_len = strlen(str);
+    int all_ints = 1;
+    for (int i = 0; i < length; i++)
+    {
+        if (items[i].type == VAL_DOUBLE)
+        {
+            all_ints = 0;
+        }
+        else if (items[i].type != VAL_INT)
+        {
+            raise_error("Runtime error: %s\n", usage);
+            return return_value;
+        }
+    }
 
-    if (start < 0 || (size_t)start >= str_len)
+    if (all_ints)
     {
-        return make_int(-1);
+        for (int i = 1; i < length; i++)
+        {
+            if (sign > 0 ? items[i].int_val < items[best].int_val : items[i].int_val > items[best].int_val)
+            {
+                best = i;
+            }
+        }
+        return make_int(items[best].int_val);
     }
 
-    const char *found = strstr(str + start, substr);
-    if (found)
+    double best_val = items[0].type == VAL_INT ? items[0].int_val : items[0].double_val;
+    for (int i = 1; i < length; i++)
     {
-        int index = found - str;
-        return make_int(index);
+        double v = items[i].type == VAL_INT ? items[i].int_val : items[i].double_val;
+        if (sign > 0 ? v < best_val : v > best_val)
+        {
+            best = i;
+            best_val = v;
+        }
     }
+    return items[best];
+}
 
-    return make_int(-1);
+Value fn_array_min(Value *args, int arg_count)
+{
+    return array_extreme(args, arg_count, 1, "array_min");
 }
 
-/**
- * Searchs for the last occurrence of a substring in a string.  Returns -1
- * if no matches are found.
+Value fn_array_max(Value *args, int arg_count)
+{
+    return array_extreme(args, arg_count, -1, "array_max");
+}
+
+/*
+ * Joins the items of an array into one string, with a separator between
+ * them.  The length is worked out first, so the result is allocated once.
  */
-Value fn_last_index_of(Value *args, int arg_count)
+Value fn_array_join(Value *args, int arg_count)
 {
-    if (arg_count < 2 || arg_count > 3)
+    Array *arr = array_arg(args, arg_count, 2, "array_join() expects an array and a separator string.");
+    if (!arr)
     {
-        raise_error("Runtime error: last_index_of() expects 2 or 3 arguments: a string, a substring, and an optional starting index.\n");
         return return_value;
     }
-    
-    if (args[0].type != VAL_STRING)
+    if (args[1].type != VAL_STRING)
     {
-        raise_error("Runtime error: last_index_of() expects the first argument to be a string.\n");
+        raise_error("Runtime error: array_join() expects an array and a separator string.\n");
         return return_value;
     }
-    
-    if (args[1].type != VAL_STRING)
+
+    Value *items = arr->items;
+    int length = arr->length;
+    const char *sep = args[1].str_val;
+    size_t sep_length = strlen(sep);
+    size_t total = 0;
+    char buffer[64];
+
+    for (int i = 0; i < length; i++)
     {
-        raise_error("Runtime error: last_index_of() expects the second argument to be a string.\n");
+        switch (items[i].type)
+        {
+            case VAL_STRING: total += strlen(items[i].str_val); break;
+            case VAL_INT:    total += format_int(items[i].int_val, buffer); break;
+            case VAL_DOUBLE: total += format_double(items[i].double_val, buffer); break;
+            case VAL_BOOL:   total += items[i].int_val ? 4 : 5; break;
+            default:
+                raise_error("Runtime error: array_join() expects an array of strings, numbers or bools.\n");
+                return return_value;
+        }
+    }
+    if (length > 1)
+    {
+        total += sep_length * (length - 1);
+    }
+
+    char *result = malloc(total + 1);
+    if (!result)
+    {
+        raise_error("Runtime error: Memory allocation failed in array_join().\n");
         return return_value;
     }
-    
-    const char *str = args[0].str_val;
-    const char *substr = args[1].str_val;
-    size_t str_len = strlen(str);
-    size_t substr_len = strlen(substr);
-    int start;
-    
-    if (arg_count == 3)
+
+    char *out = result;
+    for (int i = 0; i < length; i++)
     {
-        if (args[2].type != VAL_INT)
+        const char *text = buffer;
+        size_t n;
+
+        if (i > 0)
         {
-            raise_error("Runtime error: last_index_of() expects the third argument to be an int.\n");
-            return return_value;
+            memcpy(out, sep, sep_length);
+            out += sep_length;
         }
-        start = args[2].int_val;
+        switch (items[i].type)
+        {
+            case VAL_STRING: text = items[i].str_val; n = strlen(text); break;
+            case VAL_INT:    n = format_int(items[i].int_val, buffer); break;
+            case VAL_DOUBLE: n = format_double(items[i].double_val, buffer); break;
+            default:         text = items[i].int_val ? "true" : "false"; n = strlen(text); break;
+        }
+        memcpy(out, text, n);
+        out += n;
     }
-    else
+    *out = '\0';
+
+    Value ret;
+    ret.type = VAL_STRING;
+    ret.str_val = result;
+    ret.temp = 1;
+    return ret;
+}
+
+/*
+ * Returns the index of the first item equal to a value, or -1.
+ */
+Value fn_array_index_of(Value *args, int arg_count)
+{
+    Array *arr = array_arg(args, arg_count, 2, "array_index_of() expects an array and a value.");
+    if (!arr)
     {
-        // Default starting index: from the end of the string.
-        start = (int)str_len - 1;
+        return return_value;
     }
-    
-    // If start is negative, return -1.
-    if (start < 0)
+
+    Value *items = arr->items;
+    int length = arr->length;
+    Value value = args[1];
+
+    if (value.type == VAL_INT)
     {
+        for (int i = 0; i < length; i++)
+        {
+            if (items[i].type == VAL_INT && items[i].int_val == value.int_val)
+            {
+                return make_int(i);
+            }
+        }
         return make_int(-1);
     }
-    
-    // Clamp start to the last valid index.
-    if ((size_t)start >= str_len)
-    {
-        start = (int)str_len - 1;
-    }
-    
-    // Search backwards from the start position.
-    for (int i = start; i >= 0; i--)
+    if (value.type == VAL_STRING)
     {
-        // Ensure there is enough room for substr to match.
-        if ((size_t)(i + substr_len) > str_len)
+        for (int i = 0; i < length; i++)
         {
-            continue;
+            if (items[i].type == VAL_STRING && strcmp(items[i].str_val, value.str_val) == 0)
+            {
+                return make_int(i);
+            }
         }
-        
-        if (strncmp(str + i, substr, substr_len) == 0)
+        return make_int(-1);
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        if (values_equal(items[i], value))
         {
             return make_int(i);
         }
     }
-    
     return make_int(-1);
 }
 
-/**
- * Returns the month of a date.
+/*
+ * A key taken from an element being sorted or searched for: a number (ints
+ * and doubles, or a date packed as yyyymmdd) or a string, and the element's
+ * position.
  */
-Value fn_month(Value *args, int arg_count)
+typedef struct SortKey
 {
-    if (arg_count != 1 || args[0].type != VAL_DATE)
+    union
     {
-        raise_error("month() requires one date argument.\n");
-        return make_null();
+        double num;
+        const char *str;
+    };
+    int len;    /* of str */
+    int pos;
+} SortKey;
+
+/* What the keys of an array hold. */
+enum { SORT_NONE, SORT_NUMBERS, SORT_STRINGS, SORT_DATES };
+
+typedef struct SortOrder
+{
+    int strings;    /* the keys are strings, not numbers */
+    int dir;        /* 1 = ascending, -1 = descending */
+} SortOrder;
+
+/* Runs this short are insertion sorted. */
+#define SORT_RUN 16
+
+static int sort_kind(Value v)
+{
+    switch (v.type)
+    {
+        case VAL_INT:
+        case VAL_DOUBLE:
+            return SORT_NUMBERS;
+        case VAL_STRING:
+            return SORT_STRINGS;
+        case VAL_DATE:
+            return SORT_DATES;
+        default:
+            return SORT_NONE;
     }
-    return make_int(args[0].date_val.month);
 }
 
-/**
- * Returns the day of a date.
+/*
+ * Fills in the key of a value, returning 0 if it isn't of the kind given.
  */
-Value fn_day(Value *args, int arg_count)
+static int sort_key(Value v, int kind, SortKey *key)
 {
-    if (arg_count != 1 || args[0].type != VAL_DATE)
+    if (kind == SORT_NUMBERS && (v.type == VAL_INT || v.type == VAL_DOUBLE))
     {
-        raise_error("day() requires one date argument.\n");
-        return make_null();
+        key->num = v.type == VAL_INT ? v.int_val : v.double_val;
+        return 1;
     }
-    return make_int(args[0].date_val.day);
+    if (kind == SORT_STRINGS && v.type == VAL_STRING)
+    {
+        key->str = v.str_val;
+        key->len = (int)strlen(v.str_val);
+        return 1;
+    }
+    if (kind == SORT_DATES && v.type == VAL_DATE)
+    {
+        key->num = v.date_val.year * 10000.0 + v.date_val.month * 100 + v.date_val.day;
+        return 1;
+    }
+    return 0;
 }
 
-/**
- * Returns the year of a date.
+static void typed_key(const TypedArray *arr, int i, SortKey *key)
+{
+    key->num = arr->kind == TYPED_INT ? arr->ints[i] : arr->doubles[i];
+}
+
+/*
+ * Compares two keys in the order asked for.  Strings compare bytewise like
+ * strcmp, but with their lengths known memcmp can take them a word at a time.
  */
-Value fn_year(Value *args, int arg_count)
+static inline int key_compare(const SortKey *a, const SortKey *b, const SortOrder *order)
 {
-    if (arg_count != 1 || args[0].type != VAL_DATE)
+    int c;
+
+    if (order->strings)
     {
-        raise_error("year() requires one date argument.\n");
-        return make_null();
+        int n = a->len < b->len ? a->len : b->len;
+        c = memcmp(a->str, b->str, n);
+        if (c == 0)
+        {
+            c = a->len - b->len;
+        }
     }
-    return make_int(args[0].date_val.year);
+    else
+    {
+        c = (a->num > b->num) - (a->num < b->num);
+    }
+    return order->dir * c;
 }
 
-/**
- * Converts a string or an int (as an epoch) to a Date value.
- */
-Value fn_cdate(Value *args, int arg_count)
+#define KEY_LESS(a, b) (key_compare((a), (b), order) < 0)
+
+static inline void swap_keys(SortKey *a, SortKey *b)
 {
-    if (arg_count != 1)
+    SortKey t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void insertion_sort(SortKey *keys, int n, const SortOrder *order)
+{
+    for (int i = 1; i < n; i++)
     {
-        raise_error("cdate() requires one argument.\n");
-        return make_null();
+        SortKey key = keys[i];
+        int j = i;
+
+        while (j > 0 && KEY_LESS(&key, &keys[j - 1]))
+        {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
     }
+}
 
-    if (args[0].type == VAL_STRING)
+static void sift_down(SortKey *keys, int root, int n, const SortOrder *order)
+{
+    SortKey key = keys[root];
+
+    for (;;)
     {
-        // Supported formats: MM/DD/YYYY or YYYY/MM/DD
-        int m, d, y;
-        if (sscanf(args[0].str_val, "%d/%d/%d", &m, &d, &y) == 3)
+        int child = 2 * root + 1;
+        if (child >= n)
         {
-            // If the first number is greater than 12, assume format is YYYY/MM/DD.
-            if (m > 12)
+            break;
+        }
+        if (child + 1 < n && KEY_LESS(&keys[child], &keys[child + 1]))
+        {
+            child++;
+        }
+        if (!KEY_LESS(&key, &keys[child]))
+        {
+            break;
+        }
+        keys[root] = keys[child];
+        root = child;
+    }
+    keys[root] = key;
+}
+
+static void heap_sort(SortKey *keys, int n, const SortOrder *order)
+{
+    for (int i = n / 2 - 1; i >= 0; i--)
+    {
+        sift_down(keys, i, n, order);
+    }
+    for (int i = n - 1; i > 0; i--)
+    {
+        swap_keys(&keys[0], &keys[i]);
+        sift_down(keys, 0, i, order);
+    }
+}
+
+/*
+ * Introsort: quicksort with a median of three pivot, falling back to heapsort
+ * when the partitions keep coming out lopsided, so it's never worse than
+ * O(n log n).  Short runs are left for one insertion sort pass at the end.
+ */
+static void intro_sort(SortKey *keys, int n, int depth, const SortOrder *order)
+{
+    while (n > SORT_RUN)
+    {
+        if (depth-- == 0)
+        {
+            heap_sort(keys, n, order);
+            return;
+        }
+
+        SortKey *a = &keys[0], *b = &keys[n / 2], *c = &keys[n - 1];
+        if (KEY_LESS(b, a))
+        {
+            swap_keys(a, b);
+        }
+        if (KEY_LESS(c, b))
+        {
+            swap_keys(b, c);
+            if (KEY_LESS(b, a))
+            {
+                swap_keys(a, b);
+            }
+        }
+
+        // Hoare partition, the scans stop at keys equal to the pivot.
+        SortKey pivot = *b;
+        int i = 0, j = n - 1;
+        for (;;)
+        {
+            while (KEY_LESS(&keys[i], &pivot))
             {
-                int temp = m;
-                m = d;
-                d = y;
-                y = temp;
+                i++;
             }
-            Date date = { m, d, y };
-            return make_date(date);
+            while (KEY_LESS(&pivot, &keys[j]))
+            {
+                j--;
+            }
+            if (i >= j)
+            {
+                break;
+            }
+            swap_keys(&keys[i++], &keys[j--]);
         }
-        else
+
+        // Recurse into the smaller side and loop on the larger.
+        int left = j + 1;
+        if (left < n - left)
         {
-            raise_error("cdate() could not parse date from string: %s\n", args[0].str_val);
-            return make_null();
+            intro_sort(keys, left, depth, order);
+            keys += left;
+            n -= left;
         }
-    }
-    else if (args[0].type == VAL_INT)
-    {
-        time_t epoch = args[0].int_val;
-        struct tm *tm_date = localtime(&epoch);
-        if (!tm_date)
+        else
         {
-            raise_error("cdate() failed to convert epoch %d to date.\n", args[0].int_val);
-            return make_null();
+            intro_sort(keys + left, n - left, depth, order);
+            n = left;
         }
-        Date date = { tm_date->tm_mon + 1, tm_date->tm_mday, tm_date->tm_year + 1900 };
-        return make_date(date);
-    }
-    else
-    {
-        raise_error("cdate() expects a string or integer argument.\n");
-        return make_null();
     }
 }
 
-/**
- * Returns today's date as a Date value.
+/*
+ * A stable merge sort: runs are insertion sorted, then merged bottom up,
+ * taking from the left run on ties.  Returns 0 if it's out of memory.
  */
-Value fn_today(Value *args, int arg_count)
+static int merge_sort(SortKey *keys, int n, const SortOrder *order)
 {
-    if (arg_count != 0)
+    SortKey *buffer = malloc(sizeof(SortKey) * n);
+    if (!buffer)
     {
-        raise_error("today() expects no arguments.\n");
-        return make_null();
+        return 0;
     }
 
-    time_t now = time(NULL);
-    struct tm *local = localtime(&now);
-    if (!local)
+    for (int i = 0; i < n; i += SORT_RUN)
     {
-        raise_error("today() failed to retrieve local time.\n");
-        return make_null();
+        insertion_sort(keys + i, n - i < SORT_RUN ? n - i : SORT_RUN, order);
     }
 
-    // struct tm: tm_mon is 0-indexed and tm_year is years since 1900.
-    Date date = { local->tm_mon + 1, local->tm_mday, local->tm_year + 1900 };
-    return make_date(date);
-}
+    SortKey *from = keys;
+    SortKey *to = buffer;
 
-/**
- * Adds a given number of days to a date.
- */
-Value fn_add_days(Value *args, int arg_count)
-{
-    if (arg_count != 2 || args[0].type != VAL_DATE || args[1].type != VAL_INT)
+    for (int width = SORT_RUN; width < n; width *= 2)
     {
-        raise_error("add_days() expects a date and an integer.\n");
-        return make_null();
-    }
-
-    Date old = args[0].date_val;
-    int days = args[1].int_val;
+        for (int lo = 0; lo < n; lo += 2 * width)
+        {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int i = lo, j = mid, k = lo;
 
-    struct tm tm_date = {0};
-    tm_date.tm_year = old.year - 1900;
-    tm_date.tm_mon  = old.month - 1;
-    tm_date.tm_mday = old.day;
-    tm_date.tm_isdst = -1;
+            while (i < mid && j < hi)
+            {
+                to[k++] = KEY_LESS(&from[j], &from[i]) ? from[j++] : from[i++];
+            }
+            while (i < mid)
+            {
+                to[k++] = from[i++];
+            }
+            while (j < hi)
+            {
+                to[k++] = from[j++];
+            }
+        }
 
-    time_t t = mktime(&tm_date);
-    if (t == -1)
-    {
-        raise_error("add_days() failed to convert date.\n");
-        return make_null();
+        SortKey *t = from;
+        from = to;
+        to = t;
     }
 
-    t += days * 86400; // 86400 seconds in a day
-    struct tm *new_tm = localtime(&t);
-    if (!new_tm)
+    if (from != keys)
     {
-        raise_error("add_days() failed to compute new date.\n");
-        return make_null();
+        memcpy(keys, from, sizeof(SortKey) * n);
     }
-
-    Date result = { new_tm->tm_mon + 1, new_tm->tm_mday, new_tm->tm_year + 1900 };
-    return make_date(result);
+    free(buffer);
+    return 1;
 }
 
-/**
- * Adds a given number of months to a date.
+#undef KEY_LESS
+
+/*
+ * Reads the optional descending flag of the sort and search builtins.
  */
-Value fn_add_months(Value *args, int arg_count)
+static int sort_order_arg(Value *args, int arg_count, int i, SortOrder *order, const char *name)
 {
-    if (arg_count != 2 || args[0].type != VAL_DATE || args[1].type != VAL_INT)
+    order->strings = 0;
+    order->dir = 1;
+
+    if (arg_count > i)
     {
-        raise_error("add_months() expects a date and an integer.\n");
-        return make_null();
+        if (args[i].type != VAL_BOOL)
+        {
+            raise_error("Runtime error: %s() expects true or false for descending.\n", name);
+            return 0;
+        }
+        if (args[i].int_val)
+        {
+            order->dir = -1;
+        }
     }
+    return 1;
+}
 
-    Date old = args[0].date_val;
-    int months_to_add = args[1].int_val;
-    int new_month = old.month + months_to_add;
-    int new_year = old.year;
+/*
+ * Sorts an array (or typed array) in place.  The elements are turned into
+ * keys, which are what gets sorted, so comparing two of them is a number or
+ * a memcmp with no checks of their types, and then moved into the keys' order.
+ */
+static Value sort_array(Value *args, int arg_count, int stable, const char *name)
+{
+    SortOrder order;
 
-    // Normalize month and adjust year accordingly.
-    while (new_month > 12)
+    if (arg_count < 1 || arg_count > 2 || (args[0].type != VAL_ARRAY && args[0].type != VAL_TYPED_ARRAY))
     {
-        new_month -= 12;
-        new_year++;
+        raise_error("Runtime error: %s() expects an array and an optional descending flag.\n", name);
+        return return_value;
     }
-    while (new_month < 1)
+    if (!sort_order_arg(args, arg_count, 1, &order, name))
     {
-        new_month += 12;
-        new_year--;
+        return return_value;
     }
 
-    int new_day = old.day;
-    int days_in_month;
-    switch(new_month)
-    {
-        case 1: case 3: case 5: case 7: case 8: case 10: case 12:
-            days_in_month = 31; break;
-        case 4: case 6: case 9: case 11:
-            days_in_month = 30; break;
-        case 2:
-            // Leap year check.
-            if ((new_year % 4 == 0 && new_year % 100 != 0) || (new_year % 400 == 0))
-                days_in_month = 29;
-            else
-                days_in_month = 28;
-            break;
-        default:
-            days_in_month = 31; break;
-    }
-    if (new_day > days_in_month)
+    TypedArray *typed = args[0].type == VAL_TYPED_ARRAY ? args[0].typed_val : NULL;
+    Array *arr = typed ? NULL : args[0].array_val;
+    int n = typed ? typed->length : arr->length;
+    if (n < 2)
     {
-        new_day = days_in_month;
+        return make_null();
     }
 
-    Date result = { new_month, new_day, new_year };
-    return make_date(result);
-}
-
-/**
- * Adds a given number of years to a date.
- */
-Value fn_add_years(Value *args, int arg_count)
-{
-    if (arg_count != 2 || args[0].type != VAL_DATE || args[1].type != VAL_INT)
+    SortKey *keys = malloc(sizeof(SortKey) * n);
+    if (!keys)
     {
-        raise_error("add_years() expects a date and an integer.\n");
-        return make_null();
+        raise_error("Runtime error: Memory allocation failed in %s().\n", name);
+        return return_value;
     }
 
-    Date old = args[0].date_val;
-    int years_to_add = args[1].int_val;
-    int new_year = old.year + years_to_add;
-    int new_month = old.month;
-    int new_day = old.day;
+    int kind = typed ? SORT_NUMBERS : sort_kind(arr->items[0]);
+    order.strings = kind == SORT_STRINGS;
 
-    // Adjust February 29th if new year is not a leap year.
-    if (new_month == 2 && new_day == 29)
+    for (int i = 0; i < n; i++)
     {
-        if (!((new_year % 4 == 0 && new_year % 100 != 0) || (new_year % 400 == 0)))
+        if (typed)
         {
-            new_day = 28;
+            typed_key(typed, i, &keys[i]);
+        }
+        else if (!sort_key(arr->items[i], kind, &keys[i]))
+        {
+            free(keys);
+            raise_error("Runtime error: %s() expects an array of numbers, of strings or of dates.\n", name);
+            return return_value;
         }
+        keys[i].pos = i;
     }
 
-    Date result = { new_month, new_day, new_year };
-    return make_date(result);
-}
-
-/**
- * Converts a date to its Unix epoch equivalent.
- */
-Value fn_cepoch(Value *args, int arg_count)
-{
-    if (arg_count != 1 || args[0].type != VAL_DATE)
+    int depth = 0;
+    for (int m = n; m > 1; m >>= 1)
     {
-        raise_error("cepoch() expects a single date argument.\n");
-        return make_null();
+        depth += 2;
     }
-    
-    Date date = args[0].date_val;
-    struct tm tm_date = {0};
-    tm_date.tm_year = date.year - 1900;
-    tm_date.tm_mon  = date.month - 1;
-    tm_date.tm_mday = date.day;
-    tm_date.tm_hour = 0;
-    tm_date.tm_min  = 0;
-    tm_date.tm_sec  = 0;
-    tm_date.tm_isdst = -1;
 
-    time_t epoch = mktime(&tm_date);
-    if (epoch == -1)
+    if (stable && !merge_sort(keys, n, &order))
     {
-        raise_error("cepoch() failed to convert date to epoch.\n");
-        return make_null();
-    }
-    
-    return make_int((int)epoch);
-}
-
-/**
- * Returns the width of the terminal window.
- */
-Value fn_terminal_width(Value *args, int arg_count)
-{
-    int width;
-
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (GetConsoleScreenBufferInfo(hStdout, &csbi)) {
-        width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
-    } else {
-        // Handle error: default to a safe size or exit.
-        width = 80;
+        free(keys);
+        raise_error("Runtime error: Memory allocation failed in %s().\n", name);
+        return return_value;
     }
-#else
-    struct winsize w;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != -1) {
-        width = w.ws_col;
-        height = w.ws_row;
-    } else {
-        // Handle error: default to a safe size or exit.
-        width = 80;
+    if (!stable)
+    {
+        intro_sort(keys, n, depth, &order);
+        insertion_sort(keys, n, &order);
     }
-#endif
-
-    return make_int(width);
-}
-
-/**
- * Returns the height of the terminal window.
- */
-Value fn_terminal_height(Value *args, int arg_count)
-{
-    int height;
 
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (GetConsoleScreenBufferInfo(hStdout, &csbi)) {
-        height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-    } else {
-        // Handle error: default to a safe size or exit.
-        height = 25;
-    }
-#else
-    struct winsize w;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != -1) {
-        height = w.ws_row;
-    } else {
-        // Handle error: default to a safe size or exit.
-        height = 25;
+    if (typed)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            if (typed->kind == TYPED_INT)
+            {
+                typed->ints[i] = (int)keys[i].num;
+            }
+            else
+            {
+                typed->doubles[i] = keys[i].num;
+            }
+        }
+        free(keys);
+        return make_null();
     }
-#endif
 
-    return make_int(height);
-}
+    // An array sharing its items with slices takes a copy before it's moved.
+    if (!array_own(arr))
+    {
+        free(keys);
+        return return_value;
+    }
 
-/**
- * Returns the ASCII character for a given code.
- */
-Value fn_chr(Value *args, int arg_count)
-{
-    if (arg_count != 1 || args[0].type != VAL_INT)
+    Value *sorted = malloc(sizeof(Value) * n);
+    if (!sorted)
     {
-        raise_error("asc() expects a single integer argument.\n");
-        return make_null();
+        free(keys);
+        raise_error("Runtime error: Memory allocation failed in %s().\n", name);
+        return return_value;
     }
 
-    int code = args[0].int_val;
-    char result[2];
-    result[0] = (char) code;
-    result[1] = '\0';
+    for (int i = 0; i < n; i++)
+    {
+        sorted[i] = arr->items[keys[i].pos];
+    }
+    memcpy(arr->items, sorted, sizeof(Value) * n);
 
-    return make_string(result);
+    free(sorted);
+    free(keys);
+    return make_null();
 }
 
-/**
- * Returns the ASCII code for a given character.
+/*
+ * array_sort(arr [, descending]): sorts an array of numbers, strings or
+ * dates in place with an introsort.
  */
-Value fn_asc(Value *args, int arg_count)
+Value fn_array_sort(Value *args, int arg_count)
 {
-    if (arg_count != 1 || args[0].type != VAL_STRING)
-    {
-        raise_error("asc() expects a single character argument.\n");
-        return make_null();
-    }
+    return sort_array(args, arg_count, 0, "array_sort");
+}
 
-    char *str = args[0].str_val;
-    return make_int((int) str[0]);
+/*
+ * array_sort_stable(arr [, descending]): like array_sort, but elements
+ * that compare equal, such as 1 and 1.0, keep their order.
+ */
+Value fn_array_sort_stable(Value *args, int arg_count)
+{
+    return sort_array(args, arg_count, 1, "array_sort_stable");
 }
 
-Value fn_upperbound(Value *args, int arg_count)
+/*
+ * array_binary_search(arr, value [, descending]): the index of value in an
+ * array sorted the same way, or -1.  If value is there more than once, it's
+ * the index of the first.
+ */
+Value fn_array_binary_search(Value *args, int arg_count)
 {
-    if (arg_count != 1)
+    SortOrder order;
+    SortKey target;
+    SortKey key;
+
+    if (arg_count < 2 || arg_count > 3 || (args[0].type != VAL_ARRAY && args[0].type != VAL_TYPED_ARRAY))
     {
-        raise_error("Runtime error: upperbound() expects one argument (an array).\n");
+        raise_error("Runtime error: array_binary_search() expects a sorted array, a value and an optional descending flag.\n");
         return return_value;
     }
-    if (args[0].type != VAL_ARRAY)
+    if (!sort_order_arg(args, arg_count, 2, &order, "array_binary_search"))
     {
-        raise_error("Runtime error: upperbound() expects an array.\n");
         return return_value;
     }
-    Array *arr = args[0].array_val;
-    return make_int(arr->length - 1);
-}
 
-Value fn_split(Value *args, int arg_count)
-{
-    if (arg_count != 2)
+    TypedArray *typed = args[0].type == VAL_TYPED_ARRAY ? args[0].typed_val : NULL;
+    Array *arr = typed ? NULL : args[0].array_val;
+    int kind = sort_kind(args[1]);
+
+    if (kind == SORT_NONE || (typed && kind != SORT_NUMBERS))
     {
-        raise_error("Runtime error: split() expects two arguments: a string and a delimiter.\n");
-        return return_value;
+        return make_int(-1);
     }
-    if (args[0].type != VAL_STRING || args[1].type != VAL_STRING)
+
+    sort_key(args[1], kind, &target);
+    order.strings = kind == SORT_STRINGS;
+
+    int lo = 0;
+    int hi = typed ? typed->length : arr->length;
+    int n = hi;
+
+    while (lo < hi)
     {
-        raise_error("Runtime error: split() expects both arguments to be strings.\n");
-        return return_value;
+        int mid = lo + (hi - lo) / 2;
+
+        if (typed)
+        {
+            typed_key(typed, mid, &key);
+        }
+        else if (!sort_key(arr->items[mid], kind, &key))
+        {
+            return make_int(-1);
+        }
+
+        if (key_compare(&key, &target, &order) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
     }
-    char *str = args[0].str_val;
-    char *delim = args[1].str_val;
-    
-    // First, count the number of tokens
-    int count = 0;
-    char *copy = strdup(str);
-    char *token = strtok(copy, delim);
-    while (token != NULL)
+
+    if (lo < n)
     {
-        count++;
-        token = strtok(NULL, delim);
+        if (typed)
+        {
+            typed_key(typed, lo, &key);
+        }
+        else if (!sort_key(arr->items[lo], kind, &key))
+        {
+            return make_int(-1);
+        }
+        if (key_compare(&key, &target, &order) == 0)
+        {
+            return make_int(lo);
+        }
     }
-    free(copy);
-    
-    // Allocate an array of Value items
-    Value *items = malloc(sizeof(Value) * count);
-    if (!items)
+    return make_int(-1);
+}
+
+/*
+ * array_slice(arr, start, length): the items of an array from start, as
+ * many as length of them.  Like substring, the range is cut down to fit the
+ * array.  The slice shares the array's items until one of them is written.
+ */
+Value fn_array_slice(Value *args, int arg_count)
+{
+    if (arg_count != 3 || args[0].type != VAL_ARRAY || args[1].type != VAL_INT || args[2].type != VAL_INT)
     {
-        raise_error("Runtime error: Memory allocation failed in split().\n");
+        raise_error("Runtime error: array_slice() expects an array, a start index and a length.\n");
         return return_value;
     }
-    int index = 0;
-    copy = strdup(str);
-    token = strtok(copy, delim);
-    while (token != NULL)
+
+    int length = args[0].array_val->length;
+    int start = args[1].int_val < 0 ? 0 : args[1].int_val;
+    int count = args[2].int_val < 0 ? 0 : args[2].int_val;
+
+    if (start > length)
     {
-        items[index++] = make_string(token);
-        token = strtok(NULL, delim);
+        start = length;
     }
-    free(copy);
-    
-    // Create and populate the Array structure
-    Array *arr = malloc(sizeof(Array));
-    if (!arr)
+    if (count > length - start)
     {
-        free(items);
-        raise_error("Runtime error: Memory allocation failed in split().\n");
-        return return_value;
+        count = length - start;
     }
-    arr->items = items;
-    arr->length = count;
-    
-    Value ret;
-    ret.type = VAL_ARRAY;
-    ret.array_val = arr;
-    ret.temp = 1;
-    return ret;
+
+    return array_slice(args[0], start, count);
 }
 
-Value fn_new_array(Value *args, int arg_count)
+/*
+ * Looks up the function named by the second argument of array_map and
+ * array_filter, raising an error if there's no such function.
+ */
+static const Function *function_arg(Value *args, const char *name)
 {
-    if (arg_count != 1)
+    if (args[1].type != VAL_STRING)
     {
-        raise_error("Runtime error: new_array() expects one argument (the size).\n");
-        return return_value;
+        raise_error("Runtime error: %s() expects an array and the name of a function.\n", name);
+        return NULL;
     }
-    if (args[0].type != VAL_INT)
+
+    const Function *fn = lookup_function(args[1].str_val);
+    if (!fn)
     {
-        raise_error("Runtime error: new_array() expects an integer.\n");
-        return return_value;
+        raise_error("Runtime error: Unknown function \"%s\" passed to %s().\n", args[1].str_val, name);
     }
-    int size = args[0].int_val;
-    if (size < 0)
+    return fn;
+}
+
+/*
+ * Calls a function with each item of an array, returning a new array of the
+ * results: array_map(arr, "name").
+ */
+Value fn_array_map(Value *args, int arg_count)
+{
+    Array *arr = array_arg(args, arg_count, 2, "array_map() expects an array and the name of a function.");
+    const Function *fn = arr ? function_arg(args, "array_map") : NULL;
+    if (!fn)
     {
-        raise_error("Runtime error: new_array() expects a non-negative integer.\n");
         return return_value;
     }
-    Value *items = malloc(sizeof(Value) * size);
+
+    int length = arr->length;
+    Value *items = malloc(sizeof(Value) * (length > 0 ? length : 1));
     if (!items)
     {
-        raise_error("Runtime error: Memory allocation failed in new_array().\n");
+        raise_error("Runtime error: Memory allocation failed in array_map().\n");
         return return_value;
     }
-    for (int i = 0; i < size; i++)
-    {
-        items[i] = make_null(); // Initialize each element to null
-    }
-    Array *arr = malloc(sizeof(Array));
-    if (!arr)
+
+    for (int i = 0; i < length; i++)
     {
-        free(items);
-        raise_error("Runtime error: Memory allocation failed in new_array().\n");
-        return return_value;
+        // Read the item each time, the function may change the array.
+        Value arg = i < arr->length ? arr->items[i] : make_null();
+        arg.temp = 0;
+
+        Value result = invoke_function(fn, &arg, 1);
+        if (return_flag)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                free_value(items[j]);
+            }
+            free(items);
+            return return_value;
+        }
+
+        // The array owns its items, a borrowed string is copied.
+        if (result.type == VAL_STRING && !result.temp)
+        {
+            result = make_string(result.str_val);
+        }
+        result.temp = 0;
+        items[i] = result;
     }
-    arr->items = items;
-    arr->length = size;
-    
-    Value ret;
-    ret.type = VAL_ARRAY;
-    ret.array_val = arr;
-    ret.temp = 1;
-    return ret;
+
+    return array_result(items, length);
 }
 
-Value fn_array_set(Value *args, int arg_count)
+/*
+ * Returns a new array of the items of an array for which a function returns
+ * true: array_filter(arr, "name").
+ */
+Value fn_array_filter(Value *args, int arg_count)
 {
-    if (arg_count != 3)
+    Array *arr = array_arg(args, arg_count, 2, "array_filter() expects an array and the name of a function.");
+    const Function *fn = arr ? function_arg(args, "array_filter") : NULL;
+    if (!fn)
     {
-        raise_error("Runtime error: array_set() expects three arguments: an array, an index, and a value.\n");
         return return_value;
     }
-    if (args[0].type != VAL_ARRAY)
+
+    int count = 0;
+    Value *items = malloc(sizeof(Value) * (arr->length > 0 ? arr->length : 1));
+    if (!items)
     {
-        raise_error("Runtime error: First argument to array_set() must be an array.\n");
+        raise_error("Runtime error: Memory allocation failed in array_filter().\n");
         return return_value;
     }
-    if (args[1].type != VAL_INT)
+
+    for (int i = 0; i < arr->length; i++)
     {
-        raise_error("Runtime error: Second argument to array_set() must be an integer index.\n");
-        return return_value;
+        Value arg = arr->items[i];
+        arg.temp = 0;
+
+        Value keep = invoke_function(fn, &arg, 1);
+        if (!return_flag && keep.type != VAL_INT && keep.type != VAL_BOOL)
+        {
+            if (keep.temp)
+            {
+                free_value(keep);
+            }
+            raise_error("Runtime error: array_filter() expects its function to return a bool.\n");
+        }
+        if (return_flag)
+        {
+            for (int j = 0; j < count; j++)
+            {
+                free_value(items[j]);
+            }
+            free(items);
+            return return_value;
+        }
+
+        if (keep.int_val && i < arr->length && count < arr->length)
+        {
+            Value item = arr->items[i];
+            if (item.type == VAL_STRING)
+            {
+                item = make_string(item.str_val);
+            }
+            item.temp = 0;
+            items[count++] = item;
+        }
     }
-    Array *arr = args[0].array_val;
-    int idx = args[1].int_val;
-    if (idx < 0 || idx >= arr->length)
+
+    return array_result(items, count);
+}
+
+/*
+ * Checks the map argument of a map builtin, raising an error if it's missing
+ * or isn't a map.
+ */
+static Map *map_arg(Value *args, int arg_count, int expected, const char *usage)
+{
+    if (arg_count != expected || args[0].type != VAL_MAP)
+    {
+        raise_error("Runtime error: %s\n", usage);
+        return NULL;
+    }
+    return args[0].map_val;
+}
+
+/*
+ * If a map has a key: map_has(m, key).
+ */
+Value fn_map_has(Value *args, int arg_count)
+{
+    Map *map = map_arg(args, arg_count, 2, "map_has() expects a map and a key.");
+    if (!map)
     {
-        raise_error("Runtime error: Array index out of bounds.\n");
         return return_value;
     }
-    /* Free the previous value at that index if necessary */
-    free_value(arr->items[idx]);
 
-    Value newVal;
-    if (args[2].type == VAL_STRING)
+    return make_bool(map_get(map, args[1]) != NULL);
+}
+
+/*
+ * Removes a key and its value from a map: map_remove(m, key).  Returns true
+ * if the map had the key.
+ */
+Value fn_map_remove(Value *args, int arg_count)
+{
+    Map *map = map_arg(args, arg_count, 2, "map_remove() expects a map and a key.");
+    if (!map)
     {
-        /* Create a new string so that the array element owns its memory */
-        newVal = make_string(args[2].str_val);
-        newVal.temp = 0;  // Mark it as owned by the array.
+        return return_value;
     }
-    else
+
+    return make_bool(map_remove(map, args[1]));
+}
+
+/*
+ * Returns a new array of a map's keys, in the order they were added.
+ */
+Value fn_map_keys(Value *args, int arg_count)
+{
+    Map *map = map_arg(args, arg_count, 1, "map_keys() expects a map.");
+    if (!map)
     {
-        /* For other types, a shallow copy is sufficient */
-        newVal = args[2];
-        newVal.temp = 0;
+        return return_value;
     }
-    
-    arr->items[idx] = newVal;
-    return make_null();
+
+    return map_keys(map);
 }
 
+/*
+ * Returns the number of keys in a map.
+ */
+Value fn_map_count(Value *args, int arg_count)
+{
+    Map *map = map_arg(args, arg_count, 1, "map_count() expects a map.");
+    if (!map)
+    {
+        return return_value;
+    }
+
+    return make_int(map->count);
+}
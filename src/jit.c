@@ -0,0 +1,491 @@
+/*
+ * Arcane Script Interpreter
+ *
+ *         File: jit.c
+ *       Author: Blake Pell
+ * Initial Date: 2026-10-18
+ *      License: MIT License
+ *
+ * A template JIT for hot loops, built with ARCANE_JIT on x86-64 Linux.  Each
+ * loop VM instruction is pasted in as a fixed run of machine code.  Only
+ * loops whose condition, post expression and body statements are int
+ * arithmetic on variables are compiled; the variables are checked to hold
+ * ints each time the machine code is entered, and since nothing in it can
+ * produce another type the check holds for the whole loop.  Everything else
+ * keeps running on the loop VM and the token interpreter.
+ */
+
+ #include "arcane.h"
+ #include <stdlib.h>
+ #include <string.h>
+ #include <stddef.h>
+ 
+ #ifdef ARCANE_JIT
+ 
+ /* Back edges a loop takes before it's compiled. */
+ #define JIT_THRESHOLD 1000
+ 
+ /*
+  * Counts a trip around the loop the program belongs to.  Returns 1 on the
+  * trip that makes the loop hot, the one time it should be compiled.
+  */
+ int jit_hot(VmProgram *program)
+ {
+     return program->hits < JIT_THRESHOLD && ++program->hits == JIT_THRESHOLD;
+ }
+ 
+ #if defined(__linux__) && defined(__x86_64__)
+ 
+ #include <sys/mman.h>
+ 
+ #define JIT_MAX_VARIABLES 16
+ 
+ struct JitLoop
+ {
+     unsigned char *code;    /* Executable mapping */
+     size_t size;
+     int cond_entry;         /* Offset of the condition, the post expression is at 0 */
+     const char *names[JIT_MAX_VARIABLES]; /* Variables used, in slot order */
+     int name_count;
+ };
+ 
+ /* The machine code takes the loop's variables in rdi, one Value * per slot. */
+ typedef void (*JitFunction)(Value **slots);
+ 
+ typedef struct
+ {
+     unsigned char *buf;
+     int size;
+     int capacity;
+     int failed;
+     struct JitLoop *loop;
+ } JitEmitter;
+ 
+ /* ============================================================
+     Emitter
+    ============================================================ */
+ 
+ static void jit_byte(JitEmitter *e, int b)
+ {
+     if (e->size == e->capacity)
+     {
+         int capacity = e->capacity ? e->capacity * 2 : 256;
+         unsigned char *buf = realloc(e->buf, capacity);
+ 
+         if (!buf)
+         {
+             e->failed = 1;
+             return;
+         }
+ 
+         e->buf = buf;
+         e->capacity = capacity;
+     }
+ 
+     e->buf[e->size++] = (unsigned char)b;
+ }
+ 
+ static void jit_bytes(JitEmitter *e, const char *bytes, int count)
+ {
+     for (int i = 0; i < count && !e->failed; i++)
+     {
+         jit_byte(e, (unsigned char)bytes[i]);
+     }
+ }
+ 
+ static void jit_int32(JitEmitter *e, int v)
+ {
+     unsigned int u = (unsigned int)v;
+ 
+     for (int i = 0; i < 4; i++)
+     {
+         jit_byte(e, (u >> (8 * i)) & 0xff);
+     }
+ }
+ 
+ /*
+  * Patches the 32-bit jump displacement at offset to land on target.
+  */
+ static void jit_patch(JitEmitter *e, int offset, int target)
+ {
+     unsigned int u = (unsigned int)(target - (offset + 4));
+ 
+     if (e->failed)
+     {
+         return;
+     }
+ 
+     for (int i = 0; i < 4; i++)
+     {
+         e->buf[offset + i] = (u >> (8 * i)) & 0xff;
+     }
+ }
+ 
+ /*
+  * The slot a variable is passed in, adding it on first use.
+  */
+ static int jit_slot(JitEmitter *e, const char *name)
+ {
+     struct JitLoop *loop = e->loop;
+ 
+     for (int i = 0; i < loop->name_count; i++)
+     {
+         if (strcmp(loop->names[i], name) == 0)
+         {
+             return i;
+         }
+     }
+ 
+     if (loop->name_count == JIT_MAX_VARIABLES)
+     {
+         e->failed = 1;
+         return 0;
+     }
+ 
+     loop->names[loop->name_count] = name;
+     return loop->name_count++;
+ }
+ 
+ /*
+  * mov rcx, [rdi + slot]: the variable's Value * into rcx.
+  */
+ static void jit_variable(JitEmitter *e, const char *name)
+ {
+     jit_bytes(e, "\x48\x8b\x8f", 3);
+     jit_int32(e, jit_slot(e, name) * (int)sizeof(Value *));
+ }
+ 
+ /*
+  * mov eax, [rcx + int_val]: the variable's int into eax.
+  */
+ static void jit_load_eax(JitEmitter *e, const char *name)
+ {
+     jit_variable(e, name);
+     jit_bytes(e, "\x8b\x81", 2);
+     jit_int32(e, (int)offsetof(Value, int_val));
+ }
+ 
+ /*
+  * add dword [rcx + int_val], step: increments the variable in rcx.
+  */
+ static void jit_increment(JitEmitter *e, int step)
+ {
+     jit_bytes(e, "\x81\x81", 2);
+     jit_int32(e, (int)offsetof(Value, int_val));
+     jit_int32(e, step);
+ }
+ 
+ /*
+  * eax = eax op ecx.  Division and remainder stay in the interpreter, which
+  * reports division by zero.  The shifts use the low five bits of cl, like
+  * the interpreter.
+  */
+ static void jit_operator(JitEmitter *e, OperatorCode op)
+ {
+     int setcc;
+ 
+     switch (op)
+     {
+         case OP_ADD: jit_bytes(e, "\x01\xc8", 2); return;         // add eax, ecx
+         case OP_SUB: jit_bytes(e, "\x29\xc8", 2); return;         // sub eax, ecx
+         case OP_MUL: jit_bytes(e, "\x0f\xaf\xc1", 3); return;     // imul eax, ecx
+         case OP_BIT_AND: jit_bytes(e, "\x21\xc8", 2); return;     // and eax, ecx
+         case OP_BIT_OR:  jit_bytes(e, "\x09\xc8", 2); return;     // or eax, ecx
+         case OP_BIT_XOR: jit_bytes(e, "\x31\xc8", 2); return;     // xor eax, ecx
+         case OP_SHL: jit_bytes(e, "\xd3\xe0", 2); return;         // shl eax, cl
+         case OP_SHR: jit_bytes(e, "\xd3\xf8", 2); return;         // sar eax, cl
+         case OP_LT:  setcc = 0x9c; break;
+         case OP_GT:  setcc = 0x9f; break;
+         case OP_LE:  setcc = 0x9e; break;
+         case OP_GE:  setcc = 0x9d; break;
+         case OP_EQ:  setcc = 0x94; break;
+         case OP_NE:  setcc = 0x95; break;
+         default:
+             e->failed = 1;
+             return;
+     }
+ 
+     jit_bytes(e, "\x39\xc8\x0f", 3);       // cmp eax, ecx; setcc al
+     jit_byte(e, setcc);
+     jit_bytes(e, "\xc0\x0f\xb6\xc0", 4);   // movzx eax, al
+ }
+ 
+ /*
+  * Pastes in the template for one instruction.  Values live on the machine
+  * stack, so VM_RETURN leaves its result there for the caller to pop.
+  */
+ static void jit_instruction(JitEmitter *e, const VmInstruction *ins)
+ {
+     switch (ins->opcode)
+     {
+         case VM_CONST:
+             if (ins->constant.type != VAL_INT)
+             {
+                 e->failed = 1;
+                 return;
+             }
+             jit_byte(e, 0xb8);                      // mov eax, imm32
+             jit_int32(e, ins->constant.int_val);
+             jit_byte(e, 0x50);                      // push rax
+             return;
+         case VM_LOAD:
+             jit_load_eax(e, ins->token->text);
+             jit_byte(e, 0x50);
+             return;
+         case VM_STORE:
+             jit_bytes(e, "\x48\x8b\x04\x24", 4);    // mov rax, [rsp]
+             jit_variable(e, ins->token->text);
+             jit_bytes(e, "\x89\x81", 2);            // mov [rcx + int_val], eax
+             jit_int32(e, (int)offsetof(Value, int_val));
+             return;
+         case VM_BINARY:
+             jit_bytes(e, "\x59\x58", 2);            // pop rcx; pop rax
+             jit_operator(e, ins->token->op);
+             jit_byte(e, 0x50);
+             return;
+         case VM_NEGATE:
+             jit_bytes(e, "\x58\xf7\xd8\x50", 4);    // pop rax; neg eax; push rax
+             return;
+         case VM_PRE_INC:
+             jit_variable(e, ins->token->text);
+             jit_increment(e, ins->arg);
+             jit_bytes(e, "\x8b\x81", 2);            // mov eax, [rcx + int_val]
+             jit_int32(e, (int)offsetof(Value, int_val));
+             jit_byte(e, 0x50);
+             return;
+         case VM_POST_INC:
+             jit_load_eax(e, ins->token->text);
+             jit_byte(e, 0x50);
+             jit_increment(e, ins->arg);
+             return;
+         case VM_INC:
+             jit_variable(e, ins->operand->text);
+             jit_increment(e, ins->arg);
+             return;
+         case VM_COMPOUND:
+             // x += y and friends: eax = x, ecx = y, then store eax back.
+             // /= and %= stay in the interpreter, like '/'.
+             jit_bytes(e, "\x58\x89\xc2", 3);        // pop rax; mov edx, eax
+             jit_load_eax(e, ins->token->text);
+             jit_bytes(e, "\x51\x89\xd1", 3);        // push rcx; mov ecx, edx
+             jit_operator(e, ins->arg == OP_ADD_ASSIGN ? OP_ADD :
+                             ins->arg == OP_SUB_ASSIGN ? OP_SUB :
+                             ins->arg == OP_MUL_ASSIGN ? OP_MUL : OP_NONE);
+             jit_bytes(e, "\x59\x89\x81", 3);        // pop rcx; mov [rcx + int_val], eax
+             jit_int32(e, (int)offsetof(Value, int_val));
+             jit_byte(e, 0x50);                      // push rax
+             return;
+         case VM_INC_COMPARE:
+         case VM_BINARY_LOCAL:
+             if (ins->opcode == VM_INC_COMPARE)
+             {
+                 jit_variable(e, ins->operand->text);
+                 jit_increment(e, ins->arg);
+             }
+             if (!ins->operand2 && ins->constant.type != VAL_INT)
+             {
+                 e->failed = 1;
+                 return;
+             }
+             jit_load_eax(e, ins->operand->text);
+             if (ins->operand2)
+             {
+                 jit_variable(e, ins->operand2->text);
+                 jit_bytes(e, "\x8b\x89", 2);        // mov ecx, [rcx + int_val]
+                 jit_int32(e, (int)offsetof(Value, int_val));
+             }
+             else
+             {
+                 jit_byte(e, 0xb9);                  // mov ecx, imm32
+                 jit_int32(e, ins->constant.int_val);
+             }
+             jit_operator(e, ins->token->op);
+             jit_byte(e, 0x50);
+             return;
+         case VM_POP:
+             jit_byte(e, 0x58);                      // pop rax
+             return;
+         case VM_RETURN:
+             return;
+         default:
+             // Logical operators make bools and calls and indexing can make
+             // anything, which the entry check can't vouch for.
+             e->failed = 1;
+             return;
+     }
+ }
+ 
+ /*
+  * Compiles the expression in tokens start up to end and leaves its value in
+  * eax.
+  */
+ static void jit_expression(JitEmitter *e, TokenList *list, int start, int end)
+ {
+     VmProgram *program = vm_compile(list, start, end);
+ 
+     if (!program)
+     {
+         e->failed = 1;
+         return;
+     }
+ 
+     for (int i = 0; i < program->count && !e->failed; i++)
+     {
+         jit_instruction(e, &program->code[i]);
+     }
+ 
+     jit_byte(e, 0x58); // pop rax
+     vm_free(program);
+ }
+ 
+ /* ============================================================
+     Loops
+    ============================================================ */
+ 
+ /*
+  * Compiles a loop whose condition, post expression (empty for a while loop)
+  * and body are in the given token ranges.  The body has to be expression
+  * statements only.  Returns NULL if the loop has to be interpreted.
+  */
+ struct JitLoop *jit_compile(TokenList *list, int cond_start, int cond_end, int post_start, int post_end,
+                             int body_start, int body_end)
+ {
+     struct JitLoop *loop = calloc(1, sizeof(struct JitLoop));
+     JitEmitter e = { NULL, 0, 0, 0, loop };
+ 
+     if (!loop)
+     {
+         return NULL;
+     }
+ 
+     // post: post expression, discarded
+     if (post_start < post_end)
+     {
+         jit_expression(&e, list, post_start, post_end);
+     }
+ 
+     // cond: condition; jz exit
+     loop->cond_entry = e.size;
+     jit_expression(&e, list, cond_start, cond_end);
+     jit_bytes(&e, "\x85\xc0\x0f\x84", 4);  // test eax, eax; jz rel32
+     int exit_jump = e.size;
+     jit_int32(&e, 0);
+ 
+     // body: each statement, discarded
+     for (int pos = body_start; pos < body_end && !e.failed; pos++)
+     {
+         int end = pos;
+ 
+         while (end < body_end && list->tokens[end].type != TOKEN_SEMICOLON)
+         {
+             end++;
+         }
+ 
+         if (end == pos || end == body_end)
+         {
+             e.failed = 1;
+             break;
+         }
+ 
+         jit_expression(&e, list, pos, end);
+         pos = end;
+     }
+ 
+     // jmp post; exit: ret
+     jit_byte(&e, 0xe9);
+     int loop_jump = e.size;
+     jit_int32(&e, 0);
+     jit_patch(&e, loop_jump, 0);
+     jit_patch(&e, exit_jump, e.size);
+     jit_byte(&e, 0xc3);
+ 
+     if (!e.failed)
+     {
+         void *code = mmap(NULL, e.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+ 
+         if (code == MAP_FAILED)
+         {
+             e.failed = 1;
+         }
+         else
+         {
+             memcpy(code, e.buf, e.size);
+             mprotect(code, e.size, PROT_READ | PROT_EXEC);
+             loop->code = code;
+             loop->size = e.size;
+         }
+     }
+ 
+     free(e.buf);
+ 
+     if (e.failed)
+     {
+         free(loop);
+         return NULL;
+     }
+ 
+     return loop;
+ }
+ 
+ /*
+  * Runs a compiled loop until its condition is false, starting with the post
+  * expression when at_post is set and with the condition otherwise.  Returns
+  * 0 without running anything if a variable the loop uses isn't an int, or
+  * inside a function, isn't one of its locals.
+  */
+ int jit_run(struct JitLoop *loop, int at_post)
+ {
+     Value *slots[JIT_MAX_VARIABLES];
+ 
+     for (int i = 0; i < loop->name_count; i++)
+     {
+         Variable *var = find_assignable(loop->names[i]);
+ 
+         if (!var || var->value.type != VAL_INT)
+         {
+             return 0;
+         }
+ 
+         slots[i] = &var->value;
+     }
+ 
+     JitFunction run = (JitFunction)(loop->code + (at_post ? 0 : loop->cond_entry));
+     run(slots);
+     return 1;
+ }
+ 
+ /*
+  * Frees a compiled loop.
+  */
+ void jit_free(struct JitLoop *loop)
+ {
+     if (!loop)
+     {
+         return;
+     }
+ 
+     munmap(loop->code, loop->size);
+     free(loop);
+ }
+ 
+ #else
+ 
+ /* No code generator for this platform, every loop stays interpreted. */
+ 
+ struct JitLoop *jit_compile(TokenList *list, int cond_start, int cond_end, int post_start, int post_end,
+                             int body_start, int body_end)
+ {
+     return NULL;
+ }
+ 
+ int jit_run(struct JitLoop *loop, int at_post)
+ {
+     return 0;
+ }
+ 
+ void jit_free(struct JitLoop *loop)
+ {
+ }
+ 
+ #endif
+ #endif
@@ -24,6 +24,35 @@
 
 // #define _CRTDBG_MAP_ALLOC
 
+/**
+ * Reads a whole script file into a string the caller frees.  Returns NULL
+ * after printing the error.
+ */
+static char *read_script(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening file");
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+
+    char *script = malloc(file_size + 1);
+    if (!script) {
+        fclose(file);
+        fprintf(stderr, "Memory allocation failed.\n");
+        return NULL;
+    }
+
+    size_t bytes_read = fread(script, 1, file_size, file);
+    script[bytes_read] = '\0';
+    fclose(file);
+    return script;
+}
+
 /**
  * Main entry point to the Arcane scripting language when run from the command line.
  */
@@ -40,31 +69,57 @@ int main(int argc, char *argv[])
 
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <script_file>\n", argv[0]);
+        fprintf(stderr, "       %s --emit-c <script_file> [function_name]\n", argv[0]);
+        fprintf(stderr, "       %s --types <script_file>\n", argv[0]);
         return 1;
     }
 
-    const char *filename = argv[1];
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Error opening file");
-        return 1;
+    // Translate the script to C on stdout instead of running it.
+    if (strcmp(argv[1], "--emit-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --emit-c <script_file> [function_name]\n", argv[0]);
+            return 1;
+        }
+
+        char *script = read_script(argv[2]);
+        if (!script) {
+            return 1;
+        }
+
+        char *c_source = aot_translate(script, argc > 3 ? argv[3] : "arcane_script");
+        free(script);
+
+        if (!c_source) {
+            return 8;
+        }
+
+        fputs(c_source, stdout);
+        free(c_source);
+        return 0;
     }
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+    // Show the types inferred for the script's variables instead of running it.
+    if (strcmp(argv[1], "--types") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --types <script_file>\n", argv[0]);
+            return 1;
+        }
 
-    char *script = malloc(file_size + 1);
+        char *script = read_script(argv[2]);
+        if (!script) {
+            return 1;
+        }
+
+        int typed = dump_types(script);
+        free(script);
+        return typed ? 0 : 8;
+    }
+
+    char *script = read_script(argv[1]);
     if (!script) {
-        fclose(file);
-        fprintf(stderr, "Memory allocation failed.\n");
         return 1;
     }
 
-    size_t bytes_read = fread(script, 1, file_size, file);
-    script[bytes_read] = '\0';
-    fclose(file);
-    
     Value ret = interpret(script);
     free(script);
 
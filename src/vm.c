@@ -0,0 +1,1067 @@
+/*
+ * Arcane Script Interpreter
+ *
+ *         File: vm.c
+ *       Author: Blake Pell
+ * Initial Date: 2026-10-18
+ *      License: MIT License
+ *
+ * A small stack machine for the expressions loops re-evaluate on every
+ * iteration (conditions and post expressions).  The expression is compiled
+ * from its tokens once and the instructions run without re-parsing.  Anything
+ * the compiler doesn't understand is simply left to the token interpreter.
+ *
+ * Building with ARCANE_COMPUTED_GOTO (set by src/CMakeLists.txt on GCC and
+ * Clang) dispatches instructions with computed goto, otherwise a switch is
+ * used.  ARCANE_VM_STATS counts dispatched instructions.
+ */
+
+ #include "arcane.h"
+ #include <stdlib.h>
+ #include <string.h>
+ 
+ #define VM_STACK_SIZE 32
+ #define VM_MAX_ARGS 16
+ 
+ extern int return_flag;
+ extern Value return_value;
+ 
+ /* Cached in place of a program for expressions the VM can't compile. */
+ static VmProgram vm_unsupported = { NULL, 0, 0 };
+ 
+ #ifdef ARCANE_VM_STATS
+ long long vm_dispatches = 0;
+ #endif
+ 
+ /* Returned when the compiler reads past the end of the expression. */
+ static Token vm_end_token = { TOKEN_EOF, "EOF", -1, OP_NONE, QUICK_NONE, NULL };
+ 
+ /* ============================================================
+     Peephole Optimizer
+    ============================================================ */
+ 
+ /*
+  * If any jump in the program lands on the instruction at index.
+  */
+ static int vm_is_jump_target(const VmProgram *program, int index)
+ {
+     for (int i = 0; i < program->count; i++)
+     {
+         VmOpcode opcode = program->code[i].opcode;
+ 
+         if ((opcode == VM_AND || opcode == VM_OR) && program->code[i].arg == index)
+         {
+             return 1;
+         }
+     }
+ 
+     return 0;
+ }
+ 
+ /*
+  * If the count instructions from index can be merged, i.e. nothing jumps
+  * into the middle of them.
+  */
+ static int vm_can_fuse(const VmProgram *program, int index, int count)
+ {
+     if (index + count > program->count)
+     {
+         return 0;
+     }
+ 
+     for (int i = index + 1; i < index + count; i++)
+     {
+         if (vm_is_jump_target(program, i))
+         {
+             return 0;
+         }
+     }
+ 
+     return 1;
+ }
+ 
+ /*
+  * Replaces count instructions from index with a single instruction and moves
+  * the jumps that pointed past them.
+  */
+ static void vm_replace(VmProgram *program, int index, int count, VmInstruction fused)
+ {
+     program->code[index] = fused;
+     memmove(&program->code[index + 1], &program->code[index + count],
+             sizeof(VmInstruction) * (program->count - index - count));
+     program->count -= count - 1;
+ 
+     for (int i = 0; i < program->count; i++)
+     {
+         VmInstruction *ins = &program->code[i];
+ 
+         if ((ins->opcode == VM_AND || ins->opcode == VM_OR) && ins->arg > index)
+         {
+             ins->arg -= count - 1;
+         }
+     }
+ }
+ 
+ /*
+  * Tries to merge the instructions starting at index into a superinstruction.
+  */
+ static int vm_fuse_at(VmProgram *program, int index)
+ {
+     VmInstruction *code = &program->code[index];
+     VmInstruction fused = code[0];
+ 
+     // x < 10, x + y: LOAD, LOAD or CONST, BINARY
+     if (code[0].opcode == VM_LOAD && vm_can_fuse(program, index, 3) &&
+         (code[1].opcode == VM_LOAD || code[1].opcode == VM_CONST) && code[2].opcode == VM_BINARY)
+     {
+         fused.opcode = VM_BINARY_LOCAL;
+         fused.token = code[2].token;
+         fused.quick = code[2].quick;
+         fused.operand = code[0].token;
+         fused.operand2 = code[1].opcode == VM_LOAD ? code[1].token : NULL;
+         fused.constant = code[1].constant;
+         vm_replace(program, index, 3, fused);
+         return 1;
+     }
+ 
+     // arr[i]: LOAD, LOAD, INDEX
+     if (code[0].opcode == VM_LOAD && vm_can_fuse(program, index, 3) &&
+         code[1].opcode == VM_LOAD && code[2].opcode == VM_INDEX)
+     {
+         fused.opcode = VM_LOAD_INDEX;
+         fused.operand = code[0].token;
+         fused.operand2 = code[1].token;
+         vm_replace(program, index, 3, fused);
+         return 1;
+     }
+ 
+     // i++ whose value is discarded: PRE_INC or POST_INC, POP
+     if ((code[0].opcode == VM_PRE_INC || code[0].opcode == VM_POST_INC) &&
+         vm_can_fuse(program, index, 2) && code[1].opcode == VM_POP)
+     {
+         fused.opcode = VM_INC;
+         fused.operand = code[0].token;
+         vm_replace(program, index, 2, fused);
+         return 1;
+     }
+ 
+     // i++; i < n: INC, BINARY_LOCAL on the same variable
+     if (code[0].opcode == VM_INC && vm_can_fuse(program, index, 2) &&
+         code[1].opcode == VM_BINARY_LOCAL && strcmp(code[0].operand->text, code[1].operand->text) == 0)
+     {
+         fused = code[1];
+         fused.opcode = VM_INC_COMPARE;
+         fused.arg = code[0].arg;
+         vm_replace(program, index, 2, fused);
+         return 1;
+     }
+ 
+     return 0;
+ }
+ 
+ /*
+  * Merges common instruction sequences into superinstructions until nothing
+  * else matches.
+  */
+ static void vm_optimize(VmProgram *program)
+ {
+     int changed = 1;
+ 
+     while (changed)
+     {
+         changed = 0;
+ 
+         for (int i = 0; i < program->count; i++)
+         {
+             changed |= vm_fuse_at(program, i);
+         }
+     }
+ }
+ 
+ /* ============================================================
+     Compiler
+    ============================================================ */
+ 
+ typedef struct
+ {
+     TokenList *list;
+     int pos;
+     int end;
+     int depth;          /* Stack depth at the current instruction */
+     unsigned char ints[VM_STACK_SIZE + 1]; /* If the value at each depth is proven an int */
+     int failed;
+     VmProgram *program;
+ } VmCompiler;
+ 
+ static void vm_compile_assignment(VmCompiler *c);
+ 
+ /*
+  * The current token, or an EOF token at the end of the expression.
+  */
+ static Token *vm_current(VmCompiler *c)
+ {
+     return c->pos < c->end ? &c->list->tokens[c->pos] : &vm_end_token;
+ }
+ 
+ /*
+  * The token after the current one, or an EOF token.
+  */
+ static Token *vm_next(VmCompiler *c)
+ {
+     return c->pos + 1 < c->end ? &c->list->tokens[c->pos + 1] : &vm_end_token;
+ }
+ 
+ /*
+  * Appends an instruction and tracks the stack depth it leaves behind.
+  * Returns the index of the instruction.
+  */
+ static int vm_emit(VmCompiler *c, VmOpcode opcode, Token *token, int arg, int stack_effect)
+ {
+     VmProgram *program = c->program;
+ 
+     if (program->count == program->capacity)
+     {
+         int capacity = program->capacity ? program->capacity * 2 : 16;
+         VmInstruction *code = realloc(program->code, sizeof(VmInstruction) * capacity);
+ 
+         if (!code)
+         {
+             c->failed = 1;
+             return 0;
+         }
+ 
+         program->code = code;
+         program->capacity = capacity;
+     }
+ 
+     c->depth += stack_effect;
+ 
+     if (c->depth > VM_STACK_SIZE)
+     {
+         c->failed = 1;
+     }
+ 
+     VmInstruction *ins = &program->code[program->count];
+     ins->opcode = opcode;
+     ins->arg = arg;
+     ins->token = token;
+     ins->operand = NULL;
+     ins->operand2 = NULL;
+     ins->constant = make_null();
+     ins->quick = QUICK_NONE;
+     return program->count++;
+ }
+ 
+ /*
+  * Records whether the value the last instruction left on top of the stack is
+  * proven to be an int.
+  */
+ static void vm_proven(VmCompiler *c, int is_int)
+ {
+     if (c->depth > 0 && c->depth <= VM_STACK_SIZE + 1)
+     {
+         c->ints[c->depth - 1] = (unsigned char)is_int;
+     }
+ }
+ 
+ /*
+  * Emits a binary operator.  When type inference proved both operands are
+  * ints the instruction skips the type checks and the operator's quickening.
+  * Comparisons and bitwise operators always give ints.
+  */
+ static void vm_binary(VmCompiler *c, Token *op)
+ {
+     int ints = c->depth >= 2 && c->depth <= VM_STACK_SIZE && c->ints[c->depth - 2] && c->ints[c->depth - 1];
+     int i = vm_emit(c, VM_BINARY, op, 0, -1);
+ 
+     if (ints)
+     {
+         c->program->code[i].quick = QUICK_INT;
+     }
+     vm_proven(c, ints || op->op == OP_EQ || op->op == OP_NE || op->op == OP_LT || op->op == OP_GT ||
+                  op->op == OP_LE || op->op == OP_GE || op->op == OP_BIT_AND || op->op == OP_BIT_OR ||
+                  op->op == OP_BIT_XOR || op->op == OP_SHL || op->op == OP_SHR);
+ }
+ 
+ /*
+  * Consumes a token of the given type or fails the compile.
+  */
+ static void vm_expect(VmCompiler *c, AstTokenType type)
+ {
+     if (vm_current(c)->type != type)
+     {
+         c->failed = 1;
+         return;
+     }
+ 
+     c->pos++;
+ }
+ 
+ /*
+  * Mirrors parse_primary.
+  */
+ static void vm_compile_primary(VmCompiler *c)
+ {
+     Token *tok = vm_current(c);
+ 
+     if (c->failed)
+     {
+         return;
+     }
+ 
+     if (tok->op == OP_SUB)
+     {
+         c->pos++;
+         vm_compile_primary(c);
+         vm_emit(c, VM_NEGATE, tok, 0, 0);
+         vm_proven(c, 1);
+         return;
+     }
+ 
+     switch (tok->type)
+     {
+         case TOKEN_INT:
+         case TOKEN_DOUBLE:
+         case TOKEN_BOOL:
+         case TOKEN_STRING:
+         {
+             Value v;
+ 
+             if (tok->type == TOKEN_INT)
+             {
+                 v = make_int(atoi(tok->text));
+             }
+             else if (tok->type == TOKEN_DOUBLE)
+             {
+                 v = make_double(atof(tok->text));
+             }
+             else if (tok->type == TOKEN_BOOL)
+             {
+                 v = make_bool(strcmp(tok->text, "true") == 0);
+             }
+             else
+             {
+                 // Templates are expanded at run time by the interpreter.
+                 if (strstr(tok->text, "${") != NULL)
+                 {
+                     c->failed = 1;
+                     return;
+                 }
+ 
+                 // Borrowed from the token, copied each time it's pushed.
+                 v.type = VAL_STRING;
+                 v.str_val = tok->text;
+                 v.temp = 0;
+             }
+ 
+             int i = vm_emit(c, VM_CONST, tok, 0, 1);
+             c->program->code[i].constant = v;
+             vm_proven(c, v.type == VAL_INT);
+             c->pos++;
+             return;
+         }
+         case TOKEN_IDENTIFIER:
+         {
+             Token *next = vm_next(c);
+ 
+             if (next->type == TOKEN_LPAREN)
+             {
+                 int arg_count = 0;
+                 c->pos += 2;
+ 
+                 if (vm_current(c)->type != TOKEN_RPAREN)
+                 {
+                     while (!c->failed)
+                     {
+                         vm_compile_assignment(c);
+                         arg_count++;
+ 
+                         if (vm_current(c)->type != TOKEN_COMMA)
+                         {
+                             break;
+                         }
+ 
+                         c->pos++;
+                     }
+                 }
+ 
+                 vm_expect(c, TOKEN_RPAREN);
+ 
+                 if (arg_count > VM_MAX_ARGS)
+                 {
+                     c->failed = 1;
+                     return;
+                 }
+ 
+                 vm_emit(c, VM_CALL, tok, arg_count, 1 - arg_count);
+                 vm_proven(c, 0);
+                 return;
+             }
+ 
+             if (next->op == OP_INC || next->op == OP_DEC)
+             {
+                 vm_emit(c, VM_POST_INC, tok, next->op == OP_INC ? 1 : -1, 1);
+                 vm_proven(c, 1);
+                 c->pos += 2;
+                 return;
+             }
+ 
+             vm_emit(c, VM_LOAD, tok, 0, 1);
+             vm_proven(c, tok->quick == QUICK_INT);
+             c->pos++;
+ 
+             while (vm_current(c)->type == TOKEN_LBRACKET && !c->failed)
+             {
+                 c->pos++;
+                 vm_compile_assignment(c);
+                 vm_expect(c, TOKEN_RBRACKET);
+                 vm_emit(c, VM_INDEX, tok, 0, -1);
+                 vm_proven(c, 0);
+             }
+             return;
+         }
+         case TOKEN_LPAREN:
+             c->pos++;
+             vm_compile_assignment(c);
+             vm_expect(c, TOKEN_RPAREN);
+             return;
+         default:
+             c->failed = 1;
+             return;
+     }
+ }
+ 
+ /*
+  * Mirrors parse_unary.
+  */
+ static void vm_compile_unary(VmCompiler *c)
+ {
+     Token *tok = vm_current(c);
+ 
+     if (tok->op == OP_NOT)
+     {
+         c->pos++;
+         vm_compile_unary(c);
+         vm_emit(c, VM_NOT, tok, 0, 0);
+         vm_proven(c, 0);
+     }
+     else if (tok->op == OP_INC || tok->op == OP_DEC)
+     {
+         c->pos++;
+ 
+         if (vm_current(c)->type != TOKEN_IDENTIFIER)
+         {
+             c->failed = 1;
+             return;
+         }
+ 
+         vm_emit(c, VM_PRE_INC, vm_current(c), tok->op == OP_INC ? 1 : -1, 1);
+         vm_proven(c, 1);
+         c->pos++;
+     }
+     else
+     {
+         vm_compile_primary(c);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_factor, whose right operand is a primary.
+  */
+ static void vm_compile_factor(VmCompiler *c)
+ {
+     vm_compile_unary(c);
+ 
+     while ((vm_current(c)->op == OP_MUL || vm_current(c)->op == OP_DIV || vm_current(c)->op == OP_MOD) &&
+            !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_primary(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_term.
+  */
+ static void vm_compile_term(VmCompiler *c)
+ {
+     vm_compile_factor(c);
+ 
+     while ((vm_current(c)->op == OP_ADD || vm_current(c)->op == OP_SUB) && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_factor(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_shift.
+  */
+ static void vm_compile_shift(VmCompiler *c)
+ {
+     vm_compile_term(c);
+ 
+     while ((vm_current(c)->op == OP_SHL || vm_current(c)->op == OP_SHR) && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_term(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_relational.
+  */
+ static void vm_compile_relational(VmCompiler *c)
+ {
+     vm_compile_shift(c);
+ 
+     while ((vm_current(c)->op == OP_LT || vm_current(c)->op == OP_GT ||
+             vm_current(c)->op == OP_LE || vm_current(c)->op == OP_GE) && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_shift(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_equality.
+  */
+ static void vm_compile_equality(VmCompiler *c)
+ {
+     vm_compile_relational(c);
+ 
+     while ((vm_current(c)->op == OP_EQ || vm_current(c)->op == OP_NE) && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_relational(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_bit_and.
+  */
+ static void vm_compile_bit_and(VmCompiler *c)
+ {
+     vm_compile_equality(c);
+ 
+     while (vm_current(c)->op == OP_BIT_AND && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_equality(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_bit_xor.
+  */
+ static void vm_compile_bit_xor(VmCompiler *c)
+ {
+     vm_compile_bit_and(c);
+ 
+     while (vm_current(c)->op == OP_BIT_XOR && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_bit_and(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_bit_or.
+  */
+ static void vm_compile_bit_or(VmCompiler *c)
+ {
+     vm_compile_bit_xor(c);
+ 
+     while (vm_current(c)->op == OP_BIT_OR && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         vm_compile_bit_xor(c);
+         vm_binary(c, op);
+     }
+ }
+ 
+ /*
+  * Mirrors parse_logical_and, jumping over the right operand when the left
+  * one is false.
+  */
+ static void vm_compile_logical_and(VmCompiler *c)
+ {
+     vm_compile_bit_or(c);
+ 
+     while (vm_current(c)->op == OP_AND && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         int jump = vm_emit(c, VM_AND, op, 0, -1);
+         vm_compile_bit_or(c);
+         vm_emit(c, VM_TRUTH, op, 0, 0);
+         vm_proven(c, 0);
+         c->program->code[jump].arg = c->program->count;
+     }
+ }
+ 
+ /*
+  * Mirrors parse_logical, jumping over the right operand when the left one
+  * is true.
+  */
+ static void vm_compile_logical(VmCompiler *c)
+ {
+     vm_compile_logical_and(c);
+ 
+     while (vm_current(c)->op == OP_OR && !c->failed)
+     {
+         Token *op = vm_current(c);
+         c->pos++;
+         int jump = vm_emit(c, VM_OR, op, 0, -1);
+         vm_compile_logical_and(c);
+         vm_emit(c, VM_TRUTH, op, 0, 0);
+         vm_proven(c, 0);
+         c->program->code[jump].arg = c->program->count;
+     }
+ }
+ 
+ /*
+  * Mirrors parse_assignment.  Assignments to array elements aren't compiled.
+  */
+ static void vm_compile_assignment(VmCompiler *c)
+ {
+     Token *tok = vm_current(c);
+ 
+     if (c->failed)
+     {
+         return;
+     }
+ 
+     if (tok->type == TOKEN_IDENTIFIER && vm_next(c)->op == OP_ASSIGN)
+     {
+         c->pos += 2;
+         vm_compile_assignment(c);
+         vm_emit(c, VM_STORE, tok, 0, 0);
+         return;
+     }
+ 
+     if (tok->type == TOKEN_IDENTIFIER && IS_COMPOUND_ASSIGN(vm_next(c)->op))
+     {
+         OperatorCode op = vm_next(c)->op;
+         c->pos += 2;
+         vm_compile_assignment(c);
+         vm_emit(c, VM_COMPOUND, tok, op, 0);
+         vm_proven(c, tok->quick == QUICK_INT);
+         return;
+     }
+ 
+     vm_compile_logical(c);
+ }
+ 
+ /*
+  * Compiles the expression in tokens start up to (but not including) end.
+  * Returns NULL if the expression uses anything the VM doesn't support.
+  */
+ VmProgram *vm_compile(TokenList *list, int start, int end)
+ {
+     VmProgram *program = calloc(1, sizeof(VmProgram));
+     VmCompiler c;
+ 
+     if (!program)
+     {
+         return NULL;
+     }
+ 
+     c.list = list;
+     c.pos = start;
+     c.end = end;
+     c.depth = 0;
+     c.failed = 0;
+     c.program = program;
+ 
+     vm_compile_assignment(&c);
+     vm_emit(&c, VM_RETURN, NULL, 0, 0);
+ 
+     if (c.failed || c.pos != end || c.depth != 1)
+     {
+         vm_free(program);
+         return NULL;
+     }
+ 
+     vm_optimize(program);
+     return program;
+ }
+ 
+ /*
+  * Builds a program that runs first, discards its value, then runs second and
+  * returns its value.  A for loop uses this to run its post expression and
+  * condition in one go, which lets the optimizer merge "i++" and "i < n".
+  */
+ VmProgram *vm_fuse(const VmProgram *first, const VmProgram *second)
+ {
+     VmProgram *program = calloc(1, sizeof(VmProgram));
+     int offset = first->count;
+ 
+     if (!program)
+     {
+         return NULL;
+     }
+ 
+     program->capacity = first->count + second->count;
+     program->code = malloc(sizeof(VmInstruction) * program->capacity);
+ 
+     if (!program->code)
+     {
+         free(program);
+         return NULL;
+     }
+ 
+     // The first program's VM_RETURN becomes a VM_POP.
+     memcpy(program->code, first->code, sizeof(VmInstruction) * first->count);
+     program->code[offset - 1].opcode = VM_POP;
+     memcpy(&program->code[offset], second->code, sizeof(VmInstruction) * second->count);
+     program->count = program->capacity;
+ 
+     for (int i = offset; i < program->count; i++)
+     {
+         if (program->code[i].opcode == VM_AND || program->code[i].opcode == VM_OR)
+         {
+             program->code[i].arg += offset;
+         }
+     }
+ 
+     vm_optimize(program);
+     return program;
+ }
+ 
+ /*
+  * Returns the program for the expression in tokens start up to end, compiling
+  * it on first use and caching it on the first token.  Returns NULL if the
+  * expression has to be interpreted.
+  */
+ VmProgram *vm_program(TokenList *list, int start, int end)
+ {
+     if (start >= end)
+     {
+         return NULL;
+     }
+ 
+     Token *tok = &list->tokens[start];
+ 
+     if (!tok->code)
+     {
+         VmProgram *program = vm_compile(list, start, end);
+         tok->code = program ? program : &vm_unsupported;
+     }
+ 
+     return tok->code == &vm_unsupported ? NULL : tok->code;
+ }
+ 
+ /*
+  * Frees a compiled program.
+  */
+ void vm_free(VmProgram *program)
+ {
+     if (!program || program == &vm_unsupported)
+     {
+         return;
+     }
+ 
+     free(program->code);
+ #ifdef ARCANE_JIT
+     jit_free(program->jit);
+ #endif
+     free(program);
+ }
+ 
+ /* ============================================================
+     Interpreter
+    ============================================================ */
+ 
+ #ifdef ARCANE_COMPUTED_GOTO
+     #define VM_JUMP() goto *dispatch_table[ip->opcode]
+     #define VM_CASE(opcode) label_##opcode
+ #else
+     #define VM_JUMP() goto dispatch
+     #define VM_CASE(opcode) case opcode
+ #endif
+ 
+ #ifdef ARCANE_VM_STATS
+     #define VM_DISPATCH() do { vm_dispatches++; VM_JUMP(); } while (0)
+ #else
+     #define VM_DISPATCH() VM_JUMP()
+ #endif
+ 
+ /* Stops the program when an instruction raised an error. */
+ #define VM_CHECK() if (return_flag) return return_value
+ 
+ /*
+  * Applies an operator to two values type inference proved are ints, without
+  * checking their types.  Only division by zero is an error.
+  */
+ static Value vm_int_operation(OperatorCode op, int l, int r)
+ {
+     switch (op)
+     {
+         case OP_ADD:     return make_int(l + r);
+         case OP_SUB:     return make_int(l - r);
+         case OP_MUL:     return make_int(l * r);
+         case OP_BIT_AND: return make_int(l & r);
+         case OP_BIT_OR:  return make_int(l | r);
+         case OP_BIT_XOR: return make_int(l ^ r);
+         case OP_SHL:     return make_int((int)((unsigned int)l << (r & 31)));
+         case OP_SHR:     return make_int(l >> (r & 31));
+         case OP_LT:      return make_int(l < r);
+         case OP_GT:      return make_int(l > r);
+         case OP_LE:      return make_int(l <= r);
+         case OP_GE:      return make_int(l >= r);
+         case OP_EQ:      return make_int(l == r);
+         case OP_NE:      return make_int(l != r);
+         default:
+             if (r == 0)
+             {
+                 raise_error("Runtime error: Division by zero.\n");
+                 return return_value;
+             }
+             return make_int(op == OP_DIV ? l / r : l % r);
+     }
+ }
+ 
+ /*
+  * Runs a compiled expression and returns its value.
+  */
+ Value vm_run(const VmProgram *program)
+ {
+     Value stack[VM_STACK_SIZE];
+     int sp = 0;
+     const VmInstruction *ip = program->code;
+ 
+ #ifdef ARCANE_COMPUTED_GOTO
+     // In VmOpcode order.
+     static void *dispatch_table[] = {
+         &&label_VM_CONST, &&label_VM_LOAD, &&label_VM_STORE, &&label_VM_INDEX,
+         &&label_VM_CALL, &&label_VM_BINARY, &&label_VM_NEGATE, &&label_VM_NOT,
+         &&label_VM_PRE_INC, &&label_VM_POST_INC, &&label_VM_COMPOUND, &&label_VM_AND,
+         &&label_VM_OR, &&label_VM_TRUTH, &&label_VM_POP, &&label_VM_RETURN,
+         &&label_VM_BINARY_LOCAL, &&label_VM_LOAD_INDEX, &&label_VM_INC, &&label_VM_INC_COMPARE
+     };
+ 
+     VM_DISPATCH();
+ #else
+ dispatch:
+     switch (ip->opcode)
+ #endif
+     {
+         VM_CASE(VM_CONST):
+         {
+             Value v = ip->constant;
+             stack[sp++] = v.type == VAL_STRING ? make_string(v.str_val) : v;
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_LOAD):
+         {
+             stack[sp++] = get_variable(ip->token->text);
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_STORE):
+         {
+             set_variable(ip->token->text, stack[sp - 1]);
+             stack[sp - 1].temp = 0;
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_INDEX):
+         {
+             Value index = stack[--sp];
+             stack[sp - 1] = array_index(stack[sp - 1], index);
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_CALL):
+         {
+             sp -= ip->arg;
+             Value ret = ip->token->function ? invoke_function(ip->token->function, &stack[sp], ip->arg)
+                                             : call_function(ip->token->text, &stack[sp], ip->arg);
+             for (int i = sp; i < sp + ip->arg; i++)
+             {
+                 if (stack[i].type == VAL_STRING && stack[i].temp)
+                 {
+                     free_value(stack[i]);
+                 }
+             }
+             stack[sp++] = ret;
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_BINARY):
+         {
+             Value right = stack[--sp];
+             stack[sp - 1] = ip->quick == QUICK_INT ? vm_int_operation(ip->token->op, stack[sp - 1].int_val, right.int_val)
+                                                    : binary_operation(ip->token, stack[sp - 1], right);
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_NEGATE):
+         {
+             if (stack[sp - 1].type != VAL_INT)
+             {
+                 raise_error("Runtime error: Unary '-' operator only supports ints.\n");
+                 return return_value;
+             }
+             stack[sp - 1].int_val = -stack[sp - 1].int_val;
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_NOT):
+         {
+             if (stack[sp - 1].type != VAL_BOOL && stack[sp - 1].type != VAL_INT)
+             {
+                 raise_error("Runtime error: ! operator only works on bools or ints.\n");
+                 return return_value;
+             }
+             stack[sp - 1] = make_bool(!stack[sp - 1].int_val);
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_PRE_INC):
+         VM_CASE(VM_POST_INC):
+         {
+             Value v = get_variable(ip->token->text);
+             VM_CHECK();
+             if (v.type != VAL_INT)
+             {
+                 raise_error("Runtime error: %s operator only valid for ints.\n", ip->arg > 0 ? "++" : "--");
+                 return return_value;
+             }
+             int old_value = v.int_val;
+             v.int_val += ip->arg;
+             set_variable(ip->token->text, v);
+             stack[sp++] = ip->opcode == VM_PRE_INC ? v : make_int(old_value);
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_COMPOUND):
+         {
+             stack[sp - 1] = compound_assign(ip->token->text, (OperatorCode)ip->arg, stack[sp - 1]);
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_AND):
+         {
+             if (stack[sp - 1].int_val == 0)
+             {
+                 stack[sp - 1] = make_bool(0);
+                 ip = program->code + ip->arg;
+             }
+             else
+             {
+                 sp--;
+                 ip++;
+             }
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_OR):
+         {
+             if (stack[sp - 1].int_val != 0)
+             {
+                 stack[sp - 1] = make_bool(1);
+                 ip = program->code + ip->arg;
+             }
+             else
+             {
+                 sp--;
+                 ip++;
+             }
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_TRUTH):
+         {
+             stack[sp - 1] = make_bool(stack[sp - 1].int_val != 0);
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_POP):
+         {
+             sp--;
+             if (stack[sp].type == VAL_STRING && stack[sp].temp)
+             {
+                 free_value(stack[sp]);
+             }
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_RETURN):
+         {
+             return stack[sp - 1];
+         }
+         VM_CASE(VM_INC):
+         VM_CASE(VM_INC_COMPARE):
+         {
+             Value v = get_variable(ip->operand->text);
+             VM_CHECK();
+             if (v.type != VAL_INT)
+             {
+                 raise_error("Runtime error: %s operator only valid for ints.\n", ip->arg > 0 ? "++" : "--");
+                 return return_value;
+             }
+             v.int_val += ip->arg;
+             set_variable(ip->operand->text, v);
+             if (ip->opcode == VM_INC)
+             {
+                 ip++;
+                 VM_DISPATCH();
+             }
+         }
+         // VM_INC_COMPARE carries on with the comparison.
+         VM_CASE(VM_BINARY_LOCAL):
+         {
+             Value left = get_variable(ip->operand->text);
+             VM_CHECK();
+             Value right;
+             if (ip->operand2)
+             {
+                 right = get_variable(ip->operand2->text);
+                 VM_CHECK();
+             }
+             else
+             {
+                 right = ip->constant.type == VAL_STRING ? make_string(ip->constant.str_val) : ip->constant;
+             }
+             stack[sp++] = ip->quick == QUICK_INT ? vm_int_operation(ip->token->op, left.int_val, right.int_val)
+                                                  : binary_operation(ip->token, left, right);
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+         VM_CASE(VM_LOAD_INDEX):
+         {
+             Value array = get_variable(ip->operand->text);
+             VM_CHECK();
+             Value index = get_variable(ip->operand2->text);
+             VM_CHECK();
+             stack[sp++] = array_index(array, index);
+             VM_CHECK();
+             ip++;
+             VM_DISPATCH();
+         }
+     }
+ 
+     return make_null();
+ }
@@ -0,0 +1,26 @@
+/*
+ * Runs a script that reads a variable the host set, which type inference
+ * can't assume anything about.  The host sets it to a double, so comparing
+ * against it in the loop condition has to raise the interpreter's error
+ * rather than run as an int comparison.
+ */
+
+#include "arcane.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(void)
+{
+    set_variable("limit", make_double(2.5));
+
+    Value ret = interpret("n = 0; max = 0; max = limit; for (i = 0; i < max; i++) { n++; } return n;");
+
+    if (ret.type != VAL_ERROR || !strstr(ret.str_val, "Relational operators only support ints or dates"))
+    {
+        printf("FAIL: expected the relational operator error\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}